@@ -0,0 +1,160 @@
+/**
+ * @file attention_swiglu.cpp
+ * @brief Tiled attention against materialized scores, and decoder prefill around the FFN
+ *
+ * For every sequence length in --lengths, runs causal attention over random Q, K
+ * and V with the naive kernel, which holds a [seq, seq] score matrix per head in
+ * flight, and with swiglu_flash_attention, and reports GFLOP/s, the naive kernel's
+ * score memory and the largest difference. Then prefills a --layers block decoder
+ * at the same length:
+ *
+ *   ./attention_swiglu --lengths 512,2048,8192 --heads 32 --kv-heads 8 --threads 8
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_attention.h"
+#include "swiglu_bench.h"
+#include "swiglu_decoder.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--lengths L1,L2,...] [--heads H] [--kv-heads K] [--threads T] [--layers N]\n"
+          "          [--dim D] [--inter-dim I] [--no-naive]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  std::vector<size_t> lengths = {512, 2048, 8192};
+  size_t num_heads = 32;
+  size_t num_kv_heads = 8;
+  size_t num_threads = 1;
+  size_t num_layers = 2;
+  size_t dim = 2048;
+  size_t inter_dim = 5632;
+  bool naive = true;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--lengths") == 0) {
+      lengths.clear();
+      for (char* length = strtok(argv[++i], ","); length != NULL; length = strtok(NULL, ",")) {
+        lengths.push_back(strtoul(length, NULL, 10));
+      }
+    } else if (has_value && strcmp(argv[i], "--heads") == 0) {
+      num_heads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--kv-heads") == 0) {
+      num_kv_heads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--no-naive") == 0) {
+      naive = false;
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (lengths.empty() || std::find(lengths.begin(), lengths.end(), 0u) != lengths.end() || num_heads == 0 ||
+      num_kv_heads == 0 || num_heads % num_kv_heads != 0 || dim % num_heads != 0 || num_threads == 0 ||
+      num_layers == 0 || inter_dim == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_fp32_decoder_layer> fp32_layers =
+    swiglu_random_decoder_layers(num_layers, dim, inter_dim, num_heads, num_kv_heads);
+  std::vector<swiglu_decoder_weights> layers;
+  for (const swiglu_fp32_decoder_layer& layer : fp32_layers) {
+    layers.push_back(swiglu_fp32_decoder_weights(layer));
+  }
+  struct swiglu_decoder* decoder = NULL;
+  if (swiglu_create_decoder(layers.size(), layers.data(), /*rope=*/NULL, threadpool, &decoder) !=
+      xnn_status_success) {
+    return 1;
+  }
+
+  const size_t head_dim = dim / num_heads;
+  const size_t qkv_dim = (num_heads + 2 * num_kv_heads) * head_dim;
+  printf("heads=%zu kv_heads=%zu head_dim=%zu threads=%zu; decoder layers=%zu dim=%zu inter_dim=%zu\n",
+         num_heads, num_kv_heads, head_dim, num_threads, num_layers, dim, inter_dim);
+  for (size_t length : lengths) {
+    std::vector<float> qkv(length * qkv_dim);
+    swiglu_fill_random(qkv.data(), qkv.size(), 1.0f, 1);
+    const float* query = qkv.data();
+    const float* key = query + num_heads * head_dim;
+    const float* value = key + num_kv_heads * head_dim;
+    std::vector<float> flash_output(length * num_heads * head_dim);
+    std::vector<float> naive_output(length * num_heads * head_dim);
+    // Causal attention: two multiply-adds per channel for half of the [length, length] pairs
+    const double gflop = 2.0 * num_heads * head_dim * length * (length + 1) / 1e9;
+
+    auto start = std::chrono::steady_clock::now();
+    swiglu_flash_attention(length, num_heads, num_kv_heads, head_dim, query, key, value, qkv_dim,
+                           /*causal=*/true, /*rope=*/NULL, flash_output.data(), threadpool);
+    const double flash_ms = elapsed_ms(start);
+    printf("length %zu: flash %.2f ms (%.1f GFLOP/s)", length, flash_ms, gflop / (flash_ms / 1000.0));
+    if (naive) {
+      start = std::chrono::steady_clock::now();
+      swiglu_naive_attention(length, num_heads, num_kv_heads, head_dim, query, key, value, qkv_dim,
+                             /*causal=*/true, /*rope=*/NULL, naive_output.data(), threadpool);
+      const double naive_ms = elapsed_ms(start);
+      float max_error = 0.0f;
+      for (size_t i = 0; i < flash_output.size(); ++i) {
+        max_error = std::max(max_error, fabsf(flash_output[i] - naive_output[i]));
+      }
+      printf(", naive %.2f ms (%.1f GFLOP/s, %.1f MiB of scores), max abs difference %.2e",
+             naive_ms, gflop / (naive_ms / 1000.0),
+             std::min(num_heads, num_threads) * length * length * sizeof(float) / 1048576.0, max_error);
+    }
+    printf("\n");
+
+    // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+    std::vector<float> input(length * dim + XNN_EXTRA_BYTES / sizeof(float));
+    swiglu_fill_random(input.data(), length * dim, 1.0f, 2);
+    std::vector<float> output(length * dim);
+    if (swiglu_run_decoder_prefill(decoder, length, input.data(), output.data()) != xnn_status_success) {
+      return 1;
+    }
+    start = std::chrono::steady_clock::now();
+    if (swiglu_run_decoder_prefill(decoder, length, input.data(), output.data()) != xnn_status_success) {
+      return 1;
+    }
+    const double prefill_ms = elapsed_ms(start);
+    printf("  decoder prefill %.2f ms, %.0f rows/s\n", prefill_ms, length / (prefill_ms / 1000.0));
+  }
+
+  swiglu_delete_decoder(decoder);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * @file branch_swiglu.cpp
+ * @brief Intra-op parallelism against parallel gate and up branches, per batch size
+ *
+ * For every batch size in --sizes, runs the stack with a --threads thread pool
+ * (every operator spread over all threads, one after the other) and the branch
+ * stack, whose gate and up projections run at the same time on the two halves of
+ * the same --threads before the down projection runs on all of them. Both give the
+ * same rows up to rounding; the table shows the batch sizes at which splitting the
+ * threads between branches wins:
+ *
+ *   ./branch_swiglu --threads 8 --sizes 1,4,16,64,256
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_branch.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--sizes B1,B2,...] [--runs R] [--threads T] [--layers N] [--dim D] [--inter-dim I]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  std::vector<size_t> sizes = {1, 4, 16, 64, 256};
+  size_t num_runs = 50;
+  size_t num_threads = 8;
+  size_t num_layers = 4;
+  size_t dim = 512;
+  size_t inter_dim = 1536;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--sizes") == 0) {
+      sizes.clear();
+      for (char* size = strtok(argv[++i], ","); size != NULL; size = strtok(NULL, ",")) {
+        sizes.push_back(strtoul(size, NULL, 10));
+      }
+    } else if (has_value && strcmp(argv[i], "--runs") == 0) {
+      num_runs = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (sizes.empty() || std::find(sizes.begin(), sizes.end(), 0u) != sizes.end() || num_runs == 0 ||
+      num_threads == 0 || num_layers == 0 || dim == 0 || inter_dim == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers = swiglu_random_layers(num_layers, dim, inter_dim);
+  std::vector<swiglu_layer_weights> layers;
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    layers.push_back(swiglu_fp32_layer_weights(layer));
+  }
+  struct swiglu_stack* stack = NULL;
+  enum xnn_status status = swiglu_create_stack(layers.size(), layers.data(), threadpool, swiglu_pack_parallel, &stack);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_create_stack failed: %d\n", status);
+    return 1;
+  }
+  struct swiglu_branch_stack* branch_stack = NULL;
+  status = swiglu_create_branch_stack(layers.size(), layers.data(), threadpool, &branch_stack);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_create_branch_stack failed: %d\n", status);
+    return 1;
+  }
+
+  const size_t max_size = *std::max_element(sizes.begin(), sizes.end());
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  std::vector<float> input(max_size * dim + XNN_EXTRA_BYTES / sizeof(float));
+  swiglu_fill_random(input.data(), max_size * dim, 1.0f, 2);
+  std::vector<float> stack_output(max_size * dim);
+  std::vector<float> branch_output(max_size * dim);
+
+  printf("layers=%zu dim=%zu inter_dim=%zu threads=%zu (gate %zu, up %zu)\n",
+         num_layers, dim, inter_dim, num_threads, (num_threads + 1) / 2, num_threads / 2);
+  printf("%8s %14s %14s %9s %12s\n", "batch", "intra-op ms", "branches ms", "speedup", "max rel err");
+  for (size_t batch_size : sizes) {
+    std::vector<double> stack_ms;
+    std::vector<double> branch_ms;
+    // One untimed run each reshapes for the batch size.
+    for (size_t run = 0; run <= num_runs; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      status = swiglu_run_stack(stack, batch_size, input.data(), stack_output.data());
+      if (run > 0) {
+        stack_ms.push_back(elapsed_ms(start));
+      }
+      if (status == xnn_status_success) {
+        start = std::chrono::steady_clock::now();
+        status = swiglu_run_branch_stack(branch_stack, batch_size, input.data(), branch_output.data());
+        if (run > 0) {
+          branch_ms.push_back(elapsed_ms(start));
+        }
+      }
+      if (status != xnn_status_success) {
+        fprintf(stderr, "run failed at batch %zu: %d\n", batch_size, status);
+        return 1;
+      }
+    }
+
+    float max_error = 0.0f;
+    for (size_t i = 0; i < batch_size * dim; ++i) {
+      const float error = fabsf(stack_output[i] - branch_output[i]) / (fabsf(stack_output[i]) + 1e-6f);
+      max_error = std::max(max_error, error);
+    }
+    const double stack_median = percentile(stack_ms, 50.0);
+    const double branch_median = percentile(branch_ms, 50.0);
+    printf("%8zu %14.3f %14.3f %8.2fx %12.2e\n",
+           batch_size, stack_median, branch_median, stack_median / branch_median, max_error);
+  }
+
+  swiglu_delete_branch_stack(branch_stack);
+  swiglu_delete_stack(stack);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
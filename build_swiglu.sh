@@ -2,11 +2,12 @@
 
 XNNPACK_BUILD_DIR="XNNPACK/build/local"
 
-g++ minimal_swiglu.cpp -o minimal_swiglu_kernel \
-    -I XNNPACK/include \
+XNNPACK_INCLUDES="-I XNNPACK/include \
     -I ${XNNPACK_BUILD_DIR}/include \
     -I ${XNNPACK_BUILD_DIR}/pthreadpool-source/include \
-    -L ${XNNPACK_BUILD_DIR} \
+    -I ${XNNPACK_BUILD_DIR}/cpuinfo-source/include"
+
+XNNPACK_LIBS="-L ${XNNPACK_BUILD_DIR} \
     -L ${XNNPACK_BUILD_DIR}/pthreadpool \
     -L ${XNNPACK_BUILD_DIR}/cpuinfo \
     -lXNNPACK \
@@ -14,4 +15,84 @@ g++ minimal_swiglu.cpp -o minimal_swiglu_kernel \
     -lpthreadpool \
     -lcpuinfo \
     -lm \
-    -lpthread
\ No newline at end of file
+    -lpthread \
+    -lrt"
+
+# Shared SwiGLU layer code used by every program except the minimal example
+SWIGLU_SOURCES="swiglu_layer.cpp \
+    swiglu_batcher.cpp \
+    swiglu_weights_cache.cpp \
+    swiglu_stack.cpp \
+    swiglu_quantize.cpp \
+    swiglu_scheduler.cpp \
+    swiglu_memory.cpp \
+    swiglu_packed_file.cpp \
+    swiglu_transport.cpp \
+    swiglu_speculative.cpp \
+    swiglu_runtime_pool.cpp \
+    swiglu_work_stealing.cpp \
+    swiglu_branch.cpp \
+    swiglu_hot.cpp \
+    swiglu_kv_cache.cpp \
+    swiglu_attention.cpp \
+    swiglu_decoder.cpp \
+    swiglu_rope.cpp \
+    swiglu_lm_head.cpp \
+    swiglu_gated.cpp \
+    swiglu_qs8.cpp \
+    swiglu_calibration.cpp \
+    swiglu_gptq.cpp \
+    swiglu_smooth.cpp \
+    swiglu_precision.cpp \
+    swiglu_fp8.cpp \
+    swiglu_silu.cpp \
+    swiglu_weights_io.cpp \
+    safetensors.cpp"
+
+g++ minimal_swiglu.cpp -o minimal_swiglu_kernel ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 stack_swiglu.cpp ${SWIGLU_SOURCES} -o stack_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 pack_swiglu_weights.cpp ${SWIGLU_SOURCES} -o pack_swiglu_weights ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 transport_swiglu.cpp ${SWIGLU_SOURCES} -o transport_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 serve_swiglu.cpp ${SWIGLU_SOURCES} -o serve_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 schedule_swiglu.cpp ${SWIGLU_SOURCES} -o schedule_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 prefill_swiglu.cpp ${SWIGLU_SOURCES} -o prefill_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 varlen_swiglu.cpp ${SWIGLU_SOURCES} -o varlen_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 speculative_swiglu.cpp ${SWIGLU_SOURCES} -o speculative_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 pool_swiglu.cpp ${SWIGLU_SOURCES} -o pool_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 steal_swiglu.cpp ${SWIGLU_SOURCES} -o steal_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 branch_swiglu.cpp ${SWIGLU_SOURCES} -o branch_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 hot_swiglu.cpp ${SWIGLU_SOURCES} -o hot_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 kvcache_swiglu.cpp ${SWIGLU_SOURCES} -o kvcache_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 attention_swiglu.cpp ${SWIGLU_SOURCES} -o attention_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 rope_swiglu.cpp ${SWIGLU_SOURCES} -o rope_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 lmhead_swiglu.cpp ${SWIGLU_SOURCES} -o lmhead_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 qs8_swiglu.cpp ${SWIGLU_SOURCES} -o qs8_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 calibrate_swiglu.cpp ${SWIGLU_SOURCES} -o calibrate_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 gptq_swiglu.cpp ${SWIGLU_SOURCES} -o gptq_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 smooth_swiglu.cpp ${SWIGLU_SOURCES} -o smooth_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 plan_swiglu.cpp ${SWIGLU_SOURCES} -o plan_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 fp8_swiglu.cpp ${SWIGLU_SOURCES} -o fp8_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
+
+g++ -O2 -std=c++17 silu_swiglu.cpp ${SWIGLU_SOURCES} -o silu_swiglu ${XNNPACK_INCLUDES} ${XNNPACK_LIBS}
@@ -0,0 +1,236 @@
+/**
+ * @file calibrate_swiglu.cpp
+ * @brief Offline calibration of static int8 scales for a SwiGLU stack
+ *
+ * Runs a dataset through the fp32 layers with their gate, up, SiLU and gated
+ * intermediate values exposed (see swiglu_calibration.h), prints the range of every
+ * activation and writes the scales file that qs8_swiglu --scales and
+ * swiglu_create_qs8_stack consume:
+ *
+ *   ./calibrate_swiglu --safetensors model.safetensors --dataset rows.bin --output model.scales
+ *   ./calibrate_swiglu --random 4 --dim 2048 --inter-dim 5632 --random-rows 256 --output random.scales
+ *
+ * --dataset is raw little-endian fp32 rows of the first layer's input dim. Ranges
+ * keep the central --percentile percent of values (99.99 by default, 100 for the
+ * exact minimum and maximum).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_calibration.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--output FILE] [--percentile P] [--batch B] [--threads T] SOURCE DATASET\n"
+          "sources:\n"
+          "  --safetensors FILE [--layers N] [--key-format FMT] [--w1-name NAME] [--w3-name NAME]\n"
+          "                     [--w2-name NAME]\n"
+          "  --raw W1,W3,W2 --layers N --dim D --inter-dim I\n"
+          "  --random N --dim D --inter-dim I   N random layers (see swiglu_random_layers)\n"
+          "datasets:\n"
+          "  --dataset FILE     raw fp32 rows\n"
+          "  --random-rows R    R uniform random rows in [-1, 1]\n",
+          program);
+}
+
+static const char* const kActivationNames[SWIGLU_NUM_ACTIVATIONS] = {
+  "input", "gate", "up", "silu", "intermediate", "output",
+};
+
+int main(int argc, char** argv) {
+  const char* output_path = NULL;
+  float percentile = 99.99f;
+  size_t batch_size = 32;
+  size_t num_threads = 1;
+  const char* safetensors_path = NULL;
+  const char* key_format = "model.layers.{layer}.mlp.{proj}.weight";
+  const char* w1_name = "gate_proj";
+  const char* w3_name = "up_proj";
+  const char* w2_name = "down_proj";
+  const char* raw_paths = NULL;
+  size_t num_random_layers = 0;
+  size_t num_layers = 0;
+  size_t dim = 0;
+  size_t inter_dim = 0;
+  const char* dataset_path = NULL;
+  size_t num_random_rows = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--output") == 0) {
+      output_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--percentile") == 0) {
+      percentile = strtof(argv[++i], NULL);
+    } else if (has_value && strcmp(argv[i], "--batch") == 0) {
+      batch_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--safetensors") == 0) {
+      safetensors_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--key-format") == 0) {
+      key_format = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w1-name") == 0) {
+      w1_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w3-name") == 0) {
+      w3_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w2-name") == 0) {
+      w2_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--raw") == 0) {
+      raw_paths = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--random") == 0) {
+      num_random_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dataset") == 0) {
+      dataset_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--random-rows") == 0) {
+      num_random_rows = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  const int num_sources = (safetensors_path != NULL) + (raw_paths != NULL) + (num_random_layers != 0);
+  const int num_datasets = (dataset_path != NULL) + (num_random_rows != 0);
+  if (num_sources != 1 || num_datasets != 1 || !(percentile > 0.0f && percentile <= 100.0f) || batch_size == 0 ||
+      num_threads == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers;
+  if (safetensors_path != NULL) {
+    if (!swiglu_load_safetensors_layers(safetensors_path, key_format, w1_name, w3_name, w2_name,
+                                        num_layers, &fp32_layers)) {
+      return 1;
+    }
+  } else if (raw_paths != NULL) {
+    std::vector<std::string> paths;
+    std::string list = raw_paths;
+    for (size_t start = 0, comma; start <= list.size(); start = comma + 1) {
+      comma = list.find(',', start);
+      if (comma == std::string::npos) {
+        comma = list.size();
+      }
+      paths.push_back(list.substr(start, comma - start));
+    }
+    if (paths.size() != 3 || num_layers == 0 || dim == 0 || inter_dim == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    if (!swiglu_load_raw_layers(paths[0].c_str(), paths[1].c_str(), paths[2].c_str(), num_layers,
+                                dim, inter_dim, dim, &fp32_layers)) {
+      return 1;
+    }
+  } else {
+    if (dim == 0 || inter_dim == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    fp32_layers = swiglu_random_layers(num_random_layers, dim, inter_dim);
+  }
+  if (fp32_layers.empty()) {
+    fprintf(stderr, "no layers loaded\n");
+    return 1;
+  }
+
+  const size_t input_dim = fp32_layers.front().input_dim;
+  std::vector<float> dataset;
+  size_t num_rows = num_random_rows;
+  if (dataset_path != NULL) {
+    FILE* file = fopen(dataset_path, "rb");
+    if (file == NULL) {
+      fprintf(stderr, "failed to open %s\n", dataset_path);
+      return 1;
+    }
+    float value;
+    while (fread(&value, sizeof(float), 1, file) == 1) {
+      dataset.push_back(value);
+    }
+    fclose(file);
+    num_rows = dataset.size() / input_dim;
+    if (num_rows == 0 || dataset.size() % input_dim != 0) {
+      fprintf(stderr, "%s holds %zu values, not a whole number of rows of %zu\n", dataset_path, dataset.size(),
+              input_dim);
+      return 1;
+    }
+  } else {
+    dataset.resize(num_rows * input_dim);
+    swiglu_fill_random(dataset.data(), dataset.size(), 1.0f, 1);
+  }
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  dataset.resize(num_rows * input_dim + XNN_EXTRA_BYTES / sizeof(float));
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_layer_weights> layers;
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    layers.push_back(swiglu_fp32_layer_weights(layer));
+  }
+  struct swiglu_calibrator* calibrator = NULL;
+  if (swiglu_create_calibrator(layers.size(), layers.data(), threadpool, &calibrator) != xnn_status_success) {
+    return 1;
+  }
+  for (size_t row = 0; row < num_rows; row += batch_size) {
+    const size_t rows = std::min(batch_size, num_rows - row);
+    if (swiglu_calibrator_observe(calibrator, rows, &dataset[row * input_dim]) != xnn_status_success) {
+      return 1;
+    }
+  }
+
+  printf("Calibrated %zu layers on %zu rows, keeping the central %g%% of values\n", layers.size(), num_rows,
+         percentile);
+  for (size_t i = 0; i < layers.size(); ++i) {
+    for (int a = 0; a < SWIGLU_NUM_ACTIVATIONS; ++a) {
+      struct swiglu_activation_range range;
+      struct swiglu_activation_range full_range;
+      const enum swiglu_activation activation = static_cast<enum swiglu_activation>(a);
+      if (swiglu_calibrator_range(calibrator, i, activation, percentile, &range) != xnn_status_success ||
+          swiglu_calibrator_range(calibrator, i, activation, 100.0f, &full_range) != xnn_status_success) {
+        return 1;
+      }
+      printf("  layer %zu %-12s [%10.4f, %10.4f] of [%10.4f, %10.4f]\n", i, kActivationNames[a], range.min_value,
+             range.max_value, full_range.min_value, full_range.max_value);
+    }
+  }
+
+  std::vector<swiglu_qs8_scales> scales(layers.size());
+  if (swiglu_calibrator_scales(calibrator, percentile, scales.data()) != xnn_status_success) {
+    return 1;
+  }
+  swiglu_delete_calibrator(calibrator);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  if (output_path != NULL) {
+    if (!swiglu_save_qs8_scales(output_path, scales.size(), scales.data())) {
+      return 1;
+    }
+    printf("Wrote scales to %s\n", output_path);
+  }
+  xnn_deinitialize();
+  return 0;
+}
@@ -0,0 +1,270 @@
+/**
+ * @file fp8_swiglu.cpp
+ * @brief fp8-weight SwiGLU stacks against XNNPACK's fp32 and qc8 stacks
+ *
+ * Builds an fp8 stack (see swiglu_fp8.h), either from a checkpoint stored in fp8 or
+ * by quantizing fp32 weights, and for every batch size in --rows times it next to
+ * the fp32 and qc8 XNNPACK stacks and reports each one's error against fp32:
+ *
+ *   ./fp8_swiglu --fp8-safetensors model-fp8.safetensors --rows 1,8,64 --threads 8
+ *   ./fp8_swiglu --random 4 --dim 2048 --inter-dim 5632 --format e5m2 --per-tensor
+ *
+ * With --fp8-safetensors the fp32 reference holds exactly the stored fp8 values, so
+ * the fp8 stack's error is rounding in the GEMM alone, while qc8 has to requantize
+ * the weights.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_fp8.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--format e4m3|e5m2] [--per-tensor] [--rows R1,R2,...] [--runs N] [--threads T] SOURCE\n"
+          "sources:\n"
+          "  --fp8-safetensors FILE [--scale-suffix S]   weights stored as F8_E4M3 or F8_E5M2\n"
+          "  --safetensors FILE     fp32, fp16 or bf16 weights, quantized to --format\n"
+          "  --raw W1,W3,W2 --layers N --dim D --inter-dim I\n"
+          "  --random N --dim D --inter-dim I   N random layers (see swiglu_random_layers)\n"
+          "--fp8-safetensors and --safetensors also take [--layers N] [--key-format FMT] [--w1-name NAME]\n"
+          "[--w3-name NAME] [--w2-name NAME].\n",
+          program);
+}
+
+static float relative_error(const float* reference, const float* output, size_t size) {
+  double error = 0.0;
+  double norm = 0.0;
+  for (size_t i = 0; i < size; ++i) {
+    error += (output[i] - reference[i]) * (output[i] - reference[i]);
+    norm += reference[i] * reference[i];
+  }
+  return static_cast<float>(sqrt(error / std::max(norm, 1e-30)));
+}
+
+int main(int argc, char** argv) {
+  enum swiglu_fp8_format format = swiglu_fp8_e4m3;
+  bool per_channel = true;
+  std::vector<size_t> batch_sizes = {1, 8, 64};
+  size_t num_runs = 20;
+  size_t num_threads = 1;
+  const char* fp8_path = NULL;
+  const char* scale_suffix = "_scale";
+  const char* safetensors_path = NULL;
+  const char* key_format = "model.layers.{layer}.mlp.{proj}.weight";
+  const char* w1_name = "gate_proj";
+  const char* w3_name = "up_proj";
+  const char* w2_name = "down_proj";
+  const char* raw_paths = NULL;
+  size_t num_random_layers = 0;
+  size_t num_layers = 0;
+  size_t dim = 0;
+  size_t inter_dim = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--format") == 0) {
+      ++i;
+      if (strcmp(argv[i], "e5m2") == 0) {
+        format = swiglu_fp8_e5m2;
+      } else if (strcmp(argv[i], "e4m3") != 0) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--per-tensor") == 0) {
+      per_channel = false;
+    } else if (has_value && strcmp(argv[i], "--rows") == 0) {
+      batch_sizes.clear();
+      for (char* rows = strtok(argv[++i], ","); rows != NULL; rows = strtok(NULL, ",")) {
+        batch_sizes.push_back(strtoul(rows, NULL, 10));
+      }
+    } else if (has_value && strcmp(argv[i], "--runs") == 0) {
+      num_runs = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--fp8-safetensors") == 0) {
+      fp8_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--scale-suffix") == 0) {
+      scale_suffix = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--safetensors") == 0) {
+      safetensors_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--key-format") == 0) {
+      key_format = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w1-name") == 0) {
+      w1_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w3-name") == 0) {
+      w3_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w2-name") == 0) {
+      w2_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--raw") == 0) {
+      raw_paths = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--random") == 0) {
+      num_random_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  const int num_sources =
+    (fp8_path != NULL) + (safetensors_path != NULL) + (raw_paths != NULL) + (num_random_layers != 0);
+  if (num_sources != 1 || batch_sizes.empty() ||
+      std::find(batch_sizes.begin(), batch_sizes.end(), 0u) != batch_sizes.end() || num_runs == 0 ||
+      num_threads == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers;
+  std::vector<swiglu_fp8_layer> fp8_layers;
+  if (fp8_path != NULL) {
+    if (!swiglu_load_safetensors_fp8_layers(fp8_path, key_format, w1_name, w3_name, w2_name, scale_suffix,
+                                            num_layers, &fp8_layers)) {
+      return 1;
+    }
+    for (const swiglu_fp8_layer& layer : fp8_layers) {
+      fp32_layers.push_back(swiglu_dequantize_layer_fp8(layer));
+    }
+  } else {
+    if (safetensors_path != NULL) {
+      if (!swiglu_load_safetensors_layers(safetensors_path, key_format, w1_name, w3_name, w2_name,
+                                          num_layers, &fp32_layers)) {
+        return 1;
+      }
+    } else if (raw_paths != NULL) {
+      std::vector<std::string> paths;
+      std::string list = raw_paths;
+      for (size_t start = 0, comma; start <= list.size(); start = comma + 1) {
+        comma = list.find(',', start);
+        if (comma == std::string::npos) {
+          comma = list.size();
+        }
+        paths.push_back(list.substr(start, comma - start));
+      }
+      if (paths.size() != 3 || num_layers == 0 || dim == 0 || inter_dim == 0) {
+        print_usage(argv[0]);
+        return 1;
+      }
+      if (!swiglu_load_raw_layers(paths[0].c_str(), paths[1].c_str(), paths[2].c_str(), num_layers,
+                                  dim, inter_dim, dim, &fp32_layers)) {
+        return 1;
+      }
+    } else {
+      if (dim == 0 || inter_dim == 0) {
+        print_usage(argv[0]);
+        return 1;
+      }
+      fp32_layers = swiglu_random_layers(num_random_layers, dim, inter_dim);
+    }
+    for (const swiglu_fp32_layer& layer : fp32_layers) {
+      fp8_layers.push_back(swiglu_quantize_layer_fp8(layer, format, per_channel));
+    }
+  }
+  if (fp32_layers.empty()) {
+    fprintf(stderr, "no layers loaded\n");
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_qc8_layer> qc8_layers;
+  std::vector<swiglu_layer_weights> fp32_weights;
+  std::vector<swiglu_layer_weights> qc8_weights;
+  std::vector<swiglu_fp8_weights> fp8_weights;
+  qc8_layers.reserve(fp32_layers.size());
+  size_t fp8_bytes = 0;
+  for (size_t l = 0; l < fp32_layers.size(); ++l) {
+    qc8_layers.push_back(swiglu_quantize_layer_qc8(fp32_layers[l]));
+    fp32_weights.push_back(swiglu_fp32_layer_weights(fp32_layers[l]));
+    qc8_weights.push_back(swiglu_qc8_layer_weights(qc8_layers.back()));
+    fp8_weights.push_back(swiglu_fp8_layer_weights(fp8_layers[l]));
+    for (const swiglu_fp8_matrix* matrix : {&fp8_layers[l].w1, &fp8_layers[l].w3, &fp8_layers[l].w2}) {
+      fp8_bytes += matrix->data.size() + matrix->scale.size() * sizeof(float);
+    }
+  }
+  struct swiglu_stack* fp32_stack = NULL;
+  struct swiglu_stack* qc8_stack = NULL;
+  struct swiglu_fp8_stack* fp8_stack = NULL;
+  if (swiglu_create_stack(fp32_weights.size(), fp32_weights.data(), threadpool, swiglu_pack_parallel, &fp32_stack) !=
+        xnn_status_success ||
+      swiglu_create_stack(qc8_weights.size(), qc8_weights.data(), threadpool, swiglu_pack_parallel, &qc8_stack) !=
+        xnn_status_success ||
+      swiglu_create_fp8_stack(fp8_weights.size(), fp8_weights.data(), threadpool, &fp8_stack) != xnn_status_success) {
+    return 1;
+  }
+
+  const swiglu_fp8_layer& first = fp8_layers.front();
+  printf("layers=%zu dim=%zu inter_dim=%zu fp8=%s %s threads=%zu, %.1f MiB of fp8 weights and scales\n",
+         fp32_layers.size(), first.input_dim, first.inter_dim, first.w1.format == swiglu_fp8_e4m3 ? "e4m3" : "e5m2",
+         first.w1.scale.size() == 1 ? "per-tensor" : "per-channel", num_threads, fp8_bytes / 1048576.0);
+  const size_t input_dim = fp32_layers.front().input_dim;
+  const size_t output_dim = fp32_layers.back().output_dim;
+  for (size_t num_rows : batch_sizes) {
+    // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+    std::vector<float> input(num_rows * input_dim + XNN_EXTRA_BYTES / sizeof(float));
+    swiglu_fill_random(input.data(), num_rows * input_dim, 1.0f, 2);
+    std::vector<float> reference(num_rows * output_dim);
+    std::vector<float> qc8_output(num_rows * output_dim);
+    std::vector<float> fp8_output(num_rows * output_dim);
+    std::vector<double> fp32_ms;
+    std::vector<double> qc8_ms;
+    std::vector<double> fp8_ms;
+    for (size_t run = 0; run < num_runs; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      if (swiglu_run_stack(fp32_stack, num_rows, input.data(), reference.data()) != xnn_status_success) {
+        return 1;
+      }
+      fp32_ms.push_back(elapsed_ms(start));
+      start = std::chrono::steady_clock::now();
+      if (swiglu_run_stack(qc8_stack, num_rows, input.data(), qc8_output.data()) != xnn_status_success) {
+        return 1;
+      }
+      qc8_ms.push_back(elapsed_ms(start));
+      start = std::chrono::steady_clock::now();
+      if (swiglu_run_fp8_stack(fp8_stack, num_rows, input.data(), fp8_output.data()) != xnn_status_success) {
+        return 1;
+      }
+      fp8_ms.push_back(elapsed_ms(start));
+    }
+    printf("rows %zu: fp32 %.3f ms, qc8 %.3f ms (error %.2e), fp8 %.3f ms (error %.2e)\n", num_rows,
+           percentile(fp32_ms, 50.0), percentile(qc8_ms, 50.0),
+           relative_error(reference.data(), qc8_output.data(), reference.size()), percentile(fp8_ms, 50.0),
+           relative_error(reference.data(), fp8_output.data(), reference.size()));
+  }
+
+  swiglu_delete_fp8_stack(fp8_stack);
+  swiglu_delete_stack(qc8_stack);
+  swiglu_delete_stack(fp32_stack);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
@@ -0,0 +1,307 @@
+/**
+ * @file gptq_swiglu.cpp
+ * @brief Offline GPTQ quantization of SwiGLU weights to blockwise 4-bit
+ *
+ * Collects the Hessians of every layer's projection inputs over a calibration
+ * dataset, quantizes W1, W3 and W2 to qb4 with GPTQ (see swiglu_gptq.h) and
+ * compares the output error of GPTQ and round-to-nearest qb4 against fp32 on
+ * held-out rows, per layer and through the whole stack. --output writes the GPTQ
+ * layers to a packed file that stack_swiglu --packed serves directly:
+ *
+ *   ./gptq_swiglu --safetensors model.safetensors --dataset rows.bin --block-size 128 --output model-qb4.swpk
+ *   ./gptq_swiglu --random 2 --dim 1024 --inter-dim 2816 --random-rows 512 --threads 8
+ *
+ * The last --holdout rows of the dataset are only used for evaluation.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_calibration.h"
+#include "swiglu_gptq.h"
+#include "swiglu_packed_file.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--block-size B] [--damping D] [--holdout H] [--batch B] [--threads T] [--output FILE]\n"
+          "          SOURCE DATASET\n"
+          "sources:\n"
+          "  --safetensors FILE [--layers N] [--key-format FMT] [--w1-name NAME] [--w3-name NAME]\n"
+          "                     [--w2-name NAME]\n"
+          "  --raw W1,W3,W2 --layers N --dim D --inter-dim I\n"
+          "  --random N --dim D --inter-dim I   N random layers (see swiglu_random_layers)\n"
+          "datasets:\n"
+          "  --dataset FILE     raw fp32 rows\n"
+          "  --random-rows R    R uniform random rows in [-1, 1], plus the held-out rows\n",
+          program);
+}
+
+static float relative_error(const float* reference, const float* output, size_t size) {
+  double error = 0.0;
+  double norm = 0.0;
+  for (size_t i = 0; i < size; ++i) {
+    error += (output[i] - reference[i]) * (output[i] - reference[i]);
+    norm += reference[i] * reference[i];
+  }
+  return static_cast<float>(sqrt(error / std::max(norm, 1e-30)));
+}
+
+int main(int argc, char** argv) {
+  size_t block_size = 128;
+  float damping = 0.01f;
+  size_t num_holdout = 16;
+  size_t batch_size = 32;
+  size_t num_threads = 1;
+  const char* output_path = NULL;
+  const char* safetensors_path = NULL;
+  const char* key_format = "model.layers.{layer}.mlp.{proj}.weight";
+  const char* w1_name = "gate_proj";
+  const char* w3_name = "up_proj";
+  const char* w2_name = "down_proj";
+  const char* raw_paths = NULL;
+  size_t num_random_layers = 0;
+  size_t num_layers = 0;
+  size_t dim = 0;
+  size_t inter_dim = 0;
+  const char* dataset_path = NULL;
+  size_t num_random_rows = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--block-size") == 0) {
+      block_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--damping") == 0) {
+      damping = strtof(argv[++i], NULL);
+    } else if (has_value && strcmp(argv[i], "--holdout") == 0) {
+      num_holdout = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--batch") == 0) {
+      batch_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--output") == 0) {
+      output_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--safetensors") == 0) {
+      safetensors_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--key-format") == 0) {
+      key_format = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w1-name") == 0) {
+      w1_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w3-name") == 0) {
+      w3_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w2-name") == 0) {
+      w2_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--raw") == 0) {
+      raw_paths = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--random") == 0) {
+      num_random_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dataset") == 0) {
+      dataset_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--random-rows") == 0) {
+      num_random_rows = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  const int num_sources = (safetensors_path != NULL) + (raw_paths != NULL) + (num_random_layers != 0);
+  const int num_datasets = (dataset_path != NULL) + (num_random_rows != 0);
+  if (num_sources != 1 || num_datasets != 1 || block_size == 0 || !(damping >= 0.0f) || num_holdout == 0 ||
+      batch_size == 0 || num_threads == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers;
+  if (safetensors_path != NULL) {
+    if (!swiglu_load_safetensors_layers(safetensors_path, key_format, w1_name, w3_name, w2_name,
+                                        num_layers, &fp32_layers)) {
+      return 1;
+    }
+  } else if (raw_paths != NULL) {
+    std::vector<std::string> paths;
+    std::string list = raw_paths;
+    for (size_t start = 0, comma; start <= list.size(); start = comma + 1) {
+      comma = list.find(',', start);
+      if (comma == std::string::npos) {
+        comma = list.size();
+      }
+      paths.push_back(list.substr(start, comma - start));
+    }
+    if (paths.size() != 3 || num_layers == 0 || dim == 0 || inter_dim == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    if (!swiglu_load_raw_layers(paths[0].c_str(), paths[1].c_str(), paths[2].c_str(), num_layers,
+                                dim, inter_dim, dim, &fp32_layers)) {
+      return 1;
+    }
+  } else {
+    if (dim == 0 || inter_dim == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    fp32_layers = swiglu_random_layers(num_random_layers, dim, inter_dim);
+  }
+  if (fp32_layers.empty()) {
+    fprintf(stderr, "no layers loaded\n");
+    return 1;
+  }
+
+  const size_t input_dim = fp32_layers.front().input_dim;
+  std::vector<float> dataset;
+  size_t num_rows = num_random_rows + num_holdout;
+  if (dataset_path != NULL) {
+    FILE* file = fopen(dataset_path, "rb");
+    if (file == NULL) {
+      fprintf(stderr, "failed to open %s\n", dataset_path);
+      return 1;
+    }
+    float value;
+    while (fread(&value, sizeof(float), 1, file) == 1) {
+      dataset.push_back(value);
+    }
+    fclose(file);
+    num_rows = dataset.size() / input_dim;
+    if (num_rows <= num_holdout || dataset.size() % input_dim != 0) {
+      fprintf(stderr, "%s holds %zu values, not a whole number of more than %zu rows of %zu\n", dataset_path,
+              dataset.size(), num_holdout, input_dim);
+      return 1;
+    }
+  } else {
+    dataset.resize(num_rows * input_dim);
+    swiglu_fill_random(dataset.data(), dataset.size(), 1.0f, 1);
+  }
+  const size_t num_calibration_rows = num_rows - num_holdout;
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  dataset.resize(num_rows * input_dim + XNN_EXTRA_BYTES / sizeof(float));
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_layer_weights> fp32_weights;
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    fp32_weights.push_back(swiglu_fp32_layer_weights(layer));
+  }
+  struct swiglu_calibrator* calibrator = NULL;
+  if (swiglu_create_calibrator(fp32_weights.size(), fp32_weights.data(), threadpool, &calibrator) !=
+        xnn_status_success) {
+    return 1;
+  }
+
+  // Only one layer's Hessians fit in memory at a time, so the dataset runs once per layer.
+  std::vector<swiglu_qb4_layer> gptq_layers(fp32_layers.size());
+  std::vector<swiglu_qb4_layer> rtn_layers;
+  const auto quantize_start = std::chrono::steady_clock::now();
+  for (size_t l = 0; l < fp32_layers.size(); ++l) {
+    if (swiglu_calibrator_collect_hessians(calibrator, l) != xnn_status_success) {
+      return 1;
+    }
+    for (size_t row = 0; row < num_calibration_rows; row += batch_size) {
+      const size_t rows = std::min(batch_size, num_calibration_rows - row);
+      if (swiglu_calibrator_observe(calibrator, rows, &dataset[row * input_dim]) != xnn_status_success) {
+        return 1;
+      }
+    }
+    if (swiglu_quantize_layer_gptq(fp32_layers[l], block_size,
+                                   swiglu_calibrator_hessian(calibrator, l, swiglu_activation_input),
+                                   swiglu_calibrator_hessian(calibrator, l, swiglu_activation_intermediate),
+                                   damping, threadpool, &gptq_layers[l]) != xnn_status_success) {
+      return 1;
+    }
+    rtn_layers.push_back(swiglu_quantize_layer_qb4(fp32_layers[l], block_size));
+  }
+  swiglu_delete_calibrator(calibrator);
+  printf("Quantized %zu layers to qb4 (block size %zu) on %zu rows in %.0f ms\n", fp32_layers.size(), block_size,
+         num_calibration_rows, elapsed_ms(quantize_start));
+
+  std::vector<swiglu_layer_weights> rtn_weights;
+  std::vector<swiglu_layer_weights> gptq_weights;
+  for (size_t l = 0; l < fp32_layers.size(); ++l) {
+    rtn_weights.push_back(swiglu_qb4_layer_weights(rtn_layers[l]));
+    gptq_weights.push_back(swiglu_qb4_layer_weights(gptq_layers[l]));
+  }
+  struct swiglu_stack* fp32_stack = NULL;
+  struct swiglu_stack* rtn_stack = NULL;
+  struct swiglu_stack* gptq_stack = NULL;
+  const size_t n = fp32_layers.size();
+  if (swiglu_create_stack(n, fp32_weights.data(), threadpool, swiglu_pack_serial, &fp32_stack) != xnn_status_success ||
+      swiglu_create_stack(n, rtn_weights.data(), threadpool, swiglu_pack_serial, &rtn_stack) != xnn_status_success ||
+      swiglu_create_stack(n, gptq_weights.data(), threadpool, swiglu_pack_serial, &gptq_stack) != xnn_status_success) {
+    return 1;
+  }
+
+  // Each layer gets the fp32 output of the one before, so its error is its own.
+  std::vector<float> input(dataset.begin() + num_calibration_rows * input_dim, dataset.end());
+  for (size_t l = 0; l < n; ++l) {
+    const size_t output_size = num_holdout * fp32_layers[l].output_dim;
+    std::vector<float> reference(output_size + XNN_EXTRA_BYTES / sizeof(float));
+    std::vector<float> rtn_output(output_size);
+    std::vector<float> gptq_output(output_size);
+    if (swiglu_run_stack_layer(fp32_stack, l, num_holdout, input.data(), reference.data()) != xnn_status_success ||
+        swiglu_run_stack_layer(rtn_stack, l, num_holdout, input.data(), rtn_output.data()) != xnn_status_success ||
+        swiglu_run_stack_layer(gptq_stack, l, num_holdout, input.data(), gptq_output.data()) != xnn_status_success) {
+      return 1;
+    }
+    printf("  layer %zu: round-to-nearest error %.2e, GPTQ error %.2e\n", l,
+           relative_error(reference.data(), rtn_output.data(), output_size),
+           relative_error(reference.data(), gptq_output.data(), output_size));
+    input.swap(reference);
+  }
+  const size_t output_size = num_holdout * fp32_layers.back().output_dim;
+  std::vector<float> reference(output_size);
+  std::vector<float> rtn_output(output_size);
+  std::vector<float> gptq_output(output_size);
+  const float* holdout = &dataset[num_calibration_rows * input_dim];
+  if (swiglu_run_stack(fp32_stack, num_holdout, holdout, reference.data()) != xnn_status_success ||
+      swiglu_run_stack(rtn_stack, num_holdout, holdout, rtn_output.data()) != xnn_status_success ||
+      swiglu_run_stack(gptq_stack, num_holdout, holdout, gptq_output.data()) != xnn_status_success) {
+    return 1;
+  }
+  printf("stack on %zu held-out rows: round-to-nearest error %.2e, GPTQ error %.2e\n", num_holdout,
+         relative_error(reference.data(), rtn_output.data(), output_size),
+         relative_error(reference.data(), gptq_output.data(), output_size));
+  swiglu_delete_stack(gptq_stack);
+  swiglu_delete_stack(rtn_stack);
+  swiglu_delete_stack(fp32_stack);
+
+  if (output_path != NULL) {
+    const enum xnn_status status = swiglu_write_packed_file(output_path, n, gptq_weights.data(), threadpool);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "swiglu_write_packed_file failed: %d\n", status);
+      return 1;
+    }
+    printf("Packed the GPTQ layers (%s) into %s\n", swiglu_host_isa(), output_path);
+  }
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
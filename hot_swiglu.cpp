@@ -0,0 +1,210 @@
+/**
+ * @file hot_swiglu.cpp
+ * @brief Per-node times of batch-1 decode steps with parked, spinning and hot workers
+ *
+ * Runs --steps single-row steps through one profiled SwiGLU layer with a --gap-us
+ * pause between steps, standing in for sampling and request handling. XNNPACK's
+ * operator timings include handing each operator to the thread pool, so at batch 1
+ * the differences between modes are dispatch overhead:
+ *   yield    workers park after every step (XNN_FLAG_YIELD_WORKERS)
+ *   default  workers spin for pthreadpool's bounded spin, then park
+ *   hot      as default, inside swiglu_enter_hot_mode for the whole burst
+ *
+ *   ./hot_swiglu --threads 8 --gap-us 2000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_hot.h"
+#include "swiglu_layer.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--steps S] [--gap-us G] [--threads T] [--dim D] [--inter-dim I]\n",
+          program);
+}
+
+struct mode_result {
+  const char* name;
+  std::vector<double> step_us;
+  // node_us[n] holds operator n's time in every step.
+  std::vector<std::vector<double>> node_us;
+};
+
+static enum xnn_status get_operator_names(xnn_runtime_t runtime, std::vector<std::string>* names) {
+  size_t size = 0;
+  enum xnn_status status = xnn_get_runtime_profiling_info(runtime, xnn_profile_info_operator_name, 0, NULL, &size);
+  if (status != xnn_status_out_of_memory && status != xnn_status_success) {
+    return status;
+  }
+  std::vector<char> buffer(size);
+  status = xnn_get_runtime_profiling_info(runtime, xnn_profile_info_operator_name, size, buffer.data(), &size);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  for (size_t offset = 0; offset < size; offset += strlen(&buffer[offset]) + 1) {
+    names->push_back(&buffer[offset]);
+  }
+  return xnn_status_success;
+}
+
+static enum xnn_status run_mode(
+  xnn_subgraph_t subgraph,
+  pthreadpool_t threadpool,
+  const char* name,
+  size_t num_steps,
+  size_t gap_us,
+  const float* input,
+  float* output,
+  std::vector<std::string>* operator_names,
+  mode_result* result)
+{
+  const bool yield = strcmp(name, "yield") == 0;
+  xnn_runtime_t runtime = NULL;
+  enum xnn_status status = xnn_create_runtime_v4(
+    subgraph,
+    /*weights_cache=*/NULL,
+    /*workspace=*/NULL,
+    /*threadpool=*/threadpool,
+    /*flags=*/XNN_FLAG_BASIC_PROFILING | (yield ? XNN_FLAG_YIELD_WORKERS : 0),
+    &runtime);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_runtime_v4 failed: %d\n", status);
+    return status;
+  }
+  struct xnn_external_value external_values[SWIGLU_NUM_EXTERNAL_VALUES] = {
+    {SWIGLU_INPUT_EXTERNAL_ID, const_cast<float*>(input)},
+    {SWIGLU_OUTPUT_EXTERNAL_ID, output},
+  };
+  if ((status = xnn_reshape_runtime(runtime)) != xnn_status_success ||
+      (status = xnn_setup_runtime_v2(runtime, SWIGLU_NUM_EXTERNAL_VALUES, external_values)) != xnn_status_success ||
+      (operator_names->empty() && (status = get_operator_names(runtime, operator_names)) != xnn_status_success)) {
+    fprintf(stderr, "failed to set up the %s runtime: %d\n", name, status);
+    xnn_delete_runtime(runtime);
+    return status;
+  }
+
+  result->name = name;
+  result->node_us.assign(operator_names->size(), {});
+  std::vector<uint64_t> timings(operator_names->size());
+  struct swiglu_hot_mode* hot = NULL;
+  if (strcmp(name, "hot") == 0) {
+    status = swiglu_enter_hot_mode(threadpool, /*max_ms=*/60000.0, &hot);
+    if (status != xnn_status_success) {
+      xnn_delete_runtime(runtime);
+      return status;
+    }
+  }
+  for (size_t step = 0; step < num_steps && status == xnn_status_success; ++step) {
+    std::this_thread::sleep_for(std::chrono::microseconds(gap_us));
+    const auto start = std::chrono::steady_clock::now();
+    status = xnn_invoke_runtime(runtime);
+    result->step_us.push_back(elapsed_ms(start) * 1000.0);
+    size_t size = 0;
+    if (status == xnn_status_success) {
+      status = xnn_get_runtime_profiling_info(
+        runtime, xnn_profile_info_operator_timing, timings.size() * sizeof(uint64_t), timings.data(), &size);
+    }
+    for (size_t n = 0; n < timings.size(); ++n) {
+      result->node_us[n].push_back(static_cast<double>(timings[n]));
+    }
+  }
+  if (hot != NULL) {
+    swiglu_leave_hot_mode(hot);
+  }
+  if (status != xnn_status_success) {
+    fprintf(stderr, "%s run failed: %d\n", name, status);
+  }
+  xnn_delete_runtime(runtime);
+  return status;
+}
+
+int main(int argc, char** argv) {
+  size_t num_steps = 500;
+  size_t gap_us = 2000;
+  size_t num_threads = 8;
+  size_t dim = 512;
+  size_t inter_dim = 1536;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--steps") == 0) {
+      num_steps = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--gap-us") == 0) {
+      gap_us = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_steps == 0 || num_threads < 2 || dim == 0 || inter_dim == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = pthreadpool_create(num_threads);
+  if (threadpool == NULL) {
+    fprintf(stderr, "pthreadpool_create failed\n");
+    return 1;
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers = swiglu_random_layers(1, dim, inter_dim);
+  const struct swiglu_layer_weights weights = swiglu_fp32_layer_weights(fp32_layers[0]);
+  xnn_subgraph_t subgraph = NULL;
+  if (swiglu_define_layer(&weights, &subgraph) != xnn_status_success) {
+    return 1;
+  }
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  std::vector<float> input(dim + XNN_EXTRA_BYTES / sizeof(float));
+  swiglu_fill_random(input.data(), dim, 1.0f, 2);
+  std::vector<float> output(dim);
+
+  std::vector<std::string> operator_names;
+  const char* modes[3] = {"yield", "default", "hot"};
+  mode_result results[3];
+  for (size_t m = 0; m < 3; ++m) {
+    if (run_mode(subgraph, threadpool, modes[m], num_steps, gap_us, input.data(), output.data(),
+                 &operator_names, &results[m]) != xnn_status_success) {
+      return 1;
+    }
+  }
+
+  printf("batch=1 dim=%zu inter_dim=%zu threads=%zu steps=%zu gap=%zu us, median us per node\n",
+         dim, inter_dim, num_threads, num_steps, gap_us);
+  printf("%-4s %-24s %10s %10s %10s %14s\n", "node", "operator", "yield", "default", "hot", "yield - hot");
+  for (size_t n = 0; n < operator_names.size(); ++n) {
+    const double yield_us = percentile(results[0].node_us[n], 50.0);
+    printf("%-4zu %-24s %10.1f %10.1f %10.1f %14.1f\n", n, operator_names[n].c_str(), yield_us,
+           percentile(results[1].node_us[n], 50.0), percentile(results[2].node_us[n], 50.0),
+           yield_us - percentile(results[2].node_us[n], 50.0));
+  }
+  for (const mode_result& result : results) {
+    printf("%-8s step p50 %.1f us, p99 %.1f us\n",
+           result.name, percentile(result.step_us, 50.0), percentile(result.step_us, 99.0));
+  }
+
+  xnn_delete_subgraph(subgraph);
+  pthreadpool_destroy(threadpool);
+  xnn_deinitialize();
+  return 0;
+}
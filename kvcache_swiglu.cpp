@@ -0,0 +1,140 @@
+/**
+ * @file kvcache_swiglu.cpp
+ * @brief Decode attention over fp32, int8 and int4 key/value caches
+ *
+ * Fills --sequences sequences with --context random positions of keys and values,
+ * then times --steps decode steps, each attending one query row per sequence to
+ * its whole cache. Reports cache size, time per step and the largest difference
+ * from the fp32 cache's output:
+ *
+ *   ./kvcache_swiglu --sequences 8 --context 4096 --heads 32 --kv-heads 8 --threads 8
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_kv_cache.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--sequences S] [--context L] [--heads H] [--kv-heads K] [--head-dim D] [--block B]\n"
+          "          [--steps N] [--threads T]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  size_t num_sequences = 8;
+  size_t context = 4096;
+  size_t num_heads = 32;
+  size_t num_kv_heads = 8;
+  size_t head_dim = 128;
+  size_t block_size = 32;
+  size_t num_steps = 20;
+  size_t num_threads = 1;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--sequences") == 0) {
+      num_sequences = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--context") == 0) {
+      context = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--heads") == 0) {
+      num_heads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--kv-heads") == 0) {
+      num_kv_heads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--head-dim") == 0) {
+      head_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--block") == 0) {
+      block_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--steps") == 0) {
+      num_steps = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_sequences == 0 || context == 0 || num_kv_heads == 0 || num_heads % num_kv_heads != 0 ||
+      head_dim == 0 || num_steps == 0 || num_threads == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  const size_t kv_dim = num_kv_heads * head_dim;
+  const size_t query_dim = num_heads * head_dim;
+  std::vector<float> keys(context * kv_dim);
+  std::vector<float> values(context * kv_dim);
+  std::vector<float> queries(num_sequences * query_dim);
+  swiglu_fill_random(queries.data(), queries.size(), 1.0f, 1);
+
+  printf("sequences=%zu context=%zu heads=%zu kv_heads=%zu head_dim=%zu block=%zu threads=%zu\n",
+         num_sequences, context, num_heads, num_kv_heads, head_dim, block_size, num_threads);
+  const enum swiglu_kv_precision precisions[3] = {swiglu_kv_fp32, swiglu_kv_int8, swiglu_kv_int4};
+  const char* names[3] = {"fp32", "int8", "int4"};
+  std::vector<float> reference(num_sequences * query_dim);
+  std::vector<float> output(num_sequences * query_dim);
+  for (size_t p = 0; p < 3; ++p) {
+    struct swiglu_kv_cache* cache = NULL;
+    enum xnn_status status =
+      swiglu_create_kv_cache(num_sequences, context, num_kv_heads, head_dim, precisions[p], block_size, &cache);
+    if (status != xnn_status_success) {
+      return 1;
+    }
+    for (size_t s = 0; s < num_sequences; ++s) {
+      // Same keys and values for every precision
+      swiglu_fill_random(keys.data(), keys.size(), 1.0f, static_cast<uint32_t>(2 * s + 2));
+      swiglu_fill_random(values.data(), values.size(), 1.0f, static_cast<uint32_t>(2 * s + 3));
+      swiglu_kv_cache_append(cache, s, context, keys.data(), values.data(), kv_dim, /*rope=*/NULL);
+    }
+
+    std::vector<double> step_ms;
+    for (size_t step = 0; step < num_steps && status == xnn_status_success; ++step) {
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t s = 0; s < num_sequences && status == xnn_status_success; ++s) {
+        status = swiglu_kv_cache_attention(cache, s, /*num_rows=*/1, &queries[s * query_dim], num_heads,
+                                           /*rope=*/NULL, &output[s * query_dim], threadpool);
+      }
+      step_ms.push_back(elapsed_ms(start));
+    }
+    if (status != xnn_status_success) {
+      return 1;
+    }
+
+    if (precisions[p] == swiglu_kv_fp32) {
+      reference = output;
+    }
+    float max_error = 0.0f;
+    for (size_t i = 0; i < output.size(); ++i) {
+      max_error = std::max(max_error, fabsf(output[i] - reference[i]));
+    }
+    const size_t bytes_per_position = swiglu_kv_cache_bytes_per_position(cache);
+    printf("%s: %zu bytes/position, %.1f MiB, step p50 %.3f ms, max abs error vs fp32 %.2e\n",
+           names[p], bytes_per_position, num_sequences * context * bytes_per_position / 1048576.0,
+           percentile(step_ms, 50.0), max_error);
+    swiglu_delete_kv_cache(cache);
+  }
+
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  return 0;
+}
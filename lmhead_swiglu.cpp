@@ -0,0 +1,204 @@
+/**
+ * @file lmhead_swiglu.cpp
+ * @brief LM head: XNNPACK logits then sampling, against the fused sampling LM head
+ *
+ * For every batch size in --rows, times --runs decode steps of the vocabulary
+ * projection and sampling two ways: an XNNPACK fully connected subgraph writing the
+ * [rows, vocab] logits followed by swiglu_sample_logits, and swiglu_lm_head_sample,
+ * which never writes them. Reports p50 times, the logits traffic the fused path
+ * avoids and how many sampled tokens the two paths agree on:
+ *
+ *   ./lmhead_swiglu --vocab 128256 --hidden 4096 --rows 1,8 --weights qc8 --threads 8
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_layer.h"
+#include "swiglu_lm_head.h"
+#include "swiglu_quantize.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--vocab V] [--hidden H] [--rows R1,R2,...] [--weights fp32|qc8] [--temperature T]\n"
+          "          [--top-k K] [--top-p P] [--runs N] [--threads T]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  size_t vocab_size = 32000;
+  size_t hidden_dim = 2048;
+  std::vector<size_t> batch_sizes = {1, 8};
+  bool qc8 = false;
+  struct swiglu_sampling_params params = {/*temperature=*/0.8f, /*top_k=*/50, /*top_p=*/0.9f, /*seed=*/0};
+  size_t num_runs = 20;
+  size_t num_threads = 1;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--vocab") == 0) {
+      vocab_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--hidden") == 0) {
+      hidden_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--rows") == 0) {
+      batch_sizes.clear();
+      for (char* rows = strtok(argv[++i], ","); rows != NULL; rows = strtok(NULL, ",")) {
+        batch_sizes.push_back(strtoul(rows, NULL, 10));
+      }
+    } else if (has_value && strcmp(argv[i], "--weights") == 0) {
+      ++i;
+      if (strcmp(argv[i], "qc8") == 0) {
+        qc8 = true;
+      } else if (strcmp(argv[i], "fp32") != 0) {
+        print_usage(argv[0]);
+        return 1;
+      }
+    } else if (has_value && strcmp(argv[i], "--temperature") == 0) {
+      params.temperature = strtof(argv[++i], NULL);
+    } else if (has_value && strcmp(argv[i], "--top-k") == 0) {
+      params.top_k = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--top-p") == 0) {
+      params.top_p = strtof(argv[++i], NULL);
+    } else if (has_value && strcmp(argv[i], "--runs") == 0) {
+      num_runs = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (vocab_size == 0 || hidden_dim == 0 || batch_sizes.empty() ||
+      std::find(batch_sizes.begin(), batch_sizes.end(), 0u) != batch_sizes.end() || num_runs == 0 ||
+      num_threads == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<float> fp32_weights(vocab_size * hidden_dim);
+  swiglu_fill_random(fp32_weights.data(), fp32_weights.size(), 1.0f / sqrtf(static_cast<float>(hidden_dim)), 1);
+  std::vector<int8_t> qc8_weights;
+  std::vector<float> qc8_scale;
+  struct swiglu_projection_weights weights = {swiglu_weight_fp32, fp32_weights.data(), NULL, NULL, 0};
+  if (qc8) {
+    qc8_weights.resize(vocab_size * hidden_dim);
+    qc8_scale.resize(vocab_size);
+    swiglu_quantize_qc8(fp32_weights.data(), vocab_size, hidden_dim, qc8_weights.data(), qc8_scale.data());
+    std::vector<float>().swap(fp32_weights);
+    weights = {swiglu_weight_qc8, qc8_weights.data(), qc8_scale.data(), NULL, 0};
+  }
+
+  xnn_subgraph_t subgraph = NULL;
+  xnn_runtime_t runtime = NULL;
+  struct swiglu_lm_head* head = NULL;
+  if (swiglu_define_lm_head(vocab_size, hidden_dim, &weights, &subgraph) != xnn_status_success) {
+    return 1;
+  }
+  enum xnn_status status = xnn_create_runtime_v4(
+    subgraph,
+    /*weights_cache=*/NULL,
+    /*workspace=*/NULL,
+    /*threadpool=*/threadpool,
+    /*flags=*/0,
+    &runtime);
+  xnn_delete_subgraph(subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_runtime_v4 failed: %d\n", status);
+    return 1;
+  }
+  if (swiglu_create_lm_head(vocab_size, hidden_dim, &weights, &head) != xnn_status_success) {
+    return 1;
+  }
+
+  printf("vocab=%zu hidden=%zu weights=%s temperature=%g top_k=%zu top_p=%g threads=%zu\n", vocab_size,
+         hidden_dim, qc8 ? "qc8" : "fp32", params.temperature, params.top_k, params.top_p, num_threads);
+  for (size_t num_rows : batch_sizes) {
+    // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+    std::vector<float> hidden(num_rows * hidden_dim + XNN_EXTRA_BYTES / sizeof(float));
+    swiglu_fill_random(hidden.data(), num_rows * hidden_dim, 1.0f, 2);
+    std::vector<float> logits(num_rows * vocab_size);
+    const size_t input_dims[2] = {num_rows, hidden_dim};
+    const size_t output_dims[2] = {num_rows, vocab_size};
+    const struct xnn_external_value external_values[SWIGLU_NUM_EXTERNAL_VALUES] = {
+      {SWIGLU_INPUT_EXTERNAL_ID, hidden.data()},
+      {SWIGLU_OUTPUT_EXTERNAL_ID, logits.data()},
+    };
+    if ((status = xnn_reshape_external_value(runtime, SWIGLU_INPUT_EXTERNAL_ID, 2, input_dims)) !=
+          xnn_status_success ||
+        (status = xnn_reshape_external_value(runtime, SWIGLU_OUTPUT_EXTERNAL_ID, 2, output_dims)) !=
+          xnn_status_success ||
+        (status = xnn_reshape_runtime(runtime)) != xnn_status_success ||
+        (status = xnn_setup_runtime_v2(runtime, SWIGLU_NUM_EXTERNAL_VALUES, external_values)) !=
+          xnn_status_success) {
+      fprintf(stderr, "failed to set up the logits runtime: %d\n", status);
+      return 1;
+    }
+
+    std::vector<uint32_t> separate_tokens(num_rows);
+    std::vector<uint32_t> fused_tokens(num_rows);
+    std::vector<float> separate_log_probs(num_rows);
+    std::vector<float> fused_log_probs(num_rows);
+    std::vector<double> separate_ms;
+    std::vector<double> fused_ms;
+    size_t matches = 0;
+    float max_log_prob_error = 0.0f;
+    for (size_t run = 0; run < num_runs; ++run) {
+      params.seed = static_cast<uint32_t>(run);
+      auto start = std::chrono::steady_clock::now();
+      if (xnn_invoke_runtime(runtime) != xnn_status_success ||
+          swiglu_sample_logits(vocab_size, num_rows, logits.data(), &params, separate_tokens.data(),
+                               separate_log_probs.data()) != xnn_status_success) {
+        return 1;
+      }
+      separate_ms.push_back(elapsed_ms(start));
+
+      start = std::chrono::steady_clock::now();
+      if (swiglu_lm_head_sample(head, num_rows, hidden.data(), &params, fused_tokens.data(),
+                                fused_log_probs.data(), threadpool) != xnn_status_success) {
+        return 1;
+      }
+      fused_ms.push_back(elapsed_ms(start));
+
+      for (size_t r = 0; r < num_rows; ++r) {
+        if (separate_tokens[r] == fused_tokens[r]) {
+          ++matches;
+          max_log_prob_error = std::max(max_log_prob_error, fabsf(separate_log_probs[r] - fused_log_probs[r]));
+        }
+      }
+    }
+    printf("rows %zu: logits+sample %.3f ms, fused %.3f ms (%.1f MiB of logits not written or rescanned), "
+           "%zu/%zu tokens agree, max log prob difference %.2e\n",
+           num_rows, percentile(separate_ms, 50.0), percentile(fused_ms, 50.0),
+           num_rows * vocab_size * sizeof(float) / 1048576.0, matches, num_rows * num_runs, max_log_prob_error);
+  }
+
+  swiglu_delete_lm_head(head);
+  xnn_delete_runtime(runtime);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
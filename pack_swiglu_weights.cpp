@@ -0,0 +1,210 @@
+/**
+ * @file pack_swiglu_weights.cpp
+ * @brief Offline packing of SwiGLU weights into a ready-to-mmap packed file
+ *
+ * Loads raw W1/W3/W2 weights, optionally quantizes them, packs them into XNNPACK's
+ * GEMM layout for this host's ISA and writes a packed file (see
+ * swiglu_packed_file.h). Serving hosts then create runtimes straight from the file
+ * and never run packing code:
+ *
+ *   ./pack_swiglu_weights --safetensors model.safetensors --dtype qc8 --output model.swpk
+ *   ./pack_swiglu_weights --raw w1.bin,w3.bin,w2.bin --layers 32 --dim 4096 \
+ *       --inter-dim 14336 --output model.swpk
+ *   ./pack_swiglu_weights --example --output example.swpk
+ *
+ * --precision FILE quantizes each projection to the type a plan written by
+ * plan_swiglu gives it, instead of one --dtype for every projection.
+ *
+ * --publish-shm NAME also copies the file into POSIX shared memory for worker
+ * processes to map (see swiglu_publish_packed_shm).
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_packed_file.h"
+#include "swiglu_precision.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s --output FILE [--dtype fp32|qc8 | --precision FILE] [--isa ISA] [--threads T] [--publish-shm NAME]\n"
+          "          SOURCE\n"
+          "sources:\n"
+          "  --safetensors FILE [--layers N] [--key-format FMT] [--w1-name NAME] [--w3-name NAME]\n"
+          "                     [--w2-name NAME]\n"
+          "  --raw W1,W3,W2 --layers N --dim D --inter-dim I [--output-dim O]\n"
+          "  --example          the weights of minimal_swiglu.cpp\n"
+          "--isa must match this host (weights are packed with the kernels it selects).\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  const char* output_path = NULL;
+  const char* shm_name = NULL;
+  const char* dtype = "fp32";
+  const char* precision_path = NULL;
+  const char* isa = NULL;
+  size_t num_threads = 1;
+  const char* safetensors_path = NULL;
+  const char* key_format = "model.layers.{layer}.mlp.{proj}.weight";
+  const char* w1_name = "gate_proj";
+  const char* w3_name = "up_proj";
+  const char* w2_name = "down_proj";
+  const char* raw_paths = NULL;
+  bool example = false;
+  size_t num_layers = 0;
+  size_t dim = 0;
+  size_t inter_dim = 0;
+  size_t output_dim = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--output") == 0) {
+      output_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--publish-shm") == 0) {
+      shm_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--dtype") == 0) {
+      dtype = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--precision") == 0) {
+      precision_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--isa") == 0) {
+      isa = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--safetensors") == 0) {
+      safetensors_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--key-format") == 0) {
+      key_format = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w1-name") == 0) {
+      w1_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w3-name") == 0) {
+      w3_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w2-name") == 0) {
+      w2_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--raw") == 0) {
+      raw_paths = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--output-dim") == 0) {
+      output_dim = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--example") == 0) {
+      example = true;
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  const int num_sources = (safetensors_path != NULL) + (raw_paths != NULL) + example;
+  if (output_path == NULL || num_sources != 1 || num_threads == 0 ||
+      (strcmp(dtype, "fp32") != 0 && strcmp(dtype, "qc8") != 0) ||
+      (precision_path != NULL && strcmp(dtype, "fp32") != 0)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers;
+  if (safetensors_path != NULL) {
+    if (!swiglu_load_safetensors_layers(safetensors_path, key_format, w1_name, w3_name, w2_name,
+                                        num_layers, &fp32_layers)) {
+      return 1;
+    }
+  } else if (raw_paths != NULL) {
+    std::vector<std::string> paths;
+    std::string list = raw_paths;
+    for (size_t start = 0, comma; start <= list.size(); start = comma + 1) {
+      comma = list.find(',', start);
+      if (comma == std::string::npos) {
+        comma = list.size();
+      }
+      paths.push_back(list.substr(start, comma - start));
+    }
+    if (paths.size() != 3 || num_layers == 0 || dim == 0 || inter_dim == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    if (!swiglu_load_raw_layers(paths[0].c_str(), paths[1].c_str(), paths[2].c_str(), num_layers,
+                                dim, inter_dim, output_dim != 0 ? output_dim : dim, &fp32_layers)) {
+      return 1;
+    }
+  } else {
+    fp32_layers.push_back(swiglu_example_layer());
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  if (isa != NULL && strcmp(isa, swiglu_host_isa()) != 0) {
+    fprintf(stderr, "cannot pack for %s on this host, which is %s: XNNPACK packs for the kernels it "
+            "selects at run time, so run this tool on the target host type\n", isa, swiglu_host_isa());
+    return 1;
+  }
+
+  std::vector<swiglu_layer_precision> plan(fp32_layers.size());
+  size_t block_size = 0;
+  if (precision_path != NULL) {
+    if (!swiglu_load_precision_plan(precision_path, plan.size(), &block_size, plan.data())) {
+      return 1;
+    }
+    dtype = "mixed";
+  }
+
+  std::vector<swiglu_layer_weights> layers;
+  std::vector<swiglu_qc8_layer> qc8_layers;
+  std::vector<swiglu_mixed_layer> mixed_layers;
+  qc8_layers.reserve(fp32_layers.size());
+  mixed_layers.reserve(fp32_layers.size());
+  for (size_t l = 0; l < fp32_layers.size(); ++l) {
+    const swiglu_fp32_layer& layer = fp32_layers[l];
+    if (precision_path != NULL) {
+      mixed_layers.push_back(swiglu_quantize_layer_mixed(layer, plan[l], block_size));
+      layers.push_back(swiglu_mixed_layer_weights(mixed_layers.back()));
+    } else if (strcmp(dtype, "qc8") == 0) {
+      qc8_layers.push_back(swiglu_quantize_layer_qc8(layer));
+      layers.push_back(swiglu_qc8_layer_weights(qc8_layers.back()));
+    } else {
+      layers.push_back(swiglu_fp32_layer_weights(layer));
+    }
+  }
+
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  enum xnn_status status = swiglu_write_packed_file(output_path, layers.size(), layers.data(), threadpool);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_write_packed_file failed: %d\n", status);
+    return 1;
+  }
+
+  printf("Packed %zu layers (%s, %s) into %s\n", layers.size(), dtype, swiglu_host_isa(), output_path);
+  if (shm_name != NULL) {
+    status = swiglu_publish_packed_shm(output_path, shm_name);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "swiglu_publish_packed_shm failed: %d\n", status);
+      return 1;
+    }
+    printf("Published %s as shared memory %s\n", output_path, shm_name);
+  }
+  xnn_deinitialize();
+  return 0;
+}
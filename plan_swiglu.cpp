@@ -0,0 +1,341 @@
+/**
+ * @file plan_swiglu.cpp
+ * @brief Per-projection mixed-precision planning of a SwiGLU stack within an error budget
+ *
+ * Measures every projection of every layer at fp32, qc8 and qb4 weights (see
+ * swiglu_precision.h), picks the fastest types whose estimated error fits in
+ * --budget, then runs the planned stack on held-out rows and compares it with fp32.
+ * If the measured error is over budget, the estimate was optimistic and the plan is
+ * redone with a proportionally tighter budget:
+ *
+ *   ./plan_swiglu --safetensors model.safetensors --dataset rows.bin --budget 0.02 --batch 1 \
+ *       --plan model.plan --output model-mixed.swpk
+ *   ./plan_swiglu --random 4 --dim 1024 --inter-dim 2816 --random-rows 128 --budget 0.01
+ *
+ * Latencies are timed at --batch rows, so plan for the batch size being served:
+ * weight-only quantization pays off most at small batches, where the GEMMs are bound
+ * by reading weights. --plan writes the plan for pack_swiglu_weights --precision;
+ * --output packs the mixed layers directly.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_packed_file.h"
+#include "swiglu_precision.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_io.h"
+
+static const char* const kProjectionNames[3] = {"w1", "w3", "w2"};
+
+// Times a plan is redone with a tighter budget when its measured error is over budget.
+static const int kMaxReplans = 4;
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--budget E] [--block-size K] [--batch B] [--runs R] [--holdout H] [--threads T]\n"
+          "          [--plan FILE] [--output FILE] SOURCE DATASET\n"
+          "sources:\n"
+          "  --safetensors FILE [--layers N] [--key-format FMT] [--w1-name NAME] [--w3-name NAME]\n"
+          "                     [--w2-name NAME]\n"
+          "  --raw W1,W3,W2 --layers N --dim D --inter-dim I\n"
+          "  --random N --dim D --inter-dim I   N random layers (see swiglu_random_layers)\n"
+          "datasets:\n"
+          "  --dataset FILE     raw fp32 rows\n"
+          "  --random-rows R    R uniform random rows in [-1, 1], plus the held-out rows\n",
+          program);
+}
+
+static float relative_error(const float* reference, const float* output, size_t size) {
+  double error = 0.0;
+  double norm = 0.0;
+  for (size_t i = 0; i < size; ++i) {
+    error += (output[i] - reference[i]) * (output[i] - reference[i]);
+    norm += reference[i] * reference[i];
+  }
+  return static_cast<float>(sqrt(error / std::max(norm, 1e-30)));
+}
+
+// Runs rows through layers quantized as plan says.
+static bool run_plan(
+  const std::vector<swiglu_fp32_layer>& layers,
+  const std::vector<swiglu_layer_precision>& plan,
+  size_t block_size,
+  pthreadpool_t threadpool,
+  size_t num_rows,
+  const float* input,
+  float* output)
+{
+  std::vector<swiglu_mixed_layer> mixed_layers;
+  std::vector<swiglu_layer_weights> weights;
+  mixed_layers.reserve(layers.size());
+  for (size_t l = 0; l < layers.size(); ++l) {
+    mixed_layers.push_back(swiglu_quantize_layer_mixed(layers[l], plan[l], block_size));
+    weights.push_back(swiglu_mixed_layer_weights(mixed_layers.back()));
+  }
+  struct swiglu_stack* stack = NULL;
+  if (swiglu_create_stack(weights.size(), weights.data(), threadpool, swiglu_pack_serial, &stack) !=
+        xnn_status_success) {
+    return false;
+  }
+  const bool ok = swiglu_run_stack(stack, num_rows, input, output) == xnn_status_success;
+  swiglu_delete_stack(stack);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  float budget = 0.01f;
+  size_t block_size = 128;
+  size_t batch_size = 1;
+  size_t num_runs = 20;
+  size_t num_holdout = 16;
+  size_t num_threads = 1;
+  const char* plan_path = NULL;
+  const char* output_path = NULL;
+  const char* safetensors_path = NULL;
+  const char* key_format = "model.layers.{layer}.mlp.{proj}.weight";
+  const char* w1_name = "gate_proj";
+  const char* w3_name = "up_proj";
+  const char* w2_name = "down_proj";
+  const char* raw_paths = NULL;
+  size_t num_random_layers = 0;
+  size_t num_layers = 0;
+  size_t dim = 0;
+  size_t inter_dim = 0;
+  const char* dataset_path = NULL;
+  size_t num_random_rows = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--budget") == 0) {
+      budget = strtof(argv[++i], NULL);
+    } else if (has_value && strcmp(argv[i], "--block-size") == 0) {
+      block_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--batch") == 0) {
+      batch_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--runs") == 0) {
+      num_runs = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--holdout") == 0) {
+      num_holdout = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--plan") == 0) {
+      plan_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--output") == 0) {
+      output_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--safetensors") == 0) {
+      safetensors_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--key-format") == 0) {
+      key_format = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w1-name") == 0) {
+      w1_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w3-name") == 0) {
+      w3_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w2-name") == 0) {
+      w2_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--raw") == 0) {
+      raw_paths = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--random") == 0) {
+      num_random_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dataset") == 0) {
+      dataset_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--random-rows") == 0) {
+      num_random_rows = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  const int num_sources = (safetensors_path != NULL) + (raw_paths != NULL) + (num_random_layers != 0);
+  const int num_datasets = (dataset_path != NULL) + (num_random_rows != 0);
+  if (num_sources != 1 || num_datasets != 1 || !(budget > 0.0f) || batch_size == 0 || num_runs == 0 ||
+      num_holdout == 0 || num_threads == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers;
+  if (safetensors_path != NULL) {
+    if (!swiglu_load_safetensors_layers(safetensors_path, key_format, w1_name, w3_name, w2_name,
+                                        num_layers, &fp32_layers)) {
+      return 1;
+    }
+  } else if (raw_paths != NULL) {
+    std::vector<std::string> paths;
+    std::string list = raw_paths;
+    for (size_t start = 0, comma; start <= list.size(); start = comma + 1) {
+      comma = list.find(',', start);
+      if (comma == std::string::npos) {
+        comma = list.size();
+      }
+      paths.push_back(list.substr(start, comma - start));
+    }
+    if (paths.size() != 3 || num_layers == 0 || dim == 0 || inter_dim == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    if (!swiglu_load_raw_layers(paths[0].c_str(), paths[1].c_str(), paths[2].c_str(), num_layers,
+                                dim, inter_dim, dim, &fp32_layers)) {
+      return 1;
+    }
+  } else {
+    if (dim == 0 || inter_dim == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    fp32_layers = swiglu_random_layers(num_random_layers, dim, inter_dim);
+  }
+  if (fp32_layers.empty()) {
+    fprintf(stderr, "no layers loaded\n");
+    return 1;
+  }
+
+  const size_t input_dim = fp32_layers.front().input_dim;
+  std::vector<float> dataset;
+  size_t num_rows = num_random_rows + num_holdout;
+  if (dataset_path != NULL) {
+    FILE* file = fopen(dataset_path, "rb");
+    if (file == NULL) {
+      fprintf(stderr, "failed to open %s\n", dataset_path);
+      return 1;
+    }
+    float value;
+    while (fread(&value, sizeof(float), 1, file) == 1) {
+      dataset.push_back(value);
+    }
+    fclose(file);
+    num_rows = dataset.size() / input_dim;
+    if (num_rows <= num_holdout || dataset.size() % input_dim != 0) {
+      fprintf(stderr, "%s holds %zu values, not a whole number of more than %zu rows of %zu\n", dataset_path,
+              dataset.size(), num_holdout, input_dim);
+      return 1;
+    }
+  } else {
+    dataset.resize(num_rows * input_dim);
+    swiglu_fill_random(dataset.data(), dataset.size(), 1.0f, 1);
+  }
+  const size_t num_calibration_rows = num_rows - num_holdout;
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  dataset.resize(num_rows * input_dim + XNN_EXTRA_BYTES / sizeof(float));
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  const size_t num_plan_layers = fp32_layers.size();
+  std::vector<swiglu_projection_costs> costs(num_plan_layers * 3);
+  if (swiglu_measure_precision_costs(num_plan_layers, fp32_layers.data(), block_size, num_calibration_rows,
+                                     dataset.data(), batch_size, num_runs, threadpool, costs.data()) !=
+        xnn_status_success) {
+    return 1;
+  }
+  printf("Measured %zu layers on %zu rows; latency at batch %zu, error of the layer output:\n", num_plan_layers,
+         num_calibration_rows, batch_size);
+  for (size_t i = 0; i < costs.size(); ++i) {
+    printf("  layer %zu %s", i / 3, kProjectionNames[i % 3]);
+    for (int t = 0; t < SWIGLU_NUM_WEIGHT_TYPES; ++t) {
+      printf("  %s %.3f ms %.2e", swiglu_weight_type_name(static_cast<enum swiglu_weight_type>(t)),
+             costs[i].latency_ms[t], costs[i].error[t]);
+    }
+    printf("\n");
+  }
+
+  // Reference output of the held-out rows.
+  const size_t output_size = num_holdout * fp32_layers.back().output_dim;
+  const float* holdout = &dataset[num_calibration_rows * input_dim];
+  std::vector<float> reference(output_size);
+  std::vector<float> output(output_size);
+  std::vector<swiglu_layer_weights> fp32_weights;
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    fp32_weights.push_back(swiglu_fp32_layer_weights(layer));
+  }
+  struct swiglu_stack* fp32_stack = NULL;
+  if (swiglu_create_stack(fp32_weights.size(), fp32_weights.data(), threadpool, swiglu_pack_serial, &fp32_stack) !=
+        xnn_status_success ||
+      swiglu_run_stack(fp32_stack, num_holdout, holdout, reference.data()) != xnn_status_success) {
+    return 1;
+  }
+  swiglu_delete_stack(fp32_stack);
+
+  const std::vector<swiglu_layer_precision> fp32_plan(
+    num_plan_layers, swiglu_layer_precision{{swiglu_weight_fp32, swiglu_weight_fp32, swiglu_weight_fp32}});
+  const double fp32_latency_ms = swiglu_plan_latency(num_plan_layers, costs.data(), fp32_plan.data());
+  std::vector<swiglu_layer_precision> plan(num_plan_layers);
+  float target = budget;
+  float error = 0.0f;
+  for (int attempt = 0; attempt <= kMaxReplans; ++attempt) {
+    swiglu_plan_precision(num_plan_layers, costs.data(), target, plan.data());
+    if (!run_plan(fp32_layers, plan, block_size, threadpool, num_holdout, holdout, output.data())) {
+      return 1;
+    }
+    error = relative_error(reference.data(), output.data(), output_size);
+    size_t counts[SWIGLU_NUM_WEIGHT_TYPES] = {0};
+    for (const swiglu_layer_precision& layer : plan) {
+      for (int p = 0; p < 3; ++p) {
+        ++counts[layer.type[p]];
+      }
+    }
+    printf("Plan for %.2e: %zu fp32, %zu qc8, %zu qb4 projections, %.3f ms vs %.3f ms fp32; error %.2e "
+           "estimated, %.2e on %zu held-out rows\n", target, counts[swiglu_weight_fp32], counts[swiglu_weight_qc8],
+           counts[swiglu_weight_qb4], swiglu_plan_latency(num_plan_layers, costs.data(), plan.data()), fp32_latency_ms,
+           swiglu_plan_error(num_plan_layers, costs.data(), plan.data()), error, num_holdout);
+    if (error <= budget) {
+      break;
+    }
+    target *= budget / error;
+  }
+  if (error > budget) {
+    fprintf(stderr, "no plan met the budget of %.2e after %d attempts\n", budget, kMaxReplans + 1);
+    return 1;
+  }
+
+  if (plan_path != NULL) {
+    if (!swiglu_save_precision_plan(plan_path, plan.size(), block_size, plan.data())) {
+      return 1;
+    }
+    printf("Wrote the plan to %s\n", plan_path);
+  }
+  if (output_path != NULL) {
+    std::vector<swiglu_mixed_layer> mixed_layers;
+    std::vector<swiglu_layer_weights> mixed_weights;
+    mixed_layers.reserve(fp32_layers.size());
+    for (size_t l = 0; l < fp32_layers.size(); ++l) {
+      mixed_layers.push_back(swiglu_quantize_layer_mixed(fp32_layers[l], plan[l], block_size));
+      mixed_weights.push_back(swiglu_mixed_layer_weights(mixed_layers.back()));
+    }
+    const enum xnn_status status =
+      swiglu_write_packed_file(output_path, mixed_weights.size(), mixed_weights.data(), threadpool);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "swiglu_write_packed_file failed: %d\n", status);
+      return 1;
+    }
+    printf("Packed the mixed layers (%s) into %s\n", swiglu_host_isa(), output_path);
+  }
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file pool_swiglu.cpp
+ * @brief Concurrent clients on one stack against a pool of stacks sharing weights
+ *
+ * Every client thread runs --requests batches of --batch rows. They first share a
+ * pool of one runtime, so they take turns, then a pool of --runtimes runtimes over
+ * the same packed weights, so up to that many run at once:
+ *
+ *   ./pool_swiglu --clients 8 --runtimes 8 --batch 4
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_runtime_pool.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--clients C] [--runtimes M] [--threads-per-runtime T] [--requests R] [--batch B]\n"
+          "          [--layers N] [--dim D] [--inter-dim I]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  size_t num_clients = 8;
+  size_t num_runtimes = 8;
+  size_t threads_per_runtime = 1;
+  size_t num_requests = 100;
+  size_t batch_size = 4;
+  size_t num_layers = 4;
+  size_t dim = 512;
+  size_t inter_dim = 1536;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--clients") == 0) {
+      num_clients = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--runtimes") == 0) {
+      num_runtimes = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads-per-runtime") == 0) {
+      threads_per_runtime = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--requests") == 0) {
+      num_requests = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--batch") == 0) {
+      batch_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_clients == 0 || num_runtimes == 0 || threads_per_runtime == 0 || num_requests == 0 ||
+      batch_size == 0 || num_layers == 0 || dim == 0 || inter_dim == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers = swiglu_random_layers(num_layers, dim, inter_dim);
+  std::vector<swiglu_layer_weights> layers;
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    layers.push_back(swiglu_fp32_layer_weights(layer));
+  }
+
+  printf("clients=%zu requests=%zu batch=%zu layers=%zu dim=%zu inter_dim=%zu\n",
+         num_clients, num_requests, batch_size, num_layers, dim, inter_dim);
+  const size_t pool_sizes[2] = {1, num_runtimes};
+  for (size_t pool_size : pool_sizes) {
+    struct swiglu_runtime_pool* pool = NULL;
+    enum xnn_status status =
+      swiglu_create_runtime_pool(layers.size(), layers.data(), pool_size, threads_per_runtime, &pool);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "swiglu_create_runtime_pool failed: %d\n", status);
+      return 1;
+    }
+
+    std::atomic<size_t> failures(0);
+    std::vector<std::vector<double>> latencies_ms(num_clients);
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (size_t c = 0; c < num_clients; ++c) {
+      clients.emplace_back([&, c] {
+        // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+        std::vector<float> input(batch_size * dim + XNN_EXTRA_BYTES / sizeof(float));
+        std::vector<float> output(batch_size * dim);
+        swiglu_fill_random(input.data(), batch_size * dim, 1.0f, static_cast<uint32_t>(c + 1));
+        for (size_t r = 0; r < num_requests; ++r) {
+          const auto request_start = std::chrono::steady_clock::now();
+          if (swiglu_runtime_pool_run(pool, batch_size, input.data(), output.data()) != xnn_status_success) {
+            failures++;
+          }
+          latencies_ms[c].push_back(elapsed_ms(request_start));
+        }
+      });
+    }
+    for (std::thread& client : clients) {
+      client.join();
+    }
+    const double total_ms = elapsed_ms(start);
+
+    std::vector<double> all_ms;
+    for (const std::vector<double>& client_ms : latencies_ms) {
+      all_ms.insert(all_ms.end(), client_ms.begin(), client_ms.end());
+    }
+    printf("%zu runtime(s), %.1f MiB packed weights: %.0f requests/s, p50 %.2f ms, p99 %.2f ms, %zu failed\n",
+           pool_size, swiglu_runtime_pool_packed_size(pool) / 1048576.0,
+           all_ms.size() / (total_ms / 1000.0), percentile(all_ms, 50.0), percentile(all_ms, 99.0),
+           failures.load());
+    swiglu_delete_runtime_pool(pool);
+  }
+
+  xnn_deinitialize();
+  return 0;
+}
@@ -0,0 +1,189 @@
+/**
+ * @file prefill_swiglu.cpp
+ * @brief Decode step latency while long prompts arrive, with and without chunked prefill
+ *
+ * Keeps --decode sequences decoding at all times and adds a --prompt-rows prompt
+ * every --prompt-every steps. With --chunk 0 each prompt runs at once and stalls
+ * every decoding sequence for the whole prompt; with a chunk size, prompts are
+ * spread over steps that also run the decode rows:
+ *
+ *   ./prefill_swiglu --chunk 0 --prompt-rows 2048
+ *   ./prefill_swiglu --chunk 256 --prompt-rows 2048
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_batcher.h"
+#include "swiglu_bench.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--chunk C] [--decode D] [--prompt-rows P] [--prompt-every S] [--steps N]\n"
+          "          [--threads T] [--layers N] [--dim D] [--inter-dim I]\n",
+          program);
+}
+
+struct prefill_bench {
+  // Submission time of every prompt still waiting for its first output
+  std::map<uint64_t, std::chrono::steady_clock::time_point> prompts;
+  std::vector<double> first_output_ms;
+  size_t finished_decodes = 0;
+};
+
+static void sequence_done(void* context, uint64_t id, enum xnn_status status, const float* output) {
+  (void) output;
+  struct prefill_bench* bench = static_cast<struct prefill_bench*>(context);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "sequence %llu failed: %d\n", static_cast<unsigned long long>(id), status);
+  }
+  auto prompt = bench->prompts.find(id);
+  if (prompt != bench->prompts.end()) {
+    bench->first_output_ms.push_back(
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - prompt->second).count());
+    bench->prompts.erase(prompt);
+  } else {
+    bench->finished_decodes++;
+  }
+}
+
+int main(int argc, char** argv) {
+  size_t chunk_size = 256;
+  size_t num_decode = 16;
+  size_t prompt_rows = 2048;
+  size_t prompt_every = 32;
+  size_t num_steps = 512;
+  size_t num_threads = 1;
+  size_t num_layers = 4;
+  size_t dim = 512;
+  size_t inter_dim = 1536;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--chunk") == 0) {
+      chunk_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--decode") == 0) {
+      num_decode = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--prompt-rows") == 0) {
+      prompt_rows = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--prompt-every") == 0) {
+      prompt_every = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--steps") == 0) {
+      num_steps = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_decode == 0 || prompt_rows == 0 || prompt_every == 0 || num_threads == 0 || num_layers == 0 ||
+      dim == 0 || inter_dim == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers = swiglu_random_layers(num_layers, dim, inter_dim);
+  std::vector<swiglu_layer_weights> layers;
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    layers.push_back(swiglu_fp32_layer_weights(layer));
+  }
+  struct swiglu_stack* stack = NULL;
+  enum xnn_status status = swiglu_create_stack(layers.size(), layers.data(), threadpool, swiglu_pack_serial, &stack);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_create_stack failed: %d\n", status);
+    return 1;
+  }
+
+  // Room for the decode sequences plus the prompts in flight, each of which holds a
+  // decode row for the prompt_rows / chunk_size steps its prefill takes.
+  const size_t prompts_in_flight =
+    chunk_size == 0 ? 1 : (prompt_rows + chunk_size * prompt_every - 1) / (chunk_size * prompt_every) + 1;
+  const size_t max_batch_size = num_decode + prompts_in_flight;
+  struct prefill_bench bench;
+  struct swiglu_batcher* batcher = NULL;
+  status = swiglu_create_batcher(stack, max_batch_size, chunk_size, sequence_done, &bench, &batcher);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_create_batcher failed: %d\n", status);
+    return 1;
+  }
+
+  std::vector<float> row(dim);
+  swiglu_fill_random(row.data(), row.size(), 1.0f, 1);
+  std::vector<float> prompt(prompt_rows * dim);
+  swiglu_fill_random(prompt.data(), prompt.size(), 1.0f, 2);
+  uint64_t next_id = 0;
+  for (size_t i = 0; i < num_decode; ++i) {
+    // Decode sequences outlast the run, so the decode batch stays full.
+    status = swiglu_batcher_add(batcher, next_id++, /*num_prompt_rows=*/1, row.data(), /*num_steps=*/num_steps + 1);
+    if (status != xnn_status_success) {
+      return 1;
+    }
+  }
+
+  std::vector<double> step_ms;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t step = 0; step < num_steps; ++step) {
+    if (step % prompt_every == 0) {
+      bench.prompts[next_id] = std::chrono::steady_clock::now();
+      status = swiglu_batcher_add(batcher, next_id++, prompt_rows, prompt.data(), /*num_steps=*/1);
+      if (status != xnn_status_success) {
+        return 1;
+      }
+    }
+    const auto step_start = std::chrono::steady_clock::now();
+    status = swiglu_batcher_step(batcher);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "swiglu_batcher_step failed: %d\n", status);
+      return 1;
+    }
+    step_ms.push_back(elapsed_ms(step_start));
+  }
+  const double total_ms = elapsed_ms(start);
+
+  const struct swiglu_batcher_stats stats = swiglu_batcher_stats(batcher);
+  printf("chunk=%zu decode=%zu prompt rows=%zu every %zu steps, layers=%zu dim=%zu inter_dim=%zu\n",
+         chunk_size, num_decode, prompt_rows, prompt_every, num_layers, dim, inter_dim);
+  printf("decode step: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+         percentile(step_ms, 50.0), percentile(step_ms, 99.0), percentile(step_ms, 100.0));
+  printf("prompt first output: %zu prompts, p50 %.2f ms, max %.2f ms\n",
+         bench.first_output_ms.size(), percentile(bench.first_output_ms, 50.0),
+         percentile(bench.first_output_ms, 100.0));
+  printf("%.0f decode rows/s, %.0f prompt rows/s, %zu reshapes\n",
+         stats.rows / (total_ms / 1000.0), stats.prefill_rows / (total_ms / 1000.0), stats.reshapes);
+
+  swiglu_delete_batcher(batcher);
+  swiglu_delete_stack(stack);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
@@ -0,0 +1,206 @@
+/**
+ * @file qs8_swiglu.cpp
+ * @brief fp32, dynamically quantized qc8 and static int8 stacks side by side
+ *
+ * Calibrates activation scales for every layer on --calibration-rows random rows
+ * (see swiglu_calibration.h), or loads them from a --scales file written by
+ * calibrate_swiglu for the same random layers, then for every batch size in
+ * --batch-sizes times --runs runs of the fp32 stack, the qc8 stack (int8 weights,
+ * activations quantized per row at run time, fp32 in between) and the static int8
+ * stack, and reports each one's relative error against fp32 on fresh rows:
+ *
+ *   ./qs8_swiglu --layers 4 --dim 2048 --inter-dim 5632 --batch-sizes 1,8,32 --threads 8
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_calibration.h"
+#include "swiglu_qs8.h"
+#include "swiglu_quantize.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--layers N] [--dim D] [--inter-dim I] [--batch-sizes B1,B2,...] [--runs R]\n"
+          "          [--calibration-rows C] [--percentile P] [--scales FILE] [--threads T]\n",
+          program);
+}
+
+static float relative_error(const std::vector<float>& reference, const std::vector<float>& output, size_t size) {
+  double error = 0.0;
+  double norm = 0.0;
+  for (size_t i = 0; i < size; ++i) {
+    error += (output[i] - reference[i]) * (output[i] - reference[i]);
+    norm += reference[i] * reference[i];
+  }
+  return static_cast<float>(sqrt(error / std::max(norm, 1e-30)));
+}
+
+int main(int argc, char** argv) {
+  size_t num_layers = 4;
+  size_t dim = 2048;
+  size_t inter_dim = 5632;
+  std::vector<size_t> batch_sizes = {1, 8, 32};
+  size_t num_runs = 20;
+  size_t calibration_rows = 16;
+  float calibration_percentile = 100.0f;
+  const char* scales_path = NULL;
+  size_t num_threads = 1;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--batch-sizes") == 0) {
+      batch_sizes.clear();
+      for (char* size = strtok(argv[++i], ","); size != NULL; size = strtok(NULL, ",")) {
+        batch_sizes.push_back(strtoul(size, NULL, 10));
+      }
+    } else if (has_value && strcmp(argv[i], "--runs") == 0) {
+      num_runs = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--calibration-rows") == 0) {
+      calibration_rows = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--percentile") == 0) {
+      calibration_percentile = strtof(argv[++i], NULL);
+    } else if (has_value && strcmp(argv[i], "--scales") == 0) {
+      scales_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_layers == 0 || dim == 0 || inter_dim == 0 || batch_sizes.empty() ||
+      std::find(batch_sizes.begin(), batch_sizes.end(), 0u) != batch_sizes.end() || num_runs == 0 ||
+      calibration_rows == 0 || !(calibration_percentile > 0.0f && calibration_percentile <= 100.0f) ||
+      num_threads == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers = swiglu_random_layers(num_layers, dim, inter_dim);
+  std::vector<swiglu_qc8_layer> qc8_layers;
+  std::vector<swiglu_layer_weights> fp32_weights;
+  std::vector<swiglu_layer_weights> qc8_weights;
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    qc8_layers.push_back(swiglu_quantize_layer_qc8(layer));
+    fp32_weights.push_back(swiglu_fp32_layer_weights(layer));
+  }
+  for (const swiglu_qc8_layer& layer : qc8_layers) {
+    qc8_weights.push_back(swiglu_qc8_layer_weights(layer));
+  }
+
+  struct swiglu_stack* fp32_stack = NULL;
+  struct swiglu_stack* qc8_stack = NULL;
+  struct swiglu_qs8_stack* qs8_stack = NULL;
+  if (swiglu_create_stack(num_layers, fp32_weights.data(), threadpool, swiglu_pack_serial, &fp32_stack) !=
+        xnn_status_success ||
+      swiglu_create_stack(num_layers, qc8_weights.data(), threadpool, swiglu_pack_serial, &qc8_stack) !=
+        xnn_status_success) {
+    return 1;
+  }
+
+  std::vector<swiglu_qs8_scales> scales(num_layers);
+  const auto calibration_start = std::chrono::steady_clock::now();
+  if (scales_path != NULL) {
+    if (!swiglu_load_qs8_scales(scales_path, num_layers, scales.data())) {
+      return 1;
+    }
+  } else {
+    // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+    std::vector<float> calibration(calibration_rows * dim + XNN_EXTRA_BYTES / sizeof(float));
+    swiglu_fill_random(calibration.data(), calibration_rows * dim, 1.0f, 1);
+    struct swiglu_calibrator* calibrator = NULL;
+    if (swiglu_create_calibrator(num_layers, fp32_weights.data(), threadpool, &calibrator) != xnn_status_success) {
+      return 1;
+    }
+    const enum xnn_status status = swiglu_calibrator_observe(calibrator, calibration_rows, calibration.data());
+    if (status != xnn_status_success ||
+        swiglu_calibrator_scales(calibrator, calibration_percentile, scales.data()) != xnn_status_success) {
+      return 1;
+    }
+    swiglu_delete_calibrator(calibrator);
+  }
+  if (swiglu_create_qs8_stack(num_layers, qc8_weights.data(), scales.data(), threadpool, &qs8_stack) !=
+        xnn_status_success) {
+    return 1;
+  }
+  if (scales_path != NULL) {
+    printf("layers=%zu dim=%zu inter_dim=%zu threads=%zu; scales from %s\n", num_layers, dim, inter_dim,
+           num_threads, scales_path);
+  } else {
+    printf("layers=%zu dim=%zu inter_dim=%zu threads=%zu; calibrated on %zu rows in %.0f ms\n", num_layers, dim,
+           inter_dim, num_threads, calibration_rows, elapsed_ms(calibration_start));
+  }
+
+  for (size_t batch_size : batch_sizes) {
+    const size_t size = batch_size * dim;
+    std::vector<float> input(size + XNN_EXTRA_BYTES / sizeof(float));
+    swiglu_fill_random(input.data(), size, 1.0f, 2);
+    std::vector<int8_t> qs8_input(size + XNN_EXTRA_BYTES);
+    swiglu_quantize_qs8(input.data(), size, scales.front().input, qs8_input.data());
+    std::vector<float> reference(size);
+    std::vector<float> qc8_output(size);
+    std::vector<int8_t> qs8_output(size);
+    std::vector<double> fp32_ms, qc8_ms, qs8_ms;
+    for (size_t run = 0; run < num_runs; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      if (swiglu_run_stack(fp32_stack, batch_size, input.data(), reference.data()) != xnn_status_success) {
+        return 1;
+      }
+      fp32_ms.push_back(elapsed_ms(start));
+      start = std::chrono::steady_clock::now();
+      if (swiglu_run_stack(qc8_stack, batch_size, input.data(), qc8_output.data()) != xnn_status_success) {
+        return 1;
+      }
+      qc8_ms.push_back(elapsed_ms(start));
+      start = std::chrono::steady_clock::now();
+      if (swiglu_run_qs8_stack(qs8_stack, batch_size, qs8_input.data(), qs8_output.data()) != xnn_status_success) {
+        return 1;
+      }
+      qs8_ms.push_back(elapsed_ms(start));
+    }
+    std::vector<float> qs8_dequantized(size);
+    swiglu_dequantize_qs8(qs8_output.data(), size, scales.back().output, qs8_dequantized.data());
+    printf("batch %zu: fp32 %.3f ms, qc8 %.3f ms (error %.2e), static int8 %.3f ms (error %.2e)\n", batch_size,
+           percentile(fp32_ms, 50.0), percentile(qc8_ms, 50.0), relative_error(reference, qc8_output, size),
+           percentile(qs8_ms, 50.0), relative_error(reference, qs8_dequantized, size));
+  }
+
+  swiglu_delete_qs8_stack(qs8_stack);
+  swiglu_delete_stack(qc8_stack);
+  swiglu_delete_stack(fp32_stack);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
@@ -0,0 +1,295 @@
+/**
+ * @file rope_swiglu.cpp
+ * @brief RoPE as a separate pass against RoPE fused into the KV cache and attention
+ *
+ * Fills --sequences sequences with --context positions of rotated keys, then times
+ * --steps decode steps of one layer's attention from a QKV projection output. The
+ * separate path rotates Q and K in place with swiglu_apply_rope and then appends
+ * and attends; the fused path hands the unrotated projection output to
+ * swiglu_kv_cache_append and swiglu_kv_cache_attention, which rotate as they read.
+ * Both start every step from a fresh copy of the projection output. Then times
+ * causal attention over a --prefill row projection output the same two ways: a
+ * rotation pass before swiglu_flash_attention, or the table handed to it. Finally
+ * checks that a --layers block decoder gives the same last row when it decodes a
+ * prompt one position at a time as when it prefills it:
+ *
+ *   ./rope_swiglu --sequences 8 --context 4096 --prefill 4096 --heads 32 --kv-heads 8 --threads 8
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_attention.h"
+#include "swiglu_bench.h"
+#include "swiglu_decoder.h"
+#include "swiglu_kv_cache.h"
+#include "swiglu_rope.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--sequences S] [--context L] [--prefill P] [--heads H] [--kv-heads K] [--head-dim D]\n"
+          "          [--steps N] [--threads T] [--layers N] [--dim D] [--inter-dim I] [--prompt P]\n",
+          program);
+}
+
+// Runs a decode step for every sequence and returns its time, dropping the new
+// positions again so the next step sees the same context.
+static double run_step(
+  struct swiglu_kv_cache* cache,
+  const struct swiglu_rope_table* rope,
+  bool fused,
+  size_t num_sequences,
+  size_t num_heads,
+  size_t num_kv_heads,
+  size_t head_dim,
+  const std::vector<float>& projection,
+  std::vector<float>& qkv,
+  std::vector<float>& output,
+  pthreadpool_t threadpool)
+{
+  const size_t query_dim = num_heads * head_dim;
+  const size_t qkv_dim = query_dim + 2 * num_kv_heads * head_dim;
+  const auto start = std::chrono::steady_clock::now();
+  std::copy(projection.begin(), projection.end(), qkv.begin());
+  for (size_t s = 0; s < num_sequences; ++s) {
+    float* query = &qkv[s * qkv_dim];
+    float* key = query + query_dim;
+    const float* value = key + num_kv_heads * head_dim;
+    const size_t position = swiglu_kv_cache_length(cache, s);
+    if (!fused) {
+      swiglu_apply_rope(rope, position, /*num_rows=*/1, num_heads, query, qkv_dim);
+      swiglu_apply_rope(rope, position, /*num_rows=*/1, num_kv_heads, key, qkv_dim);
+    }
+    const struct swiglu_rope_table* fused_rope = fused ? rope : NULL;
+    swiglu_kv_cache_append(cache, s, /*num_rows=*/1, key, value, qkv_dim, fused_rope);
+    swiglu_kv_cache_attention(cache, s, /*num_rows=*/1, query, num_heads, fused_rope, &output[s * query_dim],
+                              threadpool);
+  }
+  const double ms = elapsed_ms(start);
+  for (size_t s = 0; s < num_sequences; ++s) {
+    swiglu_kv_cache_truncate(cache, s, swiglu_kv_cache_length(cache, s) - 1);
+  }
+  return ms;
+}
+
+// Times causal attention over a fresh copy of projection, rotated by a pass of its
+// own before attention or by attention itself.
+static double run_prefill(
+  const struct swiglu_rope_table* rope,
+  bool fused,
+  size_t num_rows,
+  size_t num_heads,
+  size_t num_kv_heads,
+  size_t head_dim,
+  const std::vector<float>& projection,
+  std::vector<float>& qkv,
+  std::vector<float>& output,
+  pthreadpool_t threadpool)
+{
+  const size_t query_dim = num_heads * head_dim;
+  const size_t qkv_dim = query_dim + 2 * num_kv_heads * head_dim;
+  const auto start = std::chrono::steady_clock::now();
+  std::copy(projection.begin(), projection.end(), qkv.begin());
+  float* query = qkv.data();
+  float* key = query + query_dim;
+  const float* value = key + num_kv_heads * head_dim;
+  if (!fused) {
+    swiglu_apply_rope(rope, /*first_position=*/0, num_rows, num_heads, query, qkv_dim);
+    swiglu_apply_rope(rope, /*first_position=*/0, num_rows, num_kv_heads, key, qkv_dim);
+  }
+  swiglu_flash_attention(num_rows, num_heads, num_kv_heads, head_dim, query, key, value, qkv_dim, /*causal=*/true,
+                         fused ? rope : NULL, output.data(), threadpool);
+  return elapsed_ms(start);
+}
+
+int main(int argc, char** argv) {
+  size_t num_sequences = 8;
+  size_t context = 4096;
+  size_t prefill = 2048;
+  size_t num_heads = 32;
+  size_t num_kv_heads = 8;
+  size_t head_dim = 128;
+  size_t num_steps = 20;
+  size_t num_threads = 1;
+  size_t num_layers = 2;
+  size_t dim = 1024;
+  size_t inter_dim = 2816;
+  size_t prompt = 64;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--sequences") == 0) {
+      num_sequences = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--context") == 0) {
+      context = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--prefill") == 0) {
+      prefill = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--heads") == 0) {
+      num_heads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--kv-heads") == 0) {
+      num_kv_heads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--head-dim") == 0) {
+      head_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--steps") == 0) {
+      num_steps = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--prompt") == 0) {
+      prompt = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_sequences == 0 || context == 0 || prefill == 0 || num_kv_heads == 0 || num_heads % num_kv_heads != 0 ||
+      head_dim == 0 || head_dim % 2 != 0 || num_steps == 0 || num_threads == 0 || num_layers == 0 ||
+      dim % num_heads != 0 || (dim / num_heads) % 2 != 0 || inter_dim == 0 || prompt == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  struct swiglu_rope_table* rope = NULL;
+  struct swiglu_kv_cache* cache = NULL;
+  if (swiglu_create_rope_table(context + 1, head_dim, /*theta=*/10000.0f, &rope) != xnn_status_success ||
+      swiglu_create_kv_cache(num_sequences, context + 1, num_kv_heads, head_dim, swiglu_kv_fp32,
+                             /*block_size=*/head_dim, &cache) != xnn_status_success) {
+    return 1;
+  }
+  const size_t kv_dim = num_kv_heads * head_dim;
+  const size_t query_dim = num_heads * head_dim;
+  const size_t qkv_dim = query_dim + 2 * kv_dim;
+  std::vector<float> keys(context * kv_dim);
+  std::vector<float> values(context * kv_dim);
+  for (size_t s = 0; s < num_sequences; ++s) {
+    swiglu_fill_random(keys.data(), keys.size(), 1.0f, static_cast<uint32_t>(2 * s + 2));
+    swiglu_fill_random(values.data(), values.size(), 1.0f, static_cast<uint32_t>(2 * s + 3));
+    swiglu_kv_cache_append(cache, s, context, keys.data(), values.data(), kv_dim, rope);
+  }
+
+  printf("sequences=%zu context=%zu heads=%zu kv_heads=%zu head_dim=%zu threads=%zu\n",
+         num_sequences, context, num_heads, num_kv_heads, head_dim, num_threads);
+  std::vector<float> projection(num_sequences * qkv_dim);
+  swiglu_fill_random(projection.data(), projection.size(), 1.0f, 1);
+  std::vector<float> qkv(projection.size());
+  std::vector<float> outputs[2] = {std::vector<float>(num_sequences * query_dim),
+                                   std::vector<float>(num_sequences * query_dim)};
+  const char* names[2] = {"separate", "fused"};
+  for (size_t f = 0; f < 2; ++f) {
+    std::vector<double> step_ms;
+    for (size_t step = 0; step < num_steps; ++step) {
+      step_ms.push_back(run_step(cache, rope, f == 1, num_sequences, num_heads, num_kv_heads, head_dim, projection,
+                                 qkv, outputs[f], threadpool));
+    }
+    printf("%-8s step p50 %.3f ms, p99 %.3f ms\n", names[f], percentile(step_ms, 50.0), percentile(step_ms, 99.0));
+  }
+  float max_error = 0.0f;
+  for (size_t i = 0; i < outputs[0].size(); ++i) {
+    max_error = std::max(max_error, fabsf(outputs[0][i] - outputs[1][i]));
+  }
+  printf("max abs difference %.2e\n", max_error);
+  swiglu_delete_kv_cache(cache);
+  swiglu_delete_rope_table(rope);
+
+  if (swiglu_create_rope_table(prefill, head_dim, /*theta=*/10000.0f, &rope) != xnn_status_success) {
+    return 1;
+  }
+  std::vector<float> prefill_projection(prefill * qkv_dim);
+  swiglu_fill_random(prefill_projection.data(), prefill_projection.size(), 1.0f, 5);
+  std::vector<float> prefill_qkv(prefill_projection.size());
+  std::vector<float> prefill_outputs[2] = {std::vector<float>(prefill * query_dim),
+                                           std::vector<float>(prefill * query_dim)};
+  for (size_t f = 0; f < 2; ++f) {
+    std::vector<double> prefill_ms;
+    for (size_t run = 0; run < 3; ++run) {
+      prefill_ms.push_back(run_prefill(rope, f == 1, prefill, num_heads, num_kv_heads, head_dim, prefill_projection,
+                                       prefill_qkv, prefill_outputs[f], threadpool));
+    }
+    printf("%-8s prefill of %zu rows p50 %.2f ms\n", names[f], prefill, percentile(prefill_ms, 50.0));
+  }
+  max_error = 0.0f;
+  for (size_t i = 0; i < prefill_outputs[0].size(); ++i) {
+    max_error = std::max(max_error, fabsf(prefill_outputs[0][i] - prefill_outputs[1][i]));
+  }
+  printf("max abs difference %.2e\n", max_error);
+  swiglu_delete_rope_table(rope);
+
+  std::vector<swiglu_fp32_decoder_layer> fp32_layers =
+    swiglu_random_decoder_layers(num_layers, dim, inter_dim, num_heads, num_kv_heads);
+  std::vector<swiglu_decoder_weights> layers;
+  for (const swiglu_fp32_decoder_layer& layer : fp32_layers) {
+    layers.push_back(swiglu_fp32_decoder_weights(layer));
+  }
+  const size_t decoder_head_dim = dim / num_heads;
+  struct swiglu_decoder* decoder = NULL;
+  if (swiglu_create_rope_table(prompt, decoder_head_dim, /*theta=*/10000.0f, &rope) != xnn_status_success ||
+      swiglu_create_decoder(layers.size(), layers.data(), rope, threadpool, &decoder) != xnn_status_success) {
+    return 1;
+  }
+  std::vector<struct swiglu_kv_cache*> caches(num_layers);
+  for (struct swiglu_kv_cache*& layer_cache : caches) {
+    if (swiglu_create_kv_cache(/*num_sequences=*/1, prompt, num_kv_heads, decoder_head_dim, swiglu_kv_fp32,
+                               /*block_size=*/decoder_head_dim, &layer_cache) != xnn_status_success) {
+      return 1;
+    }
+  }
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  std::vector<float> input(prompt * dim + XNN_EXTRA_BYTES / sizeof(float));
+  swiglu_fill_random(input.data(), prompt * dim, 1.0f, 4);
+  std::vector<float> prefill_output(prompt * dim);
+  std::vector<float> step_output(dim);
+  if (swiglu_run_decoder_prefill(decoder, prompt, input.data(), prefill_output.data()) != xnn_status_success) {
+    return 1;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t p = 0; p < prompt; ++p) {
+    if (swiglu_run_decoder_step(decoder, caches.data(), /*sequence=*/0, /*num_rows=*/1, &input[p * dim],
+                                step_output.data()) != xnn_status_success) {
+      return 1;
+    }
+  }
+  const double decode_ms = elapsed_ms(start);
+  float max_decoder_error = 0.0f;
+  for (size_t d = 0; d < dim; ++d) {
+    max_decoder_error = std::max(max_decoder_error, fabsf(step_output[d] - prefill_output[(prompt - 1) * dim + d]));
+  }
+  printf("decoder layers=%zu dim=%zu: %zu decode steps %.2f ms, last row max abs difference from prefill %.2e\n",
+         num_layers, dim, prompt, decode_ms, max_decoder_error);
+
+  for (struct swiglu_kv_cache* layer_cache : caches) {
+    swiglu_delete_kv_cache(layer_cache);
+  }
+  swiglu_delete_decoder(decoder);
+  swiglu_delete_rope_table(rope);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
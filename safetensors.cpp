@@ -0,0 +1,419 @@
+/**
+ * @file safetensors.cpp
+ * @brief Minimal read-only safetensors loader
+ *
+ * The format is an 8-byte little-endian header length, a JSON object mapping tensor
+ * names to {"dtype", "shape", "data_offsets"} (plus an optional "__metadata__"
+ * entry), and then the raw tensor data.
+ */
+#include "safetensors.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Just enough of a JSON parser for safetensors headers.
+struct json_parser {
+  const char* p;
+  const char* end;
+
+  void skip_whitespace() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+      ++p;
+    }
+  }
+
+  bool expect(char c) {
+    skip_whitespace();
+    if (p >= end || *p != c) {
+      return false;
+    }
+    ++p;
+    return true;
+  }
+
+  bool peek(char c) {
+    skip_whitespace();
+    return p < end && *p == c;
+  }
+
+  bool parse_string(std::string* out) {
+    if (!expect('"')) {
+      return false;
+    }
+    out->clear();
+    while (p < end && *p != '"') {
+      char c = *p++;
+      if (c == '\\') {
+        if (p >= end) {
+          return false;
+        }
+        c = *p++;
+        switch (c) {
+          case 'b': c = '\b'; break;
+          case 'f': c = '\f'; break;
+          case 'n': c = '\n'; break;
+          case 'r': c = '\r'; break;
+          case 't': c = '\t'; break;
+          case 'u': {
+            if (end - p < 4) {
+              return false;
+            }
+            unsigned code = 0;
+            for (int i = 0; i < 4; ++i) {
+              const char h = *p++;
+              code <<= 4;
+              if (h >= '0' && h <= '9') code |= h - '0';
+              else if (h >= 'a' && h <= 'f') code |= h - 'a' + 10;
+              else if (h >= 'A' && h <= 'F') code |= h - 'A' + 10;
+              else return false;
+            }
+            // Encode the code unit as UTF-8; surrogate pairs are passed through as-is.
+            if (code < 0x80) {
+              out->push_back(static_cast<char>(code));
+            } else if (code < 0x800) {
+              out->push_back(static_cast<char>(0xC0 | (code >> 6)));
+              out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+            } else {
+              out->push_back(static_cast<char>(0xE0 | (code >> 12)));
+              out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+              out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+            }
+            continue;
+          }
+          default: break;  // '"', '\\' and '/' stand for themselves
+        }
+      }
+      out->push_back(c);
+    }
+    return expect('"');
+  }
+
+  bool parse_uint(uint64_t* out) {
+    skip_whitespace();
+    if (p >= end || *p < '0' || *p > '9') {
+      return false;
+    }
+    uint64_t value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+      value = value * 10 + static_cast<uint64_t>(*p++ - '0');
+    }
+    *out = value;
+    return true;
+  }
+
+  bool parse_uint_array(std::vector<uint64_t>* out) {
+    out->clear();
+    if (!expect('[')) {
+      return false;
+    }
+    if (peek(']')) {
+      return expect(']');
+    }
+    do {
+      uint64_t value;
+      if (!parse_uint(&value)) {
+        return false;
+      }
+      out->push_back(value);
+    } while (expect(','));
+    return expect(']');
+  }
+
+  // Skips any JSON value.
+  bool skip_value() {
+    skip_whitespace();
+    if (p >= end) {
+      return false;
+    }
+    if (*p == '"') {
+      std::string ignored;
+      return parse_string(&ignored);
+    }
+    if (*p == '{' || *p == '[') {
+      const char close = *p == '{' ? '}' : ']';
+      const bool is_object = *p == '{';
+      ++p;
+      if (peek(close)) {
+        return expect(close);
+      }
+      do {
+        if (is_object) {
+          std::string key;
+          if (!parse_string(&key) || !expect(':')) {
+            return false;
+          }
+        }
+        if (!skip_value()) {
+          return false;
+        }
+      } while (expect(','));
+      return expect(close);
+    }
+    // Number, true, false or null
+    while (p < end && *p != ',' && *p != '}' && *p != ']' &&
+           *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+      ++p;
+    }
+    return true;
+  }
+
+  bool parse_tensor(safetensors_tensor* tensor) {
+    if (!expect('{')) {
+      return false;
+    }
+    bool has_offsets = false;
+    if (!peek('}')) {
+      do {
+        std::string key;
+        if (!parse_string(&key) || !expect(':')) {
+          return false;
+        }
+        if (key == "dtype") {
+          if (!parse_string(&tensor->dtype)) {
+            return false;
+          }
+        } else if (key == "shape") {
+          std::vector<uint64_t> shape;
+          if (!parse_uint_array(&shape)) {
+            return false;
+          }
+          tensor->shape.assign(shape.begin(), shape.end());
+        } else if (key == "data_offsets") {
+          std::vector<uint64_t> offsets;
+          if (!parse_uint_array(&offsets) || offsets.size() != 2) {
+            return false;
+          }
+          tensor->begin = offsets[0];
+          tensor->end = offsets[1];
+          has_offsets = true;
+        } else if (!skip_value()) {
+          return false;
+        }
+      } while (expect(','));
+    }
+    return expect('}') && has_offsets && !tensor->dtype.empty();
+  }
+};
+
+float fp16_to_fp32(uint16_t h) {
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1F;
+  uint32_t mantissa = h & 0x3FF;
+  uint32_t bits;
+  if (exponent == 0x1F) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    bits = sign;
+  } else {
+    // Subnormal: normalize the mantissa.
+    exponent = 113;
+    while ((mantissa & 0x400) == 0) {
+      mantissa <<= 1;
+      --exponent;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+  }
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+float bf16_to_fp32(uint16_t h) {
+  const uint32_t bits = static_cast<uint32_t>(h) << 16;
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+bool safetensors_open(const char* path, struct safetensors_file* file) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "failed to open %s\n", path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 8) {
+    fprintf(stderr, "%s is not a safetensors file\n", path);
+    close(fd);
+    return false;
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+  void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "failed to map %s\n", path);
+    return false;
+  }
+  file->mapping = mapping;
+  file->mapping_size = size;
+
+  const uint8_t* bytes = static_cast<const uint8_t*>(mapping);
+  uint64_t header_size = 0;
+  for (int i = 7; i >= 0; --i) {
+    header_size = (header_size << 8) | bytes[i];
+  }
+  if (header_size > size - 8) {
+    fprintf(stderr, "%s has a truncated safetensors header\n", path);
+    safetensors_close(file);
+    return false;
+  }
+  file->data = bytes + 8 + header_size;
+  file->data_size = size - 8 - header_size;
+
+  json_parser parser = {reinterpret_cast<const char*>(bytes + 8),
+                        reinterpret_cast<const char*>(bytes + 8 + header_size)};
+  bool ok = parser.expect('{');
+  if (ok && !parser.peek('}')) {
+    do {
+      std::string name;
+      if (!parser.parse_string(&name) || !parser.expect(':')) {
+        ok = false;
+        break;
+      }
+      if (name == "__metadata__") {
+        ok = parser.skip_value();
+      } else {
+        safetensors_tensor tensor;
+        ok = parser.parse_tensor(&tensor) && tensor.begin <= tensor.end && tensor.end <= file->data_size;
+        if (ok) {
+          file->tensors[name] = tensor;
+        }
+      }
+    } while (ok && parser.expect(','));
+  }
+  if (!ok || !parser.expect('}')) {
+    fprintf(stderr, "%s has a malformed safetensors header\n", path);
+    safetensors_close(file);
+    return false;
+  }
+  return true;
+}
+
+// Converts an F32, F16 or BF16 tensor of count values to fp32.
+static bool read_fp32(
+  const struct safetensors_file* file,
+  const std::string& name,
+  const safetensors_tensor& tensor,
+  size_t count,
+  std::vector<float>* data)
+{
+  const size_t element_size = tensor.dtype == "F32" ? 4 : 2;
+  if (tensor.dtype != "F32" && tensor.dtype != "F16" && tensor.dtype != "BF16") {
+    fprintf(stderr, "tensor %s has unsupported dtype %s\n", name.c_str(), tensor.dtype.c_str());
+    return false;
+  }
+  if (tensor.end - tensor.begin != count * element_size) {
+    fprintf(stderr, "tensor %s has %llu bytes, expected %zu\n", name.c_str(),
+            static_cast<unsigned long long>(tensor.end - tensor.begin), count * element_size);
+    return false;
+  }
+
+  const uint8_t* src = file->data + tensor.begin;
+  data->resize(count);
+  if (tensor.dtype == "F32") {
+    memcpy(data->data(), src, count * sizeof(float));
+  } else {
+    for (size_t i = 0; i < count; ++i) {
+      uint16_t h;
+      memcpy(&h, src + 2 * i, sizeof(h));
+      (*data)[i] = tensor.dtype == "F16" ? fp16_to_fp32(h) : bf16_to_fp32(h);
+    }
+  }
+  return true;
+}
+
+static const safetensors_tensor* find_matrix(const struct safetensors_file* file, const std::string& name) {
+  auto it = file->tensors.find(name);
+  if (it == file->tensors.end()) {
+    fprintf(stderr, "tensor %s not found\n", name.c_str());
+    return NULL;
+  }
+  if (it->second.shape.size() != 2) {
+    fprintf(stderr, "tensor %s has %zu dims, expected 2\n", name.c_str(), it->second.shape.size());
+    return NULL;
+  }
+  return &it->second;
+}
+
+bool safetensors_read_matrix(
+  const struct safetensors_file* file,
+  const std::string& name,
+  std::vector<float>* data,
+  size_t* rows,
+  size_t* cols)
+{
+  const safetensors_tensor* tensor = find_matrix(file, name);
+  if (tensor == NULL || !read_fp32(file, name, *tensor, tensor->shape[0] * tensor->shape[1], data)) {
+    return false;
+  }
+  *rows = tensor->shape[0];
+  *cols = tensor->shape[1];
+  return true;
+}
+
+bool safetensors_read_values(
+  const struct safetensors_file* file,
+  const std::string& name,
+  std::vector<float>* data)
+{
+  auto it = file->tensors.find(name);
+  if (it == file->tensors.end()) {
+    fprintf(stderr, "tensor %s not found\n", name.c_str());
+    return false;
+  }
+  size_t count = 1;
+  for (size_t dim : it->second.shape) {
+    count *= dim;
+  }
+  return read_fp32(file, name, it->second, count, data);
+}
+
+bool safetensors_read_fp8_matrix(
+  const struct safetensors_file* file,
+  const std::string& name,
+  std::string* dtype,
+  std::vector<uint8_t>* data,
+  size_t* rows,
+  size_t* cols)
+{
+  const safetensors_tensor* tensor = find_matrix(file, name);
+  if (tensor == NULL) {
+    return false;
+  }
+  const size_t count = tensor->shape[0] * tensor->shape[1];
+  if (tensor->dtype != "F8_E4M3" && tensor->dtype != "F8_E5M2") {
+    fprintf(stderr, "tensor %s has dtype %s, expected F8_E4M3 or F8_E5M2\n", name.c_str(), tensor->dtype.c_str());
+    return false;
+  }
+  if (tensor->end - tensor->begin != count) {
+    fprintf(stderr, "tensor %s has %llu bytes, expected %zu\n", name.c_str(),
+            static_cast<unsigned long long>(tensor->end - tensor->begin), count);
+    return false;
+  }
+  data->assign(file->data + tensor->begin, file->data + tensor->end);
+  *dtype = tensor->dtype;
+  *rows = tensor->shape[0];
+  *cols = tensor->shape[1];
+  return true;
+}
+
+void safetensors_close(struct safetensors_file* file) {
+  if (file->mapping != NULL) {
+    munmap(file->mapping, file->mapping_size);
+  }
+  file->mapping = NULL;
+  file->mapping_size = 0;
+  file->data = NULL;
+  file->data_size = 0;
+  file->tensors.clear();
+}
@@ -0,0 +1,68 @@
+/**
+ * @file safetensors.h
+ * @brief Minimal read-only safetensors loader
+ *
+ * Parses the JSON header of a .safetensors file and maps the tensor data so that
+ * individual F32, F16 and BF16 tensors can be read as fp32, and F8_E4M3 and F8_E5M2
+ * tensors as their raw bytes.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+struct safetensors_tensor {
+  std::string dtype;
+  std::vector<size_t> shape;
+  // Byte range of the tensor within the data section
+  uint64_t begin;
+  uint64_t end;
+};
+
+struct safetensors_file {
+  void* mapping = NULL;
+  size_t mapping_size = 0;
+  // Start of the data section that tensor offsets are relative to
+  const uint8_t* data = NULL;
+  size_t data_size = 0;
+  std::map<std::string, safetensors_tensor> tensors;
+};
+
+bool safetensors_open(const char* path, struct safetensors_file* file);
+
+/**
+ * @brief Reads a 2-D F32, F16 or BF16 tensor as row-major fp32
+ *
+ * Fails (with a message on stderr) if the tensor is missing, is not 2-D or has an
+ * unsupported dtype.
+ */
+bool safetensors_read_matrix(
+  const struct safetensors_file* file,
+  const std::string& name,
+  std::vector<float>* data,
+  size_t* rows,
+  size_t* cols);
+
+// Reads an F32, F16 or BF16 tensor of any shape, such as a scale, as flat fp32.
+bool safetensors_read_values(
+  const struct safetensors_file* file,
+  const std::string& name,
+  std::vector<float>* data);
+
+/**
+ * @brief Reads a 2-D F8_E4M3 or F8_E5M2 tensor as its row-major bytes
+ *
+ * dtype receives the tensor's dtype; the bytes are not converted.
+ */
+bool safetensors_read_fp8_matrix(
+  const struct safetensors_file* file,
+  const std::string& name,
+  std::string* dtype,
+  std::vector<uint8_t>* data,
+  size_t* rows,
+  size_t* cols);
+
+void safetensors_close(struct safetensors_file* file);
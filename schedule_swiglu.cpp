@@ -0,0 +1,186 @@
+/**
+ * @file schedule_swiglu.cpp
+ * @brief Interactive latency under bulk load, with and without priority scheduling
+ *
+ * One thread keeps a large bulk job in flight at all times while another submits a
+ * batch-1 interactive job at a fixed interval, on --threads threads in all. With
+ * --mode slices, interactive jobs have their own class on a slice of
+ * --interactive-threads threads and bulk jobs run on the rest. With --mode priority,
+ * both classes share every thread and interactive jobs preempt bulk jobs between
+ * layers. With --mode fifo, both share one class and interactive jobs wait for the
+ * bulk job ahead of them:
+ *
+ *   ./schedule_swiglu --mode slices --bulk-batch 2048 --threads 8 --interactive-threads 2
+ *   ./schedule_swiglu --mode priority --bulk-batch 2048 --threads 8
+ *   ./schedule_swiglu --mode fifo --bulk-batch 2048 --threads 8
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_scheduler.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--mode slices|priority|fifo] [--layers N] [--dim D] [--inter-dim I] [--bulk-batch B]\n"
+          "          [--threads T] [--interactive-threads T] [--interval-ms MS] [--duration-ms MS]\n"
+          "          [--interactive-deadline-ms MS] [--bulk-deadline-ms MS]\n",
+          program);
+}
+
+enum schedule_mode {
+  // Interactive and bulk classes on separate slices
+  schedule_slices,
+  // Interactive and bulk classes on one slice, with preemption
+  schedule_priority,
+  // One class for both
+  schedule_fifo,
+};
+
+int main(int argc, char** argv) {
+  enum schedule_mode mode = schedule_slices;
+  size_t num_layers = 8;
+  size_t dim = 512;
+  size_t inter_dim = 1536;
+  size_t bulk_batch_size = 512;
+  size_t num_threads = 4;
+  size_t interactive_threads = 1;
+  double interval_ms = 5.0;
+  double duration_ms = 2000.0;
+  double interactive_deadline_ms = 10.0;
+  double bulk_deadline_ms = 1000.0;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--mode") == 0) {
+      const char* name = argv[++i];
+      if (strcmp(name, "slices") == 0) {
+        mode = schedule_slices;
+      } else if (strcmp(name, "priority") == 0) {
+        mode = schedule_priority;
+      } else if (strcmp(name, "fifo") == 0) {
+        mode = schedule_fifo;
+      } else {
+        print_usage(argv[0]);
+        return 1;
+      }
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--bulk-batch") == 0) {
+      bulk_batch_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--interactive-threads") == 0) {
+      interactive_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--interval-ms") == 0) {
+      interval_ms = strtod(argv[++i], NULL);
+    } else if (has_value && strcmp(argv[i], "--duration-ms") == 0) {
+      duration_ms = strtod(argv[++i], NULL);
+    } else if (has_value && strcmp(argv[i], "--interactive-deadline-ms") == 0) {
+      interactive_deadline_ms = strtod(argv[++i], NULL);
+    } else if (has_value && strcmp(argv[i], "--bulk-deadline-ms") == 0) {
+      bulk_deadline_ms = strtod(argv[++i], NULL);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_layers == 0 || dim == 0 || inter_dim == 0 || bulk_batch_size == 0 || num_threads == 0 ||
+      (mode == schedule_slices && (interactive_threads == 0 || interactive_threads >= num_threads))) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers = swiglu_random_layers(num_layers, dim, inter_dim);
+  std::vector<swiglu_layer_weights> layers;
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    layers.push_back(swiglu_fp32_layer_weights(layer));
+  }
+
+  // In fifo mode both workloads share the bulk class, which becomes class 0.
+  const bool priority = mode != schedule_fifo;
+  const struct swiglu_scheduler_class_config classes[2] = {
+    {"interactive", interactive_deadline_ms, mode == schedule_slices ? interactive_threads : num_threads},
+    {"bulk", bulk_deadline_ms,
+     mode == schedule_slices ? num_threads - interactive_threads : mode == schedule_fifo ? num_threads : 0},
+  };
+  const size_t interactive_class = 0;
+  const size_t bulk_class = priority ? 1 : 0;
+  struct swiglu_scheduler* scheduler = NULL;
+  enum xnn_status status = swiglu_create_scheduler(
+    layers.size(), layers.data(), priority ? 2 : 1, priority ? classes : &classes[1], &scheduler);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_create_scheduler failed: %d\n", status);
+    return 1;
+  }
+
+  std::atomic<bool> done(false);
+  std::atomic<size_t> bulk_rows(0);
+  std::thread bulk([&] {
+    std::vector<float> input(bulk_batch_size * dim);
+    std::vector<float> output(bulk_batch_size * dim);
+    swiglu_fill_random(input.data(), input.size(), 1.0f, 1);
+    while (!done.load()) {
+      if (swiglu_scheduler_run(scheduler, bulk_class, bulk_batch_size, input.data(), output.data()) ==
+          xnn_status_success) {
+        bulk_rows += bulk_batch_size;
+      }
+    }
+  });
+
+  std::vector<double> latencies_ms;
+  std::vector<float> input(dim);
+  std::vector<float> output(dim);
+  swiglu_fill_random(input.data(), input.size(), 1.0f, 2);
+  const auto start = std::chrono::steady_clock::now();
+  auto next = start;
+  while (elapsed_ms(start) < duration_ms) {
+    std::this_thread::sleep_until(next);
+    next += std::chrono::microseconds(static_cast<int64_t>(interval_ms * 1000.0));
+    const auto request_start = std::chrono::steady_clock::now();
+    status = swiglu_scheduler_run(scheduler, interactive_class, 1, input.data(), output.data());
+    if (status != xnn_status_success) {
+      fprintf(stderr, "interactive job failed: %d\n", status);
+      break;
+    }
+    latencies_ms.push_back(elapsed_ms(request_start));
+  }
+  done.store(true);
+  bulk.join();
+  const double total_ms = elapsed_ms(start);
+
+  static const char* const mode_names[] = {"slices", "priority", "fifo"};
+  printf("mode=%s layers=%zu dim=%zu inter_dim=%zu bulk batch=%zu threads=%zu\n",
+         mode_names[mode], num_layers, dim, inter_dim, bulk_batch_size, num_threads);
+  printf("interactive: %zu jobs, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+         latencies_ms.size(), percentile(latencies_ms, 50.0), percentile(latencies_ms, 99.0),
+         percentile(latencies_ms, 100.0));
+  printf("bulk: %.0f rows/s\n", bulk_rows.load() / (total_ms / 1000.0));
+  for (size_t c = 0; c < (priority ? 2u : 1u); ++c) {
+    const struct swiglu_scheduler_class_stats stats = swiglu_scheduler_stats(scheduler, c);
+    printf("class %s: %zu completed, %zu failed, %zu deadline misses, %zu preemptions\n",
+           priority ? classes[c].name : "shared", stats.completed, stats.failed, stats.deadline_misses,
+           stats.preemptions);
+  }
+
+  swiglu_delete_scheduler(scheduler);
+  xnn_deinitialize();
+  return 0;
+}
@@ -0,0 +1,469 @@
+/**
+ * @file serve_swiglu.cpp
+ * @brief Local Unix-socket server running a SwiGLU stack with continuous batching
+ *
+ * Clients send sequences (a row and a number of steps). The server admits them into
+ * the running batch at every step and answers each one as soon as it finishes (see
+ * swiglu_batcher.h). The same binary also generates client load:
+ *
+ *   ./serve_swiglu --socket /tmp/swiglu.sock --max-batch 32 --threads 8 &
+ *   ./serve_swiglu --client --socket /tmp/swiglu.sock --connections 16 --sequences 100 --verify
+ *
+ * Client and server must be given the same --layers, --dim and --inter-dim for
+ * --verify, which recomputes every sequence locally at batch size 1.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_batcher.h"
+#include "swiglu_bench.h"
+#include "swiglu_packed_file.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_io.h"
+
+#define SWIGLU_REQUEST_MAGIC 0x51525753   // "SWRQ"
+#define SWIGLU_RESPONSE_MAGIC 0x53525753  // "SWRS"
+
+// Followed by dim floats.
+struct request_header {
+  uint32_t magic;
+  uint32_t num_steps;
+  uint64_t id;
+  uint32_t dim;
+  uint32_t reserved;
+};
+
+// Followed by dim floats, none if status is an error.
+struct response_header {
+  uint32_t magic;
+  int32_t status;
+  uint64_t id;
+  uint32_t dim;
+  uint32_t reserved;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signal) {
+  (void) signal;
+  stop_requested = 1;
+}
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s --socket PATH [--max-batch B] [--threads T] [--packed FILE]\n"
+          "          [--layers N] [--dim D] [--inter-dim I]\n"
+          "       %s --client --socket PATH [--connections C] [--sequences S] [--max-steps M] [--verify]\n"
+          "          [--layers N] [--dim D] [--inter-dim I]\n",
+          program, program);
+}
+
+struct connection {
+  int fd;
+  std::vector<uint8_t> in;
+  std::vector<uint8_t> out;
+};
+
+struct server {
+  struct swiglu_batcher* batcher;
+  size_t dim;
+  std::map<uint64_t, connection> connections;
+  // Connection and client id of every sequence in the batcher, by batcher id
+  std::map<uint64_t, std::pair<uint64_t, uint64_t>> sequences;
+  uint64_t next_connection = 0;
+  uint64_t next_sequence = 0;
+};
+
+static void append(std::vector<uint8_t>& buffer, const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+static void sequence_done(void* context, uint64_t id, enum xnn_status status, const float* output) {
+  struct server* server = static_cast<struct server*>(context);
+  auto sequence = server->sequences.find(id);
+  auto conn = server->connections.find(sequence->second.first);
+  if (conn != server->connections.end()) {
+    const bool ok = status == xnn_status_success;
+    struct response_header header = {
+      SWIGLU_RESPONSE_MAGIC, status, sequence->second.second, ok ? static_cast<uint32_t>(server->dim) : 0, 0};
+    append(conn->second.out, &header, sizeof(header));
+    if (ok) {
+      append(conn->second.out, output, server->dim * sizeof(float));
+    }
+  }
+  server->sequences.erase(sequence);
+}
+
+// Queues every complete request in conn's input. Returns false on a malformed one.
+static bool parse_requests(struct server* server, uint64_t conn_id, connection& conn) {
+  size_t pos = 0;
+  while (conn.in.size() - pos >= sizeof(struct request_header)) {
+    struct request_header header;
+    memcpy(&header, conn.in.data() + pos, sizeof(header));
+    if (header.magic != SWIGLU_REQUEST_MAGIC || header.dim != server->dim) {
+      fprintf(stderr, "dropping connection: bad request header or dim %u instead of %zu\n", header.dim, server->dim);
+      return false;
+    }
+    const size_t size = sizeof(header) + server->dim * sizeof(float);
+    if (conn.in.size() - pos < size) {
+      break;
+    }
+    std::vector<float> input(server->dim);
+    memcpy(input.data(), conn.in.data() + pos + sizeof(header), server->dim * sizeof(float));
+    const uint64_t id = server->next_sequence++;
+    server->sequences[id] = std::make_pair(conn_id, header.id);
+    if (swiglu_batcher_add(server->batcher, id, /*num_prompt_rows=*/1, input.data(), header.num_steps) !=
+        xnn_status_success) {
+      server->sequences.erase(id);
+      return false;
+    }
+    pos += size;
+  }
+  conn.in.erase(conn.in.begin(), conn.in.begin() + pos);
+  return true;
+}
+
+static int run_server(const char* socket_path, struct swiglu_stack* stack, size_t max_batch_size) {
+  struct server server;
+  server.dim = swiglu_stack_input_dim(stack);
+  enum xnn_status status = swiglu_create_batcher(
+    stack, max_batch_size, /*prefill_chunk_size=*/0, sequence_done, &server, &server.batcher);
+  if (status != xnn_status_success) {
+    return 1;
+  }
+
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  unlink(socket_path);
+  if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "failed to listen on %s: %s\n", socket_path, strerror(errno));
+    return 1;
+  }
+  printf("listening on %s (dim %zu, max batch %zu)\n", socket_path, server.dim, max_batch_size);
+  fflush(stdout);
+
+  std::vector<uint8_t> buffer(1 << 16);
+  while (!stop_requested) {
+    std::vector<struct pollfd> fds = {{listen_fd, POLLIN, 0}};
+    std::vector<uint64_t> fd_connections = {0};
+    for (const auto& entry : server.connections) {
+      fds.push_back({entry.second.fd, static_cast<short>(POLLIN | (entry.second.out.empty() ? 0 : POLLOUT)), 0});
+      fd_connections.push_back(entry.first);
+    }
+    // Keep stepping while there is work; block only when idle.
+    if (poll(fds.data(), fds.size(), swiglu_batcher_idle(server.batcher) ? -1 : 0) < 0 && errno != EINTR) {
+      fprintf(stderr, "poll failed: %s\n", strerror(errno));
+      break;
+    }
+
+    if ((fds[0].revents & POLLIN) != 0) {
+      const int fd = accept(listen_fd, NULL, NULL);
+      if (fd >= 0) {
+        // Non-blocking, so a client that stops reading cannot stall the batch.
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        server.connections[++server.next_connection] = connection{fd, {}, {}};
+      }
+    }
+    for (size_t i = 1; i < fds.size(); ++i) {
+      auto conn = server.connections.find(fd_connections[i]);
+      bool alive = true;
+      if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+        const ssize_t n = read(fds[i].fd, buffer.data(), buffer.size());
+        alive = n > 0 || (n < 0 && errno == EAGAIN);
+        if (n > 0) {
+          conn->second.in.insert(conn->second.in.end(), buffer.begin(), buffer.begin() + n);
+          alive = parse_requests(&server, conn->first, conn->second);
+        }
+      }
+      if (alive && (fds[i].revents & POLLOUT) != 0) {
+        const ssize_t n = write(fds[i].fd, conn->second.out.data(), conn->second.out.size());
+        alive = n >= 0 || errno == EAGAIN;
+        if (n > 0) {
+          conn->second.out.erase(conn->second.out.begin(), conn->second.out.begin() + n);
+        }
+      }
+      if (!alive) {
+        // Its sequences still run; sequence_done drops their responses.
+        close(conn->second.fd);
+        server.connections.erase(conn);
+      }
+    }
+
+    status = swiglu_batcher_step(server.batcher);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "swiglu_batcher_step failed: %d\n", status);
+    }
+  }
+
+  const struct swiglu_batcher_stats stats = swiglu_batcher_stats(server.batcher);
+  printf("%zu sequences in %zu steps: %.1f rows/step, %.1f%% padding, %zu reshapes\n",
+         stats.completed, stats.steps, stats.steps != 0 ? static_cast<double>(stats.rows) / stats.steps : 0.0,
+         stats.rows != 0 ? 100.0 * stats.padded_rows / (stats.rows + stats.padded_rows) : 0.0, stats.reshapes);
+  for (const auto& entry : server.connections) {
+    close(entry.second.fd);
+  }
+  close(listen_fd);
+  unlink(socket_path);
+  swiglu_delete_batcher(server.batcher);
+  return 0;
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  while (size != 0) {
+    const ssize_t n = write(fd, bytes, size);
+    if (n <= 0) {
+      return false;
+    }
+    bytes += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+static bool read_all(int fd, void* data, size_t size) {
+  uint8_t* bytes = static_cast<uint8_t*>(data);
+  while (size != 0) {
+    const ssize_t n = read(fd, bytes, size);
+    if (n <= 0) {
+      return false;
+    }
+    bytes += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+struct client_results {
+  std::mutex mutex;
+  std::vector<double> latencies_ms;
+  size_t errors = 0;
+};
+
+// One connection sending sequences one after another. reference is NULL without --verify.
+static void run_connection(
+  const char* socket_path,
+  size_t c,
+  size_t num_sequences,
+  size_t max_steps,
+  size_t dim,
+  struct swiglu_stack* reference,
+  std::mutex* reference_mutex,
+  struct client_results* results)
+{
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  if (fd < 0 || connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+    fprintf(stderr, "failed to connect to %s: %s\n", socket_path, strerror(errno));
+    std::lock_guard<std::mutex> lock(results->mutex);
+    results->errors += num_sequences;
+    return;
+  }
+
+  std::vector<double> latencies_ms;
+  size_t errors = 0;
+  std::vector<float> input(dim);
+  std::vector<float> output(dim);
+  for (size_t s = 0; s < num_sequences; ++s) {
+    const uint32_t seed = static_cast<uint32_t>(7919 * c + s);
+    const size_t num_steps = 1 + (seed * 2654435761u >> 8) % max_steps;
+    swiglu_fill_random(input.data(), dim, 1.0f, seed);
+
+    const auto start = std::chrono::steady_clock::now();
+    struct request_header request = {
+      SWIGLU_REQUEST_MAGIC, static_cast<uint32_t>(num_steps), s, static_cast<uint32_t>(dim), 0};
+    struct response_header response;
+    if (!write_all(fd, &request, sizeof(request)) || !write_all(fd, input.data(), dim * sizeof(float)) ||
+        !read_all(fd, &response, sizeof(response)) || response.magic != SWIGLU_RESPONSE_MAGIC ||
+        response.id != s || response.status != xnn_status_success || response.dim != dim ||
+        !read_all(fd, output.data(), dim * sizeof(float))) {
+      errors += num_sequences - s;
+      break;
+    }
+    latencies_ms.push_back(elapsed_ms(start));
+
+    if (reference != NULL) {
+      std::vector<float> expected = input;
+      std::vector<float> next(dim);
+      std::lock_guard<std::mutex> lock(*reference_mutex);
+      for (size_t step = 0; step < num_steps; ++step) {
+        swiglu_run_stack(reference, 1, expected.data(), next.data());
+        expected.swap(next);
+      }
+      for (size_t i = 0; i < dim; ++i) {
+        if (fabsf(output[i] - expected[i]) > 1.0e-4f * (1.0f + fabsf(expected[i]))) {
+          ++errors;
+          break;
+        }
+      }
+    }
+  }
+  close(fd);
+
+  std::lock_guard<std::mutex> lock(results->mutex);
+  results->latencies_ms.insert(results->latencies_ms.end(), latencies_ms.begin(), latencies_ms.end());
+  results->errors += errors;
+}
+
+static int run_client(
+  const char* socket_path,
+  size_t num_connections,
+  size_t num_sequences,
+  size_t max_steps,
+  size_t dim,
+  struct swiglu_stack* reference)
+{
+  struct client_results results;
+  std::mutex reference_mutex;
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t c = 0; c < num_connections; ++c) {
+    threads.emplace_back(run_connection, socket_path, c, num_sequences, max_steps, dim, reference,
+                         &reference_mutex, &results);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  const double total_ms = elapsed_ms(start);
+  printf("%zu sequences over %zu connections in %.1f ms: p50 %.2f ms, p99 %.2f ms, %zu errors%s\n",
+         results.latencies_ms.size(), num_connections, total_ms, percentile(results.latencies_ms, 50.0),
+         percentile(results.latencies_ms, 99.0), results.errors, reference != NULL ? " (verified)" : "");
+  return results.errors == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  const char* socket_path = NULL;
+  bool client = false;
+  size_t max_batch_size = 32;
+  size_t num_threads = 1;
+  const char* packed_path = NULL;
+  size_t num_layers = 4;
+  size_t dim = 256;
+  size_t inter_dim = 768;
+  size_t num_connections = 4;
+  size_t num_sequences = 50;
+  size_t max_steps = 32;
+  bool verify = false;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--socket") == 0) {
+      socket_path = argv[++i];
+    } else if (strcmp(argv[i], "--client") == 0) {
+      client = true;
+    } else if (has_value && strcmp(argv[i], "--max-batch") == 0) {
+      max_batch_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--packed") == 0) {
+      packed_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--connections") == 0) {
+      num_connections = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--sequences") == 0) {
+      num_sequences = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--max-steps") == 0) {
+      max_steps = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--verify") == 0) {
+      verify = true;
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (socket_path == NULL || max_batch_size == 0 || num_threads == 0 || num_layers == 0 || dim == 0 ||
+      inter_dim == 0 || max_steps == 0 || (client && packed_path != NULL)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1 && !client) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers;
+  std::vector<swiglu_layer_weights> layers;
+  struct swiglu_packed_file* packed_file = NULL;
+  struct swiglu_stack* stack = NULL;
+  enum xnn_status status = xnn_status_success;
+  if (packed_path != NULL) {
+    status = swiglu_open_packed_file(packed_path, /*flags=*/0, &packed_file);
+    if (status == xnn_status_success) {
+      for (size_t i = 0; i < swiglu_packed_file_num_layers(packed_file); ++i) {
+        layers.push_back(swiglu_packed_file_layer_weights(packed_file, i));
+      }
+      status = swiglu_create_stack_with_weights_cache(
+        layers.size(), layers.data(), swiglu_packed_file_weights_cache(packed_file), threadpool, &stack);
+    }
+  } else if (!client || verify) {
+    fp32_layers = swiglu_random_layers(num_layers, dim, inter_dim);
+    for (const swiglu_fp32_layer& layer : fp32_layers) {
+      layers.push_back(swiglu_fp32_layer_weights(layer));
+    }
+    status = swiglu_create_stack(layers.size(), layers.data(), threadpool, swiglu_pack_parallel, &stack);
+  }
+  if (status != xnn_status_success) {
+    fprintf(stderr, "failed to create the SwiGLU stack: %d\n", status);
+    return 1;
+  }
+
+  int result;
+  if (client) {
+    result = run_client(socket_path, num_connections, num_sequences, max_steps, dim, stack);
+  } else {
+    signal(SIGINT, request_stop);
+    signal(SIGTERM, request_stop);
+    signal(SIGPIPE, SIG_IGN);
+    result = run_server(socket_path, stack, max_batch_size);
+  }
+
+  if (stack != NULL) {
+    swiglu_delete_stack(stack);
+  }
+  if (packed_file != NULL) {
+    swiglu_close_packed_file(packed_file);
+  }
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return result;
+}
@@ -0,0 +1,246 @@
+/**
+ * @file silu_swiglu.cpp
+ * @brief Sigmoid approximations for SwiGLU: their errors, their cost, and stacks using them
+ *
+ * Prints the measured largest sigmoid and SiLU errors of every approximation in
+ * swiglu_silu.h along with the cost of its fused SiLU and gating pass, then for every
+ * batch size in --rows times the XNNPACK stack (whose SiLU is XNNPACK's sigmoid and
+ * two multiplies) next to a SiLU stack at each approximation, with each stack's
+ * error against the XNNPACK one:
+ *
+ *   ./silu_swiglu --safetensors model.safetensors --rows 1,64,512 --threads 8
+ *   ./silu_swiglu --random 4 --dim 2048 --inter-dim 5632 --rows 2048
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_silu.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--rows R1,R2,...] [--runs N] [--threads T] SOURCE\n"
+          "sources:\n"
+          "  --safetensors FILE [--layers N] [--key-format FMT] [--w1-name NAME] [--w3-name NAME] [--w2-name NAME]\n"
+          "  --raw W1,W3,W2 --layers N --dim D --inter-dim I\n"
+          "  --random N --dim D --inter-dim I   N random layers (see swiglu_random_layers)\n",
+          program);
+}
+
+static float relative_error(const float* reference, const float* output, size_t size) {
+  double error = 0.0;
+  double norm = 0.0;
+  for (size_t i = 0; i < size; ++i) {
+    error += (output[i] - reference[i]) * (output[i] - reference[i]);
+    norm += reference[i] * reference[i];
+  }
+  return static_cast<float>(sqrt(error / std::max(norm, 1e-30)));
+}
+
+// Nanoseconds per element of the SiLU and gating pass on one thread, median of num_runs.
+static double pass_ns_per_element(enum swiglu_silu_approx approx, size_t num_runs) {
+  const size_t kElements = 1 << 16;
+  std::vector<float> gate(kElements);
+  std::vector<float> up(kElements);
+  std::vector<float> output(kElements);
+  swiglu_fill_random(gate.data(), kElements, 8.0f, 3);
+  swiglu_fill_random(up.data(), kElements, 1.0f, 4);
+  std::vector<double> times_ms;
+  for (size_t run = 0; run < num_runs; ++run) {
+    const auto start = std::chrono::steady_clock::now();
+    swiglu_silu_gate(approx, kElements, gate.data(), up.data(), output.data());
+    times_ms.push_back(elapsed_ms(start));
+  }
+  return percentile(times_ms, 50.0) * 1e6 / kElements;
+}
+
+int main(int argc, char** argv) {
+  std::vector<size_t> batch_sizes = {1, 64, 512};
+  size_t num_runs = 20;
+  size_t num_threads = 1;
+  const char* safetensors_path = NULL;
+  const char* key_format = "model.layers.{layer}.mlp.{proj}.weight";
+  const char* w1_name = "gate_proj";
+  const char* w3_name = "up_proj";
+  const char* w2_name = "down_proj";
+  const char* raw_paths = NULL;
+  size_t num_random_layers = 0;
+  size_t num_layers = 0;
+  size_t dim = 0;
+  size_t inter_dim = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--rows") == 0) {
+      batch_sizes.clear();
+      for (char* rows = strtok(argv[++i], ","); rows != NULL; rows = strtok(NULL, ",")) {
+        batch_sizes.push_back(strtoul(rows, NULL, 10));
+      }
+    } else if (has_value && strcmp(argv[i], "--runs") == 0) {
+      num_runs = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--safetensors") == 0) {
+      safetensors_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--key-format") == 0) {
+      key_format = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w1-name") == 0) {
+      w1_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w3-name") == 0) {
+      w3_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w2-name") == 0) {
+      w2_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--raw") == 0) {
+      raw_paths = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--random") == 0) {
+      num_random_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  const int num_sources = (safetensors_path != NULL) + (raw_paths != NULL) + (num_random_layers != 0);
+  if (num_sources != 1 || batch_sizes.empty() ||
+      std::find(batch_sizes.begin(), batch_sizes.end(), 0u) != batch_sizes.end() || num_runs == 0 ||
+      num_threads == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<swiglu_fp32_layer> layers;
+  if (safetensors_path != NULL) {
+    if (!swiglu_load_safetensors_layers(safetensors_path, key_format, w1_name, w3_name, w2_name, num_layers,
+                                        &layers)) {
+      return 1;
+    }
+  } else if (raw_paths != NULL) {
+    std::vector<std::string> paths;
+    std::string list = raw_paths;
+    for (size_t start = 0, comma; start <= list.size(); start = comma + 1) {
+      comma = list.find(',', start);
+      if (comma == std::string::npos) {
+        comma = list.size();
+      }
+      paths.push_back(list.substr(start, comma - start));
+    }
+    if (paths.size() != 3 || num_layers == 0 || dim == 0 || inter_dim == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    if (!swiglu_load_raw_layers(paths[0].c_str(), paths[1].c_str(), paths[2].c_str(), num_layers, dim, inter_dim,
+                                dim, &layers)) {
+      return 1;
+    }
+  } else {
+    if (dim == 0 || inter_dim == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    layers = swiglu_random_layers(num_random_layers, dim, inter_dim);
+  }
+  if (layers.empty()) {
+    fprintf(stderr, "no layers loaded\n");
+    return 1;
+  }
+
+  printf("approximation  sigmoid error  SiLU error  pass ns/element\n");
+  for (int a = 0; a < SWIGLU_NUM_SILU_APPROXES; ++a) {
+    const enum swiglu_silu_approx approx = static_cast<enum swiglu_silu_approx>(a);
+    float sigmoid_error, silu_error;
+    swiglu_silu_max_error(approx, &sigmoid_error, &silu_error);
+    printf("%-13s  %13.2e  %10.2e  %15.3f\n", swiglu_silu_approx_name(approx), sigmoid_error, silu_error,
+           pass_ns_per_element(approx, num_runs));
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_layer_weights> weights;
+  for (const swiglu_fp32_layer& layer : layers) {
+    weights.push_back(swiglu_fp32_layer_weights(layer));
+  }
+  struct swiglu_stack* xnn_stack = NULL;
+  struct swiglu_silu_stack* silu_stack = NULL;
+  if (swiglu_create_stack(weights.size(), weights.data(), threadpool, swiglu_pack_parallel, &xnn_stack) !=
+        xnn_status_success ||
+      swiglu_create_silu_stack(weights.size(), weights.data(), swiglu_silu_exact, threadpool, &silu_stack) !=
+        xnn_status_success) {
+    return 1;
+  }
+
+  printf("layers=%zu dim=%zu inter_dim=%zu threads=%zu\n", layers.size(), layers.front().input_dim,
+         layers.front().inter_dim, num_threads);
+  const size_t input_dim = layers.front().input_dim;
+  const size_t output_dim = layers.back().output_dim;
+  for (size_t num_rows : batch_sizes) {
+    // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+    std::vector<float> input(num_rows * input_dim + XNN_EXTRA_BYTES / sizeof(float));
+    swiglu_fill_random(input.data(), num_rows * input_dim, 1.0f, 2);
+    std::vector<float> reference(num_rows * output_dim);
+    std::vector<float> output(num_rows * output_dim);
+    std::vector<double> xnn_ms;
+    for (size_t run = 0; run < num_runs; ++run) {
+      const auto start = std::chrono::steady_clock::now();
+      if (swiglu_run_stack(xnn_stack, num_rows, input.data(), reference.data()) != xnn_status_success) {
+        return 1;
+      }
+      xnn_ms.push_back(elapsed_ms(start));
+    }
+    printf("rows %zu: xnnpack sigmoid %.3f ms", num_rows, percentile(xnn_ms, 50.0));
+
+    for (int a = 0; a < SWIGLU_NUM_SILU_APPROXES; ++a) {
+      const enum swiglu_silu_approx approx = static_cast<enum swiglu_silu_approx>(a);
+      for (size_t l = 0; l < layers.size(); ++l) {
+        if (swiglu_set_silu_approx(silu_stack, l, approx) != xnn_status_success) {
+          return 1;
+        }
+      }
+      std::vector<double> silu_ms;
+      for (size_t run = 0; run < num_runs; ++run) {
+        const auto start = std::chrono::steady_clock::now();
+        if (swiglu_run_silu_stack(silu_stack, num_rows, input.data(), output.data()) != xnn_status_success) {
+          return 1;
+        }
+        silu_ms.push_back(elapsed_ms(start));
+      }
+      printf(", %s %.3f ms (error %.2e)", swiglu_silu_approx_name(approx), percentile(silu_ms, 50.0),
+             relative_error(reference.data(), output.data(), reference.size()));
+    }
+    printf("\n");
+  }
+
+  swiglu_delete_silu_stack(silu_stack);
+  swiglu_delete_stack(xnn_stack);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
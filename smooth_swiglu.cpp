@@ -0,0 +1,332 @@
+/**
+ * @file smooth_swiglu.cpp
+ * @brief SmoothQuant preprocessing of SwiGLU weights for dynamically quantized int8
+ *
+ * Records the largest magnitude of every input and intermediate channel over a
+ * calibration dataset, folds SmoothQuant factors into the weights (see
+ * swiglu_smooth.h) and compares the qc8 stack's error against fp32 on held-out
+ * rows with and without smoothing:
+ *
+ *   ./smooth_swiglu --safetensors model.safetensors --dataset rows.bin --alpha 0.5 \
+ *       --output model-smooth.swpk --input-factors model-smooth.factors
+ *   ./smooth_swiglu --random 2 --dim 1024 --inter-dim 2816 --random-rows 256 --outlier-channels 8
+ *
+ * --output packs the smoothed layers as qc8; --input-factors writes the first
+ * layer's factors as raw fp32 for whatever produces the stack input to divide by.
+ * --outlier-channels multiplies a few channels of random rows by --outlier-scale,
+ * like the outlier features of real models.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_calibration.h"
+#include "swiglu_packed_file.h"
+#include "swiglu_smooth.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--alpha A] [--holdout H] [--batch B] [--threads T] [--output FILE]\n"
+          "          [--input-factors FILE] SOURCE DATASET\n"
+          "sources:\n"
+          "  --safetensors FILE [--layers N] [--key-format FMT] [--w1-name NAME] [--w3-name NAME]\n"
+          "                     [--w2-name NAME]\n"
+          "  --raw W1,W3,W2 --layers N --dim D --inter-dim I\n"
+          "  --random N --dim D --inter-dim I   N random layers (see swiglu_random_layers)\n"
+          "datasets:\n"
+          "  --dataset FILE     raw fp32 rows\n"
+          "  --random-rows R    R uniform random rows in [-1, 1], plus the held-out rows\n"
+          "                     [--outlier-channels K] [--outlier-scale S]\n",
+          program);
+}
+
+static float relative_error(const float* reference, const float* output, size_t size) {
+  double error = 0.0;
+  double norm = 0.0;
+  for (size_t i = 0; i < size; ++i) {
+    error += (output[i] - reference[i]) * (output[i] - reference[i]);
+    norm += reference[i] * reference[i];
+  }
+  return static_cast<float>(sqrt(error / std::max(norm, 1e-30)));
+}
+
+// Runs rows through the qc8 version of layers.
+static bool run_qc8(
+  const std::vector<swiglu_fp32_layer>& layers,
+  pthreadpool_t threadpool,
+  size_t num_rows,
+  const float* input,
+  float* output)
+{
+  std::vector<swiglu_qc8_layer> qc8_layers;
+  std::vector<swiglu_layer_weights> weights;
+  qc8_layers.reserve(layers.size());
+  for (const swiglu_fp32_layer& layer : layers) {
+    qc8_layers.push_back(swiglu_quantize_layer_qc8(layer));
+    weights.push_back(swiglu_qc8_layer_weights(qc8_layers.back()));
+  }
+  struct swiglu_stack* stack = NULL;
+  if (swiglu_create_stack(weights.size(), weights.data(), threadpool, swiglu_pack_serial, &stack) !=
+        xnn_status_success) {
+    return false;
+  }
+  const bool ok = swiglu_run_stack(stack, num_rows, input, output) == xnn_status_success;
+  swiglu_delete_stack(stack);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  float alpha = 0.5f;
+  size_t num_holdout = 16;
+  size_t batch_size = 32;
+  size_t num_threads = 1;
+  const char* output_path = NULL;
+  const char* factors_path = NULL;
+  const char* safetensors_path = NULL;
+  const char* key_format = "model.layers.{layer}.mlp.{proj}.weight";
+  const char* w1_name = "gate_proj";
+  const char* w3_name = "up_proj";
+  const char* w2_name = "down_proj";
+  const char* raw_paths = NULL;
+  size_t num_random_layers = 0;
+  size_t num_layers = 0;
+  size_t dim = 0;
+  size_t inter_dim = 0;
+  const char* dataset_path = NULL;
+  size_t num_random_rows = 0;
+  size_t num_outlier_channels = 0;
+  float outlier_scale = 50.0f;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--alpha") == 0) {
+      alpha = strtof(argv[++i], NULL);
+    } else if (has_value && strcmp(argv[i], "--holdout") == 0) {
+      num_holdout = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--batch") == 0) {
+      batch_size = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--output") == 0) {
+      output_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--input-factors") == 0) {
+      factors_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--safetensors") == 0) {
+      safetensors_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--key-format") == 0) {
+      key_format = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w1-name") == 0) {
+      w1_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w3-name") == 0) {
+      w3_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--w2-name") == 0) {
+      w2_name = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--raw") == 0) {
+      raw_paths = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--random") == 0) {
+      num_random_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dataset") == 0) {
+      dataset_path = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--random-rows") == 0) {
+      num_random_rows = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--outlier-channels") == 0) {
+      num_outlier_channels = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--outlier-scale") == 0) {
+      outlier_scale = strtof(argv[++i], NULL);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  const int num_sources = (safetensors_path != NULL) + (raw_paths != NULL) + (num_random_layers != 0);
+  const int num_datasets = (dataset_path != NULL) + (num_random_rows != 0);
+  if (num_sources != 1 || num_datasets != 1 || !(alpha >= 0.0f && alpha <= 1.0f) || num_holdout == 0 ||
+      batch_size == 0 || num_threads == 0 || (num_outlier_channels != 0 && dataset_path != NULL)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers;
+  if (safetensors_path != NULL) {
+    if (!swiglu_load_safetensors_layers(safetensors_path, key_format, w1_name, w3_name, w2_name,
+                                        num_layers, &fp32_layers)) {
+      return 1;
+    }
+  } else if (raw_paths != NULL) {
+    std::vector<std::string> paths;
+    std::string list = raw_paths;
+    for (size_t start = 0, comma; start <= list.size(); start = comma + 1) {
+      comma = list.find(',', start);
+      if (comma == std::string::npos) {
+        comma = list.size();
+      }
+      paths.push_back(list.substr(start, comma - start));
+    }
+    if (paths.size() != 3 || num_layers == 0 || dim == 0 || inter_dim == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    if (!swiglu_load_raw_layers(paths[0].c_str(), paths[1].c_str(), paths[2].c_str(), num_layers,
+                                dim, inter_dim, dim, &fp32_layers)) {
+      return 1;
+    }
+  } else {
+    if (dim == 0 || inter_dim == 0) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    fp32_layers = swiglu_random_layers(num_random_layers, dim, inter_dim);
+  }
+  if (fp32_layers.empty()) {
+    fprintf(stderr, "no layers loaded\n");
+    return 1;
+  }
+
+  const size_t input_dim = fp32_layers.front().input_dim;
+  if (num_outlier_channels > input_dim) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  std::vector<float> dataset;
+  size_t num_rows = num_random_rows + num_holdout;
+  if (dataset_path != NULL) {
+    FILE* file = fopen(dataset_path, "rb");
+    if (file == NULL) {
+      fprintf(stderr, "failed to open %s\n", dataset_path);
+      return 1;
+    }
+    float value;
+    while (fread(&value, sizeof(float), 1, file) == 1) {
+      dataset.push_back(value);
+    }
+    fclose(file);
+    num_rows = dataset.size() / input_dim;
+    if (num_rows <= num_holdout || dataset.size() % input_dim != 0) {
+      fprintf(stderr, "%s holds %zu values, not a whole number of more than %zu rows of %zu\n", dataset_path,
+              dataset.size(), num_holdout, input_dim);
+      return 1;
+    }
+  } else {
+    dataset.resize(num_rows * input_dim);
+    swiglu_fill_random(dataset.data(), dataset.size(), 1.0f, 1);
+    for (size_t c = 0; c < num_outlier_channels; ++c) {
+      const size_t channel = c * (input_dim / num_outlier_channels);
+      for (size_t row = 0; row < num_rows; ++row) {
+        dataset[row * input_dim + channel] *= outlier_scale;
+      }
+    }
+  }
+  const size_t num_calibration_rows = num_rows - num_holdout;
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  dataset.resize(num_rows * input_dim + XNN_EXTRA_BYTES / sizeof(float));
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_layer_weights> fp32_weights;
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    fp32_weights.push_back(swiglu_fp32_layer_weights(layer));
+  }
+  struct swiglu_calibrator* calibrator = NULL;
+  if (swiglu_create_calibrator(fp32_weights.size(), fp32_weights.data(), threadpool, &calibrator) !=
+        xnn_status_success) {
+    return 1;
+  }
+  for (size_t row = 0; row < num_calibration_rows; row += batch_size) {
+    const size_t rows = std::min(batch_size, num_calibration_rows - row);
+    if (swiglu_calibrator_observe(calibrator, rows, &dataset[row * input_dim]) != xnn_status_success) {
+      return 1;
+    }
+  }
+  std::vector<swiglu_smoothing> smoothing;
+  for (size_t l = 0; l < fp32_layers.size(); ++l) {
+    smoothing.push_back(swiglu_smoothing_factors(
+      fp32_layers[l], swiglu_calibrator_channel_max(calibrator, l, swiglu_activation_input),
+      swiglu_calibrator_channel_max(calibrator, l, swiglu_activation_intermediate), alpha));
+  }
+
+  // Reference and unsmoothed qc8 outputs before the weights change.
+  const size_t output_size = num_holdout * fp32_layers.back().output_dim;
+  const float* holdout = &dataset[num_calibration_rows * input_dim];
+  std::vector<float> reference(output_size);
+  std::vector<float> qc8_output(output_size);
+  struct swiglu_stack* fp32_stack = NULL;
+  if (swiglu_create_stack(fp32_weights.size(), fp32_weights.data(), threadpool, swiglu_pack_serial, &fp32_stack) !=
+        xnn_status_success ||
+      swiglu_run_stack(fp32_stack, num_holdout, holdout, reference.data()) != xnn_status_success ||
+      !run_qc8(fp32_layers, threadpool, num_holdout, holdout, qc8_output.data())) {
+    return 1;
+  }
+  swiglu_delete_stack(fp32_stack);
+  swiglu_delete_calibrator(calibrator);
+
+  std::vector<float> input_factors;
+  swiglu_smooth_layers(&fp32_layers, smoothing, &input_factors);
+  std::vector<float> smoothed_input(num_holdout * input_dim + XNN_EXTRA_BYTES / sizeof(float));
+  for (size_t i = 0; i < num_holdout * input_dim; ++i) {
+    smoothed_input[i] = holdout[i] / input_factors[i % input_dim];
+  }
+  std::vector<float> smoothed_output(output_size);
+  if (!run_qc8(fp32_layers, threadpool, num_holdout, smoothed_input.data(), smoothed_output.data())) {
+    return 1;
+  }
+  printf("qc8 on %zu held-out rows: error %.2e without smoothing, %.2e with alpha %.2f\n", num_holdout,
+         relative_error(reference.data(), qc8_output.data(), output_size),
+         relative_error(reference.data(), smoothed_output.data(), output_size), alpha);
+
+  if (factors_path != NULL) {
+    FILE* file = fopen(factors_path, "wb");
+    if (file == NULL || fwrite(input_factors.data(), sizeof(float), input_dim, file) != input_dim) {
+      fprintf(stderr, "failed to write %s\n", factors_path);
+      return 1;
+    }
+    fclose(file);
+    printf("Wrote the input factors to %s\n", factors_path);
+  }
+  if (output_path != NULL) {
+    std::vector<swiglu_qc8_layer> qc8_layers;
+    std::vector<swiglu_layer_weights> qc8_weights;
+    qc8_layers.reserve(fp32_layers.size());
+    for (const swiglu_fp32_layer& layer : fp32_layers) {
+      qc8_layers.push_back(swiglu_quantize_layer_qc8(layer));
+      qc8_weights.push_back(swiglu_qc8_layer_weights(qc8_layers.back()));
+    }
+    const enum xnn_status status =
+      swiglu_write_packed_file(output_path, qc8_weights.size(), qc8_weights.data(), threadpool);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "swiglu_write_packed_file failed: %d\n", status);
+      return 1;
+    }
+    printf("Packed the smoothed qc8 layers (%s) into %s\n", swiglu_host_isa(), output_path);
+  }
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
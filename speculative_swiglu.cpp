@@ -0,0 +1,175 @@
+/**
+ * @file speculative_swiglu.cpp
+ * @brief Decode throughput with speculative steps of k = 2 to 8 draft rows
+ *
+ * The target is an fp32 stack and the draft the same layers quantized to int8
+ * (qc8), which reads a quarter of the weight bytes per step. Each k decodes --rows
+ * rows for every sequence and is compared with plain target decoding (k = 0):
+ *
+ *   ./speculative_swiglu --sequences 1 --rows 256 --threads 4
+ *   ./speculative_swiglu --sequences 4 --k 4 --tolerance 0.02
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_speculative.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--sequences S] [--rows R] [--k K] [--tolerance T] [--threads T]\n"
+          "          [--layers N] [--dim D] [--inter-dim I]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  size_t num_sequences = 1;
+  size_t num_rows = 256;
+  // 0 runs every k from 2 to 8
+  size_t only_k = 0;
+  float tolerance = 0.05f;
+  size_t num_threads = 1;
+  size_t num_layers = 4;
+  size_t dim = 512;
+  size_t inter_dim = 1536;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--sequences") == 0) {
+      num_sequences = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--rows") == 0) {
+      num_rows = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--k") == 0) {
+      only_k = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--tolerance") == 0) {
+      tolerance = strtof(argv[++i], NULL);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_sequences == 0 || num_rows == 0 || num_threads == 0 || num_layers == 0 || dim == 0 || inter_dim == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers = swiglu_random_layers(num_layers, dim, inter_dim);
+  std::vector<swiglu_qc8_layer> qc8_layers;
+  std::vector<swiglu_layer_weights> target_layers;
+  std::vector<swiglu_layer_weights> draft_layers;
+  qc8_layers.reserve(fp32_layers.size());
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    qc8_layers.push_back(swiglu_quantize_layer_qc8(layer));
+    target_layers.push_back(swiglu_fp32_layer_weights(layer));
+    draft_layers.push_back(swiglu_qc8_layer_weights(qc8_layers.back()));
+  }
+  struct swiglu_stack* target = NULL;
+  struct swiglu_stack* draft = NULL;
+  enum xnn_status status =
+    swiglu_create_stack(target_layers.size(), target_layers.data(), threadpool, swiglu_pack_parallel, &target);
+  if (status == xnn_status_success) {
+    status = swiglu_create_stack(draft_layers.size(), draft_layers.data(), threadpool, swiglu_pack_parallel, &draft);
+  }
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_create_stack failed: %d\n", status);
+    return 1;
+  }
+
+  std::vector<float> start_rows(num_sequences * dim);
+  swiglu_fill_random(start_rows.data(), start_rows.size(), 1.0f, 1);
+  std::vector<size_t> ks = {0};
+  for (size_t k = 2; k <= 8; ++k) {
+    if (only_k == 0 || k == only_k) {
+      ks.push_back(k);
+    }
+  }
+
+  printf("sequences=%zu rows=%zu tolerance=%g layers=%zu dim=%zu inter_dim=%zu\n",
+         num_sequences, num_rows, tolerance, num_layers, dim, inter_dim);
+  double baseline_rows_per_s = 0.0;
+  for (size_t k : ks) {
+    struct swiglu_speculative* speculative = NULL;
+    status = swiglu_create_speculative(draft, target, num_sequences, num_rows + 1 + k, tolerance, &speculative);
+    if (status == xnn_status_success) {
+      status = swiglu_speculative_start(speculative, num_sequences, start_rows.data());
+    }
+    if (status != xnn_status_success) {
+      fprintf(stderr, "failed to start speculative decoding: %d\n", status);
+      return 1;
+    }
+    // Warm up at this k's batch sizes so that the timed steps do not reshape.
+    const size_t draft_batch_size = num_sequences;
+    const size_t target_batch_size = num_sequences * (k + 1);
+    swiglu_warmup_stack(draft, 1, &draft_batch_size, /*lock=*/false);
+    swiglu_warmup_stack(target, 1, &target_batch_size, /*lock=*/false);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (;;) {
+      size_t shortest = SIZE_MAX;
+      for (size_t s = 0; s < num_sequences; ++s) {
+        size_t length;
+        swiglu_speculative_rows(speculative, s, &length);
+        shortest = std::min(shortest, length);
+      }
+      if (shortest > num_rows) {
+        break;
+      }
+      status = swiglu_speculative_step(speculative, k, NULL);
+      if (status != xnn_status_success) {
+        fprintf(stderr, "swiglu_speculative_step failed: %d\n", status);
+        return 1;
+      }
+    }
+    const double total_ms = elapsed_ms(start);
+
+    const struct swiglu_speculative_stats stats = swiglu_speculative_stats(speculative);
+    const double rows_per_s = stats.emitted / (total_ms / 1000.0);
+    if (k == 0) {
+      baseline_rows_per_s = rows_per_s;
+    }
+    printf("k=%zu: %zu steps, %.2f rows/step per sequence, %.1f%% accepted, %.0f rows/s, %.2fx\n",
+           k, stats.steps, static_cast<double>(stats.emitted) / (stats.steps * num_sequences),
+           stats.proposed != 0 ? 100.0 * stats.accepted / stats.proposed : 0.0, rows_per_s,
+           rows_per_s / baseline_rows_per_s);
+    swiglu_delete_speculative(speculative);
+  }
+
+  swiglu_delete_stack(draft);
+  swiglu_delete_stack(target);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
@@ -0,0 +1,229 @@
+/**
+ * @file stack_swiglu.cpp
+ * @brief Startup benchmark for deep SwiGLU stacks
+ *
+ * Builds a stack of randomly initialized SwiGLU layers and reports how long it takes
+ * to create the stack and to produce the first output with each packing mode:
+ *
+ *   ./stack_swiglu --layers 70 --dim 1024 --inter-dim 2816 --threads 8 --pack parallel
+ *
+ * With --packed, the layers come from a file written by pack_swiglu_weights and no
+ * packing happens at all. --warmup 1,8,32 faults in weights and workspace and runs
+ * each listed batch size once before the first request is timed:
+ *
+ *   ./stack_swiglu --packed model.swpk --threads 8 --warmup 1,8,32 --mlock
+ *
+ * --shm NAME instead maps a segment published by pack_swiglu_weights --publish-shm,
+ * which any number of these processes can share.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_packed_file.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--layers N] [--dim D] [--inter-dim I] [--batch B] [--threads T]\n"
+          "          [--pack serial|parallel|lazy | --packed FILE | --shm NAME] [--populate]\n"
+          "          [--warmup B1,B2,...] [--mlock]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  size_t num_layers = 8;
+  size_t dim = 512;
+  size_t inter_dim = 1536;
+  size_t batch_size = 1;
+  size_t num_threads = 1;
+  enum swiglu_pack_mode pack_mode = swiglu_pack_parallel;
+  const char* packed_path = NULL;
+  const char* shm_name = NULL;
+  bool populate = false;
+  std::vector<size_t> warmup_batch_sizes;
+  bool lock = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 < argc && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--batch") == 0) {
+      batch_size = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--pack") == 0) {
+      const char* mode = argv[++i];
+      if (strcmp(mode, "serial") == 0) {
+        pack_mode = swiglu_pack_serial;
+      } else if (strcmp(mode, "parallel") == 0) {
+        pack_mode = swiglu_pack_parallel;
+      } else if (strcmp(mode, "lazy") == 0) {
+        pack_mode = swiglu_pack_lazy;
+      } else {
+        print_usage(argv[0]);
+        return 1;
+      }
+    } else if (i + 1 < argc && strcmp(argv[i], "--packed") == 0) {
+      packed_path = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "--shm") == 0) {
+      shm_name = argv[++i];
+    } else if (strcmp(argv[i], "--populate") == 0) {
+      populate = true;
+    } else if (i + 1 < argc && strcmp(argv[i], "--warmup") == 0) {
+      const std::string list = argv[++i];
+      for (size_t start = 0, comma; start <= list.size(); start = comma + 1) {
+        comma = list.find(',', start);
+        if (comma == std::string::npos) {
+          comma = list.size();
+        }
+        warmup_batch_sizes.push_back(strtoul(list.substr(start, comma - start).c_str(), NULL, 10));
+      }
+    } else if (strcmp(argv[i], "--mlock") == 0) {
+      lock = true;
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_layers == 0 || dim == 0 || inter_dim == 0 || batch_size == 0 || num_threads == 0 ||
+      (packed_path != NULL && shm_name != NULL) ||
+      (populate && packed_path == NULL && shm_name == NULL) || (lock && warmup_batch_sizes.empty())) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers;
+  std::vector<swiglu_layer_weights> layers;
+  struct swiglu_packed_file* packed_file = NULL;
+  if (packed_path != NULL || shm_name != NULL) {
+    // Without --populate, opening only maps the file and reads its tables; blobs are
+    // faulted in on use, or by the warmup.
+    const uint32_t flags = populate ? SWIGLU_PACKED_FILE_POPULATE : 0;
+    enum xnn_status status = packed_path != NULL ? swiglu_open_packed_file(packed_path, flags, &packed_file)
+                                                 : swiglu_open_packed_shm(shm_name, flags, &packed_file);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "opening packed weights failed: %d\n", status);
+      return 1;
+    }
+    num_layers = swiglu_packed_file_num_layers(packed_file);
+    for (size_t i = 0; i < num_layers; ++i) {
+      layers.push_back(swiglu_packed_file_layer_weights(packed_file, i));
+    }
+    dim = layers[0].input_dim;
+    inter_dim = layers[0].inter_dim;
+    if (layers.back().output_dim != dim) {
+      fprintf(stderr, "%s: the stack's input and output dims differ\n", packed_path != NULL ? packed_path : shm_name);
+      return 1;
+    }
+  } else {
+    fp32_layers = swiglu_random_layers(num_layers, dim, inter_dim);
+    for (const swiglu_fp32_layer& layer : fp32_layers) {
+      layers.push_back(swiglu_fp32_layer_weights(layer));
+    }
+  }
+
+  std::vector<float> input(batch_size * dim);
+  std::vector<float> output(batch_size * dim);
+  swiglu_fill_random(input.data(), input.size(), 1.0f, 12345);
+
+  const auto start = std::chrono::steady_clock::now();
+  struct swiglu_stack* stack = NULL;
+  enum xnn_status status;
+  if (packed_file != NULL) {
+    status = swiglu_create_stack_with_weights_cache(
+      num_layers, layers.data(), swiglu_packed_file_weights_cache(packed_file), threadpool, &stack);
+  } else {
+    status = swiglu_create_stack(num_layers, layers.data(), threadpool, pack_mode, &stack);
+  }
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_create_stack failed: %d\n", status);
+    return 1;
+  }
+  const double create_ms = elapsed_ms(start);
+
+  double warmup_ms = 0.0;
+  if (!warmup_batch_sizes.empty()) {
+    const auto warmup_start = std::chrono::steady_clock::now();
+    if (packed_file != NULL) {
+      status = swiglu_prefault_packed_file(packed_file, threadpool, lock);
+      if (status != xnn_status_success) {
+        fprintf(stderr, "swiglu_prefault_packed_file failed: %d\n", status);
+        return 1;
+      }
+    }
+    status = swiglu_warmup_stack(stack, warmup_batch_sizes.size(), warmup_batch_sizes.data(), lock);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "swiglu_warmup_stack failed: %d\n", status);
+      return 1;
+    }
+    warmup_ms = elapsed_ms(warmup_start);
+  }
+
+  const auto first_request_start = std::chrono::steady_clock::now();
+  status = swiglu_run_stack(stack, batch_size, input.data(), output.data());
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_run_stack failed: %d\n", status);
+    return 1;
+  }
+  const double first_request_ms = elapsed_ms(first_request_start);
+  const double first_output_ms = elapsed_ms(start);
+
+  status = swiglu_wait_for_packing(stack);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_wait_for_packing failed: %d\n", status);
+    return 1;
+  }
+  const double all_packed_ms = elapsed_ms(start);
+
+  const auto steady_start = std::chrono::steady_clock::now();
+  status = swiglu_run_stack(stack, batch_size, input.data(), output.data());
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_run_stack failed: %d\n", status);
+    return 1;
+  }
+  const double steady_ms = elapsed_ms(steady_start);
+
+  printf("layers=%zu dim=%zu inter_dim=%zu batch=%zu threads=%zu packed=%.1f MB%s\n",
+         num_layers, dim, inter_dim, batch_size, num_threads,
+         swiglu_stack_packed_size(stack) / 1048576.0, packed_file != NULL ? " (from file)" : "");
+  printf("create: %.2f ms, warmup: %.2f ms, first output: %.2f ms, all packed: %.2f ms\n",
+         create_ms, warmup_ms, first_output_ms, all_packed_ms);
+  printf("first request: %.2f ms, steady run: %.2f ms\n", first_request_ms, steady_ms);
+  printf("Output[0]: %g\n", output[0]);
+
+  swiglu_delete_stack(stack);
+  if (packed_file != NULL) {
+    swiglu_close_packed_file(packed_file);
+  }
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return 0;
+}
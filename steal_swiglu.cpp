@@ -0,0 +1,176 @@
+/**
+ * @file steal_swiglu.cpp
+ * @brief Concurrent requests of mixed sizes: work stealing against per-request pools
+ *
+ * --clients threads each send --requests requests, with batch sizes cycling through
+ * --sizes. The requests run on one of:
+ *   steal   the work-stealing executor with --workers pinned workers
+ *   pool    a pool of one runtime per client, each with a --threads thread pool,
+ *           which oversubscribes the cores once clients * threads exceeds them
+ *   shared  a single runtime with a --threads thread pool, which runs one request
+ *           at a time
+ *
+ *   ./steal_swiglu --mode steal --clients 8 --workers 8
+ *   ./steal_swiglu --mode pool --clients 8 --threads 8
+ *   ./steal_swiglu --mode shared --clients 8 --threads 8
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_runtime_pool.h"
+#include "swiglu_weights_io.h"
+#include "swiglu_work_stealing.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--mode steal|pool|shared] [--clients C] [--requests R] [--sizes B1,B2,...]\n"
+          "          [--workers W] [--tile-rows T] [--no-pin] [--threads T] [--layers N] [--dim D] [--inter-dim I]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  const char* mode = "steal";
+  size_t num_clients = 8;
+  size_t num_requests = 50;
+  std::vector<size_t> sizes = {1, 4, 16, 64, 256};
+  size_t num_workers = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  size_t tile_rows = 16;
+  bool pin = true;
+  size_t num_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  size_t num_layers = 4;
+  size_t dim = 512;
+  size_t inter_dim = 1536;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--mode") == 0) {
+      mode = argv[++i];
+    } else if (has_value && strcmp(argv[i], "--clients") == 0) {
+      num_clients = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--requests") == 0) {
+      num_requests = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--sizes") == 0) {
+      sizes.clear();
+      for (char* size = strtok(argv[++i], ","); size != NULL; size = strtok(NULL, ",")) {
+        sizes.push_back(strtoul(size, NULL, 10));
+      }
+    } else if (has_value && strcmp(argv[i], "--workers") == 0) {
+      num_workers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--tile-rows") == 0) {
+      tile_rows = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--no-pin") == 0) {
+      pin = false;
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  const bool steal = strcmp(mode, "steal") == 0;
+  const bool shared = strcmp(mode, "shared") == 0;
+  if ((!steal && !shared && strcmp(mode, "pool") != 0) || num_clients == 0 || num_requests == 0 ||
+      sizes.empty() || std::find(sizes.begin(), sizes.end(), 0u) != sizes.end() || num_workers == 0 ||
+      tile_rows == 0 || num_threads == 0 || num_layers == 0 || dim == 0 || inter_dim == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers = swiglu_random_layers(num_layers, dim, inter_dim);
+  std::vector<swiglu_layer_weights> layers;
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    layers.push_back(swiglu_fp32_layer_weights(layer));
+  }
+  struct swiglu_work_stealing* executor = NULL;
+  struct swiglu_runtime_pool* pool = NULL;
+  enum xnn_status status;
+  if (steal) {
+    status = swiglu_create_work_stealing(layers.size(), layers.data(), num_workers, tile_rows, pin, &executor);
+  } else {
+    status = swiglu_create_runtime_pool(layers.size(), layers.data(), shared ? 1 : num_clients, num_threads, &pool);
+  }
+  if (status != xnn_status_success) {
+    fprintf(stderr, "failed to create the %s executor: %d\n", mode, status);
+    return 1;
+  }
+
+  const size_t max_size = *std::max_element(sizes.begin(), sizes.end());
+  std::atomic<size_t> rows(0);
+  std::atomic<size_t> failures(0);
+  std::vector<std::vector<double>> latencies_ms(num_clients);
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  for (size_t c = 0; c < num_clients; ++c) {
+    clients.emplace_back([&, c] {
+      // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+      std::vector<float> input(max_size * dim + XNN_EXTRA_BYTES / sizeof(float));
+      std::vector<float> output(max_size * dim);
+      swiglu_fill_random(input.data(), max_size * dim, 1.0f, static_cast<uint32_t>(c + 1));
+      for (size_t r = 0; r < num_requests; ++r) {
+        const size_t batch_size = sizes[(c + r) % sizes.size()];
+        const auto request_start = std::chrono::steady_clock::now();
+        const enum xnn_status request_status = steal ?
+          swiglu_work_stealing_run(executor, batch_size, input.data(), output.data()) :
+          swiglu_runtime_pool_run(pool, batch_size, input.data(), output.data());
+        latencies_ms[c].push_back(elapsed_ms(request_start));
+        if (request_status == xnn_status_success) {
+          rows += batch_size;
+        } else {
+          failures++;
+        }
+      }
+    });
+  }
+  for (std::thread& client : clients) {
+    client.join();
+  }
+  const double total_ms = elapsed_ms(start);
+
+  std::vector<double> all_ms;
+  for (const std::vector<double>& client_ms : latencies_ms) {
+    all_ms.insert(all_ms.end(), client_ms.begin(), client_ms.end());
+  }
+  printf("mode=%s clients=%zu requests=%zu layers=%zu dim=%zu inter_dim=%zu\n",
+         mode, num_clients, num_requests, num_layers, dim, inter_dim);
+  printf("%.0f rows/s, latency p50 %.2f ms, p99 %.2f ms, %zu failed\n",
+         rows.load() / (total_ms / 1000.0), percentile(all_ms, 50.0), percentile(all_ms, 99.0), failures.load());
+  if (steal) {
+    double busy_ms = 0.0;
+    size_t tiles = 0;
+    size_t steals = 0;
+    for (size_t w = 0; w < num_workers; ++w) {
+      const struct swiglu_work_stealing_stats stats = swiglu_work_stealing_stats(executor, w);
+      busy_ms += stats.busy_ms;
+      tiles += stats.tiles;
+      steals += stats.steals;
+    }
+    printf("%zu workers: %.1f%% busy, %zu tiles, %zu stolen\n",
+           num_workers, 100.0 * busy_ms / (num_workers * total_ms), tiles, steals);
+    swiglu_delete_work_stealing(executor);
+  } else {
+    swiglu_delete_runtime_pool(pool);
+  }
+
+  xnn_deinitialize();
+  return 0;
+}
@@ -0,0 +1,320 @@
+/**
+ * @file swiglu_attention.cpp
+ * @brief Online-softmax attention over query and key/value tiles
+ */
+#include "swiglu_attention.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+// Query rows per task and keys per inner step. A tile of transposed keys, the
+// scores and the query tile's accumulators stay in L1/L2 for head dims up to 128.
+static const size_t kQueryTile = 32;
+static const size_t kKeyTile = 64;
+
+// kQueryTile or fewer query rows of one sequence, which spans rows begin to end.
+struct attention_tile {
+  size_t begin;
+  size_t end;
+  size_t first_row;
+};
+
+struct attention_context {
+  size_t num_rows;
+  size_t num_heads;
+  size_t num_kv_heads;
+  size_t head_dim;
+  const float* query;
+  const float* key;
+  const float* value;
+  size_t input_stride;
+  bool causal;
+  const struct swiglu_rope_table* rope;
+  float* output;
+  // Query tiles of every sequence; unused by the naive kernel
+  const struct attention_tile* tiles;
+};
+
+static void attend_tile(void* context, size_t query_tile, size_t head) {
+  const struct attention_context* ctx = static_cast<const struct attention_context*>(context);
+  const size_t head_dim = ctx->head_dim;
+  const size_t kv_head = head / (ctx->num_heads / ctx->num_kv_heads);
+  const size_t stride = ctx->input_stride;
+  const size_t output_stride = ctx->num_heads * head_dim;
+  const struct attention_tile& tile = ctx->tiles[query_tile];
+  // Rows and keys are indexed in the whole batch; positions restart at each sequence.
+  const size_t begin = tile.begin;
+  const size_t first_row = tile.first_row;
+  const size_t num_tile_rows = std::min(kQueryTile, tile.end - first_row);
+  const size_t end_key = ctx->causal ? first_row + num_tile_rows : tile.end;
+  const float score_scale = 1.0f / sqrtf(static_cast<float>(head_dim));
+  const float* query = ctx->query + head * head_dim;
+  const float* key = ctx->key + kv_head * head_dim;
+  const float* value = ctx->value + kv_head * head_dim;
+
+  // Reused by every task on this thread: transposed keys [head_dim, kKeyTile],
+  // scores [kQueryTile, kKeyTile], scaled queries and accumulators
+  // [kQueryTile, head_dim] each, and one rotated key [head_dim].
+  thread_local std::vector<float> scratch;
+  scratch.resize(head_dim * kKeyTile + kQueryTile * kKeyTile + 2 * kQueryTile * head_dim + head_dim);
+  float* key_t = scratch.data();
+  float* scores = key_t + head_dim * kKeyTile;
+  float* queries = scores + kQueryTile * kKeyTile;
+  float* accumulators = queries + kQueryTile * head_dim;
+  float* rotated_key = accumulators + kQueryTile * head_dim;
+  float max_score[kQueryTile];
+  float denominator[kQueryTile];
+  std::fill(accumulators, accumulators + num_tile_rows * head_dim, 0.0f);
+  std::fill(max_score, max_score + num_tile_rows, -INFINITY);
+  std::fill(denominator, denominator + num_tile_rows, 0.0f);
+  for (size_t i = 0; i < num_tile_rows; ++i) {
+    const float* q = query + (first_row + i) * stride;
+    float* scaled = queries + i * head_dim;
+    if (ctx->rope != NULL) {
+      swiglu_rope_rotate(ctx->rope, first_row + i - begin, q, scaled);
+      q = scaled;
+    }
+    for (size_t d = 0; d < head_dim; ++d) {
+      scaled[d] = q[d] * score_scale;
+    }
+  }
+
+  for (size_t first_key = begin; first_key < end_key; first_key += kKeyTile) {
+    const size_t num_keys = std::min(kKeyTile, end_key - first_key);
+    for (size_t j = 0; j < num_keys; ++j) {
+      // Keys are rotated as they are transposed, like queries as they are scaled, so
+      // the projection output is read once and never rewritten.
+      const float* k = key + (first_key + j) * stride;
+      if (ctx->rope != NULL) {
+        swiglu_rope_rotate(ctx->rope, first_key + j - begin, k, rotated_key);
+        k = rotated_key;
+      }
+      for (size_t d = 0; d < head_dim; ++d) {
+        key_t[d * kKeyTile + j] = k[d];
+      }
+    }
+
+    for (size_t i = 0; i < num_tile_rows; ++i) {
+      const float* q = queries + i * head_dim;
+      float* s = scores + i * kKeyTile;
+      std::fill(s, s + num_keys, 0.0f);
+      for (size_t d = 0; d < head_dim; ++d) {
+        const float qd = q[d];
+        const float* kt = key_t + d * kKeyTile;
+        for (size_t j = 0; j < num_keys; ++j) {
+          s[j] += qd * kt[j];
+        }
+      }
+      if (ctx->causal) {
+        // Keys after row first_row + i; never all of them, as the sequence's first key
+        // is in the first tile.
+        for (size_t j = first_row + i + 1 > first_key ? first_row + i + 1 - first_key : 0; j < num_keys; ++j) {
+          s[j] = -INFINITY;
+        }
+      }
+
+      float tile_max = max_score[i];
+      for (size_t j = 0; j < num_keys; ++j) {
+        tile_max = std::max(tile_max, s[j]);
+      }
+      float* acc = accumulators + i * head_dim;
+      if (tile_max > max_score[i]) {
+        const float rescale = expf(max_score[i] - tile_max);
+        denominator[i] *= rescale;
+        for (size_t d = 0; d < head_dim; ++d) {
+          acc[d] *= rescale;
+        }
+        max_score[i] = tile_max;
+      }
+      float sum = 0.0f;
+      for (size_t j = 0; j < num_keys; ++j) {
+        s[j] = expf(s[j] - tile_max);
+        sum += s[j];
+      }
+      denominator[i] += sum;
+      for (size_t j = 0; j < num_keys; ++j) {
+        const float p = s[j];
+        const float* v = value + (first_key + j) * stride;
+        for (size_t d = 0; d < head_dim; ++d) {
+          acc[d] += p * v[d];
+        }
+      }
+    }
+  }
+
+  for (size_t i = 0; i < num_tile_rows; ++i) {
+    const float inv_denominator = 1.0f / denominator[i];
+    const float* acc = accumulators + i * head_dim;
+    float* out = ctx->output + (first_row + i) * output_stride + head * head_dim;
+    for (size_t d = 0; d < head_dim; ++d) {
+      out[d] = acc[d] * inv_denominator;
+    }
+  }
+}
+
+static enum xnn_status validate_attention(
+  size_t num_rows,
+  size_t num_heads,
+  size_t num_kv_heads,
+  size_t head_dim,
+  const struct swiglu_rope_table* rope)
+{
+  if (num_heads == 0 || num_kv_heads == 0 || num_heads % num_kv_heads != 0 || head_dim == 0) {
+    fprintf(stderr, "%zu query heads are not a multiple of %zu key/value heads of %zu channels\n",
+            num_heads, num_kv_heads, head_dim);
+    return xnn_status_invalid_parameter;
+  }
+  if (rope != NULL && (num_rows > swiglu_rope_max_len(rope) || head_dim != swiglu_rope_head_dim(rope))) {
+    fprintf(stderr, "%zu rows of head dim %zu do not fit a RoPE table of %zu positions of head dim %zu\n",
+            num_rows, head_dim, swiglu_rope_max_len(rope), swiglu_rope_head_dim(rope));
+    return xnn_status_invalid_parameter;
+  }
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_flash_attention(
+  size_t num_rows,
+  size_t num_heads,
+  size_t num_kv_heads,
+  size_t head_dim,
+  const float* query,
+  const float* key,
+  const float* value,
+  size_t input_stride,
+  bool causal,
+  const struct swiglu_rope_table* rope,
+  float* output,
+  pthreadpool_t threadpool)
+{
+  const size_t offsets[2] = {0, num_rows};
+  return swiglu_flash_attention_varlen(/*num_sequences=*/1, offsets, num_heads, num_kv_heads, head_dim, query, key,
+                                       value, input_stride, causal, rope, output, threadpool);
+}
+
+enum xnn_status swiglu_flash_attention_varlen(
+  size_t num_sequences,
+  const size_t* offsets,
+  size_t num_heads,
+  size_t num_kv_heads,
+  size_t head_dim,
+  const float* query,
+  const float* key,
+  const float* value,
+  size_t input_stride,
+  bool causal,
+  const struct swiglu_rope_table* rope,
+  float* output,
+  pthreadpool_t threadpool)
+{
+  if (offsets[0] != 0) {
+    fprintf(stderr, "varlen offsets must start at 0, not %zu\n", offsets[0]);
+    return xnn_status_invalid_parameter;
+  }
+  size_t max_len = 0;
+  for (size_t s = 0; s < num_sequences; ++s) {
+    if (offsets[s + 1] < offsets[s]) {
+      fprintf(stderr, "varlen offsets must not decrease: offsets[%zu] = %zu after %zu\n", s + 1, offsets[s + 1],
+              offsets[s]);
+      return xnn_status_invalid_parameter;
+    }
+    max_len = std::max(max_len, offsets[s + 1] - offsets[s]);
+  }
+  enum xnn_status status = validate_attention(max_len, num_heads, num_kv_heads, head_dim, rope);
+  if (status != xnn_status_success || max_len == 0) {
+    return status;
+  }
+
+  // Reused by later calls on this thread
+  thread_local std::vector<struct attention_tile> tiles;
+  tiles.clear();
+  for (size_t s = 0; s < num_sequences; ++s) {
+    for (size_t row = offsets[s]; row < offsets[s + 1]; row += kQueryTile) {
+      tiles.push_back({offsets[s], offsets[s + 1], row});
+    }
+  }
+  struct attention_context context = {
+    offsets[num_sequences], num_heads, num_kv_heads, head_dim, query, key, value, input_stride, causal, rope,
+    output, tiles.data()};
+  pthreadpool_parallelize_2d(threadpool, attend_tile, &context, tiles.size(), num_heads, /*flags=*/0);
+  return xnn_status_success;
+}
+
+static void attend_head_naive(void* context, size_t head) {
+  const struct attention_context* ctx = static_cast<const struct attention_context*>(context);
+  const size_t num_rows = ctx->num_rows;
+  const size_t head_dim = ctx->head_dim;
+  const size_t kv_head = head / (ctx->num_heads / ctx->num_kv_heads);
+  const size_t stride = ctx->input_stride;
+  const float score_scale = 1.0f / sqrtf(static_cast<float>(head_dim));
+
+  // Rotated copies of the head's queries and keys, [num_rows, head_dim] each
+  std::vector<float> queries(num_rows * head_dim);
+  std::vector<float> keys(num_rows * head_dim);
+  for (size_t r = 0; r < num_rows; ++r) {
+    const float* q = ctx->query + r * stride + head * head_dim;
+    const float* k = ctx->key + r * stride + kv_head * head_dim;
+    std::copy(q, q + head_dim, &queries[r * head_dim]);
+    std::copy(k, k + head_dim, &keys[r * head_dim]);
+    if (ctx->rope != NULL) {
+      swiglu_rope_rotate(ctx->rope, r, &queries[r * head_dim], &queries[r * head_dim]);
+      swiglu_rope_rotate(ctx->rope, r, &keys[r * head_dim], &keys[r * head_dim]);
+    }
+  }
+
+  std::vector<float> scores(num_rows * num_rows);
+  for (size_t r = 0; r < num_rows; ++r) {
+    const float* q = &queries[r * head_dim];
+    float* s = &scores[r * num_rows];
+    const size_t num_keys = ctx->causal ? r + 1 : num_rows;
+    float max_score = -INFINITY;
+    for (size_t j = 0; j < num_keys; ++j) {
+      const float* k = &keys[j * head_dim];
+      float dot = 0.0f;
+      for (size_t d = 0; d < head_dim; ++d) {
+        dot += q[d] * k[d];
+      }
+      s[j] = dot * score_scale;
+      max_score = std::max(max_score, s[j]);
+    }
+    float sum = 0.0f;
+    for (size_t j = 0; j < num_keys; ++j) {
+      s[j] = expf(s[j] - max_score);
+      sum += s[j];
+    }
+    float* out = ctx->output + r * ctx->num_heads * head_dim + head * head_dim;
+    std::fill(out, out + head_dim, 0.0f);
+    for (size_t j = 0; j < num_keys; ++j) {
+      const float* v = ctx->value + j * stride + kv_head * head_dim;
+      for (size_t d = 0; d < head_dim; ++d) {
+        out[d] += s[j] / sum * v[d];
+      }
+    }
+  }
+}
+
+enum xnn_status swiglu_naive_attention(
+  size_t num_rows,
+  size_t num_heads,
+  size_t num_kv_heads,
+  size_t head_dim,
+  const float* query,
+  const float* key,
+  const float* value,
+  size_t input_stride,
+  bool causal,
+  const struct swiglu_rope_table* rope,
+  float* output,
+  pthreadpool_t threadpool)
+{
+  enum xnn_status status = validate_attention(num_rows, num_heads, num_kv_heads, head_dim, rope);
+  if (status != xnn_status_success || num_rows == 0) {
+    return status;
+  }
+  struct attention_context context = {
+    num_rows, num_heads, num_kv_heads, head_dim, query, key, value, input_stride, causal, rope, output,
+    /*tiles=*/NULL};
+  pthreadpool_parallelize_1d(threadpool, attend_head_naive, &context, num_heads, /*flags=*/0);
+  return xnn_status_success;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file swiglu_attention.h
+ * @brief Tiled (flash-style) multi-head attention for decoder blocks around the FFN
+ *
+ * Computing softmax(Q K^T) V directly materializes a [seq, seq] score matrix per
+ * head, so memory grows with the square of the sequence and the scores make a round
+ * trip through memory. This kernel walks tiles of query rows against tiles of keys
+ * and values with an online softmax: every query row keeps its running maximum,
+ * denominator and weighted sum of values, which are rescaled when the maximum
+ * grows. Only a tile of scores exists at a time, so memory is O(seq), and each key
+ * and value tile is reused by every row of the query tile from cache, which makes
+ * long prefills compute-bound.
+ *
+ * The inner loops are written as unit-stride multiply-adds over a tile (queries are
+ * copied per tile and keys transposed, both rotated for RoPE on the way), which the
+ * compiler vectorizes. Query tiles and heads run in parallel on the thread pool.
+ *
+ * XNNPACK has no public way to add operators to a subgraph, so a decoder block runs
+ * this kernel between two runtimes (see swiglu_decoder.h).
+ */
+#pragma once
+
+#include <stddef.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_rope.h"
+
+/**
+ * @brief Attention of num_rows positions of one sequence to each other
+ *
+ * Row r of query, key and value starts at r * input_stride floats, with num_heads
+ * query heads or num_kv_heads key/value heads of head_dim channels each, so the
+ * three can point into one fused QKV projection output. Query head h reads key and
+ * value head h / (num_heads / num_kv_heads). output is [num_rows, num_heads *
+ * head_dim]. With causal set, row r attends to rows 0 to r only. With rope set,
+ * query and key rows are rotated for positions 0 to num_rows - 1 as tiles load them,
+ * so the projection output is only read.
+ */
+enum xnn_status swiglu_flash_attention(
+  size_t num_rows,
+  size_t num_heads,
+  size_t num_kv_heads,
+  size_t head_dim,
+  const float* query,
+  const float* key,
+  const float* value,
+  size_t input_stride,
+  bool causal,
+  const struct swiglu_rope_table* rope,
+  float* output,
+  pthreadpool_t threadpool);
+
+/**
+ * @brief Attention within each of num_sequences sequences packed back to back
+ *
+ * Sequence s is rows offsets[s] to offsets[s + 1] of query, key, value and output,
+ * so offsets has num_sequences + 1 entries, starting at 0. Rows attend only to rows
+ * of their own sequence, and positions for rope restart at 0 in every sequence.
+ * Otherwise as swiglu_flash_attention, which is this with one sequence.
+ */
+enum xnn_status swiglu_flash_attention_varlen(
+  size_t num_sequences,
+  const size_t* offsets,
+  size_t num_heads,
+  size_t num_kv_heads,
+  size_t head_dim,
+  const float* query,
+  const float* key,
+  const float* value,
+  size_t input_stride,
+  bool causal,
+  const struct swiglu_rope_table* rope,
+  float* output,
+  pthreadpool_t threadpool);
+
+/**
+ * @brief The same attention with the full [num_rows, num_rows] scores of a head
+ *        materialized, as a reference for swiglu_flash_attention
+ */
+enum xnn_status swiglu_naive_attention(
+  size_t num_rows,
+  size_t num_heads,
+  size_t num_kv_heads,
+  size_t head_dim,
+  const float* query,
+  const float* key,
+  const float* value,
+  size_t input_stride,
+  bool causal,
+  const struct swiglu_rope_table* rope,
+  float* output,
+  pthreadpool_t threadpool);
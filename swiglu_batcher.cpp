@@ -0,0 +1,358 @@
+/**
+ * @file swiglu_batcher.cpp
+ * @brief Continuous batching with in-place rows, reshape buckets and chunked prefill
+ *
+ * Row buffers hold max_batch_size decode rows followed by prefill_chunk_size chunk
+ * rows. Steps read rows[current] and write rows[current ^ 1]. Decode rows of
+ * sequences still in prefill, and rows past the active ones, are zero in both
+ * buffers, and a zero row stays zero through SwiGLU.
+ */
+#include "swiglu_batcher.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <new>
+#include <vector>
+
+struct active_sequence {
+  uint64_t id;
+  size_t steps_left;
+  // Prompt rows not yet run; empty once the sequence is decoding
+  std::vector<float> prompt;
+  size_t prefill_pos;
+  // Admission order, which is the order prompts are chunked in
+  uint64_t admitted;
+};
+
+struct queued_sequence {
+  uint64_t id;
+  size_t num_prompt_rows;
+  std::vector<float> prompt;
+  size_t num_steps;
+};
+
+// One prompt row of a chunk and the decode row of its sequence.
+struct chunk_row {
+  size_t row;
+  bool last;
+};
+
+struct swiglu_batcher {
+  struct swiglu_stack* stack;
+  size_t dim;
+  size_t max_batch_size;
+  size_t prefill_chunk_size;
+  swiglu_sequence_done_fn done;
+  void* context;
+  std::deque<queued_sequence> queued;
+  // active[i] owns decode row i of both row buffers.
+  std::vector<active_sequence> active;
+  std::vector<float> rows[2];
+  size_t current = 0;
+  // Batch size the stack was last run at
+  size_t batch_size = 0;
+  uint64_t next_admitted = 0;
+  std::vector<chunk_row> chunk;
+  // Prompts run at once, packed back to back; reused by every step
+  std::vector<size_t> prefilling;
+  std::vector<size_t> prefill_offsets;
+  std::vector<float> prefill_input;
+  std::vector<float> prefill_output;
+  struct swiglu_batcher_stats stats = {};
+};
+
+// Smallest power of two holding num_rows.
+static size_t power_of_two(size_t num_rows) {
+  size_t bucket = 1;
+  while (bucket < num_rows) {
+    bucket *= 2;
+  }
+  return bucket;
+}
+
+// Smallest power of two holding num_rows, capped at max_batch_size.
+static size_t bucket_size(size_t num_rows, size_t max_batch_size) {
+  return std::min(power_of_two(num_rows), max_batch_size);
+}
+
+enum xnn_status swiglu_create_batcher(
+  struct swiglu_stack* stack,
+  size_t max_batch_size,
+  size_t prefill_chunk_size,
+  swiglu_sequence_done_fn done,
+  void* context,
+  struct swiglu_batcher** batcher_out)
+{
+  if (swiglu_stack_input_dim(stack) != swiglu_stack_output_dim(stack)) {
+    fprintf(stderr, "continuous batching feeds outputs back as inputs, but the stack maps %zu to %zu\n",
+            swiglu_stack_input_dim(stack), swiglu_stack_output_dim(stack));
+    return xnn_status_invalid_parameter;
+  }
+  if (max_batch_size == 0) {
+    fprintf(stderr, "the maximum batch size must be at least 1\n");
+    return xnn_status_invalid_parameter;
+  }
+  struct swiglu_batcher* batcher = new (std::nothrow) swiglu_batcher();
+  if (batcher == NULL) {
+    fprintf(stderr, "failed to allocate batcher\n");
+    return xnn_status_out_of_memory;
+  }
+  batcher->stack = stack;
+  batcher->dim = swiglu_stack_input_dim(stack);
+  batcher->max_batch_size = max_batch_size;
+  batcher->prefill_chunk_size = prefill_chunk_size;
+  batcher->done = done;
+  batcher->context = context;
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  for (std::vector<float>& rows : batcher->rows) {
+    rows.assign((max_batch_size + prefill_chunk_size) * batcher->dim + XNN_EXTRA_BYTES / sizeof(float), 0.0f);
+  }
+  *batcher_out = batcher;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_batcher_add(
+  struct swiglu_batcher* batcher,
+  uint64_t id,
+  size_t num_prompt_rows,
+  const float* prompt,
+  size_t num_steps)
+{
+  if (num_prompt_rows == 0) {
+    fprintf(stderr, "sequence %llu has an empty prompt\n", static_cast<unsigned long long>(id));
+    return xnn_status_invalid_parameter;
+  }
+  batcher->queued.push_back(
+    {id, num_prompt_rows, std::vector<float>(prompt, prompt + num_prompt_rows * batcher->dim), num_steps});
+  return xnn_status_success;
+}
+
+static float* row(struct swiglu_batcher* batcher, size_t buffer, size_t i) {
+  return batcher->rows[buffer].data() + i * batcher->dim;
+}
+
+// Moves the last active sequence into row i, which has finished, and zeroes the last row.
+static void remove_row(struct swiglu_batcher* batcher, size_t i) {
+  const size_t last = batcher->active.size() - 1;
+  if (i != last) {
+    memcpy(row(batcher, batcher->current, i), row(batcher, batcher->current, last), batcher->dim * sizeof(float));
+    batcher->active[i] = std::move(batcher->active[last]);
+  }
+  for (size_t buffer = 0; buffer < 2; ++buffer) {
+    memset(row(batcher, buffer, last), 0, batcher->dim * sizeof(float));
+  }
+  batcher->active.pop_back();
+}
+
+// Counts a reshape if the stack is about to run at a new batch size.
+static void track_batch_size(struct swiglu_batcher* batcher, size_t batch_size) {
+  if (batch_size != batcher->batch_size) {
+    batcher->stats.reshapes++;
+    batcher->batch_size = batch_size;
+  }
+}
+
+// Runs the prompts of sequences admitted from row first on as one batch of their rows
+// back to back, and leaves each one's last output in its decode row. The layers work
+// on every row on its own, so the prompts need no padding to the longest one.
+static enum xnn_status prefill_admitted(struct swiglu_batcher* batcher, size_t first) {
+  std::vector<size_t>& prefilling = batcher->prefilling;
+  std::vector<size_t>& offsets = batcher->prefill_offsets;
+  prefilling.clear();
+  offsets.assign(1, 0);
+  for (size_t i = first; i < batcher->active.size(); ++i) {
+    if (!batcher->active[i].prompt.empty()) {
+      prefilling.push_back(i);
+      offsets.push_back(offsets.back() + batcher->active[i].prompt.size() / batcher->dim);
+    }
+  }
+  if (prefilling.empty()) {
+    return xnn_status_success;
+  }
+  // Exactly the prompt rows: padding would be pure waste, and a reshape is cheap next
+  // to a long prefill.
+  const size_t num_rows = offsets.back();
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  const size_t input_size = num_rows * batcher->dim + XNN_EXTRA_BYTES / sizeof(float);
+  if (batcher->prefill_input.size() < input_size) {
+    batcher->prefill_input.resize(input_size);
+    batcher->prefill_output.resize(num_rows * batcher->dim);
+  }
+  for (size_t s = 0; s < prefilling.size(); ++s) {
+    const std::vector<float>& prompt = batcher->active[prefilling[s]].prompt;
+    std::copy(prompt.begin(), prompt.end(), batcher->prefill_input.begin() + offsets[s] * batcher->dim);
+  }
+  track_batch_size(batcher, num_rows);
+  enum xnn_status status =
+    swiglu_run_stack(batcher->stack, num_rows, batcher->prefill_input.data(), batcher->prefill_output.data());
+  if (status != xnn_status_success) {
+    return status;
+  }
+  const std::vector<float>& output = batcher->prefill_output;
+  batcher->stats.prefill_rows += num_rows;
+
+  // Backwards, so the row moved into a finished one has already been handled.
+  for (size_t s = prefilling.size(); s-- > 0;) {
+    const size_t i = prefilling[s];
+    active_sequence& sequence = batcher->active[i];
+    memcpy(row(batcher, batcher->current, i), output.data() + (offsets[s + 1] - 1) * batcher->dim,
+           batcher->dim * sizeof(float));
+    sequence.prompt.clear();
+    if (--sequence.steps_left == 0) {
+      batcher->done(batcher->context, sequence.id, xnn_status_success, row(batcher, batcher->current, i));
+      batcher->stats.completed++;
+      remove_row(batcher, i);
+    }
+  }
+  return xnn_status_success;
+}
+
+static enum xnn_status admit(struct swiglu_batcher* batcher) {
+  const size_t first = batcher->active.size();
+  while (!batcher->queued.empty() && batcher->active.size() < batcher->max_batch_size) {
+    queued_sequence& queued = batcher->queued.front();
+    if (queued.num_steps == 0) {
+      batcher->done(batcher->context, queued.id, xnn_status_success,
+                    queued.prompt.data() + (queued.num_prompt_rows - 1) * batcher->dim);
+      batcher->stats.completed++;
+      batcher->queued.pop_front();
+      continue;
+    }
+
+    const size_t i = batcher->active.size();
+    batcher->active.push_back({queued.id, queued.num_steps, {}, 0, batcher->next_admitted++});
+    if (queued.num_prompt_rows == 1) {
+      // A one-row prompt is just a first decode step.
+      memcpy(row(batcher, batcher->current, i), queued.prompt.data(), batcher->dim * sizeof(float));
+    } else {
+      batcher->active.back().prompt = std::move(queued.prompt);
+    }
+    batcher->queued.pop_front();
+  }
+  return batcher->prefill_chunk_size == 0 ? prefill_admitted(batcher, first) : xnn_status_success;
+}
+
+// Copies the next prompt rows, oldest sequence first, into the chunk rows.
+static void fill_chunk(struct swiglu_batcher* batcher) {
+  std::vector<size_t> prefilling;
+  for (size_t i = 0; i < batcher->active.size(); ++i) {
+    if (!batcher->active[i].prompt.empty()) {
+      prefilling.push_back(i);
+    }
+  }
+  std::sort(prefilling.begin(), prefilling.end(), [batcher](size_t a, size_t b) {
+    return batcher->active[a].admitted < batcher->active[b].admitted;
+  });
+
+  batcher->chunk.clear();
+  for (size_t i : prefilling) {
+    active_sequence& sequence = batcher->active[i];
+    const size_t num_rows = sequence.prompt.size() / batcher->dim;
+    while (sequence.prefill_pos < num_rows && batcher->chunk.size() < batcher->prefill_chunk_size) {
+      memcpy(row(batcher, batcher->current, batcher->max_batch_size + batcher->chunk.size()),
+             sequence.prompt.data() + sequence.prefill_pos * batcher->dim, batcher->dim * sizeof(float));
+      sequence.prefill_pos++;
+      batcher->chunk.push_back({i, sequence.prefill_pos == num_rows});
+    }
+  }
+  for (size_t c = batcher->chunk.size(); c < batcher->prefill_chunk_size; ++c) {
+    memset(row(batcher, batcher->current, batcher->max_batch_size + c), 0, batcher->dim * sizeof(float));
+  }
+}
+
+static void fail_active(struct swiglu_batcher* batcher, enum xnn_status status) {
+  for (const active_sequence& sequence : batcher->active) {
+    batcher->done(batcher->context, sequence.id, status, NULL);
+  }
+  batcher->active.clear();
+  for (std::vector<float>& rows : batcher->rows) {
+    std::fill(rows.begin(), rows.end(), 0.0f);
+  }
+}
+
+enum xnn_status swiglu_batcher_step(struct swiglu_batcher* batcher) {
+  enum xnn_status status = admit(batcher);
+  if (status != xnn_status_success) {
+    fail_active(batcher, status);
+    return status;
+  }
+  if (batcher->active.empty()) {
+    return xnn_status_success;
+  }
+
+  // Sequences decoding in this step. One-shot prefill has already run in admit, so
+  // only a chunked prompt is still pending here; its sequence starts decoding the
+  // step after its last chunk.
+  std::vector<bool> decoding(batcher->active.size());
+  size_t num_decoding = 0;
+  for (size_t i = 0; i < batcher->active.size(); ++i) {
+    decoding[i] = batcher->active[i].prompt.empty();
+    num_decoding += decoding[i];
+  }
+
+  // Chunked batches take one of two fixed sizes: the decode rows alone while no
+  // prompt rows are pending, so decode steps do not pay for an empty chunk, and the
+  // decode rows plus the chunk while some are.
+  size_t batch_size;
+  if (batcher->prefill_chunk_size == 0) {
+    batch_size = bucket_size(batcher->active.size(), batcher->max_batch_size);
+  } else if (num_decoding == batcher->active.size()) {
+    batcher->chunk.clear();
+    batch_size = batcher->max_batch_size;
+  } else {
+    fill_chunk(batcher);
+    batch_size = batcher->max_batch_size + batcher->prefill_chunk_size;
+  }
+  track_batch_size(batcher, batch_size);
+  status = swiglu_run_stack(batcher->stack, batch_size, row(batcher, batcher->current, 0), row(batcher, batcher->current ^ 1, 0));
+  if (status != xnn_status_success) {
+    fail_active(batcher, status);
+    return status;
+  }
+  batcher->current ^= 1;
+  batcher->stats.steps++;
+  batcher->stats.rows += num_decoding;
+  batcher->stats.padded_rows += batch_size - num_decoding - batcher->chunk.size();
+
+  if (batcher->prefill_chunk_size != 0) {
+    for (size_t c = 0; c < batcher->chunk.size(); ++c) {
+      if (batcher->chunk[c].last) {
+        // The last prompt row's output is the first decode input.
+        const size_t i = batcher->chunk[c].row;
+        memcpy(row(batcher, batcher->current, i), row(batcher, batcher->current, batcher->max_batch_size + c),
+               batcher->dim * sizeof(float));
+        batcher->active[i].prompt.clear();
+        batcher->active[i].steps_left--;
+      }
+    }
+    batcher->stats.prefill_rows += batcher->chunk.size();
+  }
+
+  // Backwards, so the row moved into a finished one has already been handled.
+  for (size_t i = batcher->active.size(); i-- > 0;) {
+    active_sequence& sequence = batcher->active[i];
+    if (decoding[i]) {
+      sequence.steps_left--;
+    }
+    if (sequence.prompt.empty() && sequence.steps_left == 0) {
+      batcher->done(batcher->context, sequence.id, xnn_status_success, row(batcher, batcher->current, i));
+      batcher->stats.completed++;
+      remove_row(batcher, i);
+    }
+  }
+  return xnn_status_success;
+}
+
+bool swiglu_batcher_idle(const struct swiglu_batcher* batcher) {
+  return batcher->active.empty() && batcher->queued.empty();
+}
+
+struct swiglu_batcher_stats swiglu_batcher_stats(const struct swiglu_batcher* batcher) {
+  return batcher->stats;
+}
+
+void swiglu_delete_batcher(struct swiglu_batcher* batcher) {
+  delete batcher;
+}
@@ -0,0 +1,91 @@
+/**
+ * @file swiglu_batcher.h
+ * @brief Continuous batching of multi-step sequences through a SwiGLU stack
+ *
+ * A sequence has a prompt of one or more rows and is run for num_steps steps, as in
+ * decoding. The first step is prefill: every prompt row goes through the stack once,
+ * and the output of the last one is the sequence's first output. Every later step
+ * runs the previous output through the stack again. The batcher runs one step of
+ * every active sequence per call: new sequences join the batch at any step and
+ * finished ones leave it right away, instead of the whole batch waiting for its
+ * longest member.
+ *
+ * Each active sequence owns one decode row of the batch buffers for as long as it
+ * runs, so steps run in place without gathering rows.
+ *
+ * Without prefill chunking, the prompts admitted in a step run before it as one
+ * batch of exactly their rows back to back, and decoding sequences wait for them.
+ * Decode batches are padded with zero rows up to a power-of-two bucket, so the
+ * runtimes are reshaped only when the batch crosses a bucket boundary.
+ *
+ * With a prefill chunk size, every step runs the max_batch_size decode rows, plus a
+ * chunk of chunk_size rows holding the next prompt rows of sequences still in
+ * prefill while there are any. Batches thus take one of two fixed sizes, so the
+ * runtimes are reshaped only when prefill starts or ends, decode steps without
+ * prompts pay for no chunk, and a long prompt delays each decode step by at most one
+ * chunk.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <xnnpack.h>
+
+#include "swiglu_stack.h"
+
+// Called when a sequence finishes. output is its final row, NULL if status is an error.
+typedef void (*swiglu_sequence_done_fn)(void* context, uint64_t id, enum xnn_status status, const float* output);
+
+struct swiglu_batcher_stats {
+  size_t steps;
+  // Decode rows of real sequences run, and zero rows run as padding of the decode
+  // rows or a chunk
+  size_t rows;
+  size_t padded_rows;
+  // Prompt rows run
+  size_t prefill_rows;
+  // Times the runtimes were reshaped for a new batch size
+  size_t reshapes;
+  size_t completed;
+};
+
+struct swiglu_batcher;
+
+/**
+ * @brief Creates a batcher running at most max_batch_size sequences per step
+ *
+ * prefill_chunk_size is the number of prompt rows run alongside each decode step,
+ * 0 to run every prompt at once. The stack's input and output dims must be equal.
+ * done is called from swiglu_batcher_step with context.
+ */
+enum xnn_status swiglu_create_batcher(
+  struct swiglu_stack* stack,
+  size_t max_batch_size,
+  size_t prefill_chunk_size,
+  swiglu_sequence_done_fn done,
+  void* context,
+  struct swiglu_batcher** batcher_out);
+
+/**
+ * @brief Queues a sequence; it joins the batch at the next step with a free row
+ *
+ * prompt is [num_prompt_rows, dim] and is copied; num_prompt_rows must be at least
+ * 1. With num_steps 0 the sequence finishes right away with its last prompt row as
+ * output.
+ */
+enum xnn_status swiglu_batcher_add(
+  struct swiglu_batcher* batcher,
+  uint64_t id,
+  size_t num_prompt_rows,
+  const float* prompt,
+  size_t num_steps);
+
+// Runs one step of every active sequence after admitting queued ones.
+enum xnn_status swiglu_batcher_step(struct swiglu_batcher* batcher);
+
+// True if no sequence is active or queued.
+bool swiglu_batcher_idle(const struct swiglu_batcher* batcher);
+
+struct swiglu_batcher_stats swiglu_batcher_stats(const struct swiglu_batcher* batcher);
+
+void swiglu_delete_batcher(struct swiglu_batcher* batcher);
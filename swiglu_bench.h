@@ -0,0 +1,23 @@
+/**
+ * @file swiglu_bench.h
+ * @brief Timing helpers shared by the benchmark programs
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+static inline double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// p-th percentile (0 to 100) of samples, by nearest rank.
+static inline double percentile(std::vector<double> samples, double p) {
+  if (samples.empty()) {
+    return 0.0;
+  }
+  std::sort(samples.begin(), samples.end());
+  const size_t rank = static_cast<size_t>(p / 100.0 * (samples.size() - 1) + 0.5);
+  return samples[std::min(rank, samples.size() - 1)];
+}
@@ -0,0 +1,419 @@
+/**
+ * @file swiglu_branch.cpp
+ * @brief Gate and up branches on disjoint thread pools, joined before the down projection
+ *
+ * The gate and up runtimes of a layer run at the same time, so they cannot share a
+ * workspace; every runtime here has its own. Each branch is handed to a helper
+ * thread that lives as long as the stack and drives that branch's pool, so a run
+ * starts no threads and the calling thread only forks, joins and runs the down
+ * projection.
+ */
+#include "swiglu_branch.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "swiglu_weights_cache.h"
+
+struct branch_runtime {
+  xnn_runtime_t runtime = NULL;
+  // Batch size the runtime is currently reshaped for, 0 before the first run.
+  size_t batch_size = 0;
+};
+
+struct branch_layer {
+  struct swiglu_layer_weights weights;
+  branch_runtime gate;
+  branch_runtime up;
+  branch_runtime down;
+};
+
+// A helper thread and the pool it runs one branch on, pinned to cpus.
+struct branch_helper {
+  pthreadpool_t threadpool = NULL;
+  std::vector<int> cpus;
+  std::thread thread;
+  // Invoked whenever set, then cleared
+  xnn_runtime_t job = NULL;
+  enum xnn_status status = xnn_status_success;
+};
+
+struct swiglu_branch_stack {
+  std::vector<branch_layer> layers;
+  struct swiglu_weights_cache* weights_cache = NULL;
+  pthreadpool_t threadpool = NULL;
+  // Gate and up helpers; without threads, when the budget is one thread
+  branch_helper helpers[2];
+  // Branch outputs, [batch_size, inter_dim], and ping-pong activations between
+  // layers. All of them are inputs to a runtime, so they carry XNN_EXTRA_BYTES.
+  std::vector<float> gate_output;
+  std::vector<float> up_output;
+  std::vector<float> activations[2];
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stop = false;
+};
+
+static void pin_to(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+    fprintf(stderr, "failed to pin a branch thread to %zu CPUs\n", cpus.size());
+  }
+}
+
+struct pin_context {
+  const std::vector<int>* cpus;
+  size_t num_threads;
+  std::atomic<size_t> started;
+};
+
+// Pins the pool thread running it. Every task waits until all have started, so each
+// of the pool's threads runs exactly one of them.
+static void pin_pool_thread(void* context, size_t) {
+  struct pin_context* ctx = static_cast<struct pin_context*>(context);
+  pin_to(*ctx->cpus);
+  ctx->started.fetch_add(1);
+  while (ctx->started.load() < ctx->num_threads) {
+    std::this_thread::yield();
+  }
+}
+
+static void run_helper(struct swiglu_branch_stack* stack, branch_helper* helper) {
+  if (!helper->cpus.empty()) {
+    pin_to(helper->cpus);
+    struct pin_context context = {&helper->cpus, pthreadpool_get_threads_count(helper->threadpool), {0}};
+    pthreadpool_parallelize_1d(helper->threadpool, pin_pool_thread, &context, context.num_threads, /*flags=*/0);
+  }
+  std::unique_lock<std::mutex> lock(stack->mutex);
+  for (;;) {
+    stack->cv.wait(lock, [stack, helper] { return stack->stop || helper->job != NULL; });
+    if (helper->job == NULL) {
+      return;
+    }
+    xnn_runtime_t runtime = helper->job;
+    lock.unlock();
+    const enum xnn_status status = xnn_invoke_runtime(runtime);
+    lock.lock();
+    helper->status = status;
+    helper->job = NULL;
+    stack->cv.notify_all();
+  }
+}
+
+// The CPUs this process may run on, empty if they cannot be read.
+static std::vector<int> allowed_cpus() {
+  std::vector<int> cpus;
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    fprintf(stderr, "sched_getaffinity failed; branch threads are not pinned\n");
+    return cpus;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+static enum xnn_status create_branch_runtime(
+  struct swiglu_branch_stack* stack,
+  size_t i,
+  enum swiglu_branch branch,
+  pthreadpool_t threadpool,
+  branch_runtime* runtime)
+{
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = swiglu_define_branch(&stack->layers[i].weights, branch, &subgraph);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  status = xnn_create_runtime_v4(
+    subgraph,
+    /*weights_cache=*/swiglu_weights_cache_provider(stack->weights_cache),
+    /*workspace=*/NULL,
+    /*threadpool=*/threadpool,
+    // The branch pools and the down pool take turns; parked workers leave the CPUs
+    // to the other side.
+    /*flags=*/XNN_FLAG_YIELD_WORKERS,
+    &runtime->runtime);
+  xnn_delete_subgraph(subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_runtime_v4 failed for branch %d of layer %zu: %d\n", branch, i, status);
+  }
+  return status;
+}
+
+struct external_shape {
+  uint32_t id;
+  size_t cols;
+};
+
+static enum xnn_status reshape_branch(
+  branch_runtime* runtime,
+  size_t batch_size,
+  const std::vector<external_shape>& externals)
+{
+  if (runtime->batch_size == batch_size) {
+    return xnn_status_success;
+  }
+  for (const external_shape& external : externals) {
+    const size_t dims[2] = {batch_size, external.cols};
+    enum xnn_status status = xnn_reshape_external_value(runtime->runtime, external.id, 2, dims);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "xnn_reshape_external_value failed: %d\n", status);
+      return status;
+    }
+  }
+  enum xnn_status status = xnn_reshape_runtime(runtime->runtime);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_reshape_runtime failed: %d\n", status);
+    return status;
+  }
+  runtime->batch_size = batch_size;
+  return xnn_status_success;
+}
+
+static enum xnn_status setup_branch(
+  branch_runtime* runtime,
+  size_t num_external_values,
+  const struct xnn_external_value* external_values)
+{
+  enum xnn_status status = xnn_setup_runtime_v2(runtime->runtime, num_external_values, external_values);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_setup_runtime_v2 failed: %d\n", status);
+  }
+  return status;
+}
+
+enum xnn_status swiglu_create_branch_stack(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  pthreadpool_t threadpool,
+  struct swiglu_branch_stack** stack_out)
+{
+  if (num_layers == 0) {
+    fprintf(stderr, "a SwiGLU stack needs at least one layer\n");
+    return xnn_status_invalid_parameter;
+  }
+  for (size_t i = 0; i + 1 < num_layers; ++i) {
+    if (layers[i].output_dim != layers[i + 1].input_dim) {
+      fprintf(stderr, "layer %zu output dim %zu does not match layer %zu input dim %zu\n",
+              i, layers[i].output_dim, i + 1, layers[i + 1].input_dim);
+      return xnn_status_invalid_parameter;
+    }
+  }
+
+  struct swiglu_branch_stack* stack = new (std::nothrow) swiglu_branch_stack();
+  if (stack == NULL) {
+    fprintf(stderr, "failed to allocate SwiGLU branch stack\n");
+    return xnn_status_out_of_memory;
+  }
+  stack->threadpool = threadpool;
+  stack->layers.resize(num_layers);
+
+  enum xnn_status status = swiglu_create_weights_cache(&stack->weights_cache);
+  if (status != xnn_status_success) {
+    swiglu_delete_branch_stack(stack);
+    return status;
+  }
+  const size_t num_threads = threadpool != NULL ? pthreadpool_get_threads_count(threadpool) : 1;
+  const bool split = num_threads > 1;
+  if (split) {
+    // Gate gets the odd thread; its helper thread is the first of its pool's threads.
+    const size_t branch_threads[2] = {(num_threads + 1) / 2, num_threads / 2};
+    const std::vector<int> cpus = allowed_cpus();
+    for (size_t b = 0; b < 2; ++b) {
+      branch_helper& helper = stack->helpers[b];
+      if (branch_threads[b] > 1) {
+        helper.threadpool = pthreadpool_create(branch_threads[b]);
+        if (helper.threadpool == NULL) {
+          fprintf(stderr, "pthreadpool_create failed\n");
+          swiglu_delete_branch_stack(stack);
+          return xnn_status_out_of_memory;
+        }
+      }
+      // Halves of the allowed CPUs, in the same proportion as the threads
+      if (cpus.size() > 1) {
+        const size_t first = b == 0 ? 0 : cpus.size() * branch_threads[0] / num_threads;
+        const size_t last = b == 0 ? cpus.size() * branch_threads[0] / num_threads : cpus.size();
+        helper.cpus.assign(cpus.begin() + first, cpus.begin() + last);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < num_layers; ++i) {
+    branch_layer& layer = stack->layers[i];
+    layer.weights = layers[i];
+    if ((status = create_branch_runtime(stack, i, swiglu_branch_gate, split ? stack->helpers[0].threadpool : threadpool,
+                                        &layer.gate)) != xnn_status_success ||
+        (status = create_branch_runtime(stack, i, swiglu_branch_up, split ? stack->helpers[1].threadpool : threadpool,
+                                        &layer.up)) != xnn_status_success ||
+        (status = create_branch_runtime(stack, i, swiglu_branch_down, threadpool, &layer.down)) !=
+          xnn_status_success) {
+      swiglu_delete_branch_stack(stack);
+      return status;
+    }
+  }
+  swiglu_finalize_weights_cache(stack->weights_cache);
+  if (split) {
+    for (branch_helper& helper : stack->helpers) {
+      helper.thread = std::thread(run_helper, stack, &helper);
+    }
+  }
+
+  *stack_out = stack;
+  return xnn_status_success;
+}
+
+static enum xnn_status run_layer(
+  struct swiglu_branch_stack* stack,
+  branch_layer& layer,
+  size_t batch_size,
+  const float* input,
+  float* output)
+{
+  const size_t input_dim = layer.weights.input_dim;
+  const size_t inter_dim = layer.weights.inter_dim;
+  const size_t output_dim = layer.weights.output_dim;
+  enum xnn_status status;
+  if ((status = reshape_branch(&layer.gate, batch_size,
+                               {{SWIGLU_INPUT_EXTERNAL_ID, input_dim}, {SWIGLU_OUTPUT_EXTERNAL_ID, inter_dim}})) !=
+        xnn_status_success ||
+      (status = reshape_branch(&layer.up, batch_size,
+                               {{SWIGLU_INPUT_EXTERNAL_ID, input_dim}, {SWIGLU_OUTPUT_EXTERNAL_ID, inter_dim}})) !=
+        xnn_status_success ||
+      (status = reshape_branch(&layer.down, batch_size,
+                               {{SWIGLU_DOWN_SILU_EXTERNAL_ID, inter_dim},
+                                {SWIGLU_DOWN_UP_EXTERNAL_ID, inter_dim},
+                                {SWIGLU_DOWN_OUTPUT_EXTERNAL_ID, output_dim}})) != xnn_status_success) {
+    return status;
+  }
+
+  const struct xnn_external_value gate_values[SWIGLU_NUM_EXTERNAL_VALUES] = {
+    {SWIGLU_INPUT_EXTERNAL_ID, const_cast<float*>(input)},
+    {SWIGLU_OUTPUT_EXTERNAL_ID, stack->gate_output.data()},
+  };
+  const struct xnn_external_value up_values[SWIGLU_NUM_EXTERNAL_VALUES] = {
+    {SWIGLU_INPUT_EXTERNAL_ID, const_cast<float*>(input)},
+    {SWIGLU_OUTPUT_EXTERNAL_ID, stack->up_output.data()},
+  };
+  const struct xnn_external_value down_values[SWIGLU_DOWN_NUM_EXTERNAL_VALUES] = {
+    {SWIGLU_DOWN_SILU_EXTERNAL_ID, stack->gate_output.data()},
+    {SWIGLU_DOWN_OUTPUT_EXTERNAL_ID, output},
+    {SWIGLU_DOWN_UP_EXTERNAL_ID, stack->up_output.data()},
+  };
+  if ((status = setup_branch(&layer.gate, SWIGLU_NUM_EXTERNAL_VALUES, gate_values)) != xnn_status_success ||
+      (status = setup_branch(&layer.up, SWIGLU_NUM_EXTERNAL_VALUES, up_values)) != xnn_status_success ||
+      (status = setup_branch(&layer.down, SWIGLU_DOWN_NUM_EXTERNAL_VALUES, down_values)) != xnn_status_success) {
+    return status;
+  }
+
+  enum xnn_status gate_status;
+  enum xnn_status up_status;
+  if (stack->helpers[0].thread.joinable()) {
+    // Fork both branches to their helpers, and join.
+    std::unique_lock<std::mutex> lock(stack->mutex);
+    stack->helpers[0].job = layer.gate.runtime;
+    stack->helpers[1].job = layer.up.runtime;
+    stack->cv.notify_all();
+    stack->cv.wait(lock, [stack] { return stack->helpers[0].job == NULL && stack->helpers[1].job == NULL; });
+    gate_status = stack->helpers[0].status;
+    up_status = stack->helpers[1].status;
+  } else {
+    gate_status = xnn_invoke_runtime(layer.gate.runtime);
+    up_status = xnn_invoke_runtime(layer.up.runtime);
+  }
+  if (gate_status != xnn_status_success || up_status != xnn_status_success) {
+    fprintf(stderr, "xnn_invoke_runtime failed: gate %d, up %d\n", gate_status, up_status);
+    return gate_status != xnn_status_success ? gate_status : up_status;
+  }
+
+  status = xnn_invoke_runtime(layer.down.runtime);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_invoke_runtime failed: %d\n", status);
+  }
+  return status;
+}
+
+enum xnn_status swiglu_run_branch_stack(
+  struct swiglu_branch_stack* stack,
+  size_t batch_size,
+  const float* input,
+  float* output)
+{
+  size_t max_inter_dim = 0;
+  size_t max_output_dim = 0;
+  for (const branch_layer& layer : stack->layers) {
+    max_inter_dim = std::max(max_inter_dim, layer.weights.inter_dim);
+    max_output_dim = std::max(max_output_dim, layer.weights.output_dim);
+  }
+  const size_t extra = XNN_EXTRA_BYTES / sizeof(float);
+  for (std::vector<float>* branch_output : {&stack->gate_output, &stack->up_output}) {
+    if (branch_output->size() < batch_size * max_inter_dim + extra) {
+      branch_output->resize(batch_size * max_inter_dim + extra);
+    }
+  }
+  for (std::vector<float>& activations : stack->activations) {
+    if (activations.size() < batch_size * max_output_dim + extra) {
+      activations.resize(batch_size * max_output_dim + extra);
+    }
+  }
+
+  const float* layer_input = input;
+  for (size_t i = 0; i < stack->layers.size(); ++i) {
+    float* layer_output = i + 1 == stack->layers.size() ? output : stack->activations[i % 2].data();
+    enum xnn_status status = run_layer(stack, stack->layers[i], batch_size, layer_input, layer_output);
+    if (status != xnn_status_success) {
+      return status;
+    }
+    layer_input = layer_output;
+  }
+  return xnn_status_success;
+}
+
+size_t swiglu_branch_stack_packed_size(struct swiglu_branch_stack* stack) {
+  return swiglu_weights_cache_size(stack->weights_cache);
+}
+
+void swiglu_delete_branch_stack(struct swiglu_branch_stack* stack) {
+  {
+    std::lock_guard<std::mutex> lock(stack->mutex);
+    stack->stop = true;
+  }
+  stack->cv.notify_all();
+  for (branch_helper& helper : stack->helpers) {
+    if (helper.thread.joinable()) {
+      helper.thread.join();
+    }
+  }
+  for (branch_layer& layer : stack->layers) {
+    for (branch_runtime* runtime : {&layer.gate, &layer.up, &layer.down}) {
+      if (runtime->runtime != NULL) {
+        xnn_delete_runtime(runtime->runtime);
+      }
+    }
+  }
+  for (branch_helper& helper : stack->helpers) {
+    if (helper.threadpool != NULL) {
+      pthreadpool_destroy(helper.threadpool);
+    }
+  }
+  if (stack->weights_cache != NULL) {
+    swiglu_delete_weights_cache(stack->weights_cache);
+  }
+  delete stack;
+}
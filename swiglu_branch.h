@@ -0,0 +1,56 @@
+/**
+ * @file swiglu_branch.h
+ * @brief A stack of SwiGLU layers that runs the gate and up projections concurrently
+ *
+ * The gate (SiLU(W1 @ x)) and up (W3 @ x) projections of a layer only depend on the
+ * layer input, and XNNPACK runs them one after the other, each spread over the whole
+ * thread pool. At small batch sizes neither has enough work to keep every thread
+ * busy. The branch stack splits each layer into three runtimes (see
+ * swiglu_define_branch): the gate and up branches run at the same time on two
+ * thread pools that split the caller's thread budget between them, each driven by
+ * a helper thread, and once both are done the down projection runs on the full
+ * thread pool. Only one of the two phases runs at a time, and every runtime lets its
+ * workers sleep when it returns (XNN_FLAG_YIELD_WORKERS), so the idle phase's
+ * threads do not spin against the busy one's.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_layer.h"
+
+struct swiglu_branch_stack;
+
+/**
+ * @brief Creates a stack of num_layers SwiGLU layers with parallel gate and up branches
+ *
+ * The down projection runs on threadpool, which may be NULL. Its T threads are the
+ * budget the branches split: the gate branch gets a pool of (T + 1) / 2 threads and
+ * the up branch one of T / 2, and each pool and its helper thread are pinned to
+ * their own half of the CPUs the process may run on. With one thread the branches
+ * run one after the other on the calling thread. layers[i].output_dim must equal
+ * layers[i + 1].input_dim, and the weights must outlive the stack.
+ */
+enum xnn_status swiglu_create_branch_stack(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  pthreadpool_t threadpool,
+  struct swiglu_branch_stack** stack_out);
+
+/**
+ * @brief Runs batch_size rows through every layer, as swiglu_run_stack does
+ *
+ * input must be readable XNN_EXTRA_BYTES past its last row.
+ */
+enum xnn_status swiglu_run_branch_stack(
+  struct swiglu_branch_stack* stack,
+  size_t batch_size,
+  const float* input,
+  float* output);
+
+// Bytes of weights the stack has packed.
+size_t swiglu_branch_stack_packed_size(struct swiglu_branch_stack* stack);
+
+void swiglu_delete_branch_stack(struct swiglu_branch_stack* stack);
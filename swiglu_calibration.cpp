@@ -0,0 +1,558 @@
+/**
+ * @file swiglu_calibration.cpp
+ * @brief Calibration runtimes and growing activation histograms
+ */
+#include "swiglu_calibration.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "swiglu_weights_cache.h"
+
+static const size_t kBins = 4096;
+
+struct histogram {
+  float min_value = INFINITY;
+  float max_value = -INFINITY;
+  // Bins cover [-bound, bound); 0 until the first value is added.
+  float bound = 0.0f;
+  std::vector<uint64_t> counts = std::vector<uint64_t>(kBins);
+  // Finite values binned, and infinities and NaNs left out
+  uint64_t total = 0;
+  uint64_t non_finite = 0;
+};
+
+struct calibration_layer {
+  struct swiglu_layer_weights weights;
+  xnn_runtime_t runtime = NULL;
+  // Batch size the runtime is currently reshaped for, 0 before the first run.
+  size_t batch_size = 0;
+  histogram histograms[SWIGLU_NUM_ACTIVATIONS];
+  // Largest magnitude per channel of the projection inputs, empty before the first run
+  std::vector<float> input_max;
+  std::vector<float> intermediate_max;
+};
+
+struct swiglu_calibrator {
+  std::vector<calibration_layer> layers;
+  struct swiglu_weights_cache* weights_cache = NULL;
+  xnn_workspace_t workspace = NULL;
+  pthreadpool_t threadpool = NULL;
+  // Exposed intermediates, [batch_size, inter_dim] each, in swiglu_activation order
+  // from swiglu_activation_gate
+  std::vector<float> intermediates[4];
+  // Ping-pong activations between layers, runtime inputs so they carry XNN_EXTRA_BYTES
+  std::vector<float> activations[2];
+  // Layer whose input and intermediate X^T X are summed, or SIZE_MAX
+  size_t hessian_layer = SIZE_MAX;
+  std::vector<float> input_hessian;
+  std::vector<float> intermediate_hessian;
+};
+
+// Rows of a Hessian per task of the accumulation.
+static const size_t kHessianTile = 16;
+
+// Doubles the bound until it exceeds magnitude, merging bins pairwise into the middle
+// half. magnitude must be finite.
+static void grow(histogram& h, float magnitude) {
+  if (h.bound == 0.0f) {
+    h.bound = magnitude > 0.0f ? exp2f(ceilf(log2f(magnitude))) : 1.0f;
+  }
+  while (h.bound <= magnitude) {
+    std::vector<uint64_t> counts(kBins);
+    for (size_t j = 0; j < kBins; ++j) {
+      counts[kBins / 4 + j / 2] += h.counts[j];
+    }
+    h.counts.swap(counts);
+    h.bound *= 2.0f;
+  }
+}
+
+// Bins the finite values and returns how many were not, which are only counted: an
+// infinity would grow the bound forever, and a NaN has no bin.
+static size_t add_values(histogram& h, const float* values, size_t size) {
+  float min_value = h.min_value;
+  float max_value = h.max_value;
+  size_t non_finite = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if (!isfinite(values[i])) {
+      non_finite++;
+      continue;
+    }
+    min_value = std::min(min_value, values[i]);
+    max_value = std::max(max_value, values[i]);
+  }
+  h.non_finite += non_finite;
+  if (non_finite == size) {
+    return non_finite;
+  }
+  h.min_value = min_value;
+  h.max_value = max_value;
+  grow(h, std::max(fabsf(min_value), fabsf(max_value)));
+  const float bins_per_unit = kBins / (2.0f * h.bound);
+  for (size_t i = 0; i < size; ++i) {
+    if (isfinite(values[i])) {
+      const size_t bin = static_cast<size_t>((values[i] + h.bound) * bins_per_unit);
+      h.counts[std::min(bin, kBins - 1)] += 1;
+    }
+  }
+  h.total += size - non_finite;
+  return non_finite;
+}
+
+// Lower edge of the bin holding the rank-th value (from 0), or its upper edge with upper set.
+static float bin_edge(const histogram& h, uint64_t rank, bool upper) {
+  uint64_t cumulative = 0;
+  size_t bin = 0;
+  for (; bin + 1 < kBins; ++bin) {
+    cumulative += h.counts[bin];
+    if (cumulative > rank) {
+      break;
+    }
+  }
+  return -h.bound + (bin + (upper ? 1 : 0)) * (2.0f * h.bound / kBins);
+}
+
+static enum xnn_status create_runtime(struct swiglu_calibrator* calibrator, calibration_layer& layer) {
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = swiglu_define_calibration_layer(&layer.weights, &subgraph);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  status = xnn_create_runtime_v4(
+    subgraph,
+    /*weights_cache=*/swiglu_weights_cache_provider(calibrator->weights_cache),
+    /*workspace=*/calibrator->workspace,
+    /*threadpool=*/calibrator->threadpool,
+    /*flags=*/0,
+    &layer.runtime);
+  xnn_delete_subgraph(subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_runtime_v4 failed: %d\n", status);
+  }
+  return status;
+}
+
+enum xnn_status swiglu_create_calibrator(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  pthreadpool_t threadpool,
+  struct swiglu_calibrator** calibrator_out)
+{
+  if (num_layers == 0) {
+    fprintf(stderr, "a calibrator needs at least one layer\n");
+    return xnn_status_invalid_parameter;
+  }
+  for (size_t i = 1; i < num_layers; ++i) {
+    if (layers[i].input_dim != layers[i - 1].output_dim) {
+      fprintf(stderr, "layer %zu input dim %zu does not match layer %zu output dim %zu\n", i,
+              layers[i].input_dim, i - 1, layers[i - 1].output_dim);
+      return xnn_status_invalid_parameter;
+    }
+  }
+
+  struct swiglu_calibrator* calibrator = new (std::nothrow) swiglu_calibrator();
+  if (calibrator == NULL) {
+    fprintf(stderr, "failed to allocate calibrator\n");
+    return xnn_status_out_of_memory;
+  }
+  calibrator->threadpool = threadpool;
+  calibrator->layers.resize(num_layers);
+
+  enum xnn_status status = swiglu_create_weights_cache(&calibrator->weights_cache);
+  if (status != xnn_status_success) {
+    swiglu_delete_calibrator(calibrator);
+    return status;
+  }
+  status = xnn_create_workspace(&calibrator->workspace);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_workspace failed: %d\n", status);
+    swiglu_delete_calibrator(calibrator);
+    return status;
+  }
+  for (size_t i = 0; i < num_layers; ++i) {
+    calibrator->layers[i].weights = layers[i];
+    status = create_runtime(calibrator, calibrator->layers[i]);
+    if (status != xnn_status_success) {
+      swiglu_delete_calibrator(calibrator);
+      return status;
+    }
+  }
+  swiglu_finalize_weights_cache(calibrator->weights_cache);
+
+  *calibrator_out = calibrator;
+  return xnn_status_success;
+}
+
+static enum xnn_status reshape_layer(calibration_layer& layer, size_t batch_size) {
+  if (layer.batch_size == batch_size) {
+    return xnn_status_success;
+  }
+  const size_t input_dims[2] = {batch_size, layer.weights.input_dim};
+  const size_t inter_dims[2] = {batch_size, layer.weights.inter_dim};
+  const size_t output_dims[2] = {batch_size, layer.weights.output_dim};
+  enum xnn_status status;
+  if ((status = xnn_reshape_external_value(layer.runtime, SWIGLU_INPUT_EXTERNAL_ID, 2, input_dims)) !=
+        xnn_status_success ||
+      (status = xnn_reshape_external_value(layer.runtime, SWIGLU_OUTPUT_EXTERNAL_ID, 2, output_dims)) !=
+        xnn_status_success) {
+    fprintf(stderr, "xnn_reshape_external_value failed: %d\n", status);
+    return status;
+  }
+  for (uint32_t id = SWIGLU_CALIBRATION_GATE_EXTERNAL_ID; id <= SWIGLU_CALIBRATION_INTERMEDIATE_EXTERNAL_ID; ++id) {
+    status = xnn_reshape_external_value(layer.runtime, id, 2, inter_dims);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "xnn_reshape_external_value failed: %d\n", status);
+      return status;
+    }
+  }
+  status = xnn_reshape_runtime(layer.runtime);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_reshape_runtime failed: %d\n", status);
+    return status;
+  }
+  layer.batch_size = batch_size;
+  return xnn_status_success;
+}
+
+struct record_context {
+  calibration_layer* layer;
+  // Values of every activation, in swiglu_activation order
+  const float* values[SWIGLU_NUM_ACTIVATIONS];
+  size_t sizes[SWIGLU_NUM_ACTIVATIONS];
+  // Infinities and NaNs found in each activation
+  size_t non_finite[SWIGLU_NUM_ACTIVATIONS];
+};
+
+static void add_channel_max(std::vector<float>& channel_max, size_t dim, const float* values, size_t size) {
+  channel_max.resize(dim);
+  for (size_t i = 0; i < size; ++i) {
+    if (isfinite(values[i])) {
+      channel_max[i % dim] = std::max(channel_max[i % dim], fabsf(values[i]));
+    }
+  }
+}
+
+static void record_activation(void* context, size_t activation) {
+  struct record_context* ctx = static_cast<struct record_context*>(context);
+  calibration_layer& layer = *ctx->layer;
+  ctx->non_finite[activation] = add_values(layer.histograms[activation], ctx->values[activation],
+                                          ctx->sizes[activation]);
+  if (activation == swiglu_activation_input) {
+    add_channel_max(layer.input_max, layer.weights.input_dim, ctx->values[activation], ctx->sizes[activation]);
+  } else if (activation == swiglu_activation_intermediate) {
+    add_channel_max(layer.intermediate_max, layer.weights.inter_dim, ctx->values[activation],
+                    ctx->sizes[activation]);
+  }
+}
+
+struct hessian_context {
+  float* hessian;
+  const float* values;
+  size_t batch_size;
+  size_t dim;
+};
+
+static void accumulate_hessian_rows(void* context, size_t offset, size_t count) {
+  const struct hessian_context* ctx = static_cast<const struct hessian_context*>(context);
+  for (size_t i = offset; i < offset + count; ++i) {
+    float* row = ctx->hessian + i * ctx->dim;
+    for (size_t r = 0; r < ctx->batch_size; ++r) {
+      const float* x = ctx->values + r * ctx->dim;
+      const float xi = x[i];
+      if (xi == 0.0f) {
+        continue;
+      }
+      for (size_t j = 0; j < ctx->dim; ++j) {
+        row[j] += xi * x[j];
+      }
+    }
+  }
+}
+
+static void accumulate_hessian(
+  pthreadpool_t threadpool,
+  std::vector<float>& hessian,
+  const float* values,
+  size_t batch_size,
+  size_t dim)
+{
+  struct hessian_context context = {hessian.data(), values, batch_size, dim};
+  pthreadpool_parallelize_1d_tile_1d(threadpool, accumulate_hessian_rows, &context, dim, kHessianTile, /*flags=*/0);
+}
+
+enum xnn_status swiglu_calibrator_collect_hessians(struct swiglu_calibrator* calibrator, size_t layer) {
+  if (layer >= calibrator->layers.size()) {
+    fprintf(stderr, "no layer %zu of %zu\n", layer, calibrator->layers.size());
+    return xnn_status_invalid_parameter;
+  }
+  const struct swiglu_layer_weights& weights = calibrator->layers[layer].weights;
+  calibrator->hessian_layer = layer;
+  calibrator->input_hessian.assign(weights.input_dim * weights.input_dim, 0.0f);
+  calibrator->intermediate_hessian.assign(weights.inter_dim * weights.inter_dim, 0.0f);
+  return xnn_status_success;
+}
+
+const float* swiglu_calibrator_hessian(
+  const struct swiglu_calibrator* calibrator,
+  size_t layer,
+  enum swiglu_activation activation)
+{
+  if (layer != calibrator->hessian_layer) {
+    return NULL;
+  }
+  switch (activation) {
+    case swiglu_activation_input: return calibrator->input_hessian.data();
+    case swiglu_activation_intermediate: return calibrator->intermediate_hessian.data();
+    default: return NULL;
+  }
+}
+
+enum xnn_status swiglu_calibrator_observe(
+  struct swiglu_calibrator* calibrator,
+  size_t batch_size,
+  const float* input)
+{
+  if (batch_size == 0) {
+    return xnn_status_success;
+  }
+  const size_t extra = XNN_EXTRA_BYTES / sizeof(float);
+  for (const calibration_layer& layer : calibrator->layers) {
+    for (std::vector<float>& intermediate : calibrator->intermediates) {
+      if (intermediate.size() < batch_size * layer.weights.inter_dim) {
+        intermediate.resize(batch_size * layer.weights.inter_dim);
+      }
+    }
+    for (std::vector<float>& activations : calibrator->activations) {
+      if (activations.size() < batch_size * layer.weights.output_dim + extra) {
+        activations.resize(batch_size * layer.weights.output_dim + extra);
+      }
+    }
+  }
+
+  const float* layer_input = input;
+  for (size_t i = 0; i < calibrator->layers.size(); ++i) {
+    calibration_layer& layer = calibrator->layers[i];
+    float* layer_output = calibrator->activations[i % 2].data();
+    enum xnn_status status = reshape_layer(layer, batch_size);
+    if (status != xnn_status_success) {
+      return status;
+    }
+    const struct xnn_external_value external_values[SWIGLU_CALIBRATION_NUM_EXTERNAL_VALUES] = {
+      {SWIGLU_INPUT_EXTERNAL_ID, const_cast<float*>(layer_input)},
+      {SWIGLU_OUTPUT_EXTERNAL_ID, layer_output},
+      {SWIGLU_CALIBRATION_GATE_EXTERNAL_ID, calibrator->intermediates[0].data()},
+      {SWIGLU_CALIBRATION_UP_EXTERNAL_ID, calibrator->intermediates[1].data()},
+      {SWIGLU_CALIBRATION_SILU_EXTERNAL_ID, calibrator->intermediates[2].data()},
+      {SWIGLU_CALIBRATION_INTERMEDIATE_EXTERNAL_ID, calibrator->intermediates[3].data()},
+    };
+    status = xnn_setup_runtime_v2(layer.runtime, SWIGLU_CALIBRATION_NUM_EXTERNAL_VALUES, external_values);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "xnn_setup_runtime_v2 failed: %d\n", status);
+      return status;
+    }
+    status = xnn_invoke_runtime(layer.runtime);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "xnn_invoke_runtime failed: %d\n", status);
+      return status;
+    }
+
+    const size_t inter_size = batch_size * layer.weights.inter_dim;
+    struct record_context context = {
+      &layer,
+      {layer_input, calibrator->intermediates[0].data(), calibrator->intermediates[1].data(),
+       calibrator->intermediates[2].data(), calibrator->intermediates[3].data(), layer_output},
+      {batch_size * layer.weights.input_dim, inter_size, inter_size, inter_size, inter_size,
+       batch_size * layer.weights.output_dim},
+      {},
+    };
+    pthreadpool_parallelize_1d(calibrator->threadpool, record_activation, &context, SWIGLU_NUM_ACTIVATIONS,
+                               /*flags=*/0);
+    size_t non_finite = 0;
+    for (size_t a = 0; a < SWIGLU_NUM_ACTIVATIONS; ++a) {
+      non_finite += context.non_finite[a];
+    }
+    if (non_finite != 0) {
+      // Every later layer would only see more of them.
+      fprintf(stderr, "layer %zu produced %zu infinite or NaN activations; they are left out of its histograms and "
+              "the rest of the batch is dropped\n", i, non_finite);
+      return xnn_status_invalid_parameter;
+    }
+    if (i == calibrator->hessian_layer) {
+      accumulate_hessian(calibrator->threadpool, calibrator->input_hessian, layer_input, batch_size,
+                         layer.weights.input_dim);
+      accumulate_hessian(calibrator->threadpool, calibrator->intermediate_hessian, calibrator->intermediates[3].data(),
+                         batch_size, layer.weights.inter_dim);
+    }
+    layer_input = layer_output;
+  }
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_calibrator_range(
+  const struct swiglu_calibrator* calibrator,
+  size_t layer,
+  enum swiglu_activation activation,
+  float percentile,
+  struct swiglu_activation_range* range_out)
+{
+  if (layer >= calibrator->layers.size() || !(percentile > 0.0f && percentile <= 100.0f)) {
+    fprintf(stderr, "no percentile %g of layer %zu of %zu\n", percentile, layer, calibrator->layers.size());
+    return xnn_status_invalid_parameter;
+  }
+  const histogram& h = calibrator->layers[layer].histograms[activation];
+  if (h.total == 0) {
+    fprintf(stderr, "no values recorded for layer %zu\n", layer);
+    return xnn_status_invalid_state;
+  }
+  range_out->min_value = h.min_value;
+  range_out->max_value = h.max_value;
+  if (percentile < 100.0f) {
+    const uint64_t clipped = static_cast<uint64_t>((100.0 - percentile) / 200.0 * h.total);
+    range_out->min_value = std::max(h.min_value, bin_edge(h, clipped, /*upper=*/false));
+    range_out->max_value = std::min(h.max_value, bin_edge(h, h.total - 1 - clipped, /*upper=*/true));
+  }
+  return xnn_status_success;
+}
+
+const float* swiglu_calibrator_channel_max(
+  const struct swiglu_calibrator* calibrator,
+  size_t layer,
+  enum swiglu_activation activation)
+{
+  if (layer >= calibrator->layers.size()) {
+    return NULL;
+  }
+  const std::vector<float>* channel_max = NULL;
+  switch (activation) {
+    case swiglu_activation_input: channel_max = &calibrator->layers[layer].input_max; break;
+    case swiglu_activation_intermediate: channel_max = &calibrator->layers[layer].intermediate_max; break;
+    default: return NULL;
+  }
+  return channel_max->empty() ? NULL : channel_max->data();
+}
+
+enum xnn_status swiglu_calibrator_scales(
+  const struct swiglu_calibrator* calibrator,
+  float percentile,
+  struct swiglu_qs8_scales* scales)
+{
+  for (size_t i = 0; i < calibrator->layers.size(); ++i) {
+    struct swiglu_qs8_params* params[SWIGLU_NUM_ACTIVATIONS] = {
+      &scales[i].input, &scales[i].gate, &scales[i].up, NULL, &scales[i].intermediate, &scales[i].output};
+    for (int a = 0; a < SWIGLU_NUM_ACTIVATIONS; ++a) {
+      if (params[a] == NULL) {
+        // SiLU is never quantized on its own; the int8 layers fold it into a table.
+        continue;
+      }
+      struct swiglu_activation_range range;
+      enum xnn_status status =
+        swiglu_calibrator_range(calibrator, i, static_cast<enum swiglu_activation>(a), percentile, &range);
+      if (status != xnn_status_success) {
+        return status;
+      }
+      *params[a] = swiglu_qs8_params_for_range(range.min_value, range.max_value);
+    }
+    if (i > 0) {
+      // Same values as the previous output; keep them bit-identical so the layers chain.
+      scales[i].input = scales[i - 1].output;
+    }
+  }
+  return xnn_status_success;
+}
+
+void swiglu_delete_calibrator(struct swiglu_calibrator* calibrator) {
+  for (calibration_layer& layer : calibrator->layers) {
+    if (layer.runtime != NULL) {
+      xnn_delete_runtime(layer.runtime);
+    }
+  }
+  if (calibrator->workspace != NULL) {
+    xnn_release_workspace(calibrator->workspace);
+  }
+  if (calibrator->weights_cache != NULL) {
+    swiglu_delete_weights_cache(calibrator->weights_cache);
+  }
+  delete calibrator;
+}
+
+// Names of the quantized activations in scales files, and where each one lives in swiglu_qs8_scales
+static const struct {
+  const char* name;
+  struct swiglu_qs8_params swiglu_qs8_scales::*params;
+} kScalesFields[] = {
+  {"input", &swiglu_qs8_scales::input},
+  {"gate", &swiglu_qs8_scales::gate},
+  {"up", &swiglu_qs8_scales::up},
+  {"intermediate", &swiglu_qs8_scales::intermediate},
+  {"output", &swiglu_qs8_scales::output},
+};
+
+static const size_t kNumScalesFields = sizeof(kScalesFields) / sizeof(kScalesFields[0]);
+
+bool swiglu_save_qs8_scales(const char* path, size_t num_layers, const struct swiglu_qs8_scales* scales) {
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "failed to open %s\n", path);
+    return false;
+  }
+  fprintf(file, "# layer activation scale zero_point\n");
+  for (size_t i = 0; i < num_layers; ++i) {
+    for (size_t f = 0; f < kNumScalesFields; ++f) {
+      const struct swiglu_qs8_params& params = scales[i].*kScalesFields[f].params;
+      fprintf(file, "%zu %s %.9g %d\n", i, kScalesFields[f].name, params.scale, params.zero_point);
+    }
+  }
+  const bool ok = fclose(file) == 0;
+  if (!ok) {
+    fprintf(stderr, "failed to write %s\n", path);
+  }
+  return ok;
+}
+
+bool swiglu_load_qs8_scales(const char* path, size_t num_layers, struct swiglu_qs8_scales* scales) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "failed to open %s\n", path);
+    return false;
+  }
+  std::vector<bool> seen(num_layers * kNumScalesFields);
+  char line[256];
+  bool ok = true;
+  for (size_t line_number = 1; ok && fgets(line, sizeof(line), file) != NULL; ++line_number) {
+    if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line)) {
+      continue;
+    }
+    size_t layer;
+    char name[32];
+    float scale;
+    int zero_point;
+    size_t f = kNumScalesFields;
+    if (sscanf(line, "%zu %31s %g %d", &layer, name, &scale, &zero_point) == 4) {
+      for (f = 0; f < kNumScalesFields && strcmp(name, kScalesFields[f].name) != 0; ++f) {
+      }
+    }
+    ok = f < kNumScalesFields && layer < num_layers && scale > 0.0f && zero_point >= -128 && zero_point <= 127;
+    if (!ok) {
+      fprintf(stderr, "%s:%zu: expected a layer below %zu, an activation, a positive scale and an int8 zero point\n",
+              path, line_number, num_layers);
+      break;
+    }
+    scales[layer].*kScalesFields[f].params = {scale, static_cast<int8_t>(zero_point)};
+    seen[layer * kNumScalesFields + f] = true;
+  }
+  fclose(file);
+  for (size_t i = 0; ok && i < seen.size(); ++i) {
+    if (!seen[i]) {
+      fprintf(stderr, "%s has no %s scales for layer %zu\n", path, kScalesFields[i % kNumScalesFields].name,
+              i / kNumScalesFields);
+      ok = false;
+    }
+  }
+  return ok;
+}
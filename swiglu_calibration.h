@@ -0,0 +1,131 @@
+/**
+ * @file swiglu_calibration.h
+ * @brief Activation ranges of a SwiGLU stack, recorded through its fp32 subgraphs
+ *
+ * Static int8 layers (swiglu_qs8.h) need a scale and zero point for every
+ * activation, picked from the values it takes on real data. A calibrator runs
+ * batches of a dataset through layers built with swiglu_define_calibration_layer,
+ * which expose the gate, up, SiLU and gated intermediate values as external
+ * outputs, and adds every activation to a histogram.
+ *
+ * Histograms have 4096 equal bins over [-bound, bound). The bound starts at the
+ * first batch's largest magnitude rounded up to a power of two and doubles, merging
+ * pairs of bins, whenever a value falls outside, so one pass over the dataset is
+ * enough and no value is ever dropped. Exact minimums and maximums are kept besides.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_layer.h"
+
+// Activations of a layer recorded by a calibrator
+enum swiglu_activation {
+  swiglu_activation_input,
+  swiglu_activation_gate,
+  swiglu_activation_up,
+  swiglu_activation_silu,
+  swiglu_activation_intermediate,
+  swiglu_activation_output,
+};
+
+#define SWIGLU_NUM_ACTIVATIONS 6
+
+struct swiglu_activation_range {
+  float min_value;
+  float max_value;
+};
+
+struct swiglu_calibrator;
+
+/**
+ * @brief Creates a calibrator for a stack of num_layers layers
+ *
+ * The layers must chain. The weights are not copied and must outlive the
+ * calibrator. threadpool may be NULL.
+ */
+enum xnn_status swiglu_create_calibrator(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  pthreadpool_t threadpool,
+  struct swiglu_calibrator** calibrator_out);
+
+/**
+ * @brief Runs batch_size rows of the dataset through every layer and records them
+ *
+ * input is [batch_size, input_dim] and must be readable XNN_EXTRA_BYTES past its
+ * last row. Infinite and NaN activations are never binned. If a layer produces any,
+ * its finite values are still recorded, and the batch stops there with
+ * xnn_status_invalid_parameter.
+ */
+enum xnn_status swiglu_calibrator_observe(
+  struct swiglu_calibrator* calibrator,
+  size_t batch_size,
+  const float* input);
+
+/**
+ * @brief Range holding the central percentile percent of an activation's values
+ *
+ * (100 - percentile) / 2 percent of the values are clipped at each end, to the
+ * nearest bin edge. With a percentile of 100 this is the exact minimum and maximum.
+ * Fails before the first batch is observed.
+ */
+enum xnn_status swiglu_calibrator_range(
+  const struct swiglu_calibrator* calibrator,
+  size_t layer,
+  enum swiglu_activation activation,
+  float percentile,
+  struct swiglu_activation_range* range_out);
+
+/**
+ * @brief Largest magnitude so far in each channel of a projection input
+ *
+ * [input_dim] floats for swiglu_activation_input, [inter_dim] for
+ * swiglu_activation_intermediate; NULL for other activations or before the first
+ * batch. SmoothQuant (swiglu_smooth.h) balances these against the weights.
+ */
+const float* swiglu_calibrator_channel_max(
+  const struct swiglu_calibrator* calibrator,
+  size_t layer,
+  enum swiglu_activation activation);
+
+/**
+ * @brief Also sums X^T X of one layer's input and gated intermediate from now on
+ *
+ * These are the Hessians GPTQ (swiglu_gptq.h) needs for W1 and W3, and for W2, up
+ * to a factor of 2. They take input_dim^2 + inter_dim^2 floats, so only one layer
+ * collects them at a time: this clears any previous sums, and quantizing a whole
+ * stack observes the dataset once per layer.
+ */
+enum xnn_status swiglu_calibrator_collect_hessians(struct swiglu_calibrator* calibrator, size_t layer);
+
+/**
+ * @brief Sum of X^T X so far for swiglu_activation_input or swiglu_activation_intermediate
+ *
+ * Row-major [dim, dim]. NULL for other activations or layers.
+ */
+const float* swiglu_calibrator_hessian(
+  const struct swiglu_calibrator* calibrator,
+  size_t layer,
+  enum swiglu_activation activation);
+
+// Writes scales for every layer from the ranges at percentile (see swiglu_qs8_params_for_range).
+enum xnn_status swiglu_calibrator_scales(
+  const struct swiglu_calibrator* calibrator,
+  float percentile,
+  struct swiglu_qs8_scales* scales);
+
+void swiglu_delete_calibrator(struct swiglu_calibrator* calibrator);
+
+/**
+ * @brief Writes scales of num_layers layers to a text scales file
+ *
+ * One line per quantized activation: layer index, activation name (input, gate, up,
+ * intermediate or output), scale and zero point. Lines starting with '#' are comments.
+ */
+bool swiglu_save_qs8_scales(const char* path, size_t num_layers, const struct swiglu_qs8_scales* scales);
+
+// Reads a scales file written by swiglu_save_qs8_scales; every activation of num_layers layers must be present.
+bool swiglu_load_qs8_scales(const char* path, size_t num_layers, struct swiglu_qs8_scales* scales);
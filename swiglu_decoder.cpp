@@ -0,0 +1,312 @@
+/**
+ * @file swiglu_decoder.cpp
+ * @brief Decoder blocks as QKV runtime, attention kernel and attention output runtime
+ */
+#include "swiglu_decoder.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "swiglu_attention.h"
+#include "swiglu_weights_cache.h"
+
+struct decoder_block {
+  struct swiglu_decoder_weights weights;
+  xnn_runtime_t qkv_runtime = NULL;
+  xnn_runtime_t output_runtime = NULL;
+  // Batch size the runtimes are currently reshaped for, 0 before the first run.
+  size_t batch_size = 0;
+};
+
+struct swiglu_decoder {
+  std::vector<decoder_block> blocks;
+  struct swiglu_weights_cache* weights_cache = NULL;
+  xnn_workspace_t workspace = NULL;
+  pthreadpool_t threadpool = NULL;
+  const struct swiglu_rope_table* rope = NULL;
+  size_t dim;
+  // Fused QKV projection output, [batch_size, qkv_dim]
+  std::vector<float> qkv;
+  // Attention output and ping-pong activations between blocks. Both are runtime
+  // inputs, so they carry XNN_EXTRA_BYTES.
+  std::vector<float> attention;
+  std::vector<float> activations[2];
+};
+
+static size_t qkv_dim(const struct swiglu_decoder_weights& weights) {
+  return (weights.num_heads + 2 * weights.num_kv_heads) * weights.head_dim;
+}
+
+static enum xnn_status create_runtime(
+  struct swiglu_decoder* decoder,
+  enum xnn_status (*define)(const struct swiglu_decoder_weights*, xnn_subgraph_t*),
+  const struct swiglu_decoder_weights* weights,
+  xnn_runtime_t* runtime_out)
+{
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = define(weights, &subgraph);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  status = xnn_create_runtime_v4(
+    subgraph,
+    /*weights_cache=*/swiglu_weights_cache_provider(decoder->weights_cache),
+    /*workspace=*/decoder->workspace,
+    /*threadpool=*/decoder->threadpool,
+    /*flags=*/0,
+    runtime_out);
+  xnn_delete_subgraph(subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_runtime_v4 failed: %d\n", status);
+  }
+  return status;
+}
+
+enum xnn_status swiglu_create_decoder(
+  size_t num_layers,
+  const struct swiglu_decoder_weights* layers,
+  const struct swiglu_rope_table* rope,
+  pthreadpool_t threadpool,
+  struct swiglu_decoder** decoder_out)
+{
+  if (num_layers == 0) {
+    fprintf(stderr, "a decoder needs at least one block\n");
+    return xnn_status_invalid_parameter;
+  }
+  for (size_t i = 0; i < num_layers; ++i) {
+    const struct swiglu_decoder_weights& layer = layers[i];
+    if (layer.ffn.input_dim != layers[0].ffn.input_dim || layer.num_kv_heads == 0 ||
+        layer.num_heads % layer.num_kv_heads != 0) {
+      fprintf(stderr, "decoder block %zu has dim %zu, %zu heads and %zu KV heads; expected dim %zu and a "
+              "multiple of the KV heads\n", i, layer.ffn.input_dim, layer.num_heads, layer.num_kv_heads,
+              layers[0].ffn.input_dim);
+      return xnn_status_invalid_parameter;
+    }
+    if (rope != NULL && swiglu_rope_head_dim(rope) != layer.head_dim) {
+      fprintf(stderr, "decoder block %zu has head dim %zu but the RoPE table has %zu\n", i, layer.head_dim,
+              swiglu_rope_head_dim(rope));
+      return xnn_status_invalid_parameter;
+    }
+  }
+
+  struct swiglu_decoder* decoder = new (std::nothrow) swiglu_decoder();
+  if (decoder == NULL) {
+    fprintf(stderr, "failed to allocate decoder\n");
+    return xnn_status_out_of_memory;
+  }
+  decoder->threadpool = threadpool;
+  decoder->rope = rope;
+  decoder->dim = layers[0].ffn.input_dim;
+  decoder->blocks.resize(num_layers);
+
+  enum xnn_status status = swiglu_create_weights_cache(&decoder->weights_cache);
+  if (status != xnn_status_success) {
+    swiglu_delete_decoder(decoder);
+    return status;
+  }
+  status = xnn_create_workspace(&decoder->workspace);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_workspace failed: %d\n", status);
+    swiglu_delete_decoder(decoder);
+    return status;
+  }
+  for (size_t i = 0; i < num_layers; ++i) {
+    decoder_block& block = decoder->blocks[i];
+    block.weights = layers[i];
+    if ((status = create_runtime(decoder, swiglu_define_qkv_projection, &layers[i], &block.qkv_runtime)) !=
+          xnn_status_success ||
+        (status = create_runtime(decoder, swiglu_define_attention_output, &layers[i], &block.output_runtime)) !=
+          xnn_status_success) {
+      swiglu_delete_decoder(decoder);
+      return status;
+    }
+  }
+  swiglu_finalize_weights_cache(decoder->weights_cache);
+
+  *decoder_out = decoder;
+  return xnn_status_success;
+}
+
+static enum xnn_status reshape_block(struct swiglu_decoder* decoder, decoder_block& block, size_t batch_size) {
+  if (block.batch_size == batch_size) {
+    return xnn_status_success;
+  }
+  const size_t dim = decoder->dim;
+  const size_t qkv_dims[2] = {batch_size, qkv_dim(block.weights)};
+  const size_t input_dims[2] = {batch_size, dim};
+  const size_t attention_dims[2] = {batch_size, block.weights.num_heads * block.weights.head_dim};
+  enum xnn_status status;
+  if ((status = xnn_reshape_external_value(block.qkv_runtime, SWIGLU_INPUT_EXTERNAL_ID, 2, input_dims)) !=
+        xnn_status_success ||
+      (status = xnn_reshape_external_value(block.qkv_runtime, SWIGLU_OUTPUT_EXTERNAL_ID, 2, qkv_dims)) !=
+        xnn_status_success ||
+      (status = xnn_reshape_external_value(block.output_runtime, SWIGLU_ATTENTION_EXTERNAL_ID, 2,
+                                           attention_dims)) != xnn_status_success ||
+      (status = xnn_reshape_external_value(block.output_runtime, SWIGLU_RESIDUAL_EXTERNAL_ID, 2, input_dims)) !=
+        xnn_status_success ||
+      (status = xnn_reshape_external_value(block.output_runtime, SWIGLU_BLOCK_OUTPUT_EXTERNAL_ID, 2,
+                                           input_dims)) != xnn_status_success) {
+    fprintf(stderr, "xnn_reshape_external_value failed: %d\n", status);
+    return status;
+  }
+  if ((status = xnn_reshape_runtime(block.qkv_runtime)) != xnn_status_success ||
+      (status = xnn_reshape_runtime(block.output_runtime)) != xnn_status_success) {
+    fprintf(stderr, "xnn_reshape_runtime failed: %d\n", status);
+    return status;
+  }
+  block.batch_size = batch_size;
+  return xnn_status_success;
+}
+
+static enum xnn_status run_runtime(xnn_runtime_t runtime, size_t num_values, const struct xnn_external_value* values) {
+  enum xnn_status status = xnn_setup_runtime_v2(runtime, num_values, values);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_setup_runtime_v2 failed: %d\n", status);
+    return status;
+  }
+  status = xnn_invoke_runtime(runtime);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_invoke_runtime failed: %d\n", status);
+  }
+  return status;
+}
+
+// Runs every block, with attention within each of the num_sequences sequences of
+// the rows (as split by offsets) when caches is NULL, and over each block's cache of
+// the sequence otherwise.
+static enum xnn_status run_decoder(
+  struct swiglu_decoder* decoder,
+  struct swiglu_kv_cache* const* caches,
+  size_t sequence,
+  size_t num_sequences,
+  const size_t* offsets,
+  size_t num_rows,
+  const float* input,
+  float* output)
+{
+  const size_t extra = XNN_EXTRA_BYTES / sizeof(float);
+  size_t max_qkv_dim = 0;
+  size_t max_attention_dim = 0;
+  for (const decoder_block& block : decoder->blocks) {
+    max_qkv_dim = std::max(max_qkv_dim, qkv_dim(block.weights));
+    max_attention_dim = std::max(max_attention_dim, block.weights.num_heads * block.weights.head_dim);
+  }
+  if (decoder->qkv.size() < num_rows * max_qkv_dim) {
+    decoder->qkv.resize(num_rows * max_qkv_dim);
+  }
+  if (decoder->attention.size() < num_rows * max_attention_dim + extra) {
+    decoder->attention.resize(num_rows * max_attention_dim + extra);
+  }
+  for (std::vector<float>& activations : decoder->activations) {
+    if (activations.size() < num_rows * decoder->dim + extra) {
+      activations.resize(num_rows * decoder->dim + extra);
+    }
+  }
+
+  const float* block_input = input;
+  for (size_t i = 0; i < decoder->blocks.size(); ++i) {
+    decoder_block& block = decoder->blocks[i];
+    const struct swiglu_decoder_weights& weights = block.weights;
+    float* block_output = i + 1 == decoder->blocks.size() ? output : decoder->activations[i % 2].data();
+    enum xnn_status status = reshape_block(decoder, block, num_rows);
+    if (status != xnn_status_success) {
+      return status;
+    }
+
+    const struct xnn_external_value qkv_values[SWIGLU_NUM_EXTERNAL_VALUES] = {
+      {SWIGLU_INPUT_EXTERNAL_ID, const_cast<float*>(block_input)},
+      {SWIGLU_OUTPUT_EXTERNAL_ID, decoder->qkv.data()},
+    };
+    status = run_runtime(block.qkv_runtime, SWIGLU_NUM_EXTERNAL_VALUES, qkv_values);
+    if (status != xnn_status_success) {
+      return status;
+    }
+
+    const float* query = decoder->qkv.data();
+    const float* key = query + weights.num_heads * weights.head_dim;
+    const float* value = key + weights.num_kv_heads * weights.head_dim;
+    if (caches == NULL) {
+      status = swiglu_flash_attention_varlen(num_sequences, offsets, weights.num_heads, weights.num_kv_heads,
+                                             weights.head_dim, query, key, value, qkv_dim(weights), /*causal=*/true,
+                                             decoder->rope, decoder->attention.data(), decoder->threadpool);
+    } else {
+      // The projection output is read once: keys are rotated as they are quantized
+      // into the cache and queries as attention loads them.
+      status = swiglu_kv_cache_append(caches[i], sequence, num_rows, key, value, qkv_dim(weights), decoder->rope);
+      if (status == xnn_status_success) {
+        status = swiglu_kv_cache_attention(caches[i], sequence, num_rows, query, weights.num_heads, decoder->rope,
+                                           decoder->attention.data(), decoder->threadpool);
+      }
+    }
+    if (status != xnn_status_success) {
+      return status;
+    }
+
+    const struct xnn_external_value output_values[SWIGLU_BLOCK_NUM_EXTERNAL_VALUES] = {
+      {SWIGLU_ATTENTION_EXTERNAL_ID, decoder->attention.data()},
+      {SWIGLU_BLOCK_OUTPUT_EXTERNAL_ID, block_output},
+      {SWIGLU_RESIDUAL_EXTERNAL_ID, const_cast<float*>(block_input)},
+    };
+    status = run_runtime(block.output_runtime, SWIGLU_BLOCK_NUM_EXTERNAL_VALUES, output_values);
+    if (status != xnn_status_success) {
+      return status;
+    }
+    block_input = block_output;
+  }
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_run_decoder_prefill(
+  struct swiglu_decoder* decoder,
+  size_t num_rows,
+  const float* input,
+  float* output)
+{
+  const size_t offsets[2] = {0, num_rows};
+  return run_decoder(decoder, /*caches=*/NULL, /*sequence=*/0, /*num_sequences=*/1, offsets, num_rows, input, output);
+}
+
+enum xnn_status swiglu_run_decoder_prefill_varlen(
+  struct swiglu_decoder* decoder,
+  size_t num_sequences,
+  const size_t* offsets,
+  const float* input,
+  float* output)
+{
+  if (num_sequences == 0 || offsets[num_sequences] == 0) {
+    return xnn_status_success;
+  }
+  return run_decoder(decoder, /*caches=*/NULL, /*sequence=*/0, num_sequences, offsets, offsets[num_sequences], input,
+                     output);
+}
+
+enum xnn_status swiglu_run_decoder_step(
+  struct swiglu_decoder* decoder,
+  struct swiglu_kv_cache* const* caches,
+  size_t sequence,
+  size_t num_rows,
+  const float* input,
+  float* output)
+{
+  return run_decoder(decoder, caches, sequence, /*num_sequences=*/1, /*offsets=*/NULL, num_rows, input, output);
+}
+
+void swiglu_delete_decoder(struct swiglu_decoder* decoder) {
+  for (decoder_block& block : decoder->blocks) {
+    if (block.qkv_runtime != NULL) {
+      xnn_delete_runtime(block.qkv_runtime);
+    }
+    if (block.output_runtime != NULL) {
+      xnn_delete_runtime(block.output_runtime);
+    }
+  }
+  if (decoder->workspace != NULL) {
+    xnn_release_workspace(decoder->workspace);
+  }
+  if (decoder->weights_cache != NULL) {
+    swiglu_delete_weights_cache(decoder->weights_cache);
+  }
+  delete decoder;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file swiglu_decoder.h
+ * @brief A stack of decoder blocks: XNNPACK projections and FFN around tiled attention
+ *
+ * Each block runs as two runtimes with the attention kernel between them: the
+ * fused QKV projection, then swiglu_flash_attention on its output, then the output
+ * projection, residual and SwiGLU FFN (see swiglu_define_attention_output). All
+ * runtimes share one workspace and one weights cache, as in swiglu_stack.h.
+ *
+ * With a RoPE table, queries and keys are rotated by attention and the KV cache
+ * rather than in a pass over the projection output of their own (see swiglu_rope.h).
+ */
+#pragma once
+
+#include <stddef.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_kv_cache.h"
+#include "swiglu_layer.h"
+#include "swiglu_rope.h"
+
+struct swiglu_decoder;
+
+/**
+ * @brief Creates a stack of num_layers decoder blocks
+ *
+ * Every block must have the same model dim. The weights are not copied and must
+ * outlive the decoder, as must rope, which may be NULL for no position embedding
+ * and otherwise must match the blocks' head dim. threadpool may be NULL and runs
+ * both the runtimes and the attention kernel.
+ */
+enum xnn_status swiglu_create_decoder(
+  size_t num_layers,
+  const struct swiglu_decoder_weights* layers,
+  const struct swiglu_rope_table* rope,
+  pthreadpool_t threadpool,
+  struct swiglu_decoder** decoder_out);
+
+/**
+ * @brief Runs num_rows positions of one sequence through every block
+ *
+ * input and output are [num_rows, dim]. Row r attends to rows 0 to r, so this is
+ * the prefill of a sequence from its first position. input must be readable
+ * XNN_EXTRA_BYTES past its last row.
+ */
+enum xnn_status swiglu_run_decoder_prefill(
+  struct swiglu_decoder* decoder,
+  size_t num_rows,
+  const float* input,
+  float* output);
+
+/**
+ * @brief Prefills num_sequences sequences packed back to back in one batch
+ *
+ * Sequence s is rows offsets[s] to offsets[s + 1] of input and output, so offsets
+ * has num_sequences + 1 entries, starting at 0. The projections and FFN run on all
+ * offsets[num_sequences] rows at once, and attention keeps to each sequence (see
+ * swiglu_flash_attention_varlen), so no sequence is padded to the longest one.
+ */
+enum xnn_status swiglu_run_decoder_prefill_varlen(
+  struct swiglu_decoder* decoder,
+  size_t num_sequences,
+  const size_t* offsets,
+  const float* input,
+  float* output);
+
+/**
+ * @brief Runs num_rows new positions of a sequence through every block, attending to its KV caches
+ *
+ * caches holds one cache per block, each with the block's KV heads and head dim.
+ * The rows' keys and values are appended to the sequence in every cache and the
+ * rows attend to everything cached before them, so this is a decode step, or a
+ * chunk of prefill. input must be readable XNN_EXTRA_BYTES past its last row.
+ */
+enum xnn_status swiglu_run_decoder_step(
+  struct swiglu_decoder* decoder,
+  struct swiglu_kv_cache* const* caches,
+  size_t sequence,
+  size_t num_rows,
+  const float* input,
+  float* output);
+
+void swiglu_delete_decoder(struct swiglu_decoder* decoder);
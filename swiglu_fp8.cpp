@@ -0,0 +1,394 @@
+/**
+ * @file swiglu_fp8.cpp
+ * @brief fp8 conversions and SwiGLU layers that decode fp8 weights a tile of rows at a time
+ */
+#include "swiglu_fp8.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+// Output channels per task, an even number. A task decodes this many weight rows
+// once, which with its batch of inputs stays in L1 and L2.
+static const size_t kChannelTile = 16;
+
+static constexpr int exponent_bias(enum swiglu_fp8_format format) {
+  return format == swiglu_fp8_e4m3 ? 7 : 15;
+}
+
+static constexpr int mantissa_bits(enum swiglu_fp8_format format) {
+  return format == swiglu_fp8_e4m3 ? 3 : 2;
+}
+
+// Largest finite code without the sign bit: S.1111.110 for E4M3 (S.1111.111 is NaN), S.11110.11 for E5M2.
+static constexpr int max_code(enum swiglu_fp8_format format) {
+  return format == swiglu_fp8_e4m3 ? 0x7E : 0x7B;
+}
+
+// Value of one fp8 code, in integer and mask operations the compiler can vectorize.
+template <enum swiglu_fp8_format Format>
+static inline float decode(uint8_t code) {
+  const uint32_t magnitude = code & 0x7F;
+  // Exponent and mantissa slide under fp32's and the exponent is rebiased. Zero
+  // exponents are read as 1 with the implicit bit then subtracted again, which gives
+  // subnormals exactly without creating fp32 denormals.
+  const uint32_t subnormal_mask = 0u - static_cast<uint32_t>(magnitude < (1u << mantissa_bits(Format)));
+  const uint32_t bits =
+    (magnitude << (23 - mantissa_bits(Format))) + ((127 - exponent_bias(Format)) << 23) + (subnormal_mask & (1u << 23));
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  const float implicit_bit = Format == swiglu_fp8_e4m3 ? 0x1.0p-6f : 0x1.0p-14f;
+  uint32_t result;
+  const float unsigned_value = value - implicit_bit * static_cast<float>(subnormal_mask & 1u);
+  memcpy(&result, &unsigned_value, sizeof(result));
+  result |= static_cast<uint32_t>(code & 0x80) << 24;
+  memcpy(&value, &result, sizeof(value));
+  return value;
+}
+
+float swiglu_fp8_max(enum swiglu_fp8_format format) {
+  return format == swiglu_fp8_e4m3 ? 448.0f : 57344.0f;
+}
+
+uint8_t swiglu_fp32_to_fp8(float value, enum swiglu_fp8_format format) {
+  const int bias = exponent_bias(format);
+  const int mantissa = mantissa_bits(format);
+  const uint8_t sign = signbit(value) ? 0x80 : 0x00;
+  const float magnitude = fabsf(value);
+  if (!(magnitude < swiglu_fp8_max(format))) {
+    return sign | max_code(format);
+  }
+  // Binade of magnitude; subnormals share the step of the smallest normal binade.
+  int exponent;
+  frexpf(magnitude, &exponent);
+  const int binade = magnitude < ldexpf(1.0f, 1 - bias) ? 1 - bias : exponent - 1;
+  // Steps of the binade, in [0, 2^(mantissa + 1)]. Rounding up to 2^(mantissa + 1)
+  // carries into the next binade's code, as codes increase with magnitude.
+  const int steps = static_cast<int>(nearbyintf(ldexpf(magnitude, mantissa - binade)));
+  const int code = ((binade + bias - 1) << mantissa) + steps;
+  return sign | static_cast<uint8_t>(std::min(code, max_code(format)));
+}
+
+float swiglu_fp8_to_fp32(uint8_t value, enum swiglu_fp8_format format) {
+  return format == swiglu_fp8_e4m3 ? decode<swiglu_fp8_e4m3>(value) : decode<swiglu_fp8_e5m2>(value);
+}
+
+void swiglu_quantize_fp8(
+  const float* weights,
+  size_t rows,
+  size_t cols,
+  enum swiglu_fp8_format format,
+  bool per_channel,
+  uint8_t* quantized,
+  float* scale)
+{
+  const size_t num_groups = per_channel ? rows : 1;
+  const size_t group_size = per_channel ? cols : rows * cols;
+  for (size_t g = 0; g < num_groups; ++g) {
+    const float* w = weights + g * group_size;
+    float max_abs = 0.0f;
+    for (size_t i = 0; i < group_size; ++i) {
+      max_abs = std::max(max_abs, fabsf(w[i]));
+    }
+    const float s = max_abs / swiglu_fp8_max(format);
+    scale[g] = isnormal(s) ? s : 1.0f;
+    for (size_t i = 0; i < group_size; ++i) {
+      quantized[g * group_size + i] = swiglu_fp32_to_fp8(w[i] / scale[g], format);
+    }
+  }
+}
+
+// Adds eight partial sums in a fixed order.
+static inline float sum_lanes(const float* acc) {
+  return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+}
+
+// Eight independent partial sums, so the compiler can keep them in one vector
+// register, decoding each weight as it is loaded.
+template <enum swiglu_fp8_format Format>
+static float dot_fp8(const uint8_t* w, const float* x, size_t n) {
+  float acc[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    for (size_t k = 0; k < 8; ++k) {
+      acc[k] += decode<Format>(w[i + k]) * x[i + k];
+    }
+  }
+  for (; i < n; ++i) {
+    acc[0] += decode<Format>(w[i]) * x[i];
+  }
+  return sum_lanes(acc);
+}
+
+// Decodes channels offset to offset + count of a projection into decoded, as
+// [kChannelTile, cols]. Channels past count are zero. Blocks of eight go through a
+// local array, so the compiler vectorizes the decode without having to prove that
+// decoded does not alias the weights.
+template <enum swiglu_fp8_format Format>
+static void decode_tile(
+  const struct swiglu_fp8_projection& weights,
+  size_t offset,
+  size_t count,
+  size_t cols,
+  std::vector<float>& decoded)
+{
+  decoded.resize(kChannelTile * cols);
+  const uint8_t* rows = weights.data + offset * cols;
+  float* out = decoded.data();
+  const size_t size = count * cols;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    float block[8];
+    for (size_t k = 0; k < 8; ++k) {
+      block[k] = decode<Format>(rows[i + k]);
+    }
+    for (size_t k = 0; k < 8; ++k) {
+      out[i + k] = block[k];
+    }
+  }
+  for (; i < size; ++i) {
+    out[i] = decode<Format>(rows[i]);
+  }
+  std::fill(decoded.begin() + size, decoded.end(), 0.0f);
+}
+
+/**
+ * Channels c and c + 1 of a decoded tile against input rows b and b + 1, into
+ * out[b * kChannelTile + c] and its neighbours.
+ *
+ * Every block of eight weights and inputs loaded feeds two products, and the four
+ * sums of eight lanes fit in vector registers next to the loads. Four separate arrays
+ * and loops, rather than one [2][2][8] array, are what the compiler vectorizes and
+ * keeps in registers. With b + 1 past the batch, row b is read twice and only stored
+ * once.
+ */
+static void multiply_block(
+  const float* decoded,
+  size_t cols,
+  size_t c,
+  size_t batch_size,
+  const float* input,
+  size_t b,
+  float* out)
+{
+  const float* w0 = decoded + c * cols;
+  const float* w1 = w0 + cols;
+  const float* x0 = input + b * cols;
+  const bool pair = b + 1 < batch_size;
+  const float* x1 = pair ? x0 + cols : x0;
+  float acc00[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  float acc01[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  float acc10[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  float acc11[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  size_t i = 0;
+  for (; i + 8 <= cols; i += 8) {
+    for (size_t k = 0; k < 8; ++k) {
+      acc00[k] += w0[i + k] * x0[i + k];
+    }
+    for (size_t k = 0; k < 8; ++k) {
+      acc01[k] += w0[i + k] * x1[i + k];
+    }
+    for (size_t k = 0; k < 8; ++k) {
+      acc10[k] += w1[i + k] * x0[i + k];
+    }
+    for (size_t k = 0; k < 8; ++k) {
+      acc11[k] += w1[i + k] * x1[i + k];
+    }
+  }
+  for (; i < cols; ++i) {
+    acc00[0] += w0[i] * x0[i];
+    acc01[0] += w0[i] * x1[i];
+    acc10[0] += w1[i] * x0[i];
+    acc11[0] += w1[i] * x1[i];
+  }
+  out[b * kChannelTile + c] = sum_lanes(acc00);
+  out[b * kChannelTile + c + 1] = sum_lanes(acc10);
+  if (pair) {
+    out[(b + 1) * kChannelTile + c] = sum_lanes(acc01);
+    out[(b + 1) * kChannelTile + c + 1] = sum_lanes(acc11);
+  }
+}
+
+/**
+ * Channels offset to offset + count of a [rows, cols] projection against every row of
+ * input, into out[batch_size, kChannelTile].
+ *
+ * A single input row decodes weights inside the dot product. Larger batches decode
+ * the tile once into decoded, then run it in blocks of two channels by two input
+ * rows, a pair of input rows at a time against the whole tile.
+ */
+template <enum swiglu_fp8_format Format>
+static void project_tile(
+  const struct swiglu_fp8_projection& weights,
+  size_t offset,
+  size_t count,
+  size_t cols,
+  size_t batch_size,
+  const float* input,
+  std::vector<float>& decoded,
+  float* out)
+{
+  if (batch_size == 1) {
+    for (size_t c = 0; c < count; ++c) {
+      out[c] = dot_fp8<Format>(weights.data + (offset + c) * cols, input, cols);
+    }
+  } else {
+    decode_tile<Format>(weights, offset, count, cols, decoded);
+    for (size_t b = 0; b < batch_size; b += 2) {
+      for (size_t c = 0; c < count; c += 2) {
+        multiply_block(decoded.data(), cols, c, batch_size, input, b, out);
+      }
+    }
+  }
+  for (size_t b = 0; b < batch_size; ++b) {
+    for (size_t c = 0; c < count; ++c) {
+      out[b * kChannelTile + c] *= weights.scale[weights.per_channel ? offset + c : 0];
+    }
+  }
+}
+
+static void project(
+  const struct swiglu_fp8_projection& weights,
+  size_t offset,
+  size_t count,
+  size_t cols,
+  size_t batch_size,
+  const float* input,
+  std::vector<float>& decoded,
+  float* out)
+{
+  if (weights.format == swiglu_fp8_e4m3) {
+    project_tile<swiglu_fp8_e4m3>(weights, offset, count, cols, batch_size, input, decoded, out);
+  } else {
+    project_tile<swiglu_fp8_e5m2>(weights, offset, count, cols, batch_size, input, decoded, out);
+  }
+}
+
+struct swiglu_fp8_stack {
+  pthreadpool_t threadpool;
+  std::vector<swiglu_fp8_weights> layers;
+  // [batch_size, inter_dim] gated intermediate of the running layer
+  std::vector<float> intermediate;
+  // Outputs of alternate layers but the last, [batch_size, output_dim]
+  std::vector<float> activations[2];
+};
+
+struct layer_context {
+  const struct swiglu_fp8_weights* layer;
+  size_t batch_size;
+  const float* input;
+  float* intermediate;
+  float* output;
+};
+
+// SiLU(W1 @ input) * (W3 @ input) for intermediate channels offset to offset + count.
+static void gate_up_tile(void* context, size_t offset, size_t count) {
+  const struct layer_context* ctx = static_cast<const struct layer_context*>(context);
+  const struct swiglu_fp8_weights& layer = *ctx->layer;
+  const size_t batch_size = ctx->batch_size;
+  thread_local std::vector<float> decoded;
+  thread_local std::vector<float> gate;
+  thread_local std::vector<float> up;
+  gate.resize(batch_size * kChannelTile);
+  up.resize(batch_size * kChannelTile);
+  project(layer.w1, offset, count, layer.input_dim, batch_size, ctx->input, decoded, gate.data());
+  project(layer.w3, offset, count, layer.input_dim, batch_size, ctx->input, decoded, up.data());
+  for (size_t b = 0; b < batch_size; ++b) {
+    const float* g = gate.data() + b * kChannelTile;
+    const float* u = up.data() + b * kChannelTile;
+    float* out = ctx->intermediate + b * layer.inter_dim + offset;
+    for (size_t c = 0; c < count; ++c) {
+      out[c] = g[c] / (1.0f + expf(-g[c])) * u[c];
+    }
+  }
+}
+
+// W2 @ intermediate for output channels offset to offset + count.
+static void down_tile(void* context, size_t offset, size_t count) {
+  const struct layer_context* ctx = static_cast<const struct layer_context*>(context);
+  const struct swiglu_fp8_weights& layer = *ctx->layer;
+  const size_t batch_size = ctx->batch_size;
+  thread_local std::vector<float> decoded;
+  thread_local std::vector<float> down;
+  down.resize(batch_size * kChannelTile);
+  project(layer.w2, offset, count, layer.inter_dim, batch_size, ctx->intermediate, decoded, down.data());
+  for (size_t b = 0; b < batch_size; ++b) {
+    memcpy(ctx->output + b * layer.output_dim + offset, down.data() + b * kChannelTile, count * sizeof(float));
+  }
+}
+
+enum xnn_status swiglu_create_fp8_stack(
+  size_t num_layers,
+  const struct swiglu_fp8_weights* layers,
+  pthreadpool_t threadpool,
+  struct swiglu_fp8_stack** stack_out)
+{
+  if (num_layers == 0) {
+    fprintf(stderr, "a stack needs at least one layer\n");
+    return xnn_status_invalid_parameter;
+  }
+  for (size_t i = 0; i < num_layers; ++i) {
+    const struct swiglu_fp8_weights& layer = layers[i];
+    if (layer.input_dim == 0 || layer.inter_dim == 0 || layer.output_dim == 0 ||
+        (i + 1 < num_layers && layer.output_dim != layers[i + 1].input_dim)) {
+      fprintf(stderr, "fp8 layer %zu has dims %zu, %zu, %zu that are empty or do not chain\n", i, layer.input_dim,
+              layer.inter_dim, layer.output_dim);
+      return xnn_status_invalid_parameter;
+    }
+    for (const struct swiglu_fp8_projection* projection : {&layer.w1, &layer.w3, &layer.w2}) {
+      if (projection->data == NULL || projection->scale == NULL ||
+          (projection->format != swiglu_fp8_e4m3 && projection->format != swiglu_fp8_e5m2)) {
+        fprintf(stderr, "fp8 layer %zu has a projection without data or scales, or of format %d\n", i,
+                projection->format);
+        return xnn_status_invalid_parameter;
+      }
+    }
+  }
+
+  struct swiglu_fp8_stack* stack = new (std::nothrow) swiglu_fp8_stack();
+  if (stack == NULL) {
+    fprintf(stderr, "failed to allocate fp8 stack\n");
+    return xnn_status_out_of_memory;
+  }
+  stack->threadpool = threadpool;
+  stack->layers.assign(layers, layers + num_layers);
+  *stack_out = stack;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_run_fp8_stack(
+  struct swiglu_fp8_stack* stack,
+  size_t batch_size,
+  const float* input,
+  float* output)
+{
+  if (batch_size == 0) {
+    return xnn_status_success;
+  }
+  const float* layer_input = input;
+  for (size_t i = 0; i < stack->layers.size(); ++i) {
+    const struct swiglu_fp8_weights& layer = stack->layers[i];
+    float* layer_output = output;
+    if (i + 1 < stack->layers.size()) {
+      std::vector<float>& activations = stack->activations[i % 2];
+      activations.resize(std::max(activations.size(), batch_size * layer.output_dim));
+      layer_output = activations.data();
+    }
+    stack->intermediate.resize(std::max(stack->intermediate.size(), batch_size * layer.inter_dim));
+
+    struct layer_context context = {&layer, batch_size, layer_input, stack->intermediate.data(), layer_output};
+    pthreadpool_parallelize_1d_tile_1d(stack->threadpool, gate_up_tile, &context, layer.inter_dim, kChannelTile,
+                                       /*flags=*/0);
+    pthreadpool_parallelize_1d_tile_1d(stack->threadpool, down_tile, &context, layer.output_dim, kChannelTile,
+                                       /*flags=*/0);
+    layer_input = layer_output;
+  }
+  return xnn_status_success;
+}
+
+void swiglu_delete_fp8_stack(struct swiglu_fp8_stack* stack) {
+  delete stack;
+}
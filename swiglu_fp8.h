@@ -0,0 +1,103 @@
+/**
+ * @file swiglu_fp8.h
+ * @brief SwiGLU stacks over fp8 (E4M3 or E5M2) weights, dequantized inside the GEMM
+ *
+ * Checkpoints that ship in fp8 would otherwise be widened to fp32 or requantized to
+ * int8 to run through XNNPACK, which has no fp8 fully connected operator. These
+ * stacks keep the weights as one byte per value, with a scale per tensor or per
+ * output channel, so they read as little memory as qc8. Each tile of weight rows is
+ * decoded to fp32 once, with integer arithmetic the compiler vectorizes (no table
+ * lookups), right before its dot products, so products see exactly the stored fp8
+ * values and the only error is the checkpoint's own.
+ *
+ * The gate and up projections, SiLU and gating run as one pass over the
+ * intermediate channels, then the down projection as a second, each split across
+ * the thread pool by output channel. Activations stay fp32.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+enum swiglu_fp8_format {
+  // 4 exponent bits (bias 7), 3 mantissa bits, finite up to 448 with no infinities
+  swiglu_fp8_e4m3 = 0,
+  // 5 exponent bits (bias 15), 2 mantissa bits, finite up to 57344
+  swiglu_fp8_e5m2 = 1,
+};
+
+// Largest finite value of format.
+float swiglu_fp8_max(enum swiglu_fp8_format format);
+
+// Rounds to the nearest fp8 value (ties to even), saturating to +-swiglu_fp8_max.
+uint8_t swiglu_fp32_to_fp8(float value, enum swiglu_fp8_format format);
+
+// NaN and infinity codes are never produced by swiglu_fp32_to_fp8 and decode as large finite values.
+float swiglu_fp8_to_fp32(uint8_t value, enum swiglu_fp8_format format);
+
+/**
+ * @brief Quantizes [rows, cols] fp32 weights to fp8
+ *
+ * With per_channel, writes one scale per row, otherwise a single scale; each maps
+ * the largest magnitude it covers to swiglu_fp8_max.
+ */
+void swiglu_quantize_fp8(
+  const float* weights,
+  size_t rows,
+  size_t cols,
+  enum swiglu_fp8_format format,
+  bool per_channel,
+  uint8_t* quantized,
+  float* scale);
+
+/**
+ * @brief fp8 weights of one projection, row-major [rows, cols] = [output, input] channels
+ *
+ * Row r of the weights is scale[per_channel ? r : 0] times the decoded fp8 values.
+ */
+struct swiglu_fp8_projection {
+  enum swiglu_fp8_format format;
+  const uint8_t* data;
+  const float* scale;
+  bool per_channel;
+};
+
+// Shape and fp8 weights of one SwiGLU layer, as swiglu_layer_weights.
+struct swiglu_fp8_weights {
+  size_t input_dim;
+  size_t inter_dim;
+  size_t output_dim;
+  struct swiglu_fp8_projection w1;  // gate projection, [inter_dim, input_dim]
+  struct swiglu_fp8_projection w3;  // up projection, [inter_dim, input_dim]
+  struct swiglu_fp8_projection w2;  // down projection, [output_dim, inter_dim]
+};
+
+struct swiglu_fp8_stack;
+
+/**
+ * @brief Creates a stack of num_layers fp8 SwiGLU layers
+ *
+ * layers[i].output_dim must equal layers[i + 1].input_dim. The weights are not
+ * copied and must outlive the stack. threadpool may be NULL.
+ */
+enum xnn_status swiglu_create_fp8_stack(
+  size_t num_layers,
+  const struct swiglu_fp8_weights* layers,
+  pthreadpool_t threadpool,
+  struct swiglu_fp8_stack** stack_out);
+
+/**
+ * @brief Runs batch_size rows through every layer of the stack
+ *
+ * input is [batch_size, layers[0].input_dim] and output is
+ * [batch_size, layers[num_layers - 1].output_dim].
+ */
+enum xnn_status swiglu_run_fp8_stack(
+  struct swiglu_fp8_stack* stack,
+  size_t batch_size,
+  const float* input,
+  float* output);
+
+void swiglu_delete_fp8_stack(struct swiglu_fp8_stack* stack);
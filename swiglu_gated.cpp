@@ -0,0 +1,265 @@
+/**
+ * @file swiglu_gated.cpp
+ * @brief Gated layers as gate/up runtime, gating pass and down runtime
+ */
+#include "swiglu_gated.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "swiglu_weights_cache.h"
+
+// Elements of the intermediate per task of the gating pass.
+static const size_t kGateTile = 4096;
+
+struct gated_layer {
+  size_t input_dim;
+  size_t inter_dim;
+  size_t output_dim;
+  xnn_runtime_t gate_up_runtime = NULL;
+  xnn_runtime_t down_runtime = NULL;
+  // Batch size the runtimes are currently reshaped for, 0 before the first run.
+  size_t batch_size = 0;
+};
+
+struct swiglu_gated_stack {
+  std::vector<gated_layer> layers;
+  size_t element_size = 0;
+  swiglu_gate_fn gate_fn = NULL;
+  void* context = NULL;
+  struct swiglu_weights_cache* weights_cache = NULL;
+  xnn_workspace_t workspace = NULL;
+  pthreadpool_t threadpool = NULL;
+  // Gate and up projections, [batch_size, inter_dim] elements
+  std::vector<char> gate;
+  std::vector<char> up;
+  // Intermediate and ping-pong activations between layers. All are runtime inputs,
+  // so they carry XNN_EXTRA_BYTES.
+  std::vector<char> intermediate;
+  std::vector<char> activations[2];
+};
+
+static enum xnn_status create_runtime(
+  struct swiglu_gated_stack* stack,
+  swiglu_define_gated_fn define,
+  size_t i,
+  xnn_runtime_t* runtime_out)
+{
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = define(stack->context, i, &subgraph);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  status = xnn_create_runtime_v4(
+    subgraph,
+    /*weights_cache=*/swiglu_weights_cache_provider(stack->weights_cache),
+    /*workspace=*/stack->workspace,
+    /*threadpool=*/stack->threadpool,
+    /*flags=*/0,
+    runtime_out);
+  xnn_delete_subgraph(subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_runtime_v4 failed: %d\n", status);
+  }
+  return status;
+}
+
+enum xnn_status swiglu_create_gated_stack(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  size_t element_size,
+  swiglu_define_gated_fn define_gate_up,
+  swiglu_define_gated_fn define_down,
+  swiglu_gate_fn gate,
+  void* context,
+  pthreadpool_t threadpool,
+  struct swiglu_gated_stack** stack_out)
+{
+  if (num_layers == 0) {
+    fprintf(stderr, "a stack needs at least one layer\n");
+    return xnn_status_invalid_parameter;
+  }
+  for (size_t i = 0; i + 1 < num_layers; ++i) {
+    if (layers[i].output_dim != layers[i + 1].input_dim) {
+      fprintf(stderr, "layer %zu output dim %zu does not match layer %zu input dim %zu\n",
+              i, layers[i].output_dim, i + 1, layers[i + 1].input_dim);
+      return xnn_status_invalid_parameter;
+    }
+  }
+
+  struct swiglu_gated_stack* stack = new (std::nothrow) swiglu_gated_stack();
+  if (stack == NULL) {
+    fprintf(stderr, "failed to allocate gated stack\n");
+    return xnn_status_out_of_memory;
+  }
+  stack->element_size = element_size;
+  stack->gate_fn = gate;
+  stack->context = context;
+  stack->threadpool = threadpool;
+  stack->layers.resize(num_layers);
+
+  enum xnn_status status = swiglu_create_weights_cache(&stack->weights_cache);
+  if (status != xnn_status_success) {
+    swiglu_delete_gated_stack(stack);
+    return status;
+  }
+  status = xnn_create_workspace(&stack->workspace);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_workspace failed: %d\n", status);
+    swiglu_delete_gated_stack(stack);
+    return status;
+  }
+  for (size_t i = 0; i < num_layers; ++i) {
+    gated_layer& layer = stack->layers[i];
+    layer.input_dim = layers[i].input_dim;
+    layer.inter_dim = layers[i].inter_dim;
+    layer.output_dim = layers[i].output_dim;
+    if ((status = create_runtime(stack, define_gate_up, i, &layer.gate_up_runtime)) != xnn_status_success ||
+        (status = create_runtime(stack, define_down, i, &layer.down_runtime)) != xnn_status_success) {
+      swiglu_delete_gated_stack(stack);
+      return status;
+    }
+  }
+  swiglu_finalize_weights_cache(stack->weights_cache);
+
+  *stack_out = stack;
+  return xnn_status_success;
+}
+
+static enum xnn_status reshape_layer(gated_layer& layer, size_t batch_size) {
+  if (layer.batch_size == batch_size) {
+    return xnn_status_success;
+  }
+  const size_t input_dims[2] = {batch_size, layer.input_dim};
+  const size_t inter_dims[2] = {batch_size, layer.inter_dim};
+  const size_t output_dims[2] = {batch_size, layer.output_dim};
+  enum xnn_status status;
+  if ((status = xnn_reshape_external_value(layer.gate_up_runtime, SWIGLU_INPUT_EXTERNAL_ID, 2, input_dims)) !=
+        xnn_status_success ||
+      (status = xnn_reshape_external_value(layer.gate_up_runtime, SWIGLU_GATE_UP_GATE_EXTERNAL_ID, 2, inter_dims)) !=
+        xnn_status_success ||
+      (status = xnn_reshape_external_value(layer.gate_up_runtime, SWIGLU_GATE_UP_UP_EXTERNAL_ID, 2, inter_dims)) !=
+        xnn_status_success ||
+      (status = xnn_reshape_external_value(layer.down_runtime, SWIGLU_INPUT_EXTERNAL_ID, 2, inter_dims)) !=
+        xnn_status_success ||
+      (status = xnn_reshape_external_value(layer.down_runtime, SWIGLU_OUTPUT_EXTERNAL_ID, 2, output_dims)) !=
+        xnn_status_success) {
+    fprintf(stderr, "xnn_reshape_external_value failed: %d\n", status);
+    return status;
+  }
+  if ((status = xnn_reshape_runtime(layer.gate_up_runtime)) != xnn_status_success ||
+      (status = xnn_reshape_runtime(layer.down_runtime)) != xnn_status_success) {
+    fprintf(stderr, "xnn_reshape_runtime failed: %d\n", status);
+    return status;
+  }
+  layer.batch_size = batch_size;
+  return xnn_status_success;
+}
+
+static enum xnn_status run_runtime(xnn_runtime_t runtime, size_t num_values, const struct xnn_external_value* values) {
+  enum xnn_status status = xnn_setup_runtime_v2(runtime, num_values, values);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_setup_runtime_v2 failed: %d\n", status);
+    return status;
+  }
+  status = xnn_invoke_runtime(runtime);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_invoke_runtime failed: %d\n", status);
+  }
+  return status;
+}
+
+struct gate_context {
+  struct swiglu_gated_stack* stack;
+  size_t layer;
+};
+
+static void gate_tile(void* context, size_t offset, size_t count) {
+  const struct gate_context* ctx = static_cast<const struct gate_context*>(context);
+  struct swiglu_gated_stack* stack = ctx->stack;
+  const size_t start = offset * stack->element_size;
+  stack->gate_fn(stack->context, ctx->layer, count, stack->gate.data() + start, stack->up.data() + start,
+                 stack->intermediate.data() + start);
+}
+
+enum xnn_status swiglu_run_gated_stack(
+  struct swiglu_gated_stack* stack,
+  size_t batch_size,
+  const void* input,
+  void* output)
+{
+  const size_t element_size = stack->element_size;
+  size_t max_inter_dim = 0;
+  size_t max_dim = 0;
+  for (const gated_layer& layer : stack->layers) {
+    max_inter_dim = std::max(max_inter_dim, layer.inter_dim);
+    max_dim = std::max(max_dim, layer.output_dim);
+  }
+  if (stack->gate.size() < batch_size * max_inter_dim * element_size) {
+    stack->gate.resize(batch_size * max_inter_dim * element_size);
+    stack->up.resize(batch_size * max_inter_dim * element_size);
+  }
+  if (stack->intermediate.size() < batch_size * max_inter_dim * element_size + XNN_EXTRA_BYTES) {
+    stack->intermediate.resize(batch_size * max_inter_dim * element_size + XNN_EXTRA_BYTES);
+  }
+  for (std::vector<char>& activations : stack->activations) {
+    if (activations.size() < batch_size * max_dim * element_size + XNN_EXTRA_BYTES) {
+      activations.resize(batch_size * max_dim * element_size + XNN_EXTRA_BYTES);
+    }
+  }
+
+  const void* layer_input = input;
+  for (size_t i = 0; i < stack->layers.size(); ++i) {
+    gated_layer& layer = stack->layers[i];
+    void* layer_output = i + 1 == stack->layers.size() ? output : stack->activations[i % 2].data();
+    enum xnn_status status = reshape_layer(layer, batch_size);
+    if (status != xnn_status_success) {
+      return status;
+    }
+
+    const struct xnn_external_value gate_up_values[SWIGLU_GATE_UP_NUM_EXTERNAL_VALUES] = {
+      {SWIGLU_INPUT_EXTERNAL_ID, const_cast<void*>(layer_input)},
+      {SWIGLU_GATE_UP_GATE_EXTERNAL_ID, stack->gate.data()},
+      {SWIGLU_GATE_UP_UP_EXTERNAL_ID, stack->up.data()},
+    };
+    status = run_runtime(layer.gate_up_runtime, SWIGLU_GATE_UP_NUM_EXTERNAL_VALUES, gate_up_values);
+    if (status != xnn_status_success) {
+      return status;
+    }
+
+    struct gate_context context = {stack, i};
+    pthreadpool_parallelize_1d_tile_1d(stack->threadpool, gate_tile, &context, batch_size * layer.inter_dim,
+                                       kGateTile, /*flags=*/0);
+
+    const struct xnn_external_value down_values[SWIGLU_NUM_EXTERNAL_VALUES] = {
+      {SWIGLU_INPUT_EXTERNAL_ID, stack->intermediate.data()},
+      {SWIGLU_OUTPUT_EXTERNAL_ID, layer_output},
+    };
+    status = run_runtime(layer.down_runtime, SWIGLU_NUM_EXTERNAL_VALUES, down_values);
+    if (status != xnn_status_success) {
+      return status;
+    }
+    layer_input = layer_output;
+  }
+  return xnn_status_success;
+}
+
+void swiglu_delete_gated_stack(struct swiglu_gated_stack* stack) {
+  for (gated_layer& layer : stack->layers) {
+    if (layer.gate_up_runtime != NULL) {
+      xnn_delete_runtime(layer.gate_up_runtime);
+    }
+    if (layer.down_runtime != NULL) {
+      xnn_delete_runtime(layer.down_runtime);
+    }
+  }
+  if (stack->workspace != NULL) {
+    xnn_release_workspace(stack->workspace);
+  }
+  if (stack->weights_cache != NULL) {
+    swiglu_delete_weights_cache(stack->weights_cache);
+  }
+  delete stack;
+}
@@ -0,0 +1,73 @@
+/**
+ * @file swiglu_gated.h
+ * @brief Stacks of layers run as gate/up runtime, elementwise gating pass and down runtime
+ *
+ * Stacks whose gating XNNPACK cannot express, or should not run as separate
+ * operators, split every layer in two runtimes: one projects the input to gate and
+ * up, one projects the intermediate down, and between them a pass over the
+ * [batch, inter_dim] elements computes intermediate = gate_fn(gate, up) on the
+ * threadpool. This stack owns those runtimes, their buffers, weights cache and
+ * workspace; its owner supplies the subgraphs, the element type and the gating
+ * function, which is all the fp32 SiLU and static int8 stacks differ in.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_layer.h"
+
+/**
+ * @brief Defines the gate/up or the down subgraph of layer i
+ *
+ * The gate/up subgraph reads SWIGLU_INPUT_EXTERNAL_ID and writes
+ * SWIGLU_GATE_UP_GATE_EXTERNAL_ID and SWIGLU_GATE_UP_UP_EXTERNAL_ID; the down
+ * subgraph reads SWIGLU_INPUT_EXTERNAL_ID and writes SWIGLU_OUTPUT_EXTERNAL_ID.
+ * Batch dims are reshaped on every run.
+ */
+typedef enum xnn_status (*swiglu_define_gated_fn)(void* context, size_t i, xnn_subgraph_t* subgraph_out);
+
+// Gating of layer i for count elements: intermediate[j] from gate[j] and up[j], all
+// of the stack's element type.
+typedef void (*swiglu_gate_fn)(
+  void* context,
+  size_t i,
+  size_t count,
+  const void* gate,
+  const void* up,
+  void* intermediate);
+
+struct swiglu_gated_stack;
+
+/**
+ * @brief Creates a stack of num_layers gated layers with elements of element_size bytes
+ *
+ * layers gives the dims of every layer, and layers[i].output_dim must equal
+ * layers[i + 1].input_dim. define_gate_up and define_down are called once per layer
+ * while creating, and gate on every run, all with context. threadpool may be NULL.
+ */
+enum xnn_status swiglu_create_gated_stack(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  size_t element_size,
+  swiglu_define_gated_fn define_gate_up,
+  swiglu_define_gated_fn define_down,
+  swiglu_gate_fn gate,
+  void* context,
+  pthreadpool_t threadpool,
+  struct swiglu_gated_stack** stack_out);
+
+/**
+ * @brief Runs batch_size rows through every layer
+ *
+ * input is [batch_size, layers[0].input_dim] and must be readable XNN_EXTRA_BYTES
+ * past its last row; output is [batch_size, layers[num_layers - 1].output_dim].
+ */
+enum xnn_status swiglu_run_gated_stack(
+  struct swiglu_gated_stack* stack,
+  size_t batch_size,
+  const void* input,
+  void* output);
+
+void swiglu_delete_gated_stack(struct swiglu_gated_stack* stack);
@@ -0,0 +1,253 @@
+/**
+ * @file swiglu_gptq.cpp
+ * @brief GPTQ error compensation for blockwise 4-bit SwiGLU weights
+ */
+#include "swiglu_gptq.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#include "swiglu_quantize.h"
+
+// Rows of a triangular update per task while factoring.
+static const size_t kFactorTile = 16;
+
+struct cholesky_context {
+  float* matrix;
+  const float* column;
+  size_t n;
+  size_t k;
+};
+
+// matrix[i][j] -= column[i] * column[j] for k < j <= i, rows i of one tile.
+static void cholesky_update(void* context, size_t offset, size_t count) {
+  const struct cholesky_context* ctx = static_cast<const struct cholesky_context*>(context);
+  for (size_t i = ctx->k + 1 + offset; i < ctx->k + 1 + offset + count; ++i) {
+    float* row = ctx->matrix + i * ctx->n;
+    const float ci = ctx->column[i];
+    for (size_t j = ctx->k + 1; j <= i; ++j) {
+      row[j] -= ci * ctx->column[j];
+    }
+  }
+}
+
+struct inverse_context {
+  const float* lower;
+  float* upper;
+  size_t n;
+};
+
+// Solves column j of the inverse of lower, written reversed into upper.
+static void invert_column(void* context, size_t j) {
+  const struct inverse_context* ctx = static_cast<const struct inverse_context*>(context);
+  const size_t n = ctx->n;
+  std::vector<float> x(n);
+  x[j] = 1.0f / ctx->lower[j * n + j];
+  for (size_t i = j + 1; i < n; ++i) {
+    const float* row = ctx->lower + i * n;
+    double sum = 0.0;
+    for (size_t k = j; k < i; ++k) {
+      sum += static_cast<double>(row[k]) * x[k];
+    }
+    x[i] = static_cast<float>(-sum / row[i]);
+  }
+  for (size_t i = j; i < n; ++i) {
+    ctx->upper[(n - 1 - i) * n + (n - 1 - j)] = x[i];
+  }
+}
+
+/**
+ * Upper triangular U with U^T U = (H + damping)^-1, as GPTQ uses it.
+ *
+ * With P the reversal permutation and P H P = L L^T, H^-1 = (P L^-1 P)^T (P L^-1 P)
+ * and P L^-1 P is upper triangular, so one Cholesky factorization and one
+ * triangular inverse are enough.
+ */
+static bool inverse_cholesky(
+  const float* hessian,
+  size_t n,
+  const std::vector<bool>& dead,
+  float damping,
+  pthreadpool_t threadpool,
+  std::vector<float>* upper)
+{
+  double mean_diagonal = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    mean_diagonal += dead[i] ? 1.0 : hessian[i * n + i];
+  }
+  const float damp = static_cast<float>(damping * mean_diagonal / n);
+
+  std::vector<float> lower(n * n);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j <= i; ++j) {
+      lower[i * n + j] = hessian[(n - 1 - i) * n + (n - 1 - j)];
+    }
+    lower[i * n + i] = (dead[n - 1 - i] ? 1.0f : lower[i * n + i]) + damp;
+  }
+
+  std::vector<float> column(n);
+  for (size_t k = 0; k < n; ++k) {
+    const float diagonal = lower[k * n + k];
+    if (!(diagonal > 0.0f)) {
+      fprintf(stderr, "Hessian is not positive definite at input channel %zu; increase the damping\n", n - 1 - k);
+      return false;
+    }
+    const float l_kk = sqrtf(diagonal);
+    lower[k * n + k] = l_kk;
+    for (size_t i = k + 1; i < n; ++i) {
+      lower[i * n + k] /= l_kk;
+      column[i] = lower[i * n + k];
+    }
+    struct cholesky_context context = {lower.data(), column.data(), n, k};
+    pthreadpool_parallelize_1d_tile_1d(threadpool, cholesky_update, &context, n - 1 - k, kFactorTile, /*flags=*/0);
+  }
+
+  upper->assign(n * n, 0.0f);
+  struct inverse_context context = {lower.data(), upper->data(), n};
+  pthreadpool_parallelize_1d(threadpool, invert_column, &context, n, /*flags=*/0);
+  return true;
+}
+
+struct gptq_context {
+  const float* weights;
+  size_t cols;
+  size_t block_size;
+  const float* upper;
+  const std::vector<bool>* dead;
+  uint8_t* quantized;
+  uint16_t* scale;
+};
+
+// Quantizes row r one input channel at a time, moving each error onto later channels.
+static void quantize_row(void* context, size_t r) {
+  const struct gptq_context* ctx = static_cast<const struct gptq_context*>(context);
+  const size_t cols = ctx->cols;
+  const size_t num_blocks = cols / ctx->block_size;
+  std::vector<float> w(ctx->weights + r * cols, ctx->weights + (r + 1) * cols);
+  for (size_t j = 0; j < cols; ++j) {
+    if ((*ctx->dead)[j]) {
+      w[j] = 0.0f;
+    }
+  }
+  uint8_t* quantized_row = ctx->quantized + r * cols / 2;
+  float block_scale = 1.0f;
+  for (size_t j = 0; j < cols; ++j) {
+    if (j % ctx->block_size == 0) {
+      const uint16_t scale = swiglu_qb4_block_scale(&w[j], ctx->block_size);
+      ctx->scale[r * num_blocks + j / ctx->block_size] = scale;
+      block_scale = swiglu_bf16_to_fp32(scale);
+    }
+    const float q = fminf(fmaxf(nearbyintf(w[j] / block_scale) + 8.0f, 0.0f), 15.0f);
+    const uint8_t nibble = static_cast<uint8_t>(q);
+    quantized_row[j / 2] = j % 2 == 0 ? nibble : static_cast<uint8_t>(quantized_row[j / 2] | (nibble << 4));
+    const float* u = ctx->upper + j * cols;
+    const float error = (w[j] - block_scale * (q - 8.0f)) / u[j];
+    for (size_t k = j + 1; k < cols; ++k) {
+      w[k] -= error * u[k];
+    }
+  }
+}
+
+// Inverse Cholesky factor and dead input channels of one Hessian, shared by the projections that read it.
+struct factored_hessian {
+  std::vector<bool> dead;
+  std::vector<float> upper;
+};
+
+static enum xnn_status factor_hessian(
+  const float* hessian,
+  size_t cols,
+  size_t block_size,
+  float damping,
+  pthreadpool_t threadpool,
+  struct factored_hessian* factored)
+{
+  if (block_size == 0 || block_size % 32 != 0 || cols % block_size != 0 || !(damping >= 0.0f)) {
+    fprintf(stderr, "GPTQ needs a block size that is a multiple of 32 dividing %zu (got %zu) and damping >= 0\n",
+            cols, block_size);
+    return xnn_status_invalid_parameter;
+  }
+  factored->dead.resize(cols);
+  for (size_t i = 0; i < cols; ++i) {
+    factored->dead[i] = hessian[i * cols + i] == 0.0f;
+  }
+  if (!inverse_cholesky(hessian, cols, factored->dead, damping, threadpool, &factored->upper)) {
+    return xnn_status_invalid_parameter;
+  }
+  return xnn_status_success;
+}
+
+static void quantize_rows(
+  const float* weights,
+  size_t rows,
+  size_t cols,
+  size_t block_size,
+  const struct factored_hessian& factored,
+  pthreadpool_t threadpool,
+  uint8_t* quantized,
+  uint16_t* scale)
+{
+  struct gptq_context context = {weights, cols, block_size, factored.upper.data(), &factored.dead, quantized, scale};
+  pthreadpool_parallelize_1d(threadpool, quantize_row, &context, rows, /*flags=*/0);
+}
+
+enum xnn_status swiglu_quantize_qb4_gptq(
+  const float* weights,
+  size_t rows,
+  size_t cols,
+  size_t block_size,
+  const float* hessian,
+  float damping,
+  pthreadpool_t threadpool,
+  uint8_t* quantized,
+  uint16_t* scale)
+{
+  struct factored_hessian factored;
+  const enum xnn_status status = factor_hessian(hessian, cols, block_size, damping, threadpool, &factored);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  quantize_rows(weights, rows, cols, block_size, factored, threadpool, quantized, scale);
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_quantize_layer_gptq(
+  const struct swiglu_fp32_layer& layer,
+  size_t block_size,
+  const float* input_hessian,
+  const float* inter_hessian,
+  float damping,
+  pthreadpool_t threadpool,
+  struct swiglu_qb4_layer* qb4_out)
+{
+  struct swiglu_qb4_layer& qb4 = *qb4_out;
+  qb4.input_dim = layer.input_dim;
+  qb4.inter_dim = layer.inter_dim;
+  qb4.output_dim = layer.output_dim;
+  qb4.block_size = block_size;
+  qb4.w1.resize(layer.w1.size() / 2);
+  qb4.w3.resize(layer.w3.size() / 2);
+  qb4.w2.resize(layer.w2.size() / 2);
+  qb4.w1_scale.resize(layer.w1.size() / block_size);
+  qb4.w3_scale.resize(layer.w3.size() / block_size);
+  qb4.w2_scale.resize(layer.w2.size() / block_size);
+
+  // W1 and W3 read the same input, so they share its factorization.
+  struct factored_hessian factored;
+  enum xnn_status status = factor_hessian(input_hessian, layer.input_dim, block_size, damping, threadpool, &factored);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  quantize_rows(layer.w1.data(), layer.inter_dim, layer.input_dim, block_size, factored, threadpool, qb4.w1.data(),
+                qb4.w1_scale.data());
+  quantize_rows(layer.w3.data(), layer.inter_dim, layer.input_dim, block_size, factored, threadpool, qb4.w3.data(),
+                qb4.w3_scale.data());
+  status = factor_hessian(inter_hessian, layer.inter_dim, block_size, damping, threadpool, &factored);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  quantize_rows(layer.w2.data(), layer.output_dim, layer.inter_dim, block_size, factored, threadpool, qb4.w2.data(),
+                qb4.w2_scale.data());
+  return xnn_status_success;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file swiglu_gptq.h
+ * @brief GPTQ quantization of SwiGLU weights to blockwise 4-bit
+ *
+ * Rounding each 4-bit weight to nearest loses too much accuracy to serve. GPTQ
+ * quantizes one input channel of a projection at a time and spreads each rounding
+ * error over the channels not yet quantized, weighted by the inverse Hessian
+ * H = X^T X of the projection's calibration inputs, so the errors cancel in
+ * W @ X rather than in W. Block scales are picked from the updated weights as each
+ * block starts, and the result is ordinary swiglu_weight_qb4 data for XNNPACK's
+ * qb4w fully connected path.
+ *
+ * Calibration inputs come from the fp32 layers (see
+ * swiglu_calibrator_collect_hessians). Factoring H takes O(cols^3) and quantizing
+ * O(rows * cols^2) operations, both run on the threadpool; this is an offline step.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_weights_io.h"
+
+/**
+ * @brief Quantizes a [rows, cols] projection with GPTQ
+ *
+ * hessian is the [cols, cols] sum of x x^T over calibration inputs x. damping is
+ * added to its diagonal as a fraction of the mean diagonal entry; inputs that were
+ * always zero are dropped. Writes the swiglu_quantize_qb4 layout.
+ */
+enum xnn_status swiglu_quantize_qb4_gptq(
+  const float* weights,
+  size_t rows,
+  size_t cols,
+  size_t block_size,
+  const float* hessian,
+  float damping,
+  pthreadpool_t threadpool,
+  uint8_t* quantized,
+  uint16_t* scale);
+
+/**
+ * @brief Quantizes every projection of a layer with GPTQ
+ *
+ * input_hessian is X^T X of the layer input (for W1 and W3), inter_hessian of the
+ * gated intermediate (for W2).
+ */
+enum xnn_status swiglu_quantize_layer_gptq(
+  const struct swiglu_fp32_layer& layer,
+  size_t block_size,
+  const float* input_hessian,
+  const float* inter_hessian,
+  float damping,
+  pthreadpool_t threadpool,
+  struct swiglu_qb4_layer* qb4_out);
@@ -0,0 +1,79 @@
+/**
+ * @file swiglu_hot.cpp
+ * @brief Keep-alive thread issuing empty parallel operations on a thread pool
+ */
+#include "swiglu_hot.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+
+// Well below pthreadpool's spin before parking, which is a million spin
+// iterations, or about a millisecond on current cores.
+static const int64_t kKeepAliveMicroseconds = 100;
+
+struct swiglu_hot_mode {
+  pthreadpool_t threadpool;
+  std::chrono::steady_clock::time_point deadline;
+  std::thread keeper;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stop = false;
+};
+
+static void noop_task(void*, size_t) {}
+
+static void keep_alive(struct swiglu_hot_mode* hot) {
+  const size_t num_threads = pthreadpool_get_threads_count(hot->threadpool);
+  std::unique_lock<std::mutex> lock(hot->mutex);
+  for (;;) {
+    hot->cv.wait_for(lock, std::chrono::microseconds(kKeepAliveMicroseconds), [hot] { return hot->stop; });
+    if (hot->stop || std::chrono::steady_clock::now() >= hot->deadline) {
+      break;
+    }
+    lock.unlock();
+    pthreadpool_parallelize_1d(hot->threadpool, noop_task, NULL, num_threads, /*flags=*/0);
+    lock.lock();
+  }
+  lock.unlock();
+  // Park the workers now rather than after another full spin.
+  pthreadpool_parallelize_1d(hot->threadpool, noop_task, NULL, num_threads, PTHREADPOOL_FLAG_YIELD_WORKERS);
+}
+
+enum xnn_status swiglu_enter_hot_mode(
+  pthreadpool_t threadpool,
+  double max_ms,
+  struct swiglu_hot_mode** hot_out)
+{
+  if (threadpool == NULL || max_ms <= 0.0) {
+    fprintf(stderr, "hot mode needs a thread pool and a positive time budget\n");
+    return xnn_status_invalid_parameter;
+  }
+  struct swiglu_hot_mode* hot = new (std::nothrow) swiglu_hot_mode();
+  if (hot == NULL) {
+    fprintf(stderr, "failed to allocate hot mode\n");
+    return xnn_status_out_of_memory;
+  }
+  hot->threadpool = threadpool;
+  hot->deadline = std::chrono::steady_clock::now() +
+                  std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double, std::milli>(max_ms));
+  hot->keeper = std::thread(keep_alive, hot);
+
+  *hot_out = hot;
+  return xnn_status_success;
+}
+
+void swiglu_leave_hot_mode(struct swiglu_hot_mode* hot) {
+  {
+    std::lock_guard<std::mutex> lock(hot->mutex);
+    hot->stop = true;
+  }
+  hot->cv.notify_all();
+  hot->keeper.join();
+  delete hot;
+}
@@ -0,0 +1,39 @@
+/**
+ * @file swiglu_hot.h
+ * @brief Keeps a thread pool's workers spinning through a burst of small runs
+ *
+ * After a parallel operation, pthreadpool's workers spin for a bounded number of
+ * iterations waiting for the next one and then park on a futex. Within one
+ * invocation the operators follow each other closely enough that workers stay in
+ * the spin. Between decode steps, which also sample, tokenize or wait for the
+ * network, they park, and the first operator of the next step pays for waking
+ * every worker. At batch 1 an FC node runs for only a few microseconds, so that
+ * wake-up is a visible part of the step.
+ *
+ * Hot mode issues an empty parallel operation every 100 microseconds from a
+ * background thread, so the workers never reach the end of their spin, until the
+ * caller leaves hot mode or the time budget runs out. Then the workers are told to
+ * park at once instead of finishing their spin. Hot mode burns every worker's core
+ * while it lasts, so enter it for a decode burst, not for an idle server.
+ */
+#pragma once
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+struct swiglu_hot_mode;
+
+/**
+ * @brief Starts keeping threadpool's workers spinning for at most max_ms
+ *
+ * Runs on threadpool may start while hot mode is on; one of them may wait for an
+ * empty operation to finish, which takes about a microsecond.
+ */
+enum xnn_status swiglu_enter_hot_mode(
+  pthreadpool_t threadpool,
+  double max_ms,
+  struct swiglu_hot_mode** hot_out);
+
+// Stops keeping the workers busy and parks them. Also frees hot, even if its
+// time budget has already run out.
+void swiglu_leave_hot_mode(struct swiglu_hot_mode* hot);
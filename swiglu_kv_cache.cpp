@@ -0,0 +1,347 @@
+/**
+ * @file swiglu_kv_cache.cpp
+ * @brief Quantize-on-append key/value cache and attention with dequantizing dot products
+ *
+ * Attention keeps a running maximum and softmax denominator per query row (online
+ * softmax), so it makes a single pass over the cache and needs no buffer of scores.
+ */
+#include "swiglu_kv_cache.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+struct swiglu_kv_cache {
+  size_t num_sequences;
+  size_t max_len;
+  size_t num_heads;
+  size_t head_dim;
+  enum swiglu_kv_precision precision;
+  size_t block_size;
+  size_t blocks_per_head;
+  // Bytes of one head at one position
+  size_t head_bytes;
+  // [num_sequences, num_heads, max_len, head_bytes]
+  std::vector<uint8_t> keys;
+  std::vector<uint8_t> values;
+  // [num_sequences, num_heads, max_len, blocks_per_head], empty for fp32
+  std::vector<float> key_scales;
+  std::vector<float> value_scales;
+  std::vector<size_t> lengths;
+};
+
+static size_t head_offset(const struct swiglu_kv_cache* cache, size_t sequence, size_t head, size_t position) {
+  return (sequence * cache->num_heads + head) * cache->max_len + position;
+}
+
+// Quantizes one head of one position, block_size channels per scale.
+static void quantize_head(const struct swiglu_kv_cache* cache, const float* x, uint8_t* data, float* scales) {
+  if (cache->precision == swiglu_kv_fp32) {
+    memcpy(data, x, cache->head_dim * sizeof(float));
+    return;
+  }
+  const float max_level = cache->precision == swiglu_kv_int8 ? 127.0f : 7.0f;
+  for (size_t b = 0; b < cache->blocks_per_head; ++b) {
+    const float* block = x + b * cache->block_size;
+    float max_abs = 0.0f;
+    for (size_t i = 0; i < cache->block_size; ++i) {
+      max_abs = std::max(max_abs, fabsf(block[i]));
+    }
+    const float scale = max_abs / max_level;
+    const float inv_scale = scale > 0.0f ? 1.0f / scale : 0.0f;
+    scales[b] = scale;
+    if (cache->precision == swiglu_kv_int8) {
+      int8_t* q = reinterpret_cast<int8_t*>(data) + b * cache->block_size;
+      for (size_t i = 0; i < cache->block_size; ++i) {
+        q[i] = static_cast<int8_t>(std::min(std::max(lrintf(block[i] * inv_scale), -127L), 127L));
+      }
+    } else {
+      uint8_t* q = data + b * cache->block_size / 2;
+      for (size_t i = 0; i < cache->block_size; i += 2) {
+        const long lo = std::min(std::max(lrintf(block[i] * inv_scale), -7L), 7L) + 8;
+        const long hi = std::min(std::max(lrintf(block[i + 1] * inv_scale), -7L), 7L) + 8;
+        q[i / 2] = static_cast<uint8_t>(lo | hi << 4);
+      }
+    }
+  }
+}
+
+// Dot product of q with one stored head, dequantized block by block.
+static float dot_head(const struct swiglu_kv_cache* cache, const float* q, const uint8_t* data, const float* scales) {
+  if (cache->precision == swiglu_kv_fp32) {
+    const float* k = reinterpret_cast<const float*>(data);
+    float sum = 0.0f;
+    for (size_t i = 0; i < cache->head_dim; ++i) {
+      sum += q[i] * k[i];
+    }
+    return sum;
+  }
+  float sum = 0.0f;
+  for (size_t b = 0; b < cache->blocks_per_head; ++b) {
+    const float* qb = q + b * cache->block_size;
+    float block_sum = 0.0f;
+    if (cache->precision == swiglu_kv_int8) {
+      const int8_t* k = reinterpret_cast<const int8_t*>(data) + b * cache->block_size;
+      for (size_t i = 0; i < cache->block_size; ++i) {
+        block_sum += qb[i] * k[i];
+      }
+    } else {
+      const uint8_t* k = data + b * cache->block_size / 2;
+      for (size_t i = 0; i < cache->block_size; i += 2) {
+        block_sum += qb[i] * ((k[i / 2] & 0xF) - 8) + qb[i + 1] * ((k[i / 2] >> 4) - 8);
+      }
+    }
+    sum += scales[b] * block_sum;
+  }
+  return sum;
+}
+
+// out += weight * one stored head, dequantized block by block.
+static void accumulate_head(
+  const struct swiglu_kv_cache* cache,
+  float weight,
+  const uint8_t* data,
+  const float* scales,
+  float* out)
+{
+  if (cache->precision == swiglu_kv_fp32) {
+    const float* v = reinterpret_cast<const float*>(data);
+    for (size_t i = 0; i < cache->head_dim; ++i) {
+      out[i] += weight * v[i];
+    }
+    return;
+  }
+  for (size_t b = 0; b < cache->blocks_per_head; ++b) {
+    const float w = weight * scales[b];
+    float* ob = out + b * cache->block_size;
+    if (cache->precision == swiglu_kv_int8) {
+      const int8_t* v = reinterpret_cast<const int8_t*>(data) + b * cache->block_size;
+      for (size_t i = 0; i < cache->block_size; ++i) {
+        ob[i] += w * v[i];
+      }
+    } else {
+      const uint8_t* v = data + b * cache->block_size / 2;
+      for (size_t i = 0; i < cache->block_size; i += 2) {
+        ob[i] += w * ((v[i / 2] & 0xF) - 8);
+        ob[i + 1] += w * ((v[i / 2] >> 4) - 8);
+      }
+    }
+  }
+}
+
+enum xnn_status swiglu_create_kv_cache(
+  size_t num_sequences,
+  size_t max_len,
+  size_t num_heads,
+  size_t head_dim,
+  enum swiglu_kv_precision precision,
+  size_t block_size,
+  struct swiglu_kv_cache** cache_out)
+{
+  if (num_sequences == 0 || max_len == 0 || num_heads == 0 || head_dim == 0) {
+    fprintf(stderr, "a KV cache needs at least one sequence, position, head and channel\n");
+    return xnn_status_invalid_parameter;
+  }
+  if (precision == swiglu_kv_fp32) {
+    block_size = head_dim;
+  } else if (block_size == 0 || head_dim % block_size != 0 || (precision == swiglu_kv_int4 && block_size % 2 != 0)) {
+    fprintf(stderr, "KV cache block size %zu must divide head dim %zu%s\n",
+            block_size, head_dim, precision == swiglu_kv_int4 ? " and be even for int4" : "");
+    return xnn_status_invalid_parameter;
+  }
+  struct swiglu_kv_cache* cache = new (std::nothrow) swiglu_kv_cache();
+  if (cache == NULL) {
+    fprintf(stderr, "failed to allocate KV cache\n");
+    return xnn_status_out_of_memory;
+  }
+  cache->num_sequences = num_sequences;
+  cache->max_len = max_len;
+  cache->num_heads = num_heads;
+  cache->head_dim = head_dim;
+  cache->precision = precision;
+  cache->block_size = block_size;
+  cache->blocks_per_head = head_dim / block_size;
+  switch (precision) {
+    case swiglu_kv_fp32:
+      cache->head_bytes = head_dim * sizeof(float);
+      break;
+    case swiglu_kv_int8:
+      cache->head_bytes = head_dim;
+      break;
+    case swiglu_kv_int4:
+      cache->head_bytes = head_dim / 2;
+      break;
+  }
+  const size_t num_head_positions = num_sequences * num_heads * max_len;
+  cache->keys.resize(num_head_positions * cache->head_bytes);
+  cache->values.resize(num_head_positions * cache->head_bytes);
+  if (precision != swiglu_kv_fp32) {
+    cache->key_scales.resize(num_head_positions * cache->blocks_per_head);
+    cache->value_scales.resize(num_head_positions * cache->blocks_per_head);
+  }
+  cache->lengths.assign(num_sequences, 0);
+
+  *cache_out = cache;
+  return xnn_status_success;
+}
+
+// Checks that rope, if set, covers positions up to num_positions of the cache's heads.
+static enum xnn_status check_rope(
+  const struct swiglu_kv_cache* cache,
+  size_t num_positions,
+  const struct swiglu_rope_table* rope)
+{
+  if (rope != NULL && (num_positions > swiglu_rope_max_len(rope) || swiglu_rope_head_dim(rope) != cache->head_dim)) {
+    fprintf(stderr, "%zu positions of head dim %zu do not fit a RoPE table of %zu positions of head dim %zu\n",
+            num_positions, cache->head_dim, swiglu_rope_max_len(rope), swiglu_rope_head_dim(rope));
+    return xnn_status_invalid_parameter;
+  }
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_kv_cache_append(
+  struct swiglu_kv_cache* cache,
+  size_t sequence,
+  size_t num_rows,
+  const float* keys,
+  const float* values,
+  size_t key_stride,
+  const struct swiglu_rope_table* rope)
+{
+  if (sequence >= cache->num_sequences) {
+    fprintf(stderr, "sequence %zu is out of range for a KV cache of %zu\n", sequence, cache->num_sequences);
+    return xnn_status_invalid_parameter;
+  }
+  const size_t length = cache->lengths[sequence];
+  if (length + num_rows > cache->max_len) {
+    fprintf(stderr, "appending %zu positions to sequence %zu of length %zu exceeds max_len %zu\n",
+            num_rows, sequence, length, cache->max_len);
+    return xnn_status_invalid_parameter;
+  }
+  enum xnn_status status = check_rope(cache, length + num_rows, rope);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  const bool scaled = cache->precision != swiglu_kv_fp32;
+  std::vector<float> rotated_key(rope != NULL ? cache->head_dim : 0);
+  for (size_t r = 0; r < num_rows; ++r) {
+    for (size_t h = 0; h < cache->num_heads; ++h) {
+      const size_t offset = head_offset(cache, sequence, h, length + r);
+      const float* key = keys + r * key_stride + h * cache->head_dim;
+      if (rope != NULL) {
+        swiglu_rope_rotate(rope, length + r, key, rotated_key.data());
+        key = rotated_key.data();
+      }
+      quantize_head(cache, key, &cache->keys[offset * cache->head_bytes],
+                    scaled ? &cache->key_scales[offset * cache->blocks_per_head] : NULL);
+      quantize_head(cache, values + r * key_stride + h * cache->head_dim, &cache->values[offset * cache->head_bytes],
+                    scaled ? &cache->value_scales[offset * cache->blocks_per_head] : NULL);
+    }
+  }
+  cache->lengths[sequence] = length + num_rows;
+  return xnn_status_success;
+}
+
+void swiglu_kv_cache_truncate(struct swiglu_kv_cache* cache, size_t sequence, size_t length) {
+  cache->lengths[sequence] = std::min(cache->lengths[sequence], length);
+}
+
+size_t swiglu_kv_cache_length(const struct swiglu_kv_cache* cache, size_t sequence) {
+  return cache->lengths[sequence];
+}
+
+struct attention_context {
+  const struct swiglu_kv_cache* cache;
+  size_t sequence;
+  size_t num_rows;
+  const float* query;
+  size_t num_query_heads;
+  const struct swiglu_rope_table* rope;
+  float* output;
+};
+
+static void attend_row_head(void* context, size_t row, size_t query_head) {
+  const struct attention_context* ctx = static_cast<const struct attention_context*>(context);
+  const struct swiglu_kv_cache* cache = ctx->cache;
+  const size_t head_dim = cache->head_dim;
+  const size_t kv_head = query_head / (ctx->num_query_heads / cache->num_heads);
+  const size_t row_stride = ctx->num_query_heads * head_dim;
+  const float* q = ctx->query + row * row_stride + query_head * head_dim;
+  float* out = ctx->output + row * row_stride + query_head * head_dim;
+  const float score_scale = 1.0f / sqrtf(static_cast<float>(head_dim));
+  const size_t num_positions = cache->lengths[ctx->sequence] - ctx->num_rows + row + 1;
+  const size_t first = head_offset(cache, ctx->sequence, kv_head, 0);
+  const bool scaled = cache->precision != swiglu_kv_fp32;
+  thread_local std::vector<float> rotated_query;
+  if (ctx->rope != NULL) {
+    rotated_query.resize(head_dim);
+    swiglu_rope_rotate(ctx->rope, num_positions - 1, q, rotated_query.data());
+    q = rotated_query.data();
+  }
+
+  // out accumulates the value rows weighted by exp(score - max_score).
+  std::fill(out, out + head_dim, 0.0f);
+  float max_score = -INFINITY;
+  float denominator = 0.0f;
+  for (size_t p = 0; p < num_positions; ++p) {
+    const size_t offset = first + p;
+    const float score = score_scale * dot_head(cache, q, &cache->keys[offset * cache->head_bytes],
+                                               scaled ? &cache->key_scales[offset * cache->blocks_per_head] : NULL);
+    if (score > max_score) {
+      const float rescale = expf(max_score - score);
+      denominator *= rescale;
+      for (size_t i = 0; i < head_dim; ++i) {
+        out[i] *= rescale;
+      }
+      max_score = score;
+    }
+    const float weight = expf(score - max_score);
+    denominator += weight;
+    accumulate_head(cache, weight, &cache->values[offset * cache->head_bytes],
+                    scaled ? &cache->value_scales[offset * cache->blocks_per_head] : NULL, out);
+  }
+  const float inv_denominator = 1.0f / denominator;
+  for (size_t i = 0; i < head_dim; ++i) {
+    out[i] *= inv_denominator;
+  }
+}
+
+enum xnn_status swiglu_kv_cache_attention(
+  struct swiglu_kv_cache* cache,
+  size_t sequence,
+  size_t num_rows,
+  const float* query,
+  size_t num_query_heads,
+  const struct swiglu_rope_table* rope,
+  float* output,
+  pthreadpool_t threadpool)
+{
+  if (sequence >= cache->num_sequences || num_rows > cache->lengths[sequence]) {
+    fprintf(stderr, "attention over %zu rows of sequence %zu, which has fewer\n", num_rows, sequence);
+    return xnn_status_invalid_parameter;
+  }
+  if (num_query_heads == 0 || num_query_heads % cache->num_heads != 0) {
+    fprintf(stderr, "%zu query heads are not a multiple of %zu KV heads\n", num_query_heads, cache->num_heads);
+    return xnn_status_invalid_parameter;
+  }
+  enum xnn_status status = check_rope(cache, cache->lengths[sequence], rope);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  struct attention_context context = {cache, sequence, num_rows, query, num_query_heads, rope, output};
+  pthreadpool_parallelize_2d(threadpool, attend_row_head, &context, num_rows, num_query_heads, /*flags=*/0);
+  return xnn_status_success;
+}
+
+size_t swiglu_kv_cache_bytes_per_position(const struct swiglu_kv_cache* cache) {
+  const size_t scale_bytes = cache->precision == swiglu_kv_fp32 ? 0 : cache->blocks_per_head * sizeof(float);
+  return 2 * cache->num_heads * (cache->head_bytes + scale_bytes);
+}
+
+void swiglu_delete_kv_cache(struct swiglu_kv_cache* cache) {
+  delete cache;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file swiglu_kv_cache.h
+ * @brief Attention keys and values per sequence, stored as fp32, int8 or int4
+ *
+ * In a decoder built around the SwiGLU layers, every step of attention reads the
+ * whole key/value cache of a sequence, so at long contexts the cache competes with
+ * the FFN weights for memory bandwidth. The cache can store keys and values as
+ * symmetric int8 or int4 with one fp32 scale per block_size channels of a head at
+ * one position. Rows are quantized as they are appended, straight from the K and V
+ * projection outputs, and attention dequantizes them inside its dot products, so
+ * no fp32 copy of the cache is ever made. int8 uses a quarter of the memory of fp32
+ * plus the scales, int4 an eighth.
+ *
+ * The heads of a sequence are stored one after the other, each with its positions
+ * contiguous, so attention for one head scans one contiguous range.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_rope.h"
+
+enum swiglu_kv_precision {
+  swiglu_kv_fp32,
+  swiglu_kv_int8,
+  // Two values per byte, low nibble first
+  swiglu_kv_int4,
+};
+
+struct swiglu_kv_cache;
+
+/**
+ * @brief Creates a cache of num_sequences sequences of up to max_len positions
+ *
+ * Every position holds num_heads key and value heads of head_dim channels.
+ * block_size must divide head_dim and be even for int4; it is ignored for fp32.
+ */
+enum xnn_status swiglu_create_kv_cache(
+  size_t num_sequences,
+  size_t max_len,
+  size_t num_heads,
+  size_t head_dim,
+  enum swiglu_kv_precision precision,
+  size_t block_size,
+  struct swiglu_kv_cache** cache_out);
+
+/**
+ * @brief Quantizes num_rows positions of keys and values onto the end of a sequence
+ *
+ * keys and values are [num_rows, key_stride] with the num_heads * head_dim channels
+ * of a position at the start of each row, so they can point into a fused QKV
+ * projection output. With rope set, keys are rotated for their positions on the way
+ * in, so they are read once.
+ */
+enum xnn_status swiglu_kv_cache_append(
+  struct swiglu_kv_cache* cache,
+  size_t sequence,
+  size_t num_rows,
+  const float* keys,
+  const float* values,
+  size_t key_stride,
+  const struct swiglu_rope_table* rope);
+
+// Drops every position of the sequence past length.
+void swiglu_kv_cache_truncate(struct swiglu_kv_cache* cache, size_t sequence, size_t length);
+
+size_t swiglu_kv_cache_length(const struct swiglu_kv_cache* cache, size_t sequence);
+
+/**
+ * @brief Causal attention of the last num_rows positions of a sequence
+ *
+ * query and output are [num_rows, num_query_heads * head_dim]; query row r is at
+ * position length - num_rows + r and attends to every position up to its own.
+ * num_query_heads must be a multiple of num_heads, and query head h reads key and
+ * value head h / (num_query_heads / num_heads). With rope set, query rows are
+ * rotated for their positions as they are loaded; the keys must have been appended
+ * with the same table. Rows and heads run in parallel on threadpool, which may be
+ * NULL.
+ */
+enum xnn_status swiglu_kv_cache_attention(
+  struct swiglu_kv_cache* cache,
+  size_t sequence,
+  size_t num_rows,
+  const float* query,
+  size_t num_query_heads,
+  const struct swiglu_rope_table* rope,
+  float* output,
+  pthreadpool_t threadpool);
+
+// Bytes of keys, values and scales stored per position of a sequence.
+size_t swiglu_kv_cache_bytes_per_position(const struct swiglu_kv_cache* cache);
+
+void swiglu_delete_kv_cache(struct swiglu_kv_cache* cache);
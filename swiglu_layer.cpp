@@ -0,0 +1,726 @@
+/**
+ * @file swiglu_layer.cpp
+ * @brief Subgraph definition of one SwiGLU FFN layer
+ */
+#include "swiglu_layer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+// Defines a [rows, cols] fp32 tensor. Static when data is non-null, internal otherwise.
+static enum xnn_status define_tensor(
+  xnn_subgraph_t subgraph,
+  size_t rows,
+  size_t cols,
+  const void* data,
+  uint32_t external_id,
+  uint32_t flags,
+  uint32_t* id_out)
+{
+  std::vector<size_t> dims = {rows, cols};
+  enum xnn_status status = xnn_define_tensor_value(
+    subgraph,
+    xnn_datatype_fp32,
+    /*num_dims=*/dims.size(),
+    /*dims=*/dims.data(),
+    /*data=*/data,
+    /*external_id=*/external_id,
+    /*flags=*/flags,
+    id_out);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_tensor_value failed: %d\n", status);
+  }
+  return status;
+}
+
+// Defines an int8 copy of the [1, cols] fp32 activation input_id, quantized per row
+// at run time.
+static enum xnn_status define_dynamic_quantization(
+  xnn_subgraph_t subgraph,
+  size_t cols,
+  uint32_t input_id,
+  uint32_t* quantized_id_out)
+{
+  std::vector<size_t> dims = {1, cols};
+  enum xnn_status status = xnn_define_dynamically_quantized_tensor_value(
+    subgraph,
+    xnn_datatype_qdint8,
+    /*num_dims=*/dims.size(),
+    /*num_nonbatch_dims=*/1,
+    /*dims=*/dims.data(),
+    /*external_id=*/XNN_INVALID_VALUE_ID,
+    /*flags=*/0,
+    quantized_id_out);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_dynamically_quantized_tensor_value failed: %d\n", status);
+    return status;
+  }
+  status = xnn_define_unary(
+    subgraph,
+    xnn_unary_convert,
+    /*params=*/nullptr,
+    input_id,
+    *quantized_id_out,
+    /*flags=*/0);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_unary failed: %d\n", status);
+  }
+  return status;
+}
+
+/**
+ * Defines output_id = weights @ input_id for a [rows, cols] projection.
+ *
+ * quantized_input_id caches the int8 copy of input_id so that the gate and up
+ * projections quantize the layer input only once. Pass XNN_INVALID_VALUE_ID on the
+ * first use.
+ */
+static enum xnn_status define_projection(
+  xnn_subgraph_t subgraph,
+  const struct swiglu_projection_weights* weights,
+  size_t rows,
+  size_t cols,
+  uint32_t input_id,
+  uint32_t* quantized_input_id,
+  uint32_t output_id)
+{
+  enum xnn_status status = xnn_status_success;
+  uint32_t filter_id = XNN_INVALID_VALUE_ID;
+  uint32_t fc_input_id = input_id;
+  std::vector<size_t> filter_dims = {rows, cols};
+  switch (weights->type) {
+    case swiglu_weight_fp32:
+      status = define_tensor(subgraph, rows, cols, weights->data, XNN_INVALID_VALUE_ID, 0, &filter_id);
+      if (status != xnn_status_success) {
+        return status;
+      }
+      break;
+    case swiglu_weight_qc8:
+      if (*quantized_input_id == XNN_INVALID_VALUE_ID) {
+        status = define_dynamic_quantization(subgraph, cols, input_id, quantized_input_id);
+        if (status != xnn_status_success) {
+          return status;
+        }
+      }
+      fc_input_id = *quantized_input_id;
+      status = xnn_define_channelwise_quantized_tensor_value(
+        subgraph,
+        xnn_datatype_qcint8,
+        /*scale=*/weights->scale,
+        /*num_dims=*/filter_dims.size(),
+        /*channel_dim=*/0,
+        /*dims=*/filter_dims.data(),
+        /*data=*/weights->data,
+        /*external_id=*/XNN_INVALID_VALUE_ID,
+        /*flags=*/0,
+        &filter_id);
+      if (status != xnn_status_success) {
+        fprintf(stderr, "xnn_define_channelwise_quantized_tensor_value failed: %d\n", status);
+        return status;
+      }
+      break;
+    case swiglu_weight_qb4:
+      if (weights->block_size == 0 || weights->block_size % 32 != 0 || cols % weights->block_size != 0) {
+        fprintf(stderr, "qb4 block size %zu is not a multiple of 32 dividing %zu\n", weights->block_size, cols);
+        return xnn_status_invalid_parameter;
+      }
+      if (*quantized_input_id == XNN_INVALID_VALUE_ID) {
+        status = define_dynamic_quantization(subgraph, cols, input_id, quantized_input_id);
+        if (status != xnn_status_success) {
+          return status;
+        }
+      }
+      fc_input_id = *quantized_input_id;
+      status = xnn_define_blockwise_quantized_tensor_value(
+        subgraph,
+        xnn_datatype_qbint4,
+        /*zero_point=*/8,
+        /*scale=*/weights->block_scale,
+        /*num_dims=*/filter_dims.size(),
+        /*channel_dim=*/0,
+        /*block_size=*/weights->block_size,
+        /*dims=*/filter_dims.data(),
+        /*data=*/weights->data,
+        /*external_id=*/XNN_INVALID_VALUE_ID,
+        /*flags=*/0,
+        &filter_id);
+      if (status != xnn_status_success) {
+        fprintf(stderr, "xnn_define_blockwise_quantized_tensor_value failed: %d\n", status);
+        return status;
+      }
+      break;
+    default:
+      fprintf(stderr, "unsupported weight type %d\n", weights->type);
+      return xnn_status_unsupported_parameter;
+  }
+
+  status = xnn_define_fully_connected(
+    subgraph,
+    /*output_min=*/-INFINITY,
+    /*output_max=*/INFINITY,
+    /*input_id=*/fc_input_id,
+    /*filter_id=*/filter_id,
+    /*bias_id=*/XNN_INVALID_VALUE_ID,  // No bias
+    /*output_id=*/output_id,
+    /*flags=*/0);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_fully_connected failed: %d\n", status);
+  }
+  return status;
+}
+
+// Defines output_id = W2 @ (SiLU(W1 @ input_id) * (W3 @ input_id)). With
+// expose_intermediates, the gate, up, SiLU and gated intermediate values are also
+// external outputs (see swiglu_define_calibration_layer).
+static enum xnn_status define_ffn(
+  xnn_subgraph_t subgraph,
+  const struct swiglu_layer_weights* weights,
+  uint32_t input_id,
+  uint32_t output_id,
+  bool expose_intermediates)
+{
+  const size_t input_dim = weights->input_dim;
+  const size_t inter_dim = weights->inter_dim;
+  const size_t output_dim = weights->output_dim;
+  uint32_t gate_output_id, up_output_id, sigmoid_output_id, silu_output_id;
+  uint32_t gated_intermediate_output_id;
+  const uint32_t flags = expose_intermediates ? XNN_VALUE_FLAG_EXTERNAL_OUTPUT : 0;
+
+  // Intermediates. Batch dims are reshaped later.
+  enum xnn_status status;
+  if ((status = define_tensor(subgraph, 1, inter_dim, nullptr,
+                              expose_intermediates ? SWIGLU_CALIBRATION_GATE_EXTERNAL_ID : XNN_INVALID_VALUE_ID,
+                              flags, &gate_output_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, inter_dim, nullptr,
+                              expose_intermediates ? SWIGLU_CALIBRATION_UP_EXTERNAL_ID : XNN_INVALID_VALUE_ID,
+                              flags, &up_output_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, inter_dim, nullptr, XNN_INVALID_VALUE_ID,
+                              0, &sigmoid_output_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, inter_dim, nullptr,
+                              expose_intermediates ? SWIGLU_CALIBRATION_SILU_EXTERNAL_ID : XNN_INVALID_VALUE_ID,
+                              flags, &silu_output_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, inter_dim, nullptr,
+                              expose_intermediates ? SWIGLU_CALIBRATION_INTERMEDIATE_EXTERNAL_ID
+                                                   : XNN_INVALID_VALUE_ID,
+                              flags, &gated_intermediate_output_id)) != xnn_status_success) {
+    return status;
+  }
+
+  // Gate projection: w1 @ input, and up projection: w3 @ input
+  uint32_t quantized_input_id = XNN_INVALID_VALUE_ID;
+  if ((status = define_projection(subgraph, &weights->w1, inter_dim, input_dim, input_id,
+                                  &quantized_input_id, gate_output_id)) != xnn_status_success ||
+      (status = define_projection(subgraph, &weights->w3, inter_dim, input_dim, input_id,
+                                  &quantized_input_id, up_output_id)) != xnn_status_success) {
+    return status;
+  }
+
+  // SiLU(w1 @ input), implemented as sigmoid followed by multiply
+  status = xnn_define_unary(
+    subgraph,
+    xnn_unary_sigmoid,
+    /*params=*/nullptr,
+    gate_output_id,
+    sigmoid_output_id,
+    /*flags=*/0);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_unary failed: %d\n", status);
+    return status;
+  }
+
+  status = xnn_define_multiply2(
+    subgraph,
+    /*output_min=*/-INFINITY,
+    /*output_max=*/INFINITY,
+    /*input1_id=*/gate_output_id,
+    /*input2_id=*/sigmoid_output_id,
+    /*output_id=*/silu_output_id,
+    /*flags=*/0);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_multiply2 failed: %d\n", status);
+    return status;
+  }
+
+  // Gated intermediate: SiLU(W1 @ input) * (W3 @ input)
+  status = xnn_define_multiply2(
+    subgraph,
+    /*output_min=*/-INFINITY,
+    /*output_max=*/INFINITY,
+    /*input1_id=*/silu_output_id,
+    /*input2_id=*/up_output_id,
+    /*output_id=*/gated_intermediate_output_id,
+    /*flags=*/0);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_multiply2 failed: %d\n", status);
+    return status;
+  }
+
+  // Down projection: w2 @ (SiLU(W1 @ input) * (W3 @ input))
+  uint32_t quantized_intermediate_id = XNN_INVALID_VALUE_ID;
+  return define_projection(subgraph, &weights->w2, output_dim, inter_dim, gated_intermediate_output_id,
+                           &quantized_intermediate_id, output_id);
+}
+
+static enum xnn_status define_layer(
+  const struct swiglu_layer_weights* weights,
+  bool expose_intermediates,
+  xnn_subgraph_t* subgraph_out)
+{
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = xnn_create_subgraph(
+    /*external_value_ids=*/expose_intermediates ? SWIGLU_CALIBRATION_NUM_EXTERNAL_VALUES
+                                                : SWIGLU_NUM_EXTERNAL_VALUES,
+    /*flags=*/0,
+    &subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_subgraph failed: %d\n", status);
+    return status;
+  }
+
+  // External values. Batch dims are reshaped later.
+  uint32_t input_id, output_id;
+  if ((status = define_tensor(subgraph, 1, weights->input_dim, nullptr, SWIGLU_INPUT_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_INPUT, &input_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, weights->output_dim, nullptr, SWIGLU_OUTPUT_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_OUTPUT, &output_id)) != xnn_status_success ||
+      (status = define_ffn(subgraph, weights, input_id, output_id, expose_intermediates)) != xnn_status_success) {
+    xnn_delete_subgraph(subgraph);
+    return status;
+  }
+
+  *subgraph_out = subgraph;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_define_layer(
+  const struct swiglu_layer_weights* weights,
+  xnn_subgraph_t* subgraph_out)
+{
+  return define_layer(weights, /*expose_intermediates=*/false, subgraph_out);
+}
+
+enum xnn_status swiglu_define_calibration_layer(
+  const struct swiglu_layer_weights* weights,
+  xnn_subgraph_t* subgraph_out)
+{
+  return define_layer(weights, /*expose_intermediates=*/true, subgraph_out);
+}
+
+// Defines output_id = SiLU(input_id) as sigmoid followed by multiply.
+static enum xnn_status define_silu(xnn_subgraph_t subgraph, size_t cols, uint32_t input_id, uint32_t output_id) {
+  uint32_t sigmoid_output_id;
+  enum xnn_status status = define_tensor(subgraph, 1, cols, nullptr, XNN_INVALID_VALUE_ID, 0, &sigmoid_output_id);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  status = xnn_define_unary(
+    subgraph,
+    xnn_unary_sigmoid,
+    /*params=*/nullptr,
+    input_id,
+    sigmoid_output_id,
+    /*flags=*/0);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_unary failed: %d\n", status);
+    return status;
+  }
+  status = xnn_define_multiply2(
+    subgraph,
+    /*output_min=*/-INFINITY,
+    /*output_max=*/INFINITY,
+    /*input1_id=*/input_id,
+    /*input2_id=*/sigmoid_output_id,
+    /*output_id=*/output_id,
+    /*flags=*/0);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_multiply2 failed: %d\n", status);
+  }
+  return status;
+}
+
+static enum xnn_status define_gate_or_up_branch(
+  xnn_subgraph_t subgraph,
+  const struct swiglu_layer_weights* weights,
+  enum swiglu_branch branch)
+{
+  const size_t input_dim = weights->input_dim;
+  const size_t inter_dim = weights->inter_dim;
+  uint32_t input_id, output_id;
+  enum xnn_status status;
+  if ((status = define_tensor(subgraph, 1, input_dim, nullptr, SWIGLU_INPUT_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_INPUT, &input_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, inter_dim, nullptr, SWIGLU_OUTPUT_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_OUTPUT, &output_id)) != xnn_status_success) {
+    return status;
+  }
+
+  uint32_t quantized_input_id = XNN_INVALID_VALUE_ID;
+  if (branch == swiglu_branch_up) {
+    return define_projection(subgraph, &weights->w3, inter_dim, input_dim, input_id, &quantized_input_id, output_id);
+  }
+  uint32_t gate_output_id;
+  if ((status = define_tensor(subgraph, 1, inter_dim, nullptr, XNN_INVALID_VALUE_ID,
+                              0, &gate_output_id)) != xnn_status_success ||
+      (status = define_projection(subgraph, &weights->w1, inter_dim, input_dim, input_id,
+                                  &quantized_input_id, gate_output_id)) != xnn_status_success) {
+    return status;
+  }
+  return define_silu(subgraph, inter_dim, gate_output_id, output_id);
+}
+
+static enum xnn_status define_down_branch(xnn_subgraph_t subgraph, const struct swiglu_layer_weights* weights) {
+  const size_t inter_dim = weights->inter_dim;
+  const size_t output_dim = weights->output_dim;
+  uint32_t silu_id, up_id, gated_intermediate_id, output_id;
+  enum xnn_status status;
+  if ((status = define_tensor(subgraph, 1, inter_dim, nullptr, SWIGLU_DOWN_SILU_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_INPUT, &silu_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, inter_dim, nullptr, SWIGLU_DOWN_UP_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_INPUT, &up_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, output_dim, nullptr, SWIGLU_DOWN_OUTPUT_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_OUTPUT, &output_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, inter_dim, nullptr, XNN_INVALID_VALUE_ID,
+                              0, &gated_intermediate_id)) != xnn_status_success) {
+    return status;
+  }
+  status = xnn_define_multiply2(
+    subgraph,
+    /*output_min=*/-INFINITY,
+    /*output_max=*/INFINITY,
+    /*input1_id=*/silu_id,
+    /*input2_id=*/up_id,
+    /*output_id=*/gated_intermediate_id,
+    /*flags=*/0);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_multiply2 failed: %d\n", status);
+    return status;
+  }
+  uint32_t quantized_intermediate_id = XNN_INVALID_VALUE_ID;
+  return define_projection(subgraph, &weights->w2, output_dim, inter_dim, gated_intermediate_id,
+                           &quantized_intermediate_id, output_id);
+}
+
+enum xnn_status swiglu_define_branch(
+  const struct swiglu_layer_weights* weights,
+  enum swiglu_branch branch,
+  xnn_subgraph_t* subgraph_out)
+{
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = xnn_create_subgraph(
+    /*external_value_ids=*/branch == swiglu_branch_down ? SWIGLU_DOWN_NUM_EXTERNAL_VALUES : SWIGLU_NUM_EXTERNAL_VALUES,
+    /*flags=*/0,
+    &subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_subgraph failed: %d\n", status);
+    return status;
+  }
+
+  status = branch == swiglu_branch_down ?
+    define_down_branch(subgraph, weights) : define_gate_or_up_branch(subgraph, weights, branch);
+  if (status != xnn_status_success) {
+    xnn_delete_subgraph(subgraph);
+    return status;
+  }
+  *subgraph_out = subgraph;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_define_gate_up(
+  const struct swiglu_layer_weights* weights,
+  xnn_subgraph_t* subgraph_out)
+{
+  const size_t input_dim = weights->input_dim;
+  const size_t inter_dim = weights->inter_dim;
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = xnn_create_subgraph(
+    /*external_value_ids=*/SWIGLU_GATE_UP_NUM_EXTERNAL_VALUES,
+    /*flags=*/0,
+    &subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_subgraph failed: %d\n", status);
+    return status;
+  }
+
+  uint32_t input_id, gate_id, up_id;
+  uint32_t quantized_input_id = XNN_INVALID_VALUE_ID;
+  if ((status = define_tensor(subgraph, 1, input_dim, nullptr, SWIGLU_INPUT_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_INPUT, &input_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, inter_dim, nullptr, SWIGLU_GATE_UP_GATE_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_OUTPUT, &gate_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, inter_dim, nullptr, SWIGLU_GATE_UP_UP_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_OUTPUT, &up_id)) != xnn_status_success ||
+      (status = define_projection(subgraph, &weights->w1, inter_dim, input_dim, input_id,
+                                  &quantized_input_id, gate_id)) != xnn_status_success ||
+      (status = define_projection(subgraph, &weights->w3, inter_dim, input_dim, input_id,
+                                  &quantized_input_id, up_id)) != xnn_status_success) {
+    xnn_delete_subgraph(subgraph);
+    return status;
+  }
+
+  *subgraph_out = subgraph;
+  return xnn_status_success;
+}
+
+// Creates a subgraph computing weights @ input for a [rows, cols] projection.
+static enum xnn_status define_projection_subgraph(
+  const struct swiglu_projection_weights* weights,
+  size_t rows,
+  size_t cols,
+  xnn_subgraph_t* subgraph_out)
+{
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = xnn_create_subgraph(
+    /*external_value_ids=*/SWIGLU_NUM_EXTERNAL_VALUES,
+    /*flags=*/0,
+    &subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_subgraph failed: %d\n", status);
+    return status;
+  }
+
+  uint32_t input_id, output_id;
+  uint32_t quantized_input_id = XNN_INVALID_VALUE_ID;
+  if ((status = define_tensor(subgraph, 1, cols, nullptr, SWIGLU_INPUT_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_INPUT, &input_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, rows, nullptr, SWIGLU_OUTPUT_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_OUTPUT, &output_id)) != xnn_status_success ||
+      (status = define_projection(subgraph, weights, rows, cols, input_id,
+                                  &quantized_input_id, output_id)) != xnn_status_success) {
+    xnn_delete_subgraph(subgraph);
+    return status;
+  }
+
+  *subgraph_out = subgraph;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_define_qkv_projection(
+  const struct swiglu_decoder_weights* weights,
+  xnn_subgraph_t* subgraph_out)
+{
+  const size_t qkv_dim = (weights->num_heads + 2 * weights->num_kv_heads) * weights->head_dim;
+  return define_projection_subgraph(&weights->wqkv, qkv_dim, weights->ffn.input_dim, subgraph_out);
+}
+
+enum xnn_status swiglu_define_projection(
+  size_t rows,
+  size_t cols,
+  const struct swiglu_projection_weights* weights,
+  xnn_subgraph_t* subgraph_out)
+{
+  return define_projection_subgraph(weights, rows, cols, subgraph_out);
+}
+
+enum xnn_status swiglu_define_lm_head(
+  size_t vocab_size,
+  size_t hidden_dim,
+  const struct swiglu_projection_weights* weights,
+  xnn_subgraph_t* subgraph_out)
+{
+  return define_projection_subgraph(weights, vocab_size, hidden_dim, subgraph_out);
+}
+
+// Defines output_id = input1_id + input2_id.
+static enum xnn_status define_add(xnn_subgraph_t subgraph, uint32_t input1_id, uint32_t input2_id, uint32_t output_id) {
+  enum xnn_status status = xnn_define_add2(
+    subgraph,
+    /*output_min=*/-INFINITY,
+    /*output_max=*/INFINITY,
+    input1_id,
+    input2_id,
+    output_id,
+    /*flags=*/0);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_add2 failed: %d\n", status);
+  }
+  return status;
+}
+
+enum xnn_status swiglu_define_attention_output(
+  const struct swiglu_decoder_weights* weights,
+  xnn_subgraph_t* subgraph_out)
+{
+  const size_t dim = weights->ffn.input_dim;
+  const size_t attention_dim = weights->num_heads * weights->head_dim;
+  if (weights->ffn.output_dim != dim) {
+    fprintf(stderr, "decoder FFN output dim %zu does not match its input dim %zu\n", weights->ffn.output_dim, dim);
+    return xnn_status_invalid_parameter;
+  }
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = xnn_create_subgraph(
+    /*external_value_ids=*/SWIGLU_BLOCK_NUM_EXTERNAL_VALUES,
+    /*flags=*/0,
+    &subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_subgraph failed: %d\n", status);
+    return status;
+  }
+
+  uint32_t attention_id, residual_id, output_id;
+  uint32_t projected_id, hidden_id, ffn_output_id;
+  uint32_t quantized_attention_id = XNN_INVALID_VALUE_ID;
+  if ((status = define_tensor(subgraph, 1, attention_dim, nullptr, SWIGLU_ATTENTION_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_INPUT, &attention_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, dim, nullptr, SWIGLU_RESIDUAL_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_INPUT, &residual_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, dim, nullptr, SWIGLU_BLOCK_OUTPUT_EXTERNAL_ID,
+                              XNN_VALUE_FLAG_EXTERNAL_OUTPUT, &output_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, dim, nullptr, XNN_INVALID_VALUE_ID, 0, &projected_id)) !=
+        xnn_status_success ||
+      (status = define_tensor(subgraph, 1, dim, nullptr, XNN_INVALID_VALUE_ID, 0, &hidden_id)) != xnn_status_success ||
+      (status = define_tensor(subgraph, 1, dim, nullptr, XNN_INVALID_VALUE_ID, 0, &ffn_output_id)) !=
+        xnn_status_success ||
+      // h = input + Wo @ attention
+      (status = define_projection(subgraph, &weights->wo, dim, attention_dim, attention_id,
+                                  &quantized_attention_id, projected_id)) != xnn_status_success ||
+      (status = define_add(subgraph, residual_id, projected_id, hidden_id)) != xnn_status_success ||
+      // output = h + SwiGLU(h)
+      (status = define_ffn(subgraph, &weights->ffn, hidden_id, ffn_output_id,
+                          /*expose_intermediates=*/false)) != xnn_status_success ||
+      (status = define_add(subgraph, hidden_id, ffn_output_id, output_id)) != xnn_status_success) {
+    xnn_delete_subgraph(subgraph);
+    return status;
+  }
+
+  *subgraph_out = subgraph;
+  return xnn_status_success;
+}
+
+// Defines a [1, cols] int8 activation quantized with params.
+static enum xnn_status define_qs8_tensor(
+  xnn_subgraph_t subgraph,
+  size_t cols,
+  struct swiglu_qs8_params params,
+  uint32_t external_id,
+  uint32_t flags,
+  uint32_t* id_out)
+{
+  std::vector<size_t> dims = {1, cols};
+  enum xnn_status status = xnn_define_quantized_tensor_value(
+    subgraph,
+    xnn_datatype_qint8,
+    /*zero_point=*/params.zero_point,
+    /*scale=*/params.scale,
+    /*num_dims=*/dims.size(),
+    /*dims=*/dims.data(),
+    /*data=*/nullptr,
+    /*external_id=*/external_id,
+    /*flags=*/flags,
+    id_out);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_quantized_tensor_value failed: %d\n", status);
+  }
+  return status;
+}
+
+// Defines the int8 output_id = weights @ input_id for qc8 weights, requantized by XNNPACK.
+static enum xnn_status define_qs8_projection(
+  xnn_subgraph_t subgraph,
+  const struct swiglu_projection_weights* weights,
+  size_t rows,
+  size_t cols,
+  uint32_t input_id,
+  uint32_t output_id)
+{
+  if (weights->type != swiglu_weight_qc8) {
+    fprintf(stderr, "static int8 projections need qc8 weights, not type %d\n", weights->type);
+    return xnn_status_unsupported_parameter;
+  }
+  std::vector<size_t> filter_dims = {rows, cols};
+  uint32_t filter_id = XNN_INVALID_VALUE_ID;
+  enum xnn_status status = xnn_define_channelwise_quantized_tensor_value(
+    subgraph,
+    xnn_datatype_qcint8,
+    /*scale=*/weights->scale,
+    /*num_dims=*/filter_dims.size(),
+    /*channel_dim=*/0,
+    /*dims=*/filter_dims.data(),
+    /*data=*/weights->data,
+    /*external_id=*/XNN_INVALID_VALUE_ID,
+    /*flags=*/0,
+    &filter_id);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_channelwise_quantized_tensor_value failed: %d\n", status);
+    return status;
+  }
+  status = xnn_define_fully_connected(
+    subgraph,
+    /*output_min=*/-INFINITY,
+    /*output_max=*/INFINITY,
+    /*input_id=*/input_id,
+    /*filter_id=*/filter_id,
+    /*bias_id=*/XNN_INVALID_VALUE_ID,  // No bias
+    /*output_id=*/output_id,
+    /*flags=*/0);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_define_fully_connected failed: %d\n", status);
+  }
+  return status;
+}
+
+enum xnn_status swiglu_define_qs8_gate_up(
+  const struct swiglu_layer_weights* weights,
+  const struct swiglu_qs8_scales* scales,
+  xnn_subgraph_t* subgraph_out)
+{
+  const size_t input_dim = weights->input_dim;
+  const size_t inter_dim = weights->inter_dim;
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = xnn_create_subgraph(
+    /*external_value_ids=*/SWIGLU_QS8_NUM_EXTERNAL_VALUES,
+    /*flags=*/0,
+    &subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_subgraph failed: %d\n", status);
+    return status;
+  }
+
+  uint32_t input_id, gate_id, up_id;
+  if ((status = define_qs8_tensor(subgraph, input_dim, scales->input, SWIGLU_INPUT_EXTERNAL_ID,
+                                  XNN_VALUE_FLAG_EXTERNAL_INPUT, &input_id)) != xnn_status_success ||
+      (status = define_qs8_tensor(subgraph, inter_dim, scales->gate, SWIGLU_QS8_GATE_EXTERNAL_ID,
+                                  XNN_VALUE_FLAG_EXTERNAL_OUTPUT, &gate_id)) != xnn_status_success ||
+      (status = define_qs8_tensor(subgraph, inter_dim, scales->up, SWIGLU_QS8_UP_EXTERNAL_ID,
+                                  XNN_VALUE_FLAG_EXTERNAL_OUTPUT, &up_id)) != xnn_status_success ||
+      (status = define_qs8_projection(subgraph, &weights->w1, inter_dim, input_dim, input_id, gate_id)) !=
+        xnn_status_success ||
+      (status = define_qs8_projection(subgraph, &weights->w3, inter_dim, input_dim, input_id, up_id)) !=
+        xnn_status_success) {
+    xnn_delete_subgraph(subgraph);
+    return status;
+  }
+
+  *subgraph_out = subgraph;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_define_qs8_down(
+  const struct swiglu_layer_weights* weights,
+  const struct swiglu_qs8_scales* scales,
+  xnn_subgraph_t* subgraph_out)
+{
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = xnn_create_subgraph(
+    /*external_value_ids=*/SWIGLU_NUM_EXTERNAL_VALUES,
+    /*flags=*/0,
+    &subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_subgraph failed: %d\n", status);
+    return status;
+  }
+
+  uint32_t intermediate_id, output_id;
+  if ((status = define_qs8_tensor(subgraph, weights->inter_dim, scales->intermediate, SWIGLU_INPUT_EXTERNAL_ID,
+                                  XNN_VALUE_FLAG_EXTERNAL_INPUT, &intermediate_id)) != xnn_status_success ||
+      (status = define_qs8_tensor(subgraph, weights->output_dim, scales->output, SWIGLU_OUTPUT_EXTERNAL_ID,
+                                  XNN_VALUE_FLAG_EXTERNAL_OUTPUT, &output_id)) != xnn_status_success ||
+      (status = define_qs8_projection(subgraph, &weights->w2, weights->output_dim, weights->inter_dim,
+                                      intermediate_id, output_id)) != xnn_status_success) {
+    xnn_delete_subgraph(subgraph);
+    return status;
+  }
+
+  *subgraph_out = subgraph;
+  return xnn_status_success;
+}
@@ -0,0 +1,244 @@
+/**
+ * @file swiglu_layer.h
+ * @brief Reusable definition of one SwiGLU FFN layer as an XNNPACK subgraph
+ *
+ * This builds the same graph as minimal_swiglu.cpp,
+ *   output = W2 @ (SiLU(W1 @ input) * (W3 @ input))
+ * but with the shapes and weights passed in, so that multi-layer stacks and tools
+ * can define many layers without repeating the tensor/node boilerplate.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <xnnpack.h>
+
+#include "swiglu_quantize.h"
+
+// External value IDs used by every SwiGLU layer subgraph
+#define SWIGLU_INPUT_EXTERNAL_ID  0
+#define SWIGLU_OUTPUT_EXTERNAL_ID 1
+#define SWIGLU_NUM_EXTERNAL_VALUES 2
+
+// External value IDs of the down branch (see swiglu_define_branch). Gate and up
+// branches use SWIGLU_INPUT_EXTERNAL_ID and SWIGLU_OUTPUT_EXTERNAL_ID.
+#define SWIGLU_DOWN_SILU_EXTERNAL_ID   0
+#define SWIGLU_DOWN_OUTPUT_EXTERNAL_ID 1
+#define SWIGLU_DOWN_UP_EXTERNAL_ID     2
+#define SWIGLU_DOWN_NUM_EXTERNAL_VALUES 3
+
+// External value IDs of the gate and up subgraph (see swiglu_define_gate_up). Its
+// input is SWIGLU_INPUT_EXTERNAL_ID.
+#define SWIGLU_GATE_UP_GATE_EXTERNAL_ID    1
+#define SWIGLU_GATE_UP_UP_EXTERNAL_ID      2
+#define SWIGLU_GATE_UP_NUM_EXTERNAL_VALUES 3
+
+// External value IDs of a decoder block's attention output subgraph (see
+// swiglu_define_attention_output). Its QKV projection subgraph uses
+// SWIGLU_INPUT_EXTERNAL_ID and SWIGLU_OUTPUT_EXTERNAL_ID.
+#define SWIGLU_ATTENTION_EXTERNAL_ID     0
+#define SWIGLU_BLOCK_OUTPUT_EXTERNAL_ID  1
+#define SWIGLU_RESIDUAL_EXTERNAL_ID      2
+#define SWIGLU_BLOCK_NUM_EXTERNAL_VALUES 3
+
+// External value IDs of a static int8 layer's gate and up subgraph (see
+// swiglu_define_qs8_gate_up). Its input is SWIGLU_INPUT_EXTERNAL_ID.
+#define SWIGLU_QS8_GATE_EXTERNAL_ID      1
+#define SWIGLU_QS8_UP_EXTERNAL_ID        2
+#define SWIGLU_QS8_NUM_EXTERNAL_VALUES   3
+
+// External value IDs of the intermediates of a calibration layer (see
+// swiglu_define_calibration_layer), on top of SWIGLU_INPUT_EXTERNAL_ID and
+// SWIGLU_OUTPUT_EXTERNAL_ID.
+#define SWIGLU_CALIBRATION_GATE_EXTERNAL_ID         2
+#define SWIGLU_CALIBRATION_UP_EXTERNAL_ID           3
+#define SWIGLU_CALIBRATION_SILU_EXTERNAL_ID         4
+#define SWIGLU_CALIBRATION_INTERMEDIATE_EXTERNAL_ID 5
+#define SWIGLU_CALIBRATION_NUM_EXTERNAL_VALUES      6
+
+enum swiglu_weight_type {
+  // fp32 weights and fp32 GEMM
+  swiglu_weight_fp32 = 0,
+  // int8 weights with one scale per output channel. The projection's input is
+  // dynamically quantized to int8 per row.
+  swiglu_weight_qc8 = 1,
+  // 4-bit weights with one bf16 scale per block of block_size input channels, two
+  // per byte (even channel in the low nibble), stored unsigned with a zero point of
+  // 8. The input is dynamically quantized as for qc8.
+  swiglu_weight_qb4 = 2,
+};
+
+#define SWIGLU_NUM_WEIGHT_TYPES 3
+
+/**
+ * @brief Weights of one projection, row-major [rows, cols] = [output, input] channels
+ */
+struct swiglu_projection_weights {
+  enum swiglu_weight_type type;
+  // float for swiglu_weight_fp32, int8_t for swiglu_weight_qc8, uint8_t pairs for
+  // swiglu_weight_qb4 ([rows, cols / 2])
+  const void* data;
+  // Per-row scales for swiglu_weight_qc8, NULL otherwise
+  const float* scale;
+  // bf16 scales for swiglu_weight_qb4, [rows, cols / block_size]; NULL otherwise
+  const uint16_t* block_scale;
+  // Input channels per scale for swiglu_weight_qb4, a multiple of 32 that divides cols
+  size_t block_size;
+};
+
+/**
+ * @brief Shape and weights of one SwiGLU layer
+ *
+ * XNNPACK only reads the weights while packing, but weights caches key packed
+ * weights by the data pointers, so they must stay valid (and must not be reused for
+ * other data) for as long as the layer's runtimes exist.
+ */
+struct swiglu_layer_weights {
+  size_t input_dim;
+  size_t inter_dim;
+  size_t output_dim;
+  struct swiglu_projection_weights w1;  // gate projection, [inter_dim, input_dim]
+  struct swiglu_projection_weights w3;  // up projection, [inter_dim, input_dim]
+  struct swiglu_projection_weights w2;  // down projection, [output_dim, inter_dim]
+};
+
+/**
+ * @brief Creates a subgraph computing one SwiGLU layer
+ *
+ * The input (external ID 0) and output (external ID 1) are defined with a batch
+ * size of 1; reshape them with xnn_reshape_external_value before running.
+ */
+enum xnn_status swiglu_define_layer(
+  const struct swiglu_layer_weights* weights,
+  xnn_subgraph_t* subgraph_out);
+
+/**
+ * @brief Creates a subgraph computing one SwiGLU layer that also outputs its intermediates
+ *
+ * As swiglu_define_layer, but W1 @ input, W3 @ input, SiLU(W1 @ input) and the
+ * gated intermediate are external outputs (external IDs 2 to 5), so calibration can
+ * read values that XNNPACK otherwise keeps in its workspace. All six external
+ * values must be reshaped and set up.
+ */
+enum xnn_status swiglu_define_calibration_layer(
+  const struct swiglu_layer_weights* weights,
+  xnn_subgraph_t* subgraph_out);
+
+// Parts of a SwiGLU layer that run as separate subgraphs.
+enum swiglu_branch {
+  // SiLU(W1 @ input), [batch, inter_dim]
+  swiglu_branch_gate,
+  // W3 @ input, [batch, inter_dim]
+  swiglu_branch_up,
+  // W2 @ (silu * up), from the outputs of the other two branches
+  swiglu_branch_down,
+};
+
+/**
+ * @brief Creates a subgraph computing one branch of a SwiGLU layer
+ *
+ * The gate and up branches only depend on the layer input, so they can run at the
+ * same time on different threads. Batch dims are 1, as in swiglu_define_layer.
+ */
+enum xnn_status swiglu_define_branch(
+  const struct swiglu_layer_weights* weights,
+  enum swiglu_branch branch,
+  xnn_subgraph_t* subgraph_out);
+
+/**
+ * @brief Creates a subgraph computing W1 @ input and W3 @ input, without SiLU
+ *
+ * Both projections are external outputs, so the caller can apply SiLU and the gating
+ * multiply itself and run the down projection with swiglu_define_projection. Batch
+ * dims are 1, as in swiglu_define_layer.
+ */
+enum xnn_status swiglu_define_gate_up(
+  const struct swiglu_layer_weights* weights,
+  xnn_subgraph_t* subgraph_out);
+
+/**
+ * @brief Shape and weights of one decoder block built around a SwiGLU layer
+ *
+ *   h      = input + Wo @ attention(Wqkv @ input)
+ *   output = h + SwiGLU(h)
+ *
+ * There is no normalization; the blocks exist to time attention next to the FFN.
+ * ffn.input_dim and ffn.output_dim are both the model dim.
+ */
+struct swiglu_decoder_weights {
+  size_t num_heads;
+  size_t num_kv_heads;
+  size_t head_dim;
+  // Fused query, key and value projections, [(num_heads + 2 * num_kv_heads) * head_dim, dim]
+  struct swiglu_projection_weights wqkv;
+  // Attention output projection, [dim, num_heads * head_dim]
+  struct swiglu_projection_weights wo;
+  struct swiglu_layer_weights ffn;
+};
+
+// Creates a subgraph computing Wqkv @ input, [batch, (num_heads + 2 * num_kv_heads) * head_dim].
+enum xnn_status swiglu_define_qkv_projection(
+  const struct swiglu_decoder_weights* weights,
+  xnn_subgraph_t* subgraph_out);
+
+/**
+ * @brief Creates a subgraph computing the rest of a decoder block from the attention
+ *        output and the block input (the residual)
+ */
+enum xnn_status swiglu_define_attention_output(
+  const struct swiglu_decoder_weights* weights,
+  xnn_subgraph_t* subgraph_out);
+
+/**
+ * @brief Creates a subgraph computing weights @ input for one [rows, cols] projection
+ *
+ * Input and output use SWIGLU_INPUT_EXTERNAL_ID and SWIGLU_OUTPUT_EXTERNAL_ID with
+ * a batch size of 1, as in swiglu_define_layer. Lets tools time a projection on its own.
+ */
+enum xnn_status swiglu_define_projection(
+  size_t rows,
+  size_t cols,
+  const struct swiglu_projection_weights* weights,
+  xnn_subgraph_t* subgraph_out);
+
+/**
+ * @brief Creates a subgraph computing the logits weights @ input, [batch, vocab_size]
+ *
+ * weights is the [vocab_size, hidden_dim] vocabulary projection. This writes every
+ * logit; swiglu_lm_head.h samples from the projection without doing so.
+ */
+enum xnn_status swiglu_define_lm_head(
+  size_t vocab_size,
+  size_t hidden_dim,
+  const struct swiglu_projection_weights* weights,
+  xnn_subgraph_t* subgraph_out);
+
+/**
+ * @brief Calibrated int8 quantization of every activation of a static int8 layer
+ */
+struct swiglu_qs8_scales {
+  struct swiglu_qs8_params input;
+  struct swiglu_qs8_params gate;          // W1 @ input
+  struct swiglu_qs8_params up;            // W3 @ input
+  struct swiglu_qs8_params intermediate;  // SiLU(W1 @ input) * (W3 @ input)
+  struct swiglu_qs8_params output;
+};
+
+/**
+ * @brief Creates a subgraph computing the int8 gate and up projections of a layer
+ *
+ * The int8 input (external ID 0) goes through qs8 fully connected nodes with the
+ * qc8 w1 and w3 and int8 outputs, the gate (external ID 1) and up (external ID 2)
+ * projections, each requantized to its scales. Batch dims are 1, as in
+ * swiglu_define_layer.
+ */
+enum xnn_status swiglu_define_qs8_gate_up(
+  const struct swiglu_layer_weights* weights,
+  const struct swiglu_qs8_scales* scales,
+  xnn_subgraph_t* subgraph_out);
+
+// Creates a subgraph computing the int8 output (external ID 1) from the int8 intermediate (external ID 0).
+enum xnn_status swiglu_define_qs8_down(
+  const struct swiglu_layer_weights* weights,
+  const struct swiglu_qs8_scales* scales,
+  xnn_subgraph_t* subgraph_out);
@@ -0,0 +1,310 @@
+/**
+ * @file swiglu_lm_head.cpp
+ * @brief Tiled vocabulary projection with a running top-k and softmax normalizer
+ */
+#include "swiglu_lm_head.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+// Vocabulary rows whose logits are computed before being folded into the running
+// state. Chunks per thread even out chunks that finish early.
+static const size_t kVocabTile = 64;
+static const size_t kChunksPerThread = 4;
+
+struct candidate {
+  float logit;
+  uint32_t id;
+};
+
+// Larger logit first, then lower id, so ties pick the same token whichever chunk
+// found them.
+static bool better(const candidate& a, const candidate& b) {
+  return a.logit > b.logit || (a.logit == b.logit && a.id < b.id);
+}
+
+// Softmax normalizer and top-k of one row over part of the vocabulary.
+struct row_state {
+  float max_logit;
+  // Sum of exp(logit - max_logit)
+  float sum;
+  // Heap of the best top_k candidates so far, the worst in front
+  std::vector<candidate> top;
+};
+
+struct swiglu_lm_head {
+  size_t vocab_size;
+  size_t hidden_dim;
+  struct swiglu_projection_weights weights;
+  // [num_chunks, num_rows] of the last call
+  std::vector<row_state> states;
+};
+
+static void reset_row(row_state& state, size_t top_k) {
+  state.max_logit = -INFINITY;
+  state.sum = 0.0f;
+  state.top.clear();
+  state.top.reserve(top_k);
+}
+
+// Folds count logits of ids first_id on, already divided by the temperature, into state.
+static void fold_tile(row_state& state, const float* logits, size_t first_id, size_t count, size_t top_k) {
+  float tile_max = state.max_logit;
+  for (size_t j = 0; j < count; ++j) {
+    tile_max = std::max(tile_max, logits[j]);
+  }
+  if (tile_max > state.max_logit) {
+    state.sum *= expf(state.max_logit - tile_max);
+    state.max_logit = tile_max;
+  }
+  float sum = 0.0f;
+  for (size_t j = 0; j < count; ++j) {
+    sum += expf(logits[j] - state.max_logit);
+  }
+  state.sum += sum;
+
+  for (size_t j = 0; j < count; ++j) {
+    const candidate c = {logits[j], static_cast<uint32_t>(first_id + j)};
+    if (state.top.size() < top_k) {
+      state.top.push_back(c);
+      std::push_heap(state.top.begin(), state.top.end(), better);
+    } else if (better(c, state.top.front())) {
+      std::pop_heap(state.top.begin(), state.top.end(), better);
+      state.top.back() = c;
+      std::push_heap(state.top.begin(), state.top.end(), better);
+    }
+  }
+}
+
+// Uniform in [0, 1) from a xorshift stream.
+static float next_uniform(uint32_t* state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return static_cast<float>(*state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Merges the num_states states of one row, stride apart, and picks its token.
+static void pick_token(
+  const row_state* states,
+  size_t num_states,
+  size_t stride,
+  const struct swiglu_sampling_params* params,
+  size_t row,
+  uint32_t* token,
+  float* log_prob)
+{
+  float max_logit = -INFINITY;
+  for (size_t c = 0; c < num_states; ++c) {
+    max_logit = std::max(max_logit, states[c * stride].max_logit);
+  }
+  float sum = 0.0f;
+  std::vector<candidate> candidates;
+  for (size_t c = 0; c < num_states; ++c) {
+    const row_state& state = states[c * stride];
+    sum += state.sum * expf(state.max_logit - max_logit);
+    candidates.insert(candidates.end(), state.top.begin(), state.top.end());
+  }
+  const size_t num_candidates = std::min(params->top_k, candidates.size());
+  std::partial_sort(candidates.begin(), candidates.begin() + num_candidates, candidates.end(), better);
+
+  size_t chosen = 0;
+  if (params->temperature > 0.0f) {
+    // Probabilities of the nucleus under the full softmax, then a draw within it.
+    std::vector<float> probabilities;
+    float nucleus = 0.0f;
+    for (size_t i = 0; i < num_candidates && (i == 0 || nucleus < params->top_p); ++i) {
+      probabilities.push_back(expf(candidates[i].logit - max_logit) / sum);
+      nucleus += probabilities.back();
+    }
+    uint32_t rng = (params->seed ^ static_cast<uint32_t>(row * 0x9E3779B9u)) * 2654435761u + 1;
+    const float u = next_uniform(&rng) * nucleus;
+    float cumulative = 0.0f;
+    for (chosen = 0; chosen + 1 < probabilities.size(); ++chosen) {
+      cumulative += probabilities[chosen];
+      if (u < cumulative) {
+        break;
+      }
+    }
+  }
+  *token = candidates[chosen].id;
+  if (log_prob != NULL) {
+    *log_prob = candidates[chosen].logit - max_logit - logf(sum);
+  }
+}
+
+static enum xnn_status validate_params(size_t vocab_size, const struct swiglu_sampling_params* params) {
+  if (!(params->temperature >= 0.0f) || isinf(params->temperature) || params->top_k == 0 ||
+      params->top_k > vocab_size || !(params->top_p > 0.0f && params->top_p <= 1.0f)) {
+    fprintf(stderr, "temperature %g, top-k %zu and top-p %g do not fit a vocabulary of %zu\n",
+            params->temperature, params->top_k, params->top_p, vocab_size);
+    return xnn_status_invalid_parameter;
+  }
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_create_lm_head(
+  size_t vocab_size,
+  size_t hidden_dim,
+  const struct swiglu_projection_weights* weights,
+  struct swiglu_lm_head** head_out)
+{
+  if (vocab_size == 0 || vocab_size > UINT32_MAX || hidden_dim == 0) {
+    fprintf(stderr, "an LM head needs a vocabulary of 1 to 2^32 - 1 rows and a hidden dim, not %zu, %zu\n",
+            vocab_size, hidden_dim);
+    return xnn_status_invalid_parameter;
+  }
+  if (weights->type != swiglu_weight_fp32 && weights->type != swiglu_weight_qc8) {
+    fprintf(stderr, "unsupported weight type %d\n", weights->type);
+    return xnn_status_unsupported_parameter;
+  }
+  struct swiglu_lm_head* head = new (std::nothrow) swiglu_lm_head();
+  if (head == NULL) {
+    fprintf(stderr, "failed to allocate LM head\n");
+    return xnn_status_out_of_memory;
+  }
+  head->vocab_size = vocab_size;
+  head->hidden_dim = hidden_dim;
+  head->weights = *weights;
+
+  *head_out = head;
+  return xnn_status_success;
+}
+
+// Eight independent partial sums, so the compiler can keep them in one vector register.
+template <typename Weight>
+static float dot(const Weight* w, const float* x, size_t n) {
+  float acc[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    for (size_t k = 0; k < 8; ++k) {
+      acc[k] += static_cast<float>(w[i + k]) * x[i + k];
+    }
+  }
+  for (; i < n; ++i) {
+    acc[0] += static_cast<float>(w[i]) * x[i];
+  }
+  return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+}
+
+struct sample_context {
+  const struct swiglu_lm_head* head;
+  size_t num_rows;
+  const float* hidden;
+  float inv_temperature;
+  size_t top_k;
+  size_t tiles_per_chunk;
+  row_state* states;
+};
+
+static void sample_chunk(void* context, size_t chunk) {
+  const struct sample_context* ctx = static_cast<const struct sample_context*>(context);
+  const struct swiglu_lm_head* head = ctx->head;
+  const size_t hidden_dim = head->hidden_dim;
+  const size_t num_rows = ctx->num_rows;
+  const size_t first_vocab = chunk * ctx->tiles_per_chunk * kVocabTile;
+  const size_t end_vocab = std::min(head->vocab_size, first_vocab + ctx->tiles_per_chunk * kVocabTile);
+  row_state* states = ctx->states + chunk * num_rows;
+  for (size_t r = 0; r < num_rows; ++r) {
+    reset_row(states[r], ctx->top_k);
+  }
+
+  // [num_rows, kVocabTile] logits of the current tile, reused by every task on this thread
+  thread_local std::vector<float> logits;
+  logits.resize(num_rows * kVocabTile);
+  for (size_t first_id = first_vocab; first_id < end_vocab; first_id += kVocabTile) {
+    const size_t count = std::min(kVocabTile, end_vocab - first_id);
+    // Each weight row is loaded once and stays in L1 while every row of the batch reads it.
+    for (size_t j = 0; j < count; ++j) {
+      const size_t v = first_id + j;
+      if (head->weights.type == swiglu_weight_fp32) {
+        const float* w = static_cast<const float*>(head->weights.data) + v * hidden_dim;
+        for (size_t r = 0; r < num_rows; ++r) {
+          logits[r * kVocabTile + j] = dot(w, ctx->hidden + r * hidden_dim, hidden_dim) * ctx->inv_temperature;
+        }
+      } else {
+        const int8_t* w = static_cast<const int8_t*>(head->weights.data) + v * hidden_dim;
+        const float scale = head->weights.scale[v] * ctx->inv_temperature;
+        for (size_t r = 0; r < num_rows; ++r) {
+          logits[r * kVocabTile + j] = dot(w, ctx->hidden + r * hidden_dim, hidden_dim) * scale;
+        }
+      }
+    }
+    for (size_t r = 0; r < num_rows; ++r) {
+      fold_tile(states[r], &logits[r * kVocabTile], first_id, count, ctx->top_k);
+    }
+  }
+}
+
+enum xnn_status swiglu_lm_head_sample(
+  struct swiglu_lm_head* head,
+  size_t num_rows,
+  const float* hidden,
+  const struct swiglu_sampling_params* params,
+  uint32_t* tokens,
+  float* log_probs,
+  pthreadpool_t threadpool)
+{
+  enum xnn_status status = validate_params(head->vocab_size, params);
+  if (status != xnn_status_success || num_rows == 0) {
+    return status;
+  }
+  const size_t num_threads = threadpool != NULL ? pthreadpool_get_threads_count(threadpool) : 1;
+  const size_t num_tiles = (head->vocab_size + kVocabTile - 1) / kVocabTile;
+  const size_t max_chunks = std::min(num_tiles, num_threads * kChunksPerThread);
+  const size_t tiles_per_chunk = (num_tiles + max_chunks - 1) / max_chunks;
+  const size_t num_chunks = (num_tiles + tiles_per_chunk - 1) / tiles_per_chunk;
+  if (head->states.size() < num_chunks * num_rows) {
+    head->states.resize(num_chunks * num_rows);
+  }
+
+  const bool greedy = params->temperature == 0.0f;
+  struct sample_context context = {
+    head, num_rows, hidden, greedy ? 1.0f : 1.0f / params->temperature, greedy ? 1 : params->top_k,
+    tiles_per_chunk, head->states.data()};
+  pthreadpool_parallelize_1d(threadpool, sample_chunk, &context, num_chunks, /*flags=*/0);
+  for (size_t r = 0; r < num_rows; ++r) {
+    pick_token(&head->states[r], num_chunks, num_rows, params, r, &tokens[r],
+               log_probs != NULL ? &log_probs[r] : NULL);
+  }
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_sample_logits(
+  size_t vocab_size,
+  size_t num_rows,
+  const float* logits,
+  const struct swiglu_sampling_params* params,
+  uint32_t* tokens,
+  float* log_probs)
+{
+  enum xnn_status status = validate_params(vocab_size, params);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  const bool greedy = params->temperature == 0.0f;
+  const float inv_temperature = greedy ? 1.0f : 1.0f / params->temperature;
+  const size_t top_k = greedy ? 1 : params->top_k;
+  row_state state;
+  float tile[kVocabTile];
+  for (size_t r = 0; r < num_rows; ++r) {
+    reset_row(state, top_k);
+    for (size_t first_id = 0; first_id < vocab_size; first_id += kVocabTile) {
+      const size_t count = std::min(kVocabTile, vocab_size - first_id);
+      for (size_t j = 0; j < count; ++j) {
+        tile[j] = logits[r * vocab_size + first_id + j] * inv_temperature;
+      }
+      fold_tile(state, tile, first_id, count, top_k);
+    }
+    pick_token(&state, /*num_states=*/1, /*stride=*/0, params, r, &tokens[r],
+               log_probs != NULL ? &log_probs[r] : NULL);
+  }
+  return xnn_status_success;
+}
+
+void swiglu_delete_lm_head(struct swiglu_lm_head* head) {
+  delete head;
+}
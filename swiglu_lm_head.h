@@ -0,0 +1,80 @@
+/**
+ * @file swiglu_lm_head.h
+ * @brief Vocabulary projection fused with top-k / top-p sampling
+ *
+ * In decode, the vocabulary projection after the last block is the largest GEMM,
+ * and sampling from its output scans a [rows, vocab_size] logits tensor a second
+ * time. The LM head instead computes logits a tile of vocabulary rows at a time and
+ * folds each tile straight into a running top-k and softmax normalizer per row, so
+ * no logits tensor is ever written. Every weight row is read once for all rows of
+ * the batch.
+ *
+ * The vocabulary is split into chunks that run in parallel on the thread pool, each
+ * with its own top-k and normalizer per row; the chunks are merged at the end,
+ * which touches top_k candidates per chunk rather than the vocabulary.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_layer.h"
+
+struct swiglu_sampling_params {
+  // Logits are divided by temperature; 0 picks the largest logit.
+  float temperature;
+  // Number of largest logits sampled from, at least 1.
+  size_t top_k;
+  // Of those, the smallest prefix whose probability reaches top_p; 1 keeps all top_k.
+  float top_p;
+  // Rows draw from independent streams derived from seed and the row index.
+  uint32_t seed;
+};
+
+struct swiglu_lm_head;
+
+/**
+ * @brief Creates an LM head over a [vocab_size, hidden_dim] projection
+ *
+ * weights may be fp32 or qc8 and are not copied; they must outlive the head.
+ */
+enum xnn_status swiglu_create_lm_head(
+  size_t vocab_size,
+  size_t hidden_dim,
+  const struct swiglu_projection_weights* weights,
+  struct swiglu_lm_head** head_out);
+
+/**
+ * @brief Samples one token per row of hidden, [num_rows, hidden_dim]
+ *
+ * tokens receives num_rows vocabulary indices. log_probs, if not NULL, receives the
+ * log probability of each token under the full softmax at the given temperature (at
+ * temperature 1 for greedy picks), before top-k and top-p. threadpool may be NULL.
+ * Calls on one head must not overlap.
+ */
+enum xnn_status swiglu_lm_head_sample(
+  struct swiglu_lm_head* head,
+  size_t num_rows,
+  const float* hidden,
+  const struct swiglu_sampling_params* params,
+  uint32_t* tokens,
+  float* log_probs,
+  pthreadpool_t threadpool);
+
+/**
+ * @brief Samples like swiglu_lm_head_sample, from logits already in memory
+ *
+ * logits is [num_rows, vocab_size], for example the output of a subgraph from
+ * swiglu_define_lm_head. Given the same logits and params it picks the same tokens.
+ */
+enum xnn_status swiglu_sample_logits(
+  size_t vocab_size,
+  size_t num_rows,
+  const float* logits,
+  const struct swiglu_sampling_params* params,
+  uint32_t* tokens,
+  float* log_probs);
+
+void swiglu_delete_lm_head(struct swiglu_lm_head* head);
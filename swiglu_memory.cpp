@@ -0,0 +1,82 @@
+/**
+ * @file swiglu_memory.cpp
+ * @brief Page-level helpers for weight and activation memory
+ */
+#include "swiglu_memory.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+
+// Pages touched per task, large enough to amortize scheduling
+#define SWIGLU_PREFAULT_TILE_PAGES 256
+
+struct prefault_context {
+  const std::vector<struct swiglu_memory_range>* ranges;
+  // first_page[i] is the index of the first page of ranges[i] across all ranges
+  std::vector<size_t> first_page;
+  size_t page_size;
+};
+
+static void prefault_pages(void* context, size_t start, size_t count) {
+  const struct prefault_context* prefault = static_cast<const struct prefault_context*>(context);
+  size_t r = std::upper_bound(prefault->first_page.begin(), prefault->first_page.end(), start) -
+             prefault->first_page.begin() - 1;
+  for (size_t page = start; page < start + count; ++page) {
+    while (page >= prefault->first_page[r + 1]) {
+      ++r;
+    }
+    const struct swiglu_memory_range& range = (*prefault->ranges)[r];
+    const size_t offset = std::min((page - prefault->first_page[r]) * prefault->page_size, range.size - 1);
+    // A volatile read faults the page in without writing to read-only mappings.
+    (void) *static_cast<const volatile uint8_t*>(static_cast<const uint8_t*>(range.data) + offset);
+  }
+}
+
+enum xnn_status swiglu_prefault(
+  const std::vector<struct swiglu_memory_range>& ranges,
+  pthreadpool_t threadpool,
+  bool lock)
+{
+  struct prefault_context context;
+  context.ranges = &ranges;
+  context.page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  context.first_page.push_back(0);
+  for (const struct swiglu_memory_range& range : ranges) {
+    const size_t num_pages = (range.size + context.page_size - 1) / context.page_size;
+    context.first_page.push_back(context.first_page.back() + num_pages);
+    if (range.size != 0) {
+      // Start readahead for file-backed pages before the touches block on them.
+      const uintptr_t begin = reinterpret_cast<uintptr_t>(range.data) & ~(context.page_size - 1);
+      madvise(reinterpret_cast<void*>(begin), reinterpret_cast<uintptr_t>(range.data) + range.size - begin,
+              MADV_WILLNEED);
+    }
+  }
+
+  pthreadpool_parallelize_1d_tile_1d(
+    threadpool, prefault_pages, &context, context.first_page.back(), SWIGLU_PREFAULT_TILE_PAGES, /*flags=*/0);
+
+  if (lock) {
+    for (const struct swiglu_memory_range& range : ranges) {
+      if (range.size != 0 && mlock(range.data, range.size) != 0) {
+        fprintf(stderr, "mlock of %zu bytes failed: %s (raise RLIMIT_MEMLOCK, e.g. ulimit -l)\n",
+                range.size, strerror(errno));
+        swiglu_unlock(ranges);
+        return xnn_status_out_of_memory;
+      }
+    }
+  }
+  return xnn_status_success;
+}
+
+void swiglu_unlock(const std::vector<struct swiglu_memory_range>& ranges) {
+  for (const struct swiglu_memory_range& range : ranges) {
+    if (range.size != 0) {
+      munlock(range.data, range.size);
+    }
+  }
+}
@@ -0,0 +1,31 @@
+/**
+ * @file swiglu_memory.h
+ * @brief Page-level helpers for weight and activation memory
+ */
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+struct swiglu_memory_range {
+  const void* data;
+  size_t size;
+};
+
+/**
+ * @brief Faults in every page of ranges and optionally mlocks them
+ *
+ * Pages are touched by reading one byte each, split across threadpool (which may be
+ * NULL), so file-backed mappings are read in parallel instead of one page fault at
+ * a time on the first request. With lock set, the ranges are then mlocked, which
+ * fails unless RLIMIT_MEMLOCK allows it.
+ */
+enum xnn_status swiglu_prefault(
+  const std::vector<struct swiglu_memory_range>& ranges,
+  pthreadpool_t threadpool,
+  bool lock);
+
+// Undoes the mlock of swiglu_prefault.
+void swiglu_unlock(const std::vector<struct swiglu_memory_range>& ranges);
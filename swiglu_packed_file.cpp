@@ -0,0 +1,600 @@
+/**
+ * @file swiglu_packed_file.cpp
+ * @brief Writing and mapping files of pre-packed SwiGLU weights
+ */
+#include "swiglu_packed_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <map>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cpuinfo.h>
+
+#include "swiglu_memory.h"
+#include "swiglu_stack.h"
+#include "swiglu_weights_cache.h"
+
+static size_t align_up(size_t n, size_t alignment) {
+  return (n + alignment - 1) / alignment * alignment;
+}
+
+// FNV-1a over 64-bit words, then over the trailing bytes.
+static uint64_t checksum(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint64_t hash = UINT64_C(0xcbf29ce484222325);
+  const uint64_t prime = UINT64_C(0x100000001b3);
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * prime;
+  }
+  for (; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * prime;
+  }
+  return hash;
+}
+
+static const struct swiglu_projection_weights* projection_weights(
+  const struct swiglu_layer_weights* layer,
+  uint32_t projection)
+{
+  switch (projection) {
+    case swiglu_projection_w1: return &layer->w1;
+    case swiglu_projection_w3: return &layer->w3;
+    default: return &layer->w2;
+  }
+}
+
+static struct swiglu_projection_weights* projection_weights(
+  struct swiglu_layer_weights* layer,
+  uint32_t projection)
+{
+  switch (projection) {
+    case swiglu_projection_w1: return &layer->w1;
+    case swiglu_projection_w3: return &layer->w3;
+    default: return &layer->w2;
+  }
+}
+
+// Number of output channels, i.e. rows, of a projection.
+static size_t projection_rows(const struct swiglu_layer_weights* layer, uint32_t projection) {
+  return projection == swiglu_projection_w2 ? layer->output_dim : layer->inter_dim;
+}
+
+// Number of input channels, i.e. columns, of a projection.
+static size_t projection_cols(const struct swiglu_layer_weights* layer, uint32_t projection) {
+  return projection == swiglu_projection_w2 ? layer->inter_dim : layer->input_dim;
+}
+
+// Size of the scales blob of a quantized projection.
+static size_t scales_size(
+  const struct swiglu_layer_weights* layer,
+  uint32_t projection,
+  enum swiglu_weight_type type,
+  size_t block_size)
+{
+  const size_t rows = projection_rows(layer, projection);
+  if (type == swiglu_weight_qb4) {
+    return block_size == 0 ? 0 : rows * (projection_cols(layer, projection) / block_size) * sizeof(uint16_t);
+  }
+  return rows * sizeof(float);
+}
+
+const char* swiglu_host_isa(void) {
+  // Coarse kernel families. The cache seeds stored per blob are the exact check.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  if (cpuinfo_has_x86_avx512vnni()) {
+    return "x86-avx512vnni";
+  }
+  if (cpuinfo_has_x86_avx512f()) {
+    return "x86-avx512f";
+  }
+  if (cpuinfo_has_x86_avxvnni()) {
+    return "x86-avxvnni";
+  }
+  if (cpuinfo_has_x86_avx2() && cpuinfo_has_x86_fma3()) {
+    return "x86-avx2";
+  }
+  if (cpuinfo_has_x86_avx()) {
+    return "x86-avx";
+  }
+  return "x86-sse2";
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  if (cpuinfo_has_arm_i8mm()) {
+    return "arm64-i8mm";
+  }
+  if (cpuinfo_has_arm_neon_dot()) {
+    return "arm64-neondot";
+  }
+  return "arm64-neon";
+#elif defined(__arm__) || defined(_M_ARM)
+  return cpuinfo_has_arm_neon() ? "arm-neon" : "arm";
+#else
+  return "generic";
+#endif
+}
+
+struct blob {
+  const void* data;
+  size_t size;
+};
+
+enum xnn_status swiglu_write_packed_file(
+  const char* path,
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  pthreadpool_t threadpool)
+{
+  struct swiglu_weights_cache* cache = NULL;
+  enum xnn_status status = swiglu_create_weights_cache(&cache);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  status = swiglu_pack_layers(num_layers, layers, threadpool, cache);
+  if (status != xnn_status_success) {
+    swiglu_delete_weights_cache(cache);
+    return status;
+  }
+  const std::vector<struct swiglu_weights_cache_entry> packed = swiglu_weights_cache_entries(cache);
+
+  // Entries reference blobs by index until the data offset is known. A blob shared
+  // by several projections (e.g. W1 and W3 with the same data) is stored once.
+  std::vector<struct swiglu_packed_file_entry> entries;
+  std::vector<struct blob> blobs;
+  std::map<const void*, size_t> blob_index;
+  auto add_entry = [&](uint32_t layer, uint32_t projection, uint32_t kind, uint32_t seed, const void* data, size_t size) {
+    auto it = blob_index.find(data);
+    if (it == blob_index.end()) {
+      it = blob_index.emplace(data, blobs.size()).first;
+      blobs.push_back({data, size});
+    }
+    entries.push_back({layer, projection, kind, seed, /*offset=*/it->second, size, checksum(data, size)});
+  };
+
+  std::vector<struct swiglu_packed_file_layer> file_layers(num_layers);
+  for (size_t l = 0; l < num_layers; ++l) {
+    file_layers[l] = {layers[l].input_dim, layers[l].inter_dim, layers[l].output_dim,
+                      {layers[l].w1.type, layers[l].w3.type, layers[l].w2.type}, 0};
+    for (uint32_t p = swiglu_projection_w1; p <= swiglu_projection_w2; ++p) {
+      const struct swiglu_projection_weights* weights = projection_weights(&layers[l], p);
+      if (weights->type == swiglu_weight_qb4) {
+        if (file_layers[l].block_size != 0 && file_layers[l].block_size != weights->block_size) {
+          fprintf(stderr, "the qb4 projections of layer %zu have different block sizes\n", l);
+          swiglu_delete_weights_cache(cache);
+          return xnn_status_invalid_parameter;
+        }
+        file_layers[l].block_size = static_cast<uint32_t>(weights->block_size);
+      }
+    }
+    for (uint32_t p = swiglu_projection_w1; p <= swiglu_projection_w2; ++p) {
+      const struct swiglu_projection_weights* weights = projection_weights(&layers[l], p);
+      size_t num_packed = 0;
+      for (const struct swiglu_weights_cache_entry& entry : packed) {
+        if (entry.kernel == weights->data) {
+          add_entry(l, p, swiglu_packed_blob_weights, entry.seed, entry.data, entry.size);
+          num_packed++;
+        }
+      }
+      if (num_packed == 0) {
+        fprintf(stderr, "no packed weights for projection %u of layer %zu\n", p, l);
+        swiglu_delete_weights_cache(cache);
+        return xnn_status_invalid_state;
+      }
+      if (weights->type != swiglu_weight_fp32) {
+        const void* scale = weights->type == swiglu_weight_qb4 ? static_cast<const void*>(weights->block_scale)
+                                                                : static_cast<const void*>(weights->scale);
+        add_entry(l, p, swiglu_packed_blob_scales, 0, scale,
+                  scales_size(&layers[l], p, weights->type, file_layers[l].block_size));
+      }
+    }
+  }
+
+  // Lay out the blobs after the tables and turn blob indices into file offsets.
+  const size_t tables_size = num_layers * sizeof(struct swiglu_packed_file_layer) +
+                             entries.size() * sizeof(struct swiglu_packed_file_entry);
+  std::vector<uint64_t> blob_offsets(blobs.size());
+  size_t offset = align_up(sizeof(struct swiglu_packed_file_header) + tables_size, SWIGLU_PACKED_FILE_ALIGNMENT);
+  for (size_t b = 0; b < blobs.size(); ++b) {
+    blob_offsets[b] = offset;
+    // XNNPACK kernels may read up to XNN_EXTRA_BYTES past packed weights, which must
+    // stay inside the mapping even for the last blob.
+    offset = align_up(offset + blobs[b].size + XNN_EXTRA_BYTES, SWIGLU_PACKED_FILE_ALIGNMENT);
+  }
+  for (struct swiglu_packed_file_entry& entry : entries) {
+    entry.offset = blob_offsets[entry.offset];
+  }
+
+  std::vector<uint8_t> tables(tables_size);
+  memcpy(tables.data(), file_layers.data(), num_layers * sizeof(struct swiglu_packed_file_layer));
+  memcpy(tables.data() + num_layers * sizeof(struct swiglu_packed_file_layer),
+         entries.data(), entries.size() * sizeof(struct swiglu_packed_file_entry));
+
+  struct swiglu_packed_file_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SWIGLU_PACKED_FILE_MAGIC, sizeof(header.magic));
+  header.version = SWIGLU_PACKED_FILE_VERSION;
+  header.header_size = sizeof(header);
+  strncpy(header.isa, swiglu_host_isa(), sizeof(header.isa) - 1);
+  header.num_layers = static_cast<uint32_t>(num_layers);
+  header.num_entries = static_cast<uint32_t>(entries.size());
+  header.file_size = offset;
+  header.metadata_checksum = checksum(tables.data(), tables.size());
+
+  // Write next to the destination and rename, so readers never see a partial file.
+  const std::string tmp_path = std::string(path) + ".tmp";
+  FILE* file = fopen(tmp_path.c_str(), "wb");
+  if (file == NULL) {
+    fprintf(stderr, "failed to create %s\n", tmp_path.c_str());
+    swiglu_delete_weights_cache(cache);
+    return xnn_status_invalid_parameter;
+  }
+  const std::vector<uint8_t> zeros(SWIGLU_PACKED_FILE_ALIGNMENT, 0);
+  size_t position = sizeof(header) + tables.size();
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(tables.data(), 1, tables.size(), file) == tables.size();
+  for (size_t b = 0; ok && b <= blobs.size(); ++b) {
+    const size_t target = b < blobs.size() ? blob_offsets[b] : offset;
+    ok = fwrite(zeros.data(), 1, target - position, file) == target - position;
+    position = target;
+    if (ok && b < blobs.size()) {
+      ok = fwrite(blobs[b].data, 1, blobs[b].size, file) == blobs[b].size;
+      position += blobs[b].size;
+    }
+  }
+  ok = fclose(file) == 0 && ok;
+  swiglu_delete_weights_cache(cache);
+  if (!ok || rename(tmp_path.c_str(), path) != 0) {
+    fprintf(stderr, "failed to write %s\n", path);
+    unlink(tmp_path.c_str());
+    return xnn_status_invalid_state;
+  }
+  return xnn_status_success;
+}
+
+struct swiglu_packed_file {
+  struct xnn_weights_cache_provider provider;
+  std::string path;
+  void* mapping = MAP_FAILED;
+  size_t size = 0;
+  std::vector<struct swiglu_layer_weights> layers;
+  // File offset of packed weights by (identifying kernel pointer, cache seed)
+  std::map<std::pair<const void*, uint32_t>, uint64_t> packed;
+};
+
+// Everything must already be packed, so a miss is always an error. It means the file
+// was packed for a different GEMM configuration, e.g. another XNNPACK build.
+static size_t look_up(void* context, const struct xnn_weights_cache_look_up_key* cache_key) {
+  const struct swiglu_packed_file* file = static_cast<const struct swiglu_packed_file*>(context);
+  auto it = file->packed.find(std::make_pair(cache_key->kernel, cache_key->seed));
+  if (it == file->packed.end()) {
+    fprintf(stderr, "%s has no packed weights for this operator (cache seed %u); repack it on this host\n",
+            file->path.c_str(), cache_key->seed);
+    return XNN_CACHE_NOT_FOUND;
+  }
+  return it->second;
+}
+
+static void* reserve_space(void* context, size_t n) {
+  const struct swiglu_packed_file* file = static_cast<const struct swiglu_packed_file*>(context);
+  fprintf(stderr, "%s is read-only and cannot take %zu bytes of newly packed weights\n", file->path.c_str(), n);
+  return NULL;
+}
+
+static size_t look_up_or_insert(
+  void* context,
+  const struct xnn_weights_cache_look_up_key* cache_key,
+  void* ptr,
+  size_t size)
+{
+  (void) ptr;
+  (void) size;
+  return look_up(context, cache_key);
+}
+
+static bool is_finalized(void* context) {
+  // A read-only mapping never takes new weights; misses are reported by look_up.
+  (void) context;
+  return true;
+}
+
+static void* offset_to_addr(void* context, size_t offset) {
+  struct swiglu_packed_file* file = static_cast<struct swiglu_packed_file*>(context);
+  return static_cast<uint8_t*>(file->mapping) + offset;
+}
+
+static enum xnn_status delete_cache(void* context) {
+  // The file owns the mapping; see swiglu_close_packed_file.
+  (void) context;
+  return xnn_status_success;
+}
+
+// Maps and validates the packed file open as fd, which it closes. path names it in messages.
+static enum xnn_status map_packed_file(
+  int fd,
+  const char* path,
+  uint32_t flags,
+  struct swiglu_packed_file** file_out)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(struct swiglu_packed_file_header)) {
+    fprintf(stderr, "%s is not a packed weights file\n", path);
+    close(fd);
+    return xnn_status_invalid_parameter;
+  }
+
+  struct swiglu_packed_file* file = new (std::nothrow) swiglu_packed_file();
+  if (file == NULL) {
+    fprintf(stderr, "failed to allocate packed file\n");
+    close(fd);
+    return xnn_status_out_of_memory;
+  }
+  file->path = path;
+  file->size = static_cast<size_t>(st.st_size);
+  // Shared so that every process mapping the file uses the same page cache pages.
+  int map_flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if ((flags & SWIGLU_PACKED_FILE_POPULATE) != 0) {
+    map_flags |= MAP_POPULATE;
+  }
+#endif
+  file->mapping = mmap(NULL, file->size, PROT_READ, map_flags, fd, 0);
+  close(fd);
+  if (file->mapping == MAP_FAILED) {
+    fprintf(stderr, "failed to map %s\n", path);
+    swiglu_close_packed_file(file);
+    return xnn_status_invalid_parameter;
+  }
+
+  const uint8_t* base = static_cast<const uint8_t*>(file->mapping);
+  struct swiglu_packed_file_header header;
+  memcpy(&header, base, sizeof(header));
+  if (memcmp(header.magic, SWIGLU_PACKED_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+      header.version < SWIGLU_PACKED_FILE_VERSION) {
+    // Older blobs may end without the XNN_EXTRA_BYTES kernels over-read, and their
+    // layers' block_size field was reserved, so they cannot be used as they are.
+    fprintf(stderr, "%s is a version %u packed weights file; repack it with pack_swiglu_weights\n",
+            path, header.version);
+    swiglu_close_packed_file(file);
+    return xnn_status_invalid_parameter;
+  }
+  if (memcmp(header.magic, SWIGLU_PACKED_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != SWIGLU_PACKED_FILE_VERSION ||
+      header.header_size != sizeof(header) ||
+      header.file_size != file->size) {
+    fprintf(stderr, "%s is not a version %d packed weights file\n", path, SWIGLU_PACKED_FILE_VERSION);
+    swiglu_close_packed_file(file);
+    return xnn_status_invalid_parameter;
+  }
+  header.isa[sizeof(header.isa) - 1] = '\0';
+  if (strcmp(header.isa, swiglu_host_isa()) != 0) {
+    fprintf(stderr, "%s was packed for %s, but this host is %s\n", path, header.isa, swiglu_host_isa());
+    swiglu_close_packed_file(file);
+    return xnn_status_unsupported_hardware;
+  }
+
+  const size_t tables_size = header.num_layers * sizeof(struct swiglu_packed_file_layer) +
+                             header.num_entries * sizeof(struct swiglu_packed_file_entry);
+  if (sizeof(header) + tables_size > file->size ||
+      checksum(base + sizeof(header), tables_size) != header.metadata_checksum) {
+    fprintf(stderr, "%s has corrupt layer or entry tables\n", path);
+    swiglu_close_packed_file(file);
+    return xnn_status_invalid_parameter;
+  }
+  std::vector<struct swiglu_packed_file_layer> file_layers(header.num_layers);
+  std::vector<struct swiglu_packed_file_entry> entries(header.num_entries);
+  memcpy(file_layers.data(), base + sizeof(header), header.num_layers * sizeof(struct swiglu_packed_file_layer));
+  memcpy(entries.data(), base + sizeof(header) + header.num_layers * sizeof(struct swiglu_packed_file_layer),
+         header.num_entries * sizeof(struct swiglu_packed_file_entry));
+
+  file->layers.resize(header.num_layers);
+  for (size_t l = 0; l < header.num_layers; ++l) {
+    const struct swiglu_packed_file_layer& file_layer = file_layers[l];
+    bool valid = file_layer.input_dim != 0 && file_layer.inter_dim != 0 && file_layer.output_dim != 0;
+    for (uint32_t p = swiglu_projection_w1; valid && p <= swiglu_projection_w2; ++p) {
+      const uint32_t type = file_layer.weight_type[p];
+      const uint64_t cols = p == swiglu_projection_w2 ? file_layer.inter_dim : file_layer.input_dim;
+      valid = type < SWIGLU_NUM_WEIGHT_TYPES &&
+              (type != swiglu_weight_qb4 ||
+               (file_layer.block_size != 0 && file_layer.block_size % 32 == 0 && cols % file_layer.block_size == 0));
+    }
+    if (!valid) {
+      fprintf(stderr, "%s: layer %zu has empty dims, an unknown weight type or a qb4 block size of %u that does "
+              "not divide its input channels\n", path, l, file_layer.block_size);
+      swiglu_close_packed_file(file);
+      return xnn_status_invalid_parameter;
+    }
+
+    struct swiglu_layer_weights& layer = file->layers[l];
+    layer.input_dim = file_layers[l].input_dim;
+    layer.inter_dim = file_layers[l].inter_dim;
+    layer.output_dim = file_layers[l].output_dim;
+    for (uint32_t p = swiglu_projection_w1; p <= swiglu_projection_w2; ++p) {
+      *projection_weights(&layer, p) =
+        {static_cast<enum swiglu_weight_type>(file_layers[l].weight_type[p]), NULL, NULL, NULL, 0};
+      if (file_layers[l].weight_type[p] == swiglu_weight_qb4) {
+        projection_weights(&layer, p)->block_size = file_layers[l].block_size;
+      }
+    }
+  }
+
+  for (const struct swiglu_packed_file_entry& entry : entries) {
+    if (entry.layer >= header.num_layers || entry.projection > swiglu_projection_w2 ||
+        entry.offset > file->size || entry.size > file->size - entry.offset ||
+        (entry.kind == swiglu_packed_blob_weights && file->size - entry.offset - entry.size < XNN_EXTRA_BYTES)) {
+      fprintf(stderr, "%s has an out-of-range entry\n", path);
+      swiglu_close_packed_file(file);
+      return xnn_status_invalid_parameter;
+    }
+    if ((flags & SWIGLU_PACKED_FILE_VERIFY_CHECKSUMS) != 0 &&
+        checksum(base + entry.offset, entry.size) != entry.checksum) {
+      fprintf(stderr, "%s: checksum mismatch for projection %u of layer %u\n", path, entry.projection, entry.layer);
+      swiglu_close_packed_file(file);
+      return xnn_status_invalid_parameter;
+    }
+
+    struct swiglu_layer_weights* layer = &file->layers[entry.layer];
+    struct swiglu_projection_weights* weights = projection_weights(layer, entry.projection);
+    const void* blob = base + entry.offset;
+    if (entry.kind == swiglu_packed_blob_scales) {
+      if (entry.size == 0 ||
+          entry.size != scales_size(layer, entry.projection, weights->type, file_layers[entry.layer].block_size)) {
+        fprintf(stderr, "%s: wrong scale count for projection %u of layer %u\n", path, entry.projection, entry.layer);
+        swiglu_close_packed_file(file);
+        return xnn_status_invalid_parameter;
+      }
+      if (weights->type == swiglu_weight_qb4) {
+        weights->block_scale = static_cast<const uint16_t*>(blob);
+      } else {
+        weights->scale = static_cast<const float*>(blob);
+      }
+    } else {
+      // The first packed blob of a projection identifies it in cache look-ups.
+      if (weights->data == NULL) {
+        weights->data = blob;
+      }
+      file->packed[std::make_pair(weights->data, entry.seed)] = entry.offset;
+    }
+  }
+
+  for (size_t l = 0; l < header.num_layers; ++l) {
+    for (uint32_t p = swiglu_projection_w1; p <= swiglu_projection_w2; ++p) {
+      const struct swiglu_projection_weights* weights = projection_weights(&file->layers[l], p);
+      const bool has_scales = weights->type == swiglu_weight_fp32 ||
+                              (weights->type == swiglu_weight_qb4 ? weights->block_scale != NULL
+                                                                  : weights->scale != NULL);
+      if (weights->data == NULL || !has_scales) {
+        fprintf(stderr, "%s is missing projection %u of layer %zu\n", path, p, l);
+        swiglu_close_packed_file(file);
+        return xnn_status_invalid_parameter;
+      }
+    }
+  }
+
+  file->provider.context = file;
+  file->provider.look_up = look_up;
+  file->provider.reserve_space = reserve_space;
+  file->provider.look_up_or_insert = look_up_or_insert;
+  file->provider.is_finalized = is_finalized;
+  file->provider.offset_to_addr = offset_to_addr;
+  file->provider.delete_cache = delete_cache;
+  *file_out = file;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_open_packed_file(
+  const char* path,
+  uint32_t flags,
+  struct swiglu_packed_file** file_out)
+{
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "failed to open %s\n", path);
+    return xnn_status_invalid_parameter;
+  }
+  return map_packed_file(fd, path, flags, file_out);
+}
+
+enum xnn_status swiglu_publish_packed_shm(const char* path, const char* name) {
+  const int in = open(path, O_RDONLY);
+  if (in < 0) {
+    fprintf(stderr, "failed to open %s\n", path);
+    return xnn_status_invalid_parameter;
+  }
+  struct stat st;
+  if (fstat(in, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(struct swiglu_packed_file_header)) {
+    fprintf(stderr, "%s is not a packed weights file\n", path);
+    close(in);
+    return xnn_status_invalid_parameter;
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+
+  // Workers only ever need to read the segment.
+  const int out = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0444);
+  if (out < 0) {
+    fprintf(stderr, "failed to create shared memory %s: %s\n", name, strerror(errno));
+    close(in);
+    return xnn_status_invalid_parameter;
+  }
+  enum xnn_status status = xnn_status_success;
+  void* source = mmap(NULL, size, PROT_READ, MAP_SHARED, in, 0);
+  void* target = MAP_FAILED;
+  if (source == MAP_FAILED || ftruncate(out, static_cast<off_t>(size)) != 0 ||
+      (target = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, out, 0)) == MAP_FAILED) {
+    fprintf(stderr, "failed to copy %s into shared memory %s: %s\n", path, name, strerror(errno));
+    status = xnn_status_out_of_memory;
+  } else {
+    // The header goes in last: until then the magic is zero and opening fails.
+    const size_t header_size = sizeof(struct swiglu_packed_file_header);
+    memcpy(static_cast<uint8_t*>(target) + header_size, static_cast<const uint8_t*>(source) + header_size,
+           size - header_size);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(target, source, header_size);
+  }
+  if (target != MAP_FAILED) {
+    munmap(target, size);
+  }
+  if (source != MAP_FAILED) {
+    munmap(source, size);
+  }
+  close(out);
+  close(in);
+  if (status != xnn_status_success) {
+    shm_unlink(name);
+  }
+  return status;
+}
+
+enum xnn_status swiglu_open_packed_shm(
+  const char* name,
+  uint32_t flags,
+  struct swiglu_packed_file** file_out)
+{
+  const int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    fprintf(stderr, "failed to open shared memory %s: %s\n", name, strerror(errno));
+    return xnn_status_invalid_parameter;
+  }
+  return map_packed_file(fd, name, flags, file_out);
+}
+
+void swiglu_unlink_packed_shm(const char* name) {
+  shm_unlink(name);
+}
+
+size_t swiglu_packed_file_num_layers(const struct swiglu_packed_file* file) {
+  return file->layers.size();
+}
+
+struct swiglu_layer_weights swiglu_packed_file_layer_weights(const struct swiglu_packed_file* file, size_t i) {
+  return file->layers[i];
+}
+
+xnn_weights_cache_t swiglu_packed_file_weights_cache(struct swiglu_packed_file* file) {
+  return &file->provider;
+}
+
+enum xnn_status swiglu_prefault_packed_file(
+  struct swiglu_packed_file* file,
+  pthreadpool_t threadpool,
+  bool lock)
+{
+  // munmap in swiglu_close_packed_file drops the lock.
+  return swiglu_prefault({{file->mapping, file->size}}, threadpool, lock);
+}
+
+void swiglu_close_packed_file(struct swiglu_packed_file* file) {
+  if (file->mapping != MAP_FAILED) {
+    munmap(file->mapping, file->size);
+  }
+  delete file;
+}
@@ -0,0 +1,171 @@
+/**
+ * @file swiglu_packed_file.h
+ * @brief Files of pre-packed SwiGLU weights that runtimes use without packing
+ *
+ * A packed file holds the exact buffers XNNPACK's weights cache would produce for
+ * every projection of every layer, keyed by the cache seed XNNPACK computes for the
+ * GEMM configuration. Opening a file maps it read-only and exposes it as a weights
+ * cache, so runtimes created against it only look weights up and never pack.
+ *
+ * Layout (little-endian, all blobs 4 KiB aligned so they can be mapped directly):
+ *
+ *   swiglu_packed_file_header
+ *   swiglu_packed_file_layer[num_layers]
+ *   swiglu_packed_file_entry[num_entries]
+ *   padding, then every blob referenced by an entry
+ *
+ * Every blob is followed by at least XNN_EXTRA_BYTES of zeros, the over-read
+ * XNNPACK kernels are allowed, before the padding to the next blob.
+ *
+ * Version 2 added the XNN_EXTRA_BYTES tail and gave swiglu_packed_file_layer its
+ * block_size; version 1 files are rejected and must be repacked.
+ *
+ * The header checksum covers the layer and entry tables; every entry carries the
+ * checksum of its own blob.
+ *
+ * Files are always mapped shared and read-only, so worker processes that open the
+ * same file, or the same shared memory segment, share one copy of the weights.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_layer.h"
+
+#define SWIGLU_PACKED_FILE_MAGIC "SWIGLUPK"
+#define SWIGLU_PACKED_FILE_VERSION 2
+#define SWIGLU_PACKED_FILE_ALIGNMENT 4096
+
+// Verify every blob's checksum when opening. This reads the whole file.
+#define SWIGLU_PACKED_FILE_VERIFY_CHECKSUMS 0x00000001
+// Map with MAP_POPULATE so the kernel reads the whole file in before open returns.
+// Single threaded; swiglu_prefault_packed_file reads it in parallel instead.
+#define SWIGLU_PACKED_FILE_POPULATE 0x00000002
+
+enum swiglu_projection {
+  swiglu_projection_w1 = 0,
+  swiglu_projection_w3 = 1,
+  swiglu_projection_w2 = 2,
+};
+
+enum swiglu_packed_blob_kind {
+  // Packed weights as produced by XNNPACK for one cache seed
+  swiglu_packed_blob_weights = 0,
+  // Scales of a quantized projection, needed to define its tensor: per-channel fp32
+  // for qc8, per-block bf16 for qb4
+  swiglu_packed_blob_scales = 1,
+};
+
+struct swiglu_packed_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  // ISA the weights were packed for, as returned by swiglu_host_isa()
+  char isa[32];
+  uint32_t num_layers;
+  uint32_t num_entries;
+  uint64_t file_size;
+  uint64_t metadata_checksum;
+};
+
+struct swiglu_packed_file_layer {
+  uint64_t input_dim;
+  uint64_t inter_dim;
+  uint64_t output_dim;
+  // swiglu_weight_type of w1, w3 and w2
+  uint32_t weight_type[3];
+  // Block size of the layer's qb4 projections, 0 if it has none
+  uint32_t block_size;
+};
+
+struct swiglu_packed_file_entry {
+  uint32_t layer;
+  uint32_t projection;  // swiglu_projection
+  uint32_t kind;        // swiglu_packed_blob_kind
+  uint32_t seed;        // XNNPACK cache seed, 0 for scales
+  uint64_t offset;      // from the start of the file
+  uint64_t size;
+  uint64_t checksum;
+};
+
+/**
+ * @brief Name of the instruction set XNNPACK will pick kernels for on this host
+ *
+ * Packed layouts differ between kernel families, so a file can only be used on a
+ * host that reports the same ISA. XNNPACK must be initialized.
+ */
+const char* swiglu_host_isa(void);
+
+/**
+ * @brief Packs the weights of every layer and writes them to a packed file
+ *
+ * Packing runs concurrently on threadpool, which may be NULL. Weights are packed
+ * for the host ISA.
+ */
+enum xnn_status swiglu_write_packed_file(
+  const char* path,
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  pthreadpool_t threadpool);
+
+struct swiglu_packed_file;
+
+/**
+ * @brief Maps a packed file read-only and validates it against this host
+ *
+ * flags is a combination of SWIGLU_PACKED_FILE_* flags.
+ */
+enum xnn_status swiglu_open_packed_file(
+  const char* path,
+  uint32_t flags,
+  struct swiglu_packed_file** file_out);
+
+/**
+ * @brief Copies a packed file into a new POSIX shared memory object
+ *
+ * Worker processes then open it with swiglu_open_packed_shm, and every one of them
+ * maps the same physical pages, so N workers hold one copy of the weights. Unlike
+ * the page cache behind a file on disk, the segment cannot be dropped under memory
+ * pressure and re-read; it is only swapped. Fails if name already exists.
+ */
+enum xnn_status swiglu_publish_packed_shm(const char* path, const char* name);
+
+// Maps a packed file published with swiglu_publish_packed_shm, read-only.
+enum xnn_status swiglu_open_packed_shm(
+  const char* name,
+  uint32_t flags,
+  struct swiglu_packed_file** file_out);
+
+// Removes the segment's name. Processes that have it mapped keep using it.
+void swiglu_unlink_packed_shm(const char* name);
+
+size_t swiglu_packed_file_num_layers(const struct swiglu_packed_file* file);
+
+/**
+ * @brief Layer weights to define the layer's subgraph with
+ *
+ * The data pointers point into the file and only identify the packed buffers: the
+ * file's weights cache always finds them, so XNNPACK never reads them as raw
+ * weights. Scales of quantized projections are real.
+ */
+struct swiglu_layer_weights swiglu_packed_file_layer_weights(const struct swiglu_packed_file* file, size_t i);
+
+// Weights cache to create runtimes for the file's layers with.
+xnn_weights_cache_t swiglu_packed_file_weights_cache(struct swiglu_packed_file* file);
+
+/**
+ * @brief Reads every page of the file in ahead of the first request
+ *
+ * Pages are touched in parallel on threadpool, which may be NULL. With lock set,
+ * the mapping is also mlocked so the packed weights are never evicted.
+ */
+enum xnn_status swiglu_prefault_packed_file(
+  struct swiglu_packed_file* file,
+  pthreadpool_t threadpool,
+  bool lock);
+
+// Runtimes created from the file must be deleted first.
+void swiglu_close_packed_file(struct swiglu_packed_file* file);
@@ -0,0 +1,459 @@
+/**
+ * @file swiglu_precision.cpp
+ * @brief Mixed-precision plans, mixed layers and the precision planner
+ */
+#include "swiglu_precision.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <tuple>
+
+#include "swiglu_bench.h"
+#include "swiglu_stack.h"
+
+static const char* const kProjectionNames[3] = {"w1", "w3", "w2"};
+static const char* const kWeightTypeNames[SWIGLU_NUM_WEIGHT_TYPES] = {"fp32", "qc8", "qb4"};
+
+const char* swiglu_weight_type_name(enum swiglu_weight_type type) {
+  return kWeightTypeNames[type];
+}
+
+bool swiglu_save_precision_plan(
+  const char* path,
+  size_t num_layers,
+  size_t block_size,
+  const struct swiglu_layer_precision* plan)
+{
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "failed to open %s\n", path);
+    return false;
+  }
+  fprintf(file, "# layer projection type\n");
+  fprintf(file, "block_size %zu\n", block_size);
+  for (size_t i = 0; i < num_layers; ++i) {
+    for (int p = 0; p < 3; ++p) {
+      fprintf(file, "%zu %s %s\n", i, kProjectionNames[p], kWeightTypeNames[plan[i].type[p]]);
+    }
+  }
+  const bool ok = fclose(file) == 0;
+  if (!ok) {
+    fprintf(stderr, "failed to write %s\n", path);
+  }
+  return ok;
+}
+
+// Index of name in names, or count if it is not there.
+static int find_name(const char* const* names, int count, const char* name) {
+  int i = 0;
+  while (i < count && strcmp(name, names[i]) != 0) {
+    ++i;
+  }
+  return i;
+}
+
+bool swiglu_load_precision_plan(
+  const char* path,
+  size_t num_layers,
+  size_t* block_size,
+  struct swiglu_layer_precision* plan)
+{
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "failed to open %s\n", path);
+    return false;
+  }
+  std::vector<bool> seen(num_layers * 3);
+  bool has_block_size = false;
+  char line[256];
+  bool ok = true;
+  for (size_t line_number = 1; ok && fgets(line, sizeof(line), file) != NULL; ++line_number) {
+    if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line)) {
+      continue;
+    }
+    if (sscanf(line, "block_size %zu", block_size) == 1) {
+      has_block_size = true;
+      continue;
+    }
+    size_t layer;
+    char projection_name[32];
+    char type_name[32];
+    int p = 3;
+    int t = SWIGLU_NUM_WEIGHT_TYPES;
+    if (sscanf(line, "%zu %31s %31s", &layer, projection_name, type_name) == 3) {
+      p = find_name(kProjectionNames, 3, projection_name);
+      t = find_name(kWeightTypeNames, SWIGLU_NUM_WEIGHT_TYPES, type_name);
+    }
+    ok = p < 3 && t < SWIGLU_NUM_WEIGHT_TYPES && layer < num_layers;
+    if (!ok) {
+      fprintf(stderr, "%s:%zu: expected a layer below %zu, w1, w3 or w2, and fp32, qc8 or qb4\n", path, line_number,
+              num_layers);
+      break;
+    }
+    plan[layer].type[p] = static_cast<enum swiglu_weight_type>(t);
+    seen[layer * 3 + p] = true;
+  }
+  fclose(file);
+  if (ok && !has_block_size) {
+    fprintf(stderr, "%s has no block_size line\n", path);
+    ok = false;
+  }
+  for (size_t i = 0; ok && i < seen.size(); ++i) {
+    if (seen[i] && plan[i / 3].type[i % 3] == swiglu_weight_qb4 && (*block_size == 0 || *block_size % 32 != 0)) {
+      fprintf(stderr, "%s gives qb4 weights a block size of %zu, not a multiple of 32\n", path, *block_size);
+      ok = false;
+    }
+  }
+  for (size_t i = 0; ok && i < seen.size(); ++i) {
+    if (!seen[i]) {
+      fprintf(stderr, "%s has no type for %s of layer %zu\n", path, kProjectionNames[i % 3], i / 3);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// fp32 weights, rows and cols of projection p of layer.
+static const std::vector<float>& projection_data(const struct swiglu_fp32_layer& layer, int p, size_t* rows,
+                                                 size_t* cols) {
+  *rows = p == swiglu_projection_w2 ? layer.output_dim : layer.inter_dim;
+  *cols = p == swiglu_projection_w2 ? layer.inter_dim : layer.input_dim;
+  return p == swiglu_projection_w1 ? layer.w1 : p == swiglu_projection_w3 ? layer.w3 : layer.w2;
+}
+
+static struct swiglu_projection_weights& layer_projection(struct swiglu_layer_weights& weights, int p) {
+  return p == swiglu_projection_w1 ? weights.w1 : p == swiglu_projection_w3 ? weights.w3 : weights.w2;
+}
+
+static bool qb4_fits(size_t cols, size_t block_size) {
+  return block_size != 0 && block_size % 32 == 0 && cols % block_size == 0;
+}
+
+static struct swiglu_mixed_projection quantize_projection(
+  const std::vector<float>& weights,
+  size_t rows,
+  size_t cols,
+  enum swiglu_weight_type type,
+  size_t block_size)
+{
+  struct swiglu_mixed_projection projection;
+  projection.type = type;
+  switch (type) {
+    case swiglu_weight_fp32:
+      projection.fp32 = weights;
+      break;
+    case swiglu_weight_qc8:
+      projection.qc8.resize(rows * cols);
+      projection.scale.resize(rows);
+      swiglu_quantize_qc8(weights.data(), rows, cols, projection.qc8.data(), projection.scale.data());
+      break;
+    case swiglu_weight_qb4:
+      projection.qb4.resize(rows * cols / 2);
+      projection.block_scale.resize(rows * cols / block_size);
+      swiglu_quantize_qb4(weights.data(), rows, cols, block_size, projection.qb4.data(),
+                          projection.block_scale.data());
+      break;
+  }
+  return projection;
+}
+
+static struct swiglu_projection_weights projection_weights(
+  const struct swiglu_mixed_projection& projection,
+  size_t block_size)
+{
+  switch (projection.type) {
+    case swiglu_weight_qc8:
+      return {swiglu_weight_qc8, projection.qc8.data(), projection.scale.data(), NULL, 0};
+    case swiglu_weight_qb4:
+      return {swiglu_weight_qb4, projection.qb4.data(), NULL, projection.block_scale.data(), block_size};
+    default:
+      return {swiglu_weight_fp32, projection.fp32.data(), NULL, NULL, 0};
+  }
+}
+
+struct swiglu_mixed_layer swiglu_quantize_layer_mixed(
+  const struct swiglu_fp32_layer& layer,
+  const struct swiglu_layer_precision& precision,
+  size_t block_size)
+{
+  struct swiglu_mixed_layer mixed;
+  mixed.input_dim = layer.input_dim;
+  mixed.inter_dim = layer.inter_dim;
+  mixed.output_dim = layer.output_dim;
+  mixed.block_size = block_size;
+  for (int p = 0; p < 3; ++p) {
+    size_t rows, cols;
+    const std::vector<float>& weights = projection_data(layer, p, &rows, &cols);
+    mixed.projection[p] = quantize_projection(weights, rows, cols, precision.type[p], block_size);
+  }
+  return mixed;
+}
+
+struct swiglu_layer_weights swiglu_mixed_layer_weights(const struct swiglu_mixed_layer& layer) {
+  struct swiglu_layer_weights weights;
+  weights.input_dim = layer.input_dim;
+  weights.inter_dim = layer.inter_dim;
+  weights.output_dim = layer.output_dim;
+  for (int p = 0; p < 3; ++p) {
+    layer_projection(weights, p) = projection_weights(layer.projection[p], layer.block_size);
+  }
+  return weights;
+}
+
+static float relative_error(const float* reference, const float* output, size_t size) {
+  double error = 0.0;
+  double norm = 0.0;
+  for (size_t i = 0; i < size; ++i) {
+    error += (output[i] - reference[i]) * (output[i] - reference[i]);
+    norm += reference[i] * reference[i];
+  }
+  return static_cast<float>(sqrt(error / std::max(norm, 1e-30)));
+}
+
+// Median time of num_runs runs of weights @ input at batch_size rows, after one untimed run.
+static enum xnn_status time_projection(
+  const struct swiglu_projection_weights& weights,
+  size_t rows,
+  size_t cols,
+  size_t batch_size,
+  size_t num_runs,
+  pthreadpool_t threadpool,
+  double* latency_ms)
+{
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = swiglu_define_projection(rows, cols, &weights, &subgraph);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  xnn_runtime_t runtime = NULL;
+  status = xnn_create_runtime_v4(
+    subgraph,
+    /*weights_cache=*/NULL,
+    /*workspace=*/NULL,
+    /*threadpool=*/threadpool,
+    /*flags=*/0,
+    &runtime);
+  xnn_delete_subgraph(subgraph);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_runtime_v4 failed: %d\n", status);
+    return status;
+  }
+
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  std::vector<float> input(batch_size * cols + XNN_EXTRA_BYTES / sizeof(float));
+  swiglu_fill_random(input.data(), batch_size * cols, 1.0f, 1);
+  std::vector<float> output(batch_size * rows);
+  const size_t input_dims[2] = {batch_size, cols};
+  const size_t output_dims[2] = {batch_size, rows};
+  const struct xnn_external_value external_values[SWIGLU_NUM_EXTERNAL_VALUES] = {
+    {SWIGLU_INPUT_EXTERNAL_ID, input.data()},
+    {SWIGLU_OUTPUT_EXTERNAL_ID, output.data()},
+  };
+  if ((status = xnn_reshape_external_value(runtime, SWIGLU_INPUT_EXTERNAL_ID, 2, input_dims)) !=
+        xnn_status_success ||
+      (status = xnn_reshape_external_value(runtime, SWIGLU_OUTPUT_EXTERNAL_ID, 2, output_dims)) !=
+        xnn_status_success ||
+      (status = xnn_reshape_runtime(runtime)) != xnn_status_success ||
+      (status = xnn_setup_runtime_v2(runtime, SWIGLU_NUM_EXTERNAL_VALUES, external_values)) != xnn_status_success) {
+    fprintf(stderr, "failed to set up a [%zu, %zu] projection: %d\n", rows, cols, status);
+    xnn_delete_runtime(runtime);
+    return status;
+  }
+  std::vector<double> samples;
+  for (size_t run = 0; run <= num_runs && status == xnn_status_success; ++run) {
+    const auto start = std::chrono::steady_clock::now();
+    status = xnn_invoke_runtime(runtime);
+    if (run != 0) {
+      samples.push_back(elapsed_ms(start));
+    }
+  }
+  xnn_delete_runtime(runtime);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_invoke_runtime failed: %d\n", status);
+    return status;
+  }
+  *latency_ms = percentile(samples, 50.0);
+  return xnn_status_success;
+}
+
+// Runs rows of input through a stack of the single layer weights.
+static enum xnn_status run_layer(
+  const struct swiglu_layer_weights& weights,
+  size_t num_rows,
+  const float* input,
+  pthreadpool_t threadpool,
+  float* output)
+{
+  struct swiglu_stack* stack = NULL;
+  enum xnn_status status = swiglu_create_stack(1, &weights, threadpool, swiglu_pack_serial, &stack);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  status = swiglu_run_stack(stack, num_rows, input, output);
+  swiglu_delete_stack(stack);
+  return status;
+}
+
+enum xnn_status swiglu_measure_precision_costs(
+  size_t num_layers,
+  const struct swiglu_fp32_layer* layers,
+  size_t block_size,
+  size_t num_rows,
+  const float* input,
+  size_t batch_size,
+  size_t num_runs,
+  pthreadpool_t threadpool,
+  struct swiglu_projection_costs* costs)
+{
+  if (num_layers == 0 || num_rows == 0 || batch_size == 0 || num_runs == 0) {
+    fprintf(stderr, "measuring precision costs needs layers, rows, a batch size and runs\n");
+    return xnn_status_invalid_parameter;
+  }
+  for (size_t l = 1; l < num_layers; ++l) {
+    if (layers[l].input_dim != layers[l - 1].output_dim) {
+      fprintf(stderr, "layer %zu has input dim %zu but layer %zu has output dim %zu\n", l, layers[l].input_dim,
+              l - 1, layers[l - 1].output_dim);
+      return xnn_status_invalid_parameter;
+    }
+  }
+
+  // activations[l] is the fp32 input of layer l, activations[num_layers] the stack output.
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of each input.
+  std::vector<std::vector<float>> activations(num_layers + 1);
+  activations[0].assign(input, input + num_rows * layers[0].input_dim);
+  activations[0].resize(activations[0].size() + XNN_EXTRA_BYTES / sizeof(float));
+  for (size_t l = 0; l < num_layers; ++l) {
+    activations[l + 1].resize(num_rows * layers[l].output_dim + XNN_EXTRA_BYTES / sizeof(float));
+    const enum xnn_status status = run_layer(swiglu_fp32_layer_weights(layers[l]), num_rows,
+                                             activations[l].data(), threadpool, activations[l + 1].data());
+    if (status != xnn_status_success) {
+      return status;
+    }
+  }
+
+  std::map<std::tuple<size_t, size_t, int>, double> latencies;
+  std::vector<float> output;
+  for (size_t l = 0; l < num_layers; ++l) {
+    const size_t output_size = num_rows * layers[l].output_dim;
+    output.resize(output_size);
+    for (int p = 0; p < 3; ++p) {
+      struct swiglu_projection_costs& cost = costs[l * 3 + p];
+      size_t rows, cols;
+      const std::vector<float>& fp32 = projection_data(layers[l], p, &rows, &cols);
+      for (int t = 0; t < SWIGLU_NUM_WEIGHT_TYPES; ++t) {
+        const enum swiglu_weight_type type = static_cast<enum swiglu_weight_type>(t);
+        if (type == swiglu_weight_qb4 && !qb4_fits(cols, block_size)) {
+          cost.error[t] = INFINITY;
+          cost.latency_ms[t] = INFINITY;
+          continue;
+        }
+        const struct swiglu_mixed_projection projection = quantize_projection(fp32, rows, cols, type, block_size);
+        struct swiglu_layer_weights weights = swiglu_fp32_layer_weights(layers[l]);
+        layer_projection(weights, p) = projection_weights(projection, block_size);
+
+        cost.error[t] = 0.0f;
+        if (type != swiglu_weight_fp32) {
+          const enum xnn_status status = run_layer(weights, num_rows, activations[l].data(), threadpool,
+                                                   output.data());
+          if (status != xnn_status_success) {
+            return status;
+          }
+          cost.error[t] = relative_error(activations[l + 1].data(), output.data(), output_size);
+        }
+
+        const std::tuple<size_t, size_t, int> shape(rows, cols, t);
+        auto latency = latencies.find(shape);
+        if (latency == latencies.end()) {
+          double latency_ms = 0.0;
+          const enum xnn_status status = time_projection(layer_projection(weights, p), rows, cols, batch_size,
+                                                         num_runs, threadpool, &latency_ms);
+          if (status != xnn_status_success) {
+            return status;
+          }
+          latency = latencies.emplace(shape, latency_ms).first;
+        }
+        cost.latency_ms[t] = latency->second;
+      }
+    }
+  }
+  return xnn_status_success;
+}
+
+static double squared(float error) {
+  return static_cast<double>(error) * error;
+}
+
+void swiglu_plan_precision(
+  size_t num_layers,
+  const struct swiglu_projection_costs* costs,
+  float error_budget,
+  struct swiglu_layer_precision* plan)
+{
+  for (size_t l = 0; l < num_layers; ++l) {
+    for (int p = 0; p < 3; ++p) {
+      plan[l].type[p] = swiglu_weight_fp32;
+    }
+  }
+  const double budget = squared(error_budget);
+  double error = 0.0;
+  // Every move makes a projection strictly faster, so this ends.
+  for (;;) {
+    size_t best = num_layers * 3;
+    int best_type = 0;
+    double best_score = 0.0;
+    double best_saving = 0.0;
+    double best_added = 0.0;
+    for (size_t i = 0; i < num_layers * 3; ++i) {
+      const struct swiglu_projection_costs& cost = costs[i];
+      const int current = plan[i / 3].type[i % 3];
+      for (int t = 0; t < SWIGLU_NUM_WEIGHT_TYPES; ++t) {
+        const double saving = cost.latency_ms[current] - cost.latency_ms[t];
+        const double added = squared(cost.error[t]) - squared(cost.error[current]);
+        if (!(saving > 0.0) || !(error + added <= budget)) {
+          continue;
+        }
+        const double score = added > 0.0 ? saving / added : INFINITY;
+        if (best == num_layers * 3 || score > best_score || (score == best_score && saving > best_saving)) {
+          best = i;
+          best_type = t;
+          best_score = score;
+          best_saving = saving;
+          best_added = added;
+        }
+      }
+    }
+    if (best == num_layers * 3) {
+      break;
+    }
+    plan[best / 3].type[best % 3] = static_cast<enum swiglu_weight_type>(best_type);
+    error += best_added;
+  }
+}
+
+float swiglu_plan_error(
+  size_t num_layers,
+  const struct swiglu_projection_costs* costs,
+  const struct swiglu_layer_precision* plan)
+{
+  double error = 0.0;
+  for (size_t i = 0; i < num_layers * 3; ++i) {
+    error += squared(costs[i].error[plan[i / 3].type[i % 3]]);
+  }
+  return static_cast<float>(sqrt(error));
+}
+
+double swiglu_plan_latency(
+  size_t num_layers,
+  const struct swiglu_projection_costs* costs,
+  const struct swiglu_layer_precision* plan)
+{
+  double latency_ms = 0.0;
+  for (size_t i = 0; i < num_layers * 3; ++i) {
+    latency_ms += costs[i].latency_ms[plan[i / 3].type[i % 3]];
+  }
+  return latency_ms;
+}
@@ -0,0 +1,143 @@
+/**
+ * @file swiglu_precision.h
+ * @brief Mixed-precision SwiGLU stacks with a weight type picked per projection
+ *
+ * Layers do not tolerate quantization equally: some projections lose almost nothing
+ * at 4 bits while others need 8-bit or fp32 weights. A precision plan gives every
+ * projection of every layer its own swiglu_weight_type, and swiglu_layer defines
+ * each one's tensor with that type, so a single layer can mix them.
+ *
+ * The planner measures, for each projection and type, the relative error of the
+ * layer's output against fp32 with only that projection quantized, and the latency
+ * of the projection alone at the batch size being served. Assuming the errors of
+ * different projections are independent, their squares add, so the planner
+ * repeatedly moves the projection with the best saving per unit of added squared
+ * error to a faster type, until no move fits within the error budget. The sum is
+ * an estimate; check the planned stack's error end to end (as plan_swiglu does).
+ *
+ * Plans are text files of "layer projection type" lines with a "block_size" line,
+ * e.g.
+ *
+ *   block_size 128
+ *   0 w1 qb4
+ *   0 w3 qb4
+ *   0 w2 qc8
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+#include <vector>
+
+#include "swiglu_packed_file.h"
+#include "swiglu_weights_io.h"
+
+// Weight types of one layer, indexed by swiglu_projection.
+struct swiglu_layer_precision {
+  enum swiglu_weight_type type[3];
+};
+
+// Name of a weight type in plan files: "fp32", "qc8" or "qb4".
+const char* swiglu_weight_type_name(enum swiglu_weight_type type);
+
+// Writes a plan for num_layers layers whose qb4 projections use block_size.
+bool swiglu_save_precision_plan(
+  const char* path,
+  size_t num_layers,
+  size_t block_size,
+  const struct swiglu_layer_precision* plan);
+
+// Reads a plan written by swiglu_save_precision_plan; every projection of num_layers layers must be present.
+bool swiglu_load_precision_plan(
+  const char* path,
+  size_t num_layers,
+  size_t* block_size,
+  struct swiglu_layer_precision* plan);
+
+// Owned weights of one projection of a mixed layer; only the vectors of its type are filled.
+struct swiglu_mixed_projection {
+  enum swiglu_weight_type type;
+  std::vector<float> fp32;
+  std::vector<int8_t> qc8;
+  std::vector<float> scale;
+  std::vector<uint8_t> qb4;
+  std::vector<uint16_t> block_scale;
+};
+
+// Owned weights of one layer whose projections each have their own type.
+struct swiglu_mixed_layer {
+  size_t input_dim;
+  size_t inter_dim;
+  size_t output_dim;
+  size_t block_size;
+  struct swiglu_mixed_projection projection[3];  // indexed by swiglu_projection
+};
+
+/**
+ * @brief Quantizes every projection of a layer to its type in precision
+ *
+ * qb4 projections are rounded to nearest (see swiglu_quantize_qb4); block_size must
+ * divide their input dims.
+ */
+struct swiglu_mixed_layer swiglu_quantize_layer_mixed(
+  const struct swiglu_fp32_layer& layer,
+  const struct swiglu_layer_precision& precision,
+  size_t block_size);
+
+// Mixed layer weights pointing into layer, which must outlive them.
+struct swiglu_layer_weights swiglu_mixed_layer_weights(const struct swiglu_mixed_layer& layer);
+
+// Measured cost of one projection at every weight type, indexed by swiglu_weight_type.
+struct swiglu_projection_costs {
+  // Relative error of the layer's output with only this projection at the type,
+  // INFINITY if the type cannot hold the projection (qb4 blocks that do not divide it)
+  float error[SWIGLU_NUM_WEIGHT_TYPES];
+  // Median time of the projection alone, in milliseconds
+  double latency_ms[SWIGLU_NUM_WEIGHT_TYPES];
+};
+
+/**
+ * @brief Measures every projection of a stack at every weight type
+ *
+ * Errors are measured on num_rows rows of input, [num_rows, layers[0].input_dim],
+ * with each layer fed its fp32 input. Latencies are medians of num_runs runs at
+ * batch_size rows; projections of the same shape are only timed once. Writes
+ * num_layers * 3 entries to costs, indexed by layer * 3 + swiglu_projection.
+ */
+enum xnn_status swiglu_measure_precision_costs(
+  size_t num_layers,
+  const struct swiglu_fp32_layer* layers,
+  size_t block_size,
+  size_t num_rows,
+  const float* input,
+  size_t batch_size,
+  size_t num_runs,
+  pthreadpool_t threadpool,
+  struct swiglu_projection_costs* costs);
+
+/**
+ * @brief Picks the fastest weight types whose estimated error stays within error_budget
+ *
+ * Starts from fp32 everywhere and greedily moves projections to faster types, as
+ * described above. Types that are not faster than fp32 at the measured batch size
+ * are never picked.
+ */
+void swiglu_plan_precision(
+  size_t num_layers,
+  const struct swiglu_projection_costs* costs,
+  float error_budget,
+  struct swiglu_layer_precision* plan);
+
+// Estimated relative error of a plan, the root of the summed squared errors.
+float swiglu_plan_error(
+  size_t num_layers,
+  const struct swiglu_projection_costs* costs,
+  const struct swiglu_layer_precision* plan);
+
+// Summed projection latencies of a plan, in milliseconds.
+double swiglu_plan_latency(
+  size_t num_layers,
+  const struct swiglu_projection_costs* costs,
+  const struct swiglu_layer_precision* plan);
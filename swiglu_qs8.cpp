@@ -0,0 +1,120 @@
+/**
+ * @file swiglu_qs8.cpp
+ * @brief Static int8 layers as gated stacks with a SiLU table gating pass
+ */
+#include "swiglu_qs8.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "swiglu_gated.h"
+
+static_assert(SWIGLU_QS8_GATE_EXTERNAL_ID == SWIGLU_GATE_UP_GATE_EXTERNAL_ID &&
+                SWIGLU_QS8_UP_EXTERNAL_ID == SWIGLU_GATE_UP_UP_EXTERNAL_ID,
+              "the int8 gate/up subgraph must bind as a gated stack's gate/up runtime");
+
+struct qs8_layer {
+  struct swiglu_layer_weights weights;
+  struct swiglu_qs8_scales scales;
+  // silu_table[g + 128] = SiLU(gate.scale * (g - gate.zero_point)) * up.scale / intermediate.scale,
+  // so intermediate = round(silu_table[g + 128] * (u - up.zero_point)) + intermediate.zero_point.
+  float silu_table[256];
+};
+
+struct swiglu_qs8_stack {
+  std::vector<qs8_layer> layers;
+  struct swiglu_gated_stack* gated = NULL;
+};
+
+static bool same_params(struct swiglu_qs8_params a, struct swiglu_qs8_params b) {
+  return a.scale == b.scale && a.zero_point == b.zero_point;
+}
+
+static enum xnn_status define_gate_up(void* context, size_t i, xnn_subgraph_t* subgraph_out) {
+  const qs8_layer& layer = static_cast<const struct swiglu_qs8_stack*>(context)->layers[i];
+  return swiglu_define_qs8_gate_up(&layer.weights, &layer.scales, subgraph_out);
+}
+
+static enum xnn_status define_down(void* context, size_t i, xnn_subgraph_t* subgraph_out) {
+  const qs8_layer& layer = static_cast<const struct swiglu_qs8_stack*>(context)->layers[i];
+  return swiglu_define_qs8_down(&layer.weights, &layer.scales, subgraph_out);
+}
+
+static void gate_qs8(void* context, size_t i, size_t count, const void* gate_ptr, const void* up_ptr,
+                     void* intermediate_ptr)
+{
+  const qs8_layer& layer = static_cast<const struct swiglu_qs8_stack*>(context)->layers[i];
+  const int8_t* gate = static_cast<const int8_t*>(gate_ptr);
+  const int8_t* up = static_cast<const int8_t*>(up_ptr);
+  int8_t* intermediate = static_cast<int8_t*>(intermediate_ptr);
+  const float* table = layer.silu_table;
+  const int32_t up_zero_point = layer.scales.up.zero_point;
+  const float intermediate_zero_point = layer.scales.intermediate.zero_point;
+  for (size_t j = 0; j < count; ++j) {
+    const float q = nearbyintf(table[gate[j] + 128] * static_cast<float>(up[j] - up_zero_point)) +
+                    intermediate_zero_point;
+    intermediate[j] = static_cast<int8_t>(std::min(std::max(q, -128.0f), 127.0f));
+  }
+}
+
+enum xnn_status swiglu_create_qs8_stack(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  const struct swiglu_qs8_scales* scales,
+  pthreadpool_t threadpool,
+  struct swiglu_qs8_stack** stack_out)
+{
+  for (size_t i = 1; i < num_layers; ++i) {
+    if (!same_params(scales[i].input, scales[i - 1].output)) {
+      fprintf(stderr, "layer %zu does not take layer %zu's output scales\n", i, i - 1);
+      return xnn_status_invalid_parameter;
+    }
+  }
+
+  struct swiglu_qs8_stack* stack = new (std::nothrow) swiglu_qs8_stack();
+  if (stack == NULL) {
+    fprintf(stderr, "failed to allocate int8 stack\n");
+    return xnn_status_out_of_memory;
+  }
+  stack->layers.resize(num_layers);
+  for (size_t i = 0; i < num_layers; ++i) {
+    qs8_layer& layer = stack->layers[i];
+    layer.weights = layers[i];
+    layer.scales = scales[i];
+    const struct swiglu_qs8_params gate = scales[i].gate;
+    const float multiplier = scales[i].up.scale / scales[i].intermediate.scale;
+    for (int g = -128; g < 128; ++g) {
+      const float x = gate.scale * static_cast<float>(g - gate.zero_point);
+      layer.silu_table[g + 128] = x / (1.0f + expf(-x)) * multiplier;
+    }
+  }
+  enum xnn_status status = swiglu_create_gated_stack(
+    num_layers, layers, /*element_size=*/sizeof(int8_t), define_gate_up, define_down, gate_qs8,
+    /*context=*/stack, threadpool, &stack->gated);
+  if (status != xnn_status_success) {
+    swiglu_delete_qs8_stack(stack);
+    return status;
+  }
+
+  *stack_out = stack;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_run_qs8_stack(
+  struct swiglu_qs8_stack* stack,
+  size_t batch_size,
+  const int8_t* input,
+  int8_t* output)
+{
+  return swiglu_run_gated_stack(stack->gated, batch_size, input, output);
+}
+
+void swiglu_delete_qs8_stack(struct swiglu_qs8_stack* stack) {
+  if (stack->gated != NULL) {
+    swiglu_delete_gated_stack(stack->gated);
+  }
+  delete stack;
+}
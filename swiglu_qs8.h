@@ -0,0 +1,54 @@
+/**
+ * @file swiglu_qs8.h
+ * @brief SwiGLU stacks quantized statically to int8 end to end
+ *
+ * The qc8 layers quantize each projection input per row at run time and produce
+ * fp32, so SiLU, the gating multiply and the activations between layers stay fp32.
+ * Here every activation has a calibrated scale and zero point (swiglu_qs8_scales):
+ * the projections are qs8 fully connected nodes with int8 outputs, and the layers
+ * read and write int8, so hosts with fast int8 and slow fp32 never leave 8 bits.
+ *
+ * SiLU and the gating multiply run as one pass between two runtimes per layer. The
+ * gate value is an int8, so SiLU of each of its 256 values is a table computed when
+ * the stack is created, folded with the up and intermediate scales; the pass is one
+ * lookup, one multiply and one rounding per element.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_layer.h"
+
+struct swiglu_qs8_stack;
+
+/**
+ * @brief Creates a stack of num_layers static int8 layers
+ *
+ * Every layer needs qc8 weights and scales[i]; scales[i].output must equal
+ * scales[i + 1].input. The weights are not copied and must outlive the stack.
+ * threadpool may be NULL.
+ */
+enum xnn_status swiglu_create_qs8_stack(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  const struct swiglu_qs8_scales* scales,
+  pthreadpool_t threadpool,
+  struct swiglu_qs8_stack** stack_out);
+
+/**
+ * @brief Runs batch_size rows through every layer
+ *
+ * input is [batch_size, input_dim] quantized with the first layer's input scales,
+ * and output [batch_size, output_dim] with the last layer's output scales. input
+ * must be readable XNN_EXTRA_BYTES past its last row.
+ */
+enum xnn_status swiglu_run_qs8_stack(
+  struct swiglu_qs8_stack* stack,
+  size_t batch_size,
+  const int8_t* input,
+  int8_t* output);
+
+void swiglu_delete_qs8_stack(struct swiglu_qs8_stack* stack);
@@ -0,0 +1,116 @@
+/**
+ * @file swiglu_quantize.cpp
+ * @brief Weight quantization helpers for the SwiGLU projections
+ */
+#include "swiglu_quantize.h"
+
+#include <math.h>
+#include <string.h>
+
+void swiglu_quantize_qc8(
+  const float* weights,
+  size_t rows,
+  size_t cols,
+  int8_t* quantized,
+  float* scale)
+{
+  for (size_t i = 0; i < rows; ++i) {
+    const float* row = weights + i * cols;
+    float max_abs = 0.0f;
+    for (size_t j = 0; j < cols; ++j) {
+      max_abs = fmaxf(max_abs, fabsf(row[j]));
+    }
+    float row_scale = max_abs / 127.0f;
+    if (!isnormal(row_scale)) {
+      row_scale = 1.0f;
+    }
+    for (size_t j = 0; j < cols; ++j) {
+      const float q = nearbyintf(row[j] / row_scale);
+      quantized[i * cols + j] = static_cast<int8_t>(fminf(fmaxf(q, -127.0f), 127.0f));
+    }
+    scale[i] = row_scale;
+  }
+}
+
+uint16_t swiglu_fp32_to_bf16(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  if (isnan(value)) {
+    return static_cast<uint16_t>((bits >> 16) | 0x0040);
+  }
+  bits += 0x7FFF + ((bits >> 16) & 1);
+  return static_cast<uint16_t>(bits >> 16);
+}
+
+float swiglu_bf16_to_fp32(uint16_t value) {
+  const uint32_t bits = static_cast<uint32_t>(value) << 16;
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+uint16_t swiglu_qb4_block_scale(const float* values, size_t size) {
+  float min_value = 0.0f;
+  float max_value = 0.0f;
+  for (size_t i = 0; i < size; ++i) {
+    min_value = fminf(min_value, values[i]);
+    max_value = fmaxf(max_value, values[i]);
+  }
+  const float block_scale = fmaxf(max_value / 7.0f, -min_value / 8.0f);
+  uint16_t scale = swiglu_fp32_to_bf16(block_scale);
+  if (swiglu_bf16_to_fp32(scale) < block_scale) {
+    scale += 1;
+  }
+  return isnormal(swiglu_bf16_to_fp32(scale)) ? scale : swiglu_fp32_to_bf16(1.0f);
+}
+
+void swiglu_quantize_qb4(
+  const float* weights,
+  size_t rows,
+  size_t cols,
+  size_t block_size,
+  uint8_t* quantized,
+  uint16_t* scale)
+{
+  const size_t num_blocks = cols / block_size;
+  for (size_t i = 0; i < rows; ++i) {
+    const float* row = weights + i * cols;
+    uint8_t* quantized_row = quantized + i * cols / 2;
+    for (size_t b = 0; b < num_blocks; ++b) {
+      const uint16_t block_scale = swiglu_qb4_block_scale(row + b * block_size, block_size);
+      scale[i * num_blocks + b] = block_scale;
+      const float inv_scale = 1.0f / swiglu_bf16_to_fp32(block_scale);
+      for (size_t j = b * block_size; j < (b + 1) * block_size; ++j) {
+        const uint8_t q = static_cast<uint8_t>(fminf(fmaxf(nearbyintf(row[j] * inv_scale) + 8.0f, 0.0f), 15.0f));
+        quantized_row[j / 2] = j % 2 == 0 ? q : static_cast<uint8_t>(quantized_row[j / 2] | (q << 4));
+      }
+    }
+  }
+}
+
+struct swiglu_qs8_params swiglu_qs8_params_for_range(float min_value, float max_value) {
+  min_value = fminf(min_value, 0.0f);
+  max_value = fmaxf(max_value, 0.0f);
+  struct swiglu_qs8_params params;
+  params.scale = (max_value - min_value) / 255.0f;
+  if (!isnormal(params.scale)) {
+    params.scale = 1.0f;
+  }
+  const float zero_point = nearbyintf(-128.0f - min_value / params.scale);
+  params.zero_point = static_cast<int8_t>(fminf(fmaxf(zero_point, -128.0f), 127.0f));
+  return params;
+}
+
+void swiglu_quantize_qs8(const float* input, size_t size, struct swiglu_qs8_params params, int8_t* output) {
+  const float inv_scale = 1.0f / params.scale;
+  for (size_t i = 0; i < size; ++i) {
+    const float q = nearbyintf(input[i] * inv_scale) + params.zero_point;
+    output[i] = static_cast<int8_t>(fminf(fmaxf(q, -128.0f), 127.0f));
+  }
+}
+
+void swiglu_dequantize_qs8(const int8_t* input, size_t size, struct swiglu_qs8_params params, float* output) {
+  for (size_t i = 0; i < size; ++i) {
+    output[i] = params.scale * static_cast<float>(input[i] - params.zero_point);
+  }
+}
@@ -0,0 +1,68 @@
+/**
+ * @file swiglu_quantize.h
+ * @brief Weight quantization helpers for the SwiGLU projections
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Symmetric round-to-nearest int8 quantization with one scale per row
+ *
+ * weights is [rows, cols] fp32. Writes rows * cols int8 values to quantized and
+ * rows scales to scale such that weights ~= quantized * scale. Rows whose scale would
+ * be zero or subnormal get a scale of 1, as XNNPACK requires normal scales.
+ */
+void swiglu_quantize_qc8(
+  const float* weights,
+  size_t rows,
+  size_t cols,
+  int8_t* quantized,
+  float* scale);
+
+// bf16 conversions, rounding to nearest even.
+uint16_t swiglu_fp32_to_bf16(float value);
+float swiglu_bf16_to_fp32(uint16_t value);
+
+/**
+ * @brief bf16 scale of one block of 4-bit weights
+ *
+ * Covers the block with the 16 levels scale * (q - 8), q in [0, 15], rounded up to
+ * a bf16 so that no value clips. Blocks whose scale would not
+ * be a normal number get a scale of 1.
+ */
+uint16_t swiglu_qb4_block_scale(const float* values, size_t size);
+
+/**
+ * @brief Round-to-nearest 4-bit quantization with one bf16 scale per block of each row
+ *
+ * weights is [rows, cols] fp32. Writes rows * cols / 2 bytes to quantized in the
+ * swiglu_weight_qb4 layout and rows * cols / block_size scales to scale.
+ */
+void swiglu_quantize_qb4(
+  const float* weights,
+  size_t rows,
+  size_t cols,
+  size_t block_size,
+  uint8_t* quantized,
+  uint16_t* scale);
+
+/**
+ * @brief Static quantization of an activation, real = scale * (q - zero_point)
+ *
+ * Unlike the dynamically quantized projection inputs, these are fixed ahead of
+ * time from calibration data.
+ */
+struct swiglu_qs8_params {
+  float scale;
+  int8_t zero_point;
+};
+
+// Asymmetric params covering [min_value, max_value], widened to include 0 so that 0 is exact.
+struct swiglu_qs8_params swiglu_qs8_params_for_range(float min_value, float max_value);
+
+// Rounds size values to int8 with params, saturating.
+void swiglu_quantize_qs8(const float* input, size_t size, struct swiglu_qs8_params params, int8_t* output);
+
+void swiglu_dequantize_qs8(const int8_t* input, size_t size, struct swiglu_qs8_params params, float* output);
@@ -0,0 +1,91 @@
+/**
+ * @file swiglu_rope.cpp
+ * @brief cos/sin table construction and rotation of heads
+ */
+#include "swiglu_rope.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <new>
+#include <vector>
+
+struct swiglu_rope_table {
+  size_t max_len;
+  size_t head_dim;
+  // [max_len, head_dim / 2] each
+  std::vector<float> cos;
+  std::vector<float> sin;
+};
+
+enum xnn_status swiglu_create_rope_table(
+  size_t max_len,
+  size_t head_dim,
+  float theta,
+  struct swiglu_rope_table** table_out)
+{
+  if (max_len == 0 || head_dim == 0 || head_dim % 2 != 0 || theta <= 0.0f) {
+    fprintf(stderr, "a RoPE table needs positions, an even head dim and a positive theta, not %zu, %zu, %g\n",
+            max_len, head_dim, theta);
+    return xnn_status_invalid_parameter;
+  }
+  struct swiglu_rope_table* table = new (std::nothrow) swiglu_rope_table();
+  if (table == NULL) {
+    fprintf(stderr, "failed to allocate RoPE table\n");
+    return xnn_status_out_of_memory;
+  }
+  const size_t half = head_dim / 2;
+  table->max_len = max_len;
+  table->head_dim = head_dim;
+  table->cos.resize(max_len * half);
+  table->sin.resize(max_len * half);
+  for (size_t i = 0; i < half; ++i) {
+    const double frequency = pow(static_cast<double>(theta), -2.0 * i / head_dim);
+    for (size_t p = 0; p < max_len; ++p) {
+      table->cos[p * half + i] = static_cast<float>(cos(p * frequency));
+      table->sin[p * half + i] = static_cast<float>(sin(p * frequency));
+    }
+  }
+
+  *table_out = table;
+  return xnn_status_success;
+}
+
+size_t swiglu_rope_max_len(const struct swiglu_rope_table* table) {
+  return table->max_len;
+}
+
+size_t swiglu_rope_head_dim(const struct swiglu_rope_table* table) {
+  return table->head_dim;
+}
+
+void swiglu_rope_rotate(const struct swiglu_rope_table* table, size_t position, const float* x, float* output) {
+  const size_t half = table->head_dim / 2;
+  const float* c = &table->cos[position * half];
+  const float* s = &table->sin[position * half];
+  for (size_t i = 0; i < half; ++i) {
+    const float x0 = x[i];
+    const float x1 = x[i + half];
+    output[i] = x0 * c[i] - x1 * s[i];
+    output[i + half] = x1 * c[i] + x0 * s[i];
+  }
+}
+
+void swiglu_apply_rope(
+  const struct swiglu_rope_table* table,
+  size_t first_position,
+  size_t num_rows,
+  size_t num_heads,
+  float* x,
+  size_t stride)
+{
+  for (size_t r = 0; r < num_rows; ++r) {
+    for (size_t h = 0; h < num_heads; ++h) {
+      float* head = x + r * stride + h * table->head_dim;
+      swiglu_rope_rotate(table, first_position + r, head, head);
+    }
+  }
+}
+
+void swiglu_delete_rope_table(struct swiglu_rope_table* table) {
+  delete table;
+}
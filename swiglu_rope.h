@@ -0,0 +1,50 @@
+/**
+ * @file swiglu_rope.h
+ * @brief Rotary position embeddings with precomputed cos/sin tables
+ *
+ * Channel i of a head, for i below head_dim / 2, is rotated together with channel
+ * i + head_dim / 2 by position * theta^(-2i / head_dim). The table holds the cos and
+ * sin of every angle up to max_len positions, computed once in double, so applying
+ * the rotation costs four multiply-adds per pair.
+ *
+ * The decoder does not rotate queries or keys in a pass of their own: attention
+ * rotates them as it loads them (swiglu_flash_attention, swiglu_kv_cache_attention).
+ * Keys in the KV cache are read by every later step, so they are rotated once, as
+ * the cache quantizes them on append.
+ * swiglu_apply_rope is the separate pass, kept to measure against.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <xnnpack.h>
+
+struct swiglu_rope_table;
+
+// head_dim must be even.
+enum xnn_status swiglu_create_rope_table(
+  size_t max_len,
+  size_t head_dim,
+  float theta,
+  struct swiglu_rope_table** table_out);
+
+size_t swiglu_rope_max_len(const struct swiglu_rope_table* table);
+
+size_t swiglu_rope_head_dim(const struct swiglu_rope_table* table);
+
+// Writes the rotation of one head at position to output, which may be x.
+void swiglu_rope_rotate(const struct swiglu_rope_table* table, size_t position, const float* x, float* output);
+
+/**
+ * @brief Rotates num_heads heads of num_rows rows in place
+ *
+ * Row r, at position first_position + r, starts at x + r * stride.
+ */
+void swiglu_apply_rope(
+  const struct swiglu_rope_table* table,
+  size_t first_position,
+  size_t num_rows,
+  size_t num_heads,
+  float* x,
+  size_t stride);
+
+void swiglu_delete_rope_table(struct swiglu_rope_table* table);
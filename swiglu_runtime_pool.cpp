@@ -0,0 +1,173 @@
+/**
+ * @file swiglu_runtime_pool.cpp
+ * @brief Stacks sharing a weights cache, checked out through a tagged Treiber stack
+ */
+#include "swiglu_runtime_pool.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <pthreadpool.h>
+
+#include "swiglu_weights_cache.h"
+
+// The free list head packs a tag in the high 32 bits and index + 1 of the top free
+// stack in the low 32 bits, 0 if none is free.
+static const uint64_t kIndexMask = UINT64_C(0xFFFFFFFF);
+
+struct swiglu_runtime_pool {
+  struct swiglu_weights_cache* weights_cache = NULL;
+  std::vector<pthreadpool_t> threadpools;
+  std::vector<struct swiglu_stack*> stacks;
+  std::atomic<uint64_t> free_head{0};
+  // next[i] is index + 1 of the free stack below stack i, 0 at the bottom.
+  std::vector<std::atomic<uint32_t>> next;
+};
+
+static void push_free(struct swiglu_runtime_pool* pool, size_t i) {
+  uint64_t head = pool->free_head.load(std::memory_order_relaxed);
+  uint64_t new_head;
+  do {
+    pool->next[i].store(static_cast<uint32_t>(head & kIndexMask), std::memory_order_relaxed);
+    new_head = ((head >> 32) + 1) << 32 | (i + 1);
+  } while (!pool->free_head.compare_exchange_weak(head, new_head, std::memory_order_release,
+                                                  std::memory_order_relaxed));
+}
+
+// Returns index + 1 of a free stack, 0 if none is free.
+static size_t pop_free(struct swiglu_runtime_pool* pool) {
+  uint64_t head = pool->free_head.load(std::memory_order_acquire);
+  for (;;) {
+    const size_t top = head & kIndexMask;
+    if (top == 0) {
+      return 0;
+    }
+    // next may be stale if another thread popped top meanwhile, but then the tag
+    // has changed and the exchange fails.
+    const uint64_t new_head = ((head >> 32) + 1) << 32 | pool->next[top - 1].load(std::memory_order_relaxed);
+    if (pool->free_head.compare_exchange_weak(head, new_head, std::memory_order_acquire,
+                                              std::memory_order_acquire)) {
+      return top;
+    }
+  }
+}
+
+enum xnn_status swiglu_create_runtime_pool(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  size_t num_runtimes,
+  size_t threads_per_runtime,
+  struct swiglu_runtime_pool** pool_out)
+{
+  if (num_runtimes == 0 || num_runtimes > kIndexMask - 1) {
+    fprintf(stderr, "a runtime pool holds 1 to %llu runtimes, not %zu\n",
+            static_cast<unsigned long long>(kIndexMask - 1), num_runtimes);
+    return xnn_status_invalid_parameter;
+  }
+  struct swiglu_runtime_pool* pool = new (std::nothrow) swiglu_runtime_pool();
+  if (pool == NULL) {
+    fprintf(stderr, "failed to allocate runtime pool\n");
+    return xnn_status_out_of_memory;
+  }
+  pool->threadpools.assign(num_runtimes, NULL);
+  pool->stacks.assign(num_runtimes, NULL);
+  pool->next = std::vector<std::atomic<uint32_t>>(num_runtimes);
+
+  enum xnn_status status = swiglu_create_weights_cache(&pool->weights_cache);
+  if (status != xnn_status_success) {
+    swiglu_delete_runtime_pool(pool);
+    return status;
+  }
+  if (threads_per_runtime > 1) {
+    for (pthreadpool_t& threadpool : pool->threadpools) {
+      threadpool = pthreadpool_create(threads_per_runtime);
+      if (threadpool == NULL) {
+        fprintf(stderr, "pthreadpool_create failed\n");
+        swiglu_delete_runtime_pool(pool);
+        return xnn_status_out_of_memory;
+      }
+    }
+  }
+  // Pack once; every stack then finds its weights in the cache.
+  status = swiglu_pack_layers(num_layers, layers, pool->threadpools[0], pool->weights_cache);
+  if (status != xnn_status_success) {
+    swiglu_delete_runtime_pool(pool);
+    return status;
+  }
+  for (size_t i = 0; i < num_runtimes; ++i) {
+    status = swiglu_create_stack_with_weights_cache(
+      num_layers, layers, swiglu_weights_cache_provider(pool->weights_cache), pool->threadpools[i], &pool->stacks[i]);
+    if (status != xnn_status_success) {
+      swiglu_delete_runtime_pool(pool);
+      return status;
+    }
+  }
+  for (size_t i = num_runtimes; i-- > 0;) {
+    push_free(pool, i);
+  }
+
+  *pool_out = pool;
+  return xnn_status_success;
+}
+
+struct swiglu_stack* swiglu_runtime_pool_try_acquire(struct swiglu_runtime_pool* pool) {
+  const size_t top = pop_free(pool);
+  return top != 0 ? pool->stacks[top - 1] : NULL;
+}
+
+struct swiglu_stack* swiglu_runtime_pool_acquire(struct swiglu_runtime_pool* pool) {
+  for (;;) {
+    struct swiglu_stack* stack = swiglu_runtime_pool_try_acquire(pool);
+    if (stack != NULL) {
+      return stack;
+    }
+    std::this_thread::yield();
+  }
+}
+
+void swiglu_runtime_pool_release(struct swiglu_runtime_pool* pool, struct swiglu_stack* stack) {
+  for (size_t i = 0; i < pool->stacks.size(); ++i) {
+    if (pool->stacks[i] == stack) {
+      push_free(pool, i);
+      return;
+    }
+  }
+  fprintf(stderr, "released a stack that does not belong to the runtime pool\n");
+}
+
+enum xnn_status swiglu_runtime_pool_run(
+  struct swiglu_runtime_pool* pool,
+  size_t batch_size,
+  const float* input,
+  float* output)
+{
+  struct swiglu_stack* stack = swiglu_runtime_pool_acquire(pool);
+  const enum xnn_status status = swiglu_run_stack(stack, batch_size, input, output);
+  swiglu_runtime_pool_release(pool, stack);
+  return status;
+}
+
+size_t swiglu_runtime_pool_packed_size(struct swiglu_runtime_pool* pool) {
+  return swiglu_weights_cache_size(pool->weights_cache);
+}
+
+void swiglu_delete_runtime_pool(struct swiglu_runtime_pool* pool) {
+  for (struct swiglu_stack* stack : pool->stacks) {
+    if (stack != NULL) {
+      swiglu_delete_stack(stack);
+    }
+  }
+  for (pthreadpool_t threadpool : pool->threadpools) {
+    if (threadpool != NULL) {
+      pthreadpool_destroy(threadpool);
+    }
+  }
+  if (pool->weights_cache != NULL) {
+    swiglu_delete_weights_cache(pool->weights_cache);
+  }
+  delete pool;
+}
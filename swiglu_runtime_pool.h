@@ -0,0 +1,58 @@
+/**
+ * @file swiglu_runtime_pool.h
+ * @brief A pool of stacks over one set of packed weights for concurrent callers
+ *
+ * A runtime is not reentrant, so a single stack runs one caller's batch at a time.
+ * The pool holds several stacks of the same layers. They share one weights cache,
+ * so the weights are packed and held in memory once, and each has its own workspace
+ * and thread pool, so stacks checked out by different threads run in parallel.
+ *
+ * Free stacks are kept on a lock-free stack (a Treiber stack) of indices. The head
+ * carries a tag that every update increments, so a pop cannot succeed with a stale
+ * next index after the head has been popped and pushed back in between (the ABA
+ * problem).
+ */
+#pragma once
+
+#include <stddef.h>
+#include <xnnpack.h>
+
+#include "swiglu_layer.h"
+#include "swiglu_stack.h"
+
+struct swiglu_runtime_pool;
+
+/**
+ * @brief Packs the layers once and creates num_runtimes stacks over them
+ *
+ * Each stack gets a thread pool of threads_per_runtime threads, or runs on the
+ * calling thread alone if it is 1. The weights must outlive the pool.
+ */
+enum xnn_status swiglu_create_runtime_pool(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  size_t num_runtimes,
+  size_t threads_per_runtime,
+  struct swiglu_runtime_pool** pool_out);
+
+// Checks out a free stack, or returns NULL if all are in use.
+struct swiglu_stack* swiglu_runtime_pool_try_acquire(struct swiglu_runtime_pool* pool);
+
+// Checks out a free stack, yielding until one is released.
+struct swiglu_stack* swiglu_runtime_pool_acquire(struct swiglu_runtime_pool* pool);
+
+// Returns a stack checked out of pool.
+void swiglu_runtime_pool_release(struct swiglu_runtime_pool* pool, struct swiglu_stack* stack);
+
+// Checks out a stack, runs batch_size rows through it and returns it.
+enum xnn_status swiglu_runtime_pool_run(
+  struct swiglu_runtime_pool* pool,
+  size_t batch_size,
+  const float* input,
+  float* output);
+
+// Bytes of packed weights, shared by every stack of the pool.
+size_t swiglu_runtime_pool_packed_size(struct swiglu_runtime_pool* pool);
+
+// Every stack must have been released.
+void swiglu_delete_runtime_pool(struct swiglu_runtime_pool* pool);
@@ -0,0 +1,345 @@
+/**
+ * @file swiglu_scheduler.cpp
+ * @brief Dispatchers that each run one layer at a time of the most urgent job of their slice
+ *
+ * Only a slice's dispatcher thread runs its classes' layers, so the stacks of a slice
+ * never run concurrently and can share its thread pool.
+ */
+#include "swiglu_scheduler.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include <pthreadpool.h>
+
+#include "swiglu_stack.h"
+#include "swiglu_weights_cache.h"
+
+typedef std::chrono::steady_clock::time_point time_point;
+
+struct scheduled_job {
+  size_t batch_size;
+  const float* input;
+  float* output;
+  swiglu_job_done_fn done;
+  void* context;
+  time_point deadline;
+  // Submission order, to keep jobs with equal deadlines first come, first served
+  uint64_t sequence;
+  // Next layer to run, non-zero once the job has started
+  size_t next_layer;
+};
+
+struct later_deadline {
+  bool operator()(const scheduled_job& a, const scheduled_job& b) const {
+    return a.deadline != b.deadline ? a.deadline > b.deadline : a.sequence > b.sequence;
+  }
+};
+
+struct scheduler_class {
+  struct swiglu_scheduler_class_config config;
+  // Index of the class's slice in swiglu_scheduler::slices
+  size_t slice = 0;
+  struct swiglu_stack* stack = NULL;
+  std::priority_queue<scheduled_job, std::vector<scheduled_job>, later_deadline> queued;
+  // The job between layers, owned by the dispatcher; valid if running is set
+  scheduled_job current;
+  bool running = false;
+  // Ping-pong activations of the current job
+  std::vector<float> activations[2];
+  struct swiglu_scheduler_class_stats stats = {};
+};
+
+// Classes first_class to end_class, in priority order, and the threads they share
+struct scheduler_slice {
+  size_t first_class;
+  size_t end_class;
+  pthreadpool_t threadpool = NULL;
+  // Guards the queues, running jobs and stats of the slice's classes
+  std::mutex mutex;
+  std::condition_variable work_cv;
+  bool stop = false;
+  std::thread dispatcher;
+};
+
+struct swiglu_scheduler {
+  struct swiglu_weights_cache* weights_cache = NULL;
+  std::vector<scheduler_class> classes;
+  std::vector<scheduler_slice> slices;
+  size_t max_dim = 0;
+  std::atomic<uint64_t> next_sequence{0};
+};
+
+static bool has_work(const scheduler_class& cls) {
+  return cls.running || !cls.queued.empty();
+}
+
+static bool overdue(const scheduler_class& cls, time_point now) {
+  return cls.running ? cls.current.deadline < now : !cls.queued.empty() && cls.queued.top().deadline < now;
+}
+
+// Class of the slice to run the next layer of, or end_class if there is no work. The
+// most urgent class with work wins, except that right after one of its layers, a less
+// urgent class whose job is past its deadline gets a layer, so a saturated urgent
+// class slows other classes down instead of starving them.
+static size_t pick_class(const struct swiglu_scheduler* scheduler, const scheduler_slice& slice, size_t previous) {
+  size_t c = slice.first_class;
+  while (c < slice.end_class && !has_work(scheduler->classes[c])) {
+    ++c;
+  }
+  if (c == slice.end_class || previous != c) {
+    return c;
+  }
+  const time_point now = std::chrono::steady_clock::now();
+  for (size_t other = c + 1; other < slice.end_class; ++other) {
+    if (has_work(scheduler->classes[other]) && overdue(scheduler->classes[other], now)) {
+      return other;
+    }
+  }
+  return c;
+}
+
+static enum xnn_status run_layer(struct swiglu_scheduler* scheduler, scheduler_class& cls, size_t i) {
+  scheduled_job& job = cls.current;
+  if (i == 0) {
+    for (std::vector<float>& activations : cls.activations) {
+      if (activations.size() < job.batch_size * scheduler->max_dim) {
+        activations.resize(job.batch_size * scheduler->max_dim);
+      }
+    }
+  }
+  const size_t num_layers = swiglu_stack_num_layers(cls.stack);
+  const float* input = i == 0 ? job.input : cls.activations[(i - 1) % 2].data();
+  float* output = i + 1 == num_layers ? job.output : cls.activations[i % 2].data();
+  return swiglu_run_stack_layer(cls.stack, i, job.batch_size, input, output);
+}
+
+static void dispatch(struct swiglu_scheduler* scheduler, scheduler_slice* slice) {
+  std::unique_lock<std::mutex> lock(slice->mutex);
+  size_t previous = slice->end_class;
+  for (;;) {
+    slice->work_cv.wait(lock, [scheduler, slice, previous] {
+      return slice->stop || pick_class(scheduler, *slice, previous) != slice->end_class;
+    });
+    if (slice->stop) {
+      return;
+    }
+    const size_t c = pick_class(scheduler, *slice, previous);
+    scheduler_class& cls = scheduler->classes[c];
+    if (previous < slice->end_class && previous != c && scheduler->classes[previous].running) {
+      scheduler->classes[previous].stats.preemptions++;
+    }
+    previous = c;
+    if (!cls.running) {
+      cls.current = cls.queued.top();
+      cls.queued.pop();
+      cls.running = true;
+    }
+
+    // Other threads only touch the queues, so the layer runs unlocked.
+    const size_t i = cls.current.next_layer;
+    lock.unlock();
+    const enum xnn_status status = run_layer(scheduler, cls, i);
+    lock.lock();
+
+    cls.current.next_layer = i + 1;
+    if (status != xnn_status_success || cls.current.next_layer == swiglu_stack_num_layers(cls.stack)) {
+      cls.running = false;
+      if (status != xnn_status_success) {
+        cls.stats.failed++;
+      } else {
+        cls.stats.completed++;
+        if (std::chrono::steady_clock::now() > cls.current.deadline) {
+          cls.stats.deadline_misses++;
+        }
+      }
+      const scheduled_job job = cls.current;
+      lock.unlock();
+      job.done(job.context, status);
+      lock.lock();
+    }
+  }
+}
+
+enum xnn_status swiglu_create_scheduler(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  size_t num_classes,
+  const struct swiglu_scheduler_class_config* classes,
+  struct swiglu_scheduler** scheduler_out)
+{
+  if (num_classes == 0 || classes[0].num_threads == 0) {
+    fprintf(stderr, "a scheduler needs at least one class, and the first class needs threads of its own\n");
+    return xnn_status_invalid_parameter;
+  }
+  struct swiglu_scheduler* scheduler = new (std::nothrow) swiglu_scheduler();
+  if (scheduler == NULL) {
+    fprintf(stderr, "failed to allocate scheduler\n");
+    return xnn_status_out_of_memory;
+  }
+  scheduler->classes.resize(num_classes);
+  for (size_t i = 0; i < num_layers; ++i) {
+    scheduler->max_dim = std::max(scheduler->max_dim, layers[i].output_dim);
+  }
+  size_t num_slices = 0;
+  for (size_t c = 0; c < num_classes; ++c) {
+    scheduler->classes[c].config = classes[c];
+    num_slices += classes[c].num_threads != 0;
+    scheduler->classes[c].slice = num_slices - 1;
+  }
+  scheduler->slices = std::vector<scheduler_slice>(num_slices);
+  pthreadpool_t widest = NULL;
+  for (size_t c = 0; c < num_classes; ++c) {
+    scheduler_slice& slice = scheduler->slices[scheduler->classes[c].slice];
+    if (classes[c].num_threads == 0) {
+      slice.end_class = c + 1;
+      continue;
+    }
+    slice.first_class = c;
+    slice.end_class = c + 1;
+    if (classes[c].num_threads > 1) {
+      slice.threadpool = pthreadpool_create(classes[c].num_threads);
+      if (slice.threadpool == NULL) {
+        fprintf(stderr, "failed to create a thread pool of %zu threads for class %s\n", classes[c].num_threads,
+                classes[c].name);
+        swiglu_delete_scheduler(scheduler);
+        return xnn_status_out_of_memory;
+      }
+      if (pthreadpool_get_threads_count(slice.threadpool) > pthreadpool_get_threads_count(widest)) {
+        widest = slice.threadpool;
+      }
+    }
+  }
+
+  enum xnn_status status = swiglu_create_weights_cache(&scheduler->weights_cache);
+  if (status != xnn_status_success) {
+    swiglu_delete_scheduler(scheduler);
+    return status;
+  }
+  // Pack once, on the widest slice; every class then finds its weights in the cache.
+  status = swiglu_pack_layers(num_layers, layers, widest, scheduler->weights_cache);
+  if (status != xnn_status_success) {
+    swiglu_delete_scheduler(scheduler);
+    return status;
+  }
+  for (scheduler_class& cls : scheduler->classes) {
+    status = swiglu_create_stack_with_weights_cache(
+      num_layers, layers, swiglu_weights_cache_provider(scheduler->weights_cache),
+      scheduler->slices[cls.slice].threadpool, &cls.stack);
+    if (status != xnn_status_success) {
+      swiglu_delete_scheduler(scheduler);
+      return status;
+    }
+  }
+
+  for (scheduler_slice& slice : scheduler->slices) {
+    slice.dispatcher = std::thread(dispatch, scheduler, &slice);
+  }
+  *scheduler_out = scheduler;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_scheduler_submit(
+  struct swiglu_scheduler* scheduler,
+  size_t class_index,
+  size_t batch_size,
+  const float* input,
+  float* output,
+  swiglu_job_done_fn done,
+  void* context)
+{
+  if (class_index >= scheduler->classes.size() || batch_size == 0) {
+    fprintf(stderr, "invalid job: class %zu of %zu, batch size %zu\n",
+            class_index, scheduler->classes.size(), batch_size);
+    return xnn_status_invalid_parameter;
+  }
+  scheduler_class& cls = scheduler->classes[class_index];
+  scheduler_slice& slice = scheduler->slices[cls.slice];
+  const auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double, std::milli>(cls.config.deadline_ms));
+  {
+    std::lock_guard<std::mutex> lock(slice.mutex);
+    cls.queued.push({batch_size, input, output, done, context, deadline, scheduler->next_sequence++, 0});
+  }
+  slice.work_cv.notify_one();
+  return xnn_status_success;
+}
+
+struct job_waiter {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  enum xnn_status status = xnn_status_success;
+};
+
+static void wake_waiter(void* context, enum xnn_status status) {
+  struct job_waiter* waiter = static_cast<struct job_waiter*>(context);
+  std::lock_guard<std::mutex> lock(waiter->mutex);
+  waiter->status = status;
+  waiter->done = true;
+  waiter->cv.notify_one();
+}
+
+enum xnn_status swiglu_scheduler_run(
+  struct swiglu_scheduler* scheduler,
+  size_t class_index,
+  size_t batch_size,
+  const float* input,
+  float* output)
+{
+  struct job_waiter waiter;
+  enum xnn_status status =
+    swiglu_scheduler_submit(scheduler, class_index, batch_size, input, output, wake_waiter, &waiter);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  std::unique_lock<std::mutex> lock(waiter.mutex);
+  waiter.cv.wait(lock, [&waiter] { return waiter.done; });
+  return waiter.status;
+}
+
+struct swiglu_scheduler_class_stats swiglu_scheduler_stats(struct swiglu_scheduler* scheduler, size_t class_index) {
+  const scheduler_class& cls = scheduler->classes[class_index];
+  std::lock_guard<std::mutex> lock(scheduler->slices[cls.slice].mutex);
+  return cls.stats;
+}
+
+void swiglu_delete_scheduler(struct swiglu_scheduler* scheduler) {
+  for (scheduler_slice& slice : scheduler->slices) {
+    if (slice.dispatcher.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(slice.mutex);
+        slice.stop = true;
+      }
+      slice.work_cv.notify_one();
+      slice.dispatcher.join();
+    }
+  }
+  for (scheduler_class& cls : scheduler->classes) {
+    if (cls.running) {
+      cls.current.done(cls.current.context, xnn_status_invalid_state);
+    }
+    for (; !cls.queued.empty(); cls.queued.pop()) {
+      cls.queued.top().done(cls.queued.top().context, xnn_status_invalid_state);
+    }
+    if (cls.stack != NULL) {
+      swiglu_delete_stack(cls.stack);
+    }
+  }
+  for (scheduler_slice& slice : scheduler->slices) {
+    if (slice.threadpool != NULL) {
+      pthreadpool_destroy(slice.threadpool);
+    }
+  }
+  swiglu_delete_weights_cache(scheduler->weights_cache);
+  delete scheduler;
+}
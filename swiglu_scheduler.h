@@ -0,0 +1,94 @@
+/**
+ * @file swiglu_scheduler.h
+ * @brief Priority classes with deadlines and layer-boundary preemption
+ *
+ * The scheduler runs jobs from several priority classes, given in priority order,
+ * most urgent first. The threads are split into slices: a class with a thread count
+ * gets a slice of that many threads with its own pool and dispatcher thread, and a
+ * class with none joins the slice of the class before it. Slices run concurrently,
+ * so an interactive class on its own slice keeps its cores while a bulk class runs
+ * on another.
+ *
+ * Within a slice, one layer of one job runs at a time. Before every layer, the
+ * dispatcher picks the most urgent class of the slice with work, so a batch-1 job
+ * waits at most one layer of a large job of a less urgent class on its slice, never
+ * the whole job. Within a class, jobs run earliest deadline first. So that a
+ * saturated urgent class cannot starve the others of its slice, a job past its
+ * deadline gets every other layer.
+ *
+ * Every class has its own stack, so a preempted job keeps its reshaped runtimes and
+ * in-flight activations while another class runs. All stacks share one weights
+ * cache, so weights are packed once.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <xnnpack.h>
+
+#include "swiglu_layer.h"
+
+struct swiglu_scheduler_class_config {
+  const char* name;
+  // Jobs not done within this many milliseconds of submission count as misses.
+  double deadline_ms;
+  // Threads of the class's slice; 1 runs on its dispatcher thread alone. 0 shares the
+  // slice of the class before it, which the first class cannot do.
+  size_t num_threads;
+};
+
+struct swiglu_scheduler_class_stats {
+  // Jobs whose every layer ran
+  size_t completed;
+  // Jobs ended by a failed layer, which count toward neither completed nor misses
+  size_t failed;
+  size_t deadline_misses;
+  // Times a job of the class was suspended between layers to run another class of
+  // its slice
+  size_t preemptions;
+};
+
+// Called on the dispatcher thread of the job's slice when the job finishes.
+typedef void (*swiglu_job_done_fn)(void* context, enum xnn_status status);
+
+struct swiglu_scheduler;
+
+/**
+ * @brief Packs the layers once and creates one stack per class and one thread pool
+ * and dispatcher per slice
+ *
+ * The weights must outlive the scheduler.
+ */
+enum xnn_status swiglu_create_scheduler(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  size_t num_classes,
+  const struct swiglu_scheduler_class_config* classes,
+  struct swiglu_scheduler** scheduler_out);
+
+/**
+ * @brief Queues a job of batch_size rows in class class_index
+ *
+ * input and output must stay valid until done is called.
+ */
+enum xnn_status swiglu_scheduler_submit(
+  struct swiglu_scheduler* scheduler,
+  size_t class_index,
+  size_t batch_size,
+  const float* input,
+  float* output,
+  swiglu_job_done_fn done,
+  void* context);
+
+// Submits a job and waits for it.
+enum xnn_status swiglu_scheduler_run(
+  struct swiglu_scheduler* scheduler,
+  size_t class_index,
+  size_t batch_size,
+  const float* input,
+  float* output);
+
+struct swiglu_scheduler_class_stats swiglu_scheduler_stats(struct swiglu_scheduler* scheduler, size_t class_index);
+
+// Stops the dispatchers. Jobs still queued complete with xnn_status_invalid_state.
+void swiglu_delete_scheduler(struct swiglu_scheduler* scheduler);
@@ -0,0 +1,293 @@
+/**
+ * @file swiglu_silu.cpp
+ * @brief Sigmoid approximations and gated stacks whose gating pass uses them
+ */
+#include "swiglu_silu.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "swiglu_gated.h"
+
+// Samples of the linear approximation over [0, kLinearRange).
+static const int kLinearSegments = 256;
+static const float kLinearRange = 16.0f;
+
+// |x| where tanh's degree 13 / degree 6 rational stops being accurate; tanh rounds to 1 beyond it.
+static const float kRationalLimit = 7.90531110763549805f;
+// Where the [5/4] Pade approximant of tanh reaches 1.
+static const float kPadeLimit = 3.64673859f;
+
+// Sigmoid minus 0.5 at the start of each segment, and its rise over the segment,
+// for |x| = i * kLinearRange / kLinearSegments. The last entry is the flat tail
+// past kLinearRange.
+struct linear_table {
+  float value[kLinearSegments + 1];
+  float rise[kLinearSegments + 1];
+};
+
+static const struct linear_table& get_linear_table() {
+  static const struct linear_table table = [] {
+    struct linear_table t;
+    const double step = static_cast<double>(kLinearRange) / kLinearSegments;
+    for (int i = 0; i <= kLinearSegments; ++i) {
+      const double start = 1.0 / (1.0 + exp(-i * step)) - 0.5;
+      // The last segment ends at exactly 0.5, so sigmoid is continuous into the tail.
+      const double end = i + 1 >= kLinearSegments ? 0.5 : 1.0 / (1.0 + exp(-(i + 1) * step)) - 0.5;
+      t.value[i] = i == kLinearSegments ? 0.5f : static_cast<float>(start);
+      t.rise[i] = i == kLinearSegments ? 0.0f : static_cast<float>(end - start);
+    }
+    return t;
+  }();
+  return table;
+}
+
+// min(|x|, limit) for a positive finite limit, as integer compares of the bit
+// patterns, which the compiler vectorizes where a float compare and branch would not
+// be. NaN clamps to limit.
+static inline float clamp_magnitude(float x, float limit) {
+  uint32_t x_bits, limit_bits;
+  memcpy(&x_bits, &x, sizeof(x_bits));
+  memcpy(&limit_bits, &limit, sizeof(limit_bits));
+  x_bits &= 0x7FFFFFFF;
+  const uint32_t below_mask = static_cast<uint32_t>(static_cast<int32_t>(x_bits - limit_bits) >> 31);
+  const uint32_t bits = (x_bits & below_mask) | (limit_bits & ~below_mask);
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+// 0.5 + offset for non-negative x and 0.5 - offset for negative x, given a non-negative offset.
+static inline float from_offset(float offset, float x) {
+  uint32_t offset_bits, x_bits;
+  memcpy(&offset_bits, &offset, sizeof(offset_bits));
+  memcpy(&x_bits, &x, sizeof(x_bits));
+  offset_bits |= x_bits & 0x80000000;
+  float signed_offset;
+  memcpy(&signed_offset, &offset_bits, sizeof(signed_offset));
+  return 0.5f + signed_offset;
+}
+
+template <enum swiglu_silu_approx Approx>
+static inline float sigmoid(float x, const struct linear_table& table) {
+  switch (Approx) {
+    case swiglu_silu_exact:
+      return 1.0f / (1.0f + expf(-x));
+    case swiglu_silu_rational: {
+      const float y = clamp_magnitude(0.5f * x, kRationalLimit);
+      const float y2 = y * y;
+      float p = -2.76076847742355e-16f;
+      p = p * y2 + 2.00018790482477e-13f;
+      p = p * y2 - 8.60467152213735e-11f;
+      p = p * y2 + 5.12229709037114e-08f;
+      p = p * y2 + 1.48572235717979e-05f;
+      p = p * y2 + 6.37261928875436e-04f;
+      p = p * y2 + 4.89352455891786e-03f;
+      float q = 1.19825839466702e-06f;
+      q = q * y2 + 1.18534705686654e-04f;
+      q = q * y2 + 2.26843463243900e-03f;
+      q = q * y2 + 4.89352518554385e-03f;
+      return from_offset(0.5f * (p * y / q), x);
+    }
+    case swiglu_silu_linear: {
+      const float position = clamp_magnitude(x, kLinearRange) * (kLinearSegments / kLinearRange);
+      const int32_t i = static_cast<int32_t>(position);
+      return from_offset(table.value[i] + table.rise[i] * (position - static_cast<float>(i)), x);
+    }
+    case swiglu_silu_tanh: {
+      const float y = clamp_magnitude(0.5f * x, kPadeLimit);
+      const float y2 = y * y;
+      return from_offset(0.5f * (y * (945.0f + y2 * (105.0f + y2)) / (945.0f + y2 * (420.0f + 15.0f * y2))), x);
+    }
+  }
+  return 0.0f;
+}
+
+// Blocks of eight results go through a local array, so the compiler vectorizes the
+// block without having to prove that output does not alias gate or up.
+template <enum swiglu_silu_approx Approx>
+static void silu_gate(size_t count, const float* gate, const float* up, float* output) {
+  const struct linear_table& table = get_linear_table();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    float block[8];
+    for (size_t k = 0; k < 8; ++k) {
+      block[k] = gate[i + k] * sigmoid<Approx>(gate[i + k], table) * up[i + k];
+    }
+    for (size_t k = 0; k < 8; ++k) {
+      output[i + k] = block[k];
+    }
+  }
+  for (; i < count; ++i) {
+    output[i] = gate[i] * sigmoid<Approx>(gate[i], table) * up[i];
+  }
+}
+
+const char* swiglu_silu_approx_name(enum swiglu_silu_approx approx) {
+  switch (approx) {
+    case swiglu_silu_exact:
+      return "exact";
+    case swiglu_silu_rational:
+      return "rational";
+    case swiglu_silu_linear:
+      return "linear";
+    case swiglu_silu_tanh:
+      return "tanh";
+  }
+  return "unknown";
+}
+
+float swiglu_sigmoid(enum swiglu_silu_approx approx, float x) {
+  const struct linear_table& table = get_linear_table();
+  switch (approx) {
+    case swiglu_silu_exact:
+      return sigmoid<swiglu_silu_exact>(x, table);
+    case swiglu_silu_rational:
+      return sigmoid<swiglu_silu_rational>(x, table);
+    case swiglu_silu_linear:
+      return sigmoid<swiglu_silu_linear>(x, table);
+    case swiglu_silu_tanh:
+      return sigmoid<swiglu_silu_tanh>(x, table);
+  }
+  return 0.0f;
+}
+
+void swiglu_silu_gate(
+  enum swiglu_silu_approx approx,
+  size_t count,
+  const float* gate,
+  const float* up,
+  float* output)
+{
+  switch (approx) {
+    case swiglu_silu_exact:
+      silu_gate<swiglu_silu_exact>(count, gate, up, output);
+      break;
+    case swiglu_silu_rational:
+      silu_gate<swiglu_silu_rational>(count, gate, up, output);
+      break;
+    case swiglu_silu_linear:
+      silu_gate<swiglu_silu_linear>(count, gate, up, output);
+      break;
+    case swiglu_silu_tanh:
+      silu_gate<swiglu_silu_tanh>(count, gate, up, output);
+      break;
+  }
+}
+
+void swiglu_silu_max_error(
+  enum swiglu_silu_approx approx,
+  float* sigmoid_error,
+  float* silu_error)
+{
+  const size_t kPoints = (1 << 20) + 1;
+  const double kLimit = 32.0;
+  std::vector<float> x(kPoints);
+  for (size_t i = 0; i < kPoints; ++i) {
+    x[i] = static_cast<float>(-kLimit + 2.0 * kLimit * static_cast<double>(i) / (kPoints - 1));
+  }
+  // SiLU as the gating pass computes it, with an up projection of 1.
+  const std::vector<float> ones(kPoints, 1.0f);
+  std::vector<float> silu(kPoints);
+  swiglu_silu_gate(approx, kPoints, x.data(), ones.data(), silu.data());
+
+  double max_sigmoid_error = 0.0;
+  double max_silu_error = 0.0;
+  for (size_t i = 0; i < kPoints; ++i) {
+    const double reference = 1.0 / (1.0 + exp(-static_cast<double>(x[i])));
+    max_sigmoid_error = std::max(max_sigmoid_error, fabs(swiglu_sigmoid(approx, x[i]) - reference));
+    max_silu_error = std::max(max_silu_error, fabs(silu[i] - x[i] * reference));
+  }
+  *sigmoid_error = static_cast<float>(max_sigmoid_error);
+  *silu_error = static_cast<float>(max_silu_error);
+}
+
+struct swiglu_silu_stack {
+  std::vector<struct swiglu_layer_weights> weights;
+  std::vector<enum swiglu_silu_approx> approx;
+  struct swiglu_gated_stack* gated = NULL;
+};
+
+static enum xnn_status define_gate_up(void* context, size_t i, xnn_subgraph_t* subgraph_out) {
+  const struct swiglu_layer_weights& weights = static_cast<const struct swiglu_silu_stack*>(context)->weights[i];
+  return swiglu_define_gate_up(&weights, subgraph_out);
+}
+
+static enum xnn_status define_down(void* context, size_t i, xnn_subgraph_t* subgraph_out) {
+  const struct swiglu_layer_weights& weights = static_cast<const struct swiglu_silu_stack*>(context)->weights[i];
+  return swiglu_define_projection(weights.output_dim, weights.inter_dim, &weights.w2, subgraph_out);
+}
+
+static void gate_silu(void* context, size_t i, size_t count, const void* gate, const void* up, void* intermediate) {
+  swiglu_silu_gate(static_cast<const struct swiglu_silu_stack*>(context)->approx[i], count,
+                   static_cast<const float*>(gate), static_cast<const float*>(up), static_cast<float*>(intermediate));
+}
+
+static bool valid_approx(enum swiglu_silu_approx approx) {
+  return approx >= swiglu_silu_exact && approx < SWIGLU_NUM_SILU_APPROXES;
+}
+
+enum xnn_status swiglu_create_silu_stack(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  enum swiglu_silu_approx approx,
+  pthreadpool_t threadpool,
+  struct swiglu_silu_stack** stack_out)
+{
+  if (!valid_approx(approx)) {
+    fprintf(stderr, "unknown sigmoid approximation %d\n", approx);
+    return xnn_status_invalid_parameter;
+  }
+
+  struct swiglu_silu_stack* stack = new (std::nothrow) swiglu_silu_stack();
+  if (stack == NULL) {
+    fprintf(stderr, "failed to allocate SiLU stack\n");
+    return xnn_status_out_of_memory;
+  }
+  stack->weights.assign(layers, layers + num_layers);
+  stack->approx.assign(num_layers, approx);
+  enum xnn_status status = swiglu_create_gated_stack(
+    num_layers, layers, /*element_size=*/sizeof(float), define_gate_up, define_down, gate_silu,
+    /*context=*/stack, threadpool, &stack->gated);
+  if (status != xnn_status_success) {
+    swiglu_delete_silu_stack(stack);
+    return status;
+  }
+
+  *stack_out = stack;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_set_silu_approx(
+  struct swiglu_silu_stack* stack,
+  size_t i,
+  enum swiglu_silu_approx approx)
+{
+  if (i >= stack->approx.size() || !valid_approx(approx)) {
+    fprintf(stderr, "cannot set layer %zu of %zu to sigmoid approximation %d\n", i, stack->approx.size(), approx);
+    return xnn_status_invalid_parameter;
+  }
+  stack->approx[i] = approx;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_run_silu_stack(
+  struct swiglu_silu_stack* stack,
+  size_t batch_size,
+  const float* input,
+  float* output)
+{
+  return swiglu_run_gated_stack(stack->gated, batch_size, input, output);
+}
+
+void swiglu_delete_silu_stack(struct swiglu_silu_stack* stack) {
+  if (stack->gated != NULL) {
+    swiglu_delete_gated_stack(stack->gated);
+  }
+  delete stack;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file swiglu_silu.h
+ * @brief SwiGLU stacks with a selectable sigmoid approximation per layer
+ *
+ * XNNPACK's sigmoid is accurate to about an ulp, and SiLU and the gating multiply
+ * add two more passes over the [batch, inter_dim] intermediate; for large prefill
+ * batches that elementwise phase is a visible share of a layer. These stacks run each
+ * layer as a gate/up runtime, one fused SiLU and gating pass, and a down runtime, on
+ * the same gated stack (swiglu_gated.h) as the static int8 stacks, and the sigmoid in
+ * that pass is one of the approximations below. Every approximation but the exact one is branch-free so the
+ * compiler vectorizes the pass, and each works on |x| and takes the sign of x, so
+ * sigmoid(-x) = 1 - sigmoid(x) holds exactly.
+ *
+ * swiglu_silu_max_error measures how far each one is from the exact function, so a
+ * tier can be picked against an error budget rather than by name.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_layer.h"
+
+// Sigmoid approximations, from most to least accurate.
+enum swiglu_silu_approx {
+  // 1 / (1 + expf(-x)), calling libm for every element, so the pass is not vectorized
+  swiglu_silu_exact = 0,
+  // 0.5 + 0.5 * tanh(x / 2), with tanh as a degree 13 over degree 6 rational minimax
+  // approximation; within a few ulps of exact
+  swiglu_silu_rational = 1,
+  // Linear interpolation between 256 samples of sigmoid over |x| < 16
+  swiglu_silu_linear = 2,
+  // 0.5 + 0.5 * tanh(x / 2), with tanh as its [5/4] Pade approximant, clamped where
+  // that reaches 1; the fewest operations
+  swiglu_silu_tanh = 3,
+};
+
+#define SWIGLU_NUM_SILU_APPROXES 4
+
+// "exact", "rational", "linear" or "tanh".
+const char* swiglu_silu_approx_name(enum swiglu_silu_approx approx);
+
+float swiglu_sigmoid(enum swiglu_silu_approx approx, float x);
+
+// output[i] = SiLU(gate[i]) * up[i] for count elements, with sigmoid from approx.
+void swiglu_silu_gate(
+  enum swiglu_silu_approx approx,
+  size_t count,
+  const float* gate,
+  const float* up,
+  float* output);
+
+/**
+ * @brief Measures the largest absolute errors of sigmoid and SiLU under approx
+ *
+ * Compares against a double-precision reference at 2^20 + 1 evenly spaced points in
+ * [-32, 32], which covers the gate values of trained models. SiLU scales the sigmoid
+ * error by |x|, so its error is the one that reaches the layer output.
+ */
+void swiglu_silu_max_error(
+  enum swiglu_silu_approx approx,
+  float* sigmoid_error,
+  float* silu_error);
+
+struct swiglu_silu_stack;
+
+/**
+ * @brief Creates a stack of num_layers SwiGLU layers whose SiLU uses approx
+ *
+ * layers[i].output_dim must equal layers[i + 1].input_dim. The weights are not
+ * copied and must outlive the stack. threadpool may be NULL.
+ */
+enum xnn_status swiglu_create_silu_stack(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  enum swiglu_silu_approx approx,
+  pthreadpool_t threadpool,
+  struct swiglu_silu_stack** stack_out);
+
+// Switches layer i to approx. Takes effect on the next run and repacks nothing.
+enum xnn_status swiglu_set_silu_approx(
+  struct swiglu_silu_stack* stack,
+  size_t i,
+  enum swiglu_silu_approx approx);
+
+/**
+ * @brief Runs batch_size rows through every layer
+ *
+ * input is [batch_size, layers[0].input_dim] and must be readable XNN_EXTRA_BYTES
+ * past its last row; output is [batch_size, layers[num_layers - 1].output_dim].
+ */
+enum xnn_status swiglu_run_silu_stack(
+  struct swiglu_silu_stack* stack,
+  size_t batch_size,
+  const float* input,
+  float* output);
+
+void swiglu_delete_silu_stack(struct swiglu_silu_stack* stack);
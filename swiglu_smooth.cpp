@@ -0,0 +1,91 @@
+/**
+ * @file swiglu_smooth.cpp
+ * @brief SmoothQuant factors and folding them into SwiGLU weights
+ */
+#include "swiglu_smooth.h"
+
+#include <math.h>
+
+// Factors are kept within this ratio of 1 so channels that never fire stay finite.
+static const float kMaxFactor = 1.0e4f;
+
+// s_j for channels j of activations read by the [rows, dim] projections a and, if non-null, b.
+static std::vector<float> factors(
+  const float* activation_max,
+  size_t dim,
+  const float* a,
+  const float* b,
+  size_t rows,
+  float alpha)
+{
+  std::vector<float> weight_max(dim);
+  for (const float* weights : {a, b}) {
+    if (weights == NULL) {
+      continue;
+    }
+    for (size_t r = 0; r < rows; ++r) {
+      for (size_t j = 0; j < dim; ++j) {
+        weight_max[j] = fmaxf(weight_max[j], fabsf(weights[r * dim + j]));
+      }
+    }
+  }
+  std::vector<float> s(dim, 1.0f);
+  for (size_t j = 0; j < dim; ++j) {
+    if (activation_max[j] > 0.0f && weight_max[j] > 0.0f) {
+      const float factor = powf(activation_max[j], alpha) / powf(weight_max[j], 1.0f - alpha);
+      s[j] = fminf(fmaxf(factor, 1.0f / kMaxFactor), kMaxFactor);
+    }
+  }
+  return s;
+}
+
+struct swiglu_smoothing swiglu_smoothing_factors(
+  const struct swiglu_fp32_layer& layer,
+  const float* input_max,
+  const float* inter_max,
+  float alpha)
+{
+  struct swiglu_smoothing smoothing;
+  smoothing.input = factors(input_max, layer.input_dim, layer.w1.data(), layer.w3.data(), layer.inter_dim, alpha);
+  smoothing.intermediate = factors(inter_max, layer.inter_dim, layer.w2.data(), NULL, layer.output_dim, alpha);
+  return smoothing;
+}
+
+// weights[r][j] *= s[j] for a [rows, cols] matrix.
+static void scale_columns(std::vector<float>& weights, size_t rows, size_t cols, const std::vector<float>& s) {
+  for (size_t r = 0; r < rows; ++r) {
+    for (size_t j = 0; j < cols; ++j) {
+      weights[r * cols + j] *= s[j];
+    }
+  }
+}
+
+// weights[r][j] /= s[r] for a [rows, cols] matrix.
+static void divide_rows(std::vector<float>& weights, size_t rows, size_t cols, const std::vector<float>& s) {
+  for (size_t r = 0; r < rows; ++r) {
+    const float inv = 1.0f / s[r];
+    for (size_t j = 0; j < cols; ++j) {
+      weights[r * cols + j] *= inv;
+    }
+  }
+}
+
+void swiglu_smooth_layers(
+  std::vector<struct swiglu_fp32_layer>* layers,
+  const std::vector<struct swiglu_smoothing>& smoothing,
+  std::vector<float>* input_factors)
+{
+  for (size_t i = 0; i < layers->size(); ++i) {
+    struct swiglu_fp32_layer& layer = (*layers)[i];
+    const struct swiglu_smoothing& s = smoothing[i];
+    scale_columns(layer.w1, layer.inter_dim, layer.input_dim, s.input);
+    scale_columns(layer.w3, layer.inter_dim, layer.input_dim, s.input);
+    scale_columns(layer.w2, layer.output_dim, layer.inter_dim, s.intermediate);
+    divide_rows(layer.w3, layer.inter_dim, layer.input_dim, s.intermediate);
+    if (i > 0) {
+      struct swiglu_fp32_layer& previous = (*layers)[i - 1];
+      divide_rows(previous.w2, previous.output_dim, previous.inter_dim, s.input);
+    }
+  }
+  *input_factors = smoothing.front().input;
+}
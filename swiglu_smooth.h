@@ -0,0 +1,55 @@
+/**
+ * @file swiglu_smooth.h
+ * @brief SmoothQuant outlier migration from activations into the SwiGLU weights
+ *
+ * Dynamically quantized projections (swiglu_weight_qc8) share one int8 scale across
+ * each row of activations, so a few outlier channels far larger than the rest leave
+ * the other channels only a handful of levels. SmoothQuant divides input channel j
+ * by s_j = max|x_j|^alpha / max|w_j|^(1 - alpha) and multiplies column j of every
+ * projection reading it by s_j. The product is unchanged, and part of the outlier
+ * range moves into the weights, where per-channel scales absorb it.
+ *
+ * The divisions are folded offline. The gated intermediate is linear in W3 @ x, so
+ * W2's factors divide the rows of W3. A layer input is the previous layer's W2
+ * output, so W1 and W3's factors divide the rows of that W2; the first layer's
+ * are returned for the caller to fold into whatever produces the input, e.g. the
+ * weight of a preceding norm. This assumes plain stacks: decoder blocks add a
+ * residual to each output, so only the W2 factors apply there.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+#include "swiglu_weights_io.h"
+
+struct swiglu_smoothing {
+  // [input_dim], divides the layer input and multiplies the columns of W1 and W3
+  std::vector<float> input;
+  // [inter_dim], divides the gated intermediate and multiplies the columns of W2
+  std::vector<float> intermediate;
+};
+
+/**
+ * @brief Smoothing factors of one layer
+ *
+ * input_max and inter_max are the largest magnitudes per channel of the layer input
+ * and gated intermediate (see swiglu_calibrator_channel_max). alpha in [0, 1] is
+ * the share of the range moved into the weights; 0.5 splits it evenly.
+ */
+struct swiglu_smoothing swiglu_smoothing_factors(
+  const struct swiglu_fp32_layer& layer,
+  const float* input_max,
+  const float* inter_max,
+  float alpha);
+
+/**
+ * @brief Folds smoothing[i] into layers[i] and the layer before it, in place
+ *
+ * Afterwards the stack computes the same function of input / input_factors, element
+ * wise per channel, as it did of input.
+ */
+void swiglu_smooth_layers(
+  std::vector<struct swiglu_fp32_layer>* layers,
+  const std::vector<struct swiglu_smoothing>& smoothing,
+  std::vector<float>* input_factors);
@@ -0,0 +1,210 @@
+/**
+ * @file swiglu_speculative.cpp
+ * @brief Draft, verify and roll back in batches across sequences
+ */
+#include "swiglu_speculative.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include <vector>
+
+struct swiglu_speculative {
+  struct swiglu_stack* draft;
+  struct swiglu_stack* target;
+  size_t dim;
+  size_t max_sequences;
+  size_t max_len;
+  float tolerance;
+  size_t num_sequences = 0;
+  // Sequence s is rows[s * max_len, s * max_len + lengths[s]).
+  std::vector<float> rows;
+  std::vector<size_t> lengths;
+  // Draft rows in and out, [num_sequences, dim]
+  std::vector<float> draft_rows[2];
+  // Target rows in and out, [num_sequences * (k + 1), dim]
+  std::vector<float> verify_input;
+  std::vector<float> verify_output;
+  struct swiglu_speculative_stats stats = {};
+};
+
+static float* cache_row(struct swiglu_speculative* speculative, size_t s, size_t position) {
+  return speculative->rows.data() + (s * speculative->max_len + position) * speculative->dim;
+}
+
+// Accumulates in double, where the squares of small activations do not underflow.
+static bool accepted(const float* target, const float* proposal, size_t dim, float tolerance) {
+  double error = 0.0;
+  double norm = 0.0;
+  for (size_t i = 0; i < dim; ++i) {
+    const double difference = static_cast<double>(target[i]) - proposal[i];
+    error += difference * difference;
+    norm += static_cast<double>(target[i]) * target[i];
+  }
+  return sqrt(error) <= tolerance * sqrt(norm);
+}
+
+enum xnn_status swiglu_create_speculative(
+  struct swiglu_stack* draft,
+  struct swiglu_stack* target,
+  size_t max_sequences,
+  size_t max_len,
+  float tolerance,
+  struct swiglu_speculative** speculative_out)
+{
+  const size_t dim = swiglu_stack_input_dim(target);
+  if (swiglu_stack_output_dim(target) != dim || swiglu_stack_input_dim(draft) != dim ||
+      swiglu_stack_output_dim(draft) != dim) {
+    fprintf(stderr, "draft and target must both map %zu-wide rows to %zu-wide rows\n", dim, dim);
+    return xnn_status_invalid_parameter;
+  }
+  if (max_sequences == 0 || max_len == 0) {
+    fprintf(stderr, "a speculative decoder needs room for at least one row\n");
+    return xnn_status_invalid_parameter;
+  }
+  struct swiglu_speculative* speculative = new (std::nothrow) swiglu_speculative();
+  if (speculative == NULL) {
+    fprintf(stderr, "failed to allocate speculative decoder\n");
+    return xnn_status_out_of_memory;
+  }
+  speculative->draft = draft;
+  speculative->target = target;
+  speculative->dim = dim;
+  speculative->max_sequences = max_sequences;
+  speculative->max_len = max_len;
+  speculative->tolerance = tolerance;
+  speculative->rows.resize(max_sequences * max_len * dim);
+  speculative->lengths.resize(max_sequences);
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  for (std::vector<float>& rows : speculative->draft_rows) {
+    rows.resize(max_sequences * dim + XNN_EXTRA_BYTES / sizeof(float));
+  }
+  *speculative_out = speculative;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_speculative_start(
+  struct swiglu_speculative* speculative,
+  size_t num_sequences,
+  const float* rows)
+{
+  if (num_sequences == 0 || num_sequences > speculative->max_sequences) {
+    fprintf(stderr, "cannot start %zu sequences, the decoder holds 1 to %zu\n",
+            num_sequences, speculative->max_sequences);
+    return xnn_status_invalid_parameter;
+  }
+  speculative->num_sequences = num_sequences;
+  for (size_t s = 0; s < num_sequences; ++s) {
+    memcpy(cache_row(speculative, s, 0), rows + s * speculative->dim, speculative->dim * sizeof(float));
+    speculative->lengths[s] = 1;
+  }
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_speculative_step(
+  struct swiglu_speculative* speculative,
+  size_t num_draft_rows,
+  size_t* emitted)
+{
+  const size_t n = speculative->num_sequences;
+  const size_t k = num_draft_rows;
+  const size_t dim = speculative->dim;
+  if (n == 0) {
+    fprintf(stderr, "no sequences; call swiglu_speculative_start first\n");
+    return xnn_status_invalid_state;
+  }
+  for (size_t s = 0; s < n; ++s) {
+    if (speculative->lengths[s] + k + 1 > speculative->max_len) {
+      fprintf(stderr, "sequence %zu has %zu rows, no room for %zu more in %zu\n",
+              s, speculative->lengths[s], k + 1, speculative->max_len);
+      return xnn_status_invalid_state;
+    }
+  }
+
+  // Lengths before the step, then after it
+  std::vector<size_t> lengths(speculative->lengths.begin(), speculative->lengths.begin() + n);
+
+  // Draft k rows per sequence, one batch of all sequences at a time, appending them
+  // to the cache.
+  for (size_t s = 0; s < n; ++s) {
+    memcpy(&speculative->draft_rows[0][s * dim], cache_row(speculative, s, lengths[s] - 1), dim * sizeof(float));
+  }
+  for (size_t j = 0; j < k; ++j) {
+    const std::vector<float>& input = speculative->draft_rows[j % 2];
+    std::vector<float>& output = speculative->draft_rows[(j + 1) % 2];
+    enum xnn_status status = swiglu_run_stack(speculative->draft, n, input.data(), output.data());
+    if (status != xnn_status_success) {
+      return status;
+    }
+    for (size_t s = 0; s < n; ++s) {
+      memcpy(cache_row(speculative, s, lengths[s] + j), &output[s * dim], dim * sizeof(float));
+    }
+  }
+  for (size_t s = 0; s < n; ++s) {
+    speculative->lengths[s] += k;
+  }
+
+  // Verify: the target runs the last accepted row and the k proposals of every
+  // sequence, which are contiguous in the cache.
+  const size_t rows_per_sequence = k + 1;
+  speculative->verify_input.resize(n * rows_per_sequence * dim + XNN_EXTRA_BYTES / sizeof(float));
+  speculative->verify_output.resize(n * rows_per_sequence * dim);
+  for (size_t s = 0; s < n; ++s) {
+    memcpy(&speculative->verify_input[s * rows_per_sequence * dim], cache_row(speculative, s, lengths[s] - 1),
+           rows_per_sequence * dim * sizeof(float));
+  }
+  enum xnn_status status = swiglu_run_stack(
+    speculative->target, n * rows_per_sequence, speculative->verify_input.data(), speculative->verify_output.data());
+  if (status != xnn_status_success) {
+    swiglu_speculative_rollback(speculative, lengths.data());
+    return status;
+  }
+
+  // Accept proposals while they match the target, then put the target's own row
+  // after them: over the first rejected proposal, or appended if none was.
+  for (size_t s = 0; s < n; ++s) {
+    const float* target_rows = &speculative->verify_output[s * rows_per_sequence * dim];
+    const size_t base = lengths[s];
+    size_t a = 0;
+    while (a < k && accepted(target_rows + a * dim, cache_row(speculative, s, base + a), dim, speculative->tolerance)) {
+      ++a;
+    }
+    memcpy(cache_row(speculative, s, base + a), target_rows + a * dim, dim * sizeof(float));
+    if (a == k) {
+      speculative->lengths[s] = base + k + 1;
+    }
+    lengths[s] = base + a + 1;
+    speculative->stats.proposed += k;
+    speculative->stats.accepted += a;
+    speculative->stats.emitted += a + 1;
+    if (emitted != NULL) {
+      emitted[s] = a + 1;
+    }
+  }
+  // Drop every sequence's rejected proposals at once.
+  swiglu_speculative_rollback(speculative, lengths.data());
+  speculative->stats.steps++;
+  return xnn_status_success;
+}
+
+void swiglu_speculative_rollback(struct swiglu_speculative* speculative, const size_t* lengths) {
+  for (size_t s = 0; s < speculative->num_sequences; ++s) {
+    if (lengths[s] < speculative->lengths[s]) {
+      speculative->lengths[s] = lengths[s];
+    }
+  }
+}
+
+const float* swiglu_speculative_rows(const struct swiglu_speculative* speculative, size_t s, size_t* length) {
+  *length = speculative->lengths[s];
+  return speculative->rows.data() + s * speculative->max_len * speculative->dim;
+}
+
+struct swiglu_speculative_stats swiglu_speculative_stats(const struct swiglu_speculative* speculative) {
+  return speculative->stats;
+}
+
+void swiglu_delete_speculative(struct swiglu_speculative* speculative) {
+  delete speculative;
+}
@@ -0,0 +1,79 @@
+/**
+ * @file swiglu_speculative.h
+ * @brief Speculative decoding: a cheap draft stack proposes rows, the target verifies
+ *
+ * Decoding one row per step with the target stack reads all of its weights for a
+ * single row, so it is bound by memory bandwidth. A speculative step instead runs
+ * the draft stack k times to propose k rows per sequence, then runs the target once
+ * on the last accepted row and the k proposals, k + 1 rows per sequence, for about
+ * the cost of one. Proposals are accepted in order while the target's output for the
+ * row before matches them within a tolerance; the target's output at the first
+ * mismatch, or after the last proposal, is appended as well, so every step emits
+ * between 1 and k + 1 rows per sequence.
+ *
+ * Every sequence keeps its rows in a cache of up to max_len rows, the state an
+ * attention layer would read. Proposals are written to the cache as they are drafted
+ * and rejected ones are dropped by truncating all sequences at once.
+ *
+ * The draft stack always runs num_sequences rows and the target num_sequences *
+ * (k + 1), so with a fixed k neither is reshaped after the first step.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <xnnpack.h>
+
+#include "swiglu_stack.h"
+
+struct swiglu_speculative_stats {
+  size_t steps;
+  // Rows proposed by the draft stack and accepted by the target
+  size_t proposed;
+  size_t accepted;
+  // Rows appended to the sequences, accepted ones included
+  size_t emitted;
+};
+
+struct swiglu_speculative;
+
+/**
+ * @brief Creates a decoder of up to max_sequences sequences of up to max_len rows
+ *
+ * Both stacks must map rows of one width to rows of the same width. A proposal is
+ * accepted if ||target - proposal|| <= tolerance * ||target||. The stacks must
+ * outlive the decoder.
+ */
+enum xnn_status swiglu_create_speculative(
+  struct swiglu_stack* draft,
+  struct swiglu_stack* target,
+  size_t max_sequences,
+  size_t max_len,
+  float tolerance,
+  struct swiglu_speculative** speculative_out);
+
+// Starts num_sequences sequences, each from one row of rows [num_sequences, dim].
+enum xnn_status swiglu_speculative_start(
+  struct swiglu_speculative* speculative,
+  size_t num_sequences,
+  const float* rows);
+
+/**
+ * @brief Runs one step with num_draft_rows proposals per sequence
+ *
+ * With num_draft_rows 0, this is a plain target decode step. emitted, if not NULL,
+ * receives the number of rows appended to each sequence.
+ */
+enum xnn_status swiglu_speculative_step(
+  struct swiglu_speculative* speculative,
+  size_t num_draft_rows,
+  size_t* emitted);
+
+// Truncates every sequence s to lengths[s] rows, which must not exceed its length.
+void swiglu_speculative_rollback(struct swiglu_speculative* speculative, const size_t* lengths);
+
+// Rows of sequence s, [*length, dim].
+const float* swiglu_speculative_rows(const struct swiglu_speculative* speculative, size_t s, size_t* length);
+
+struct swiglu_speculative_stats swiglu_speculative_stats(const struct swiglu_speculative* speculative);
+
+void swiglu_delete_speculative(struct swiglu_speculative* speculative);
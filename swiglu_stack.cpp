@@ -0,0 +1,504 @@
+/**
+ * @file swiglu_stack.cpp
+ * @brief Multi-layer SwiGLU stack with serial, parallel and lazy weight packing
+ *
+ * Packing works by creating a throwaway runtime for a layer with the stack's weights
+ * cache, no thread pool and no shared workspace. Its private workspace is never
+ * reshaped, so it allocates nothing; the only lasting effect is the packed weights
+ * left in the cache. The layer's real runtime, which shares the stack's workspace,
+ * is then created on the calling thread and finds its weights already packed.
+ * Shared workspaces are not thread-safe to attach to, which is why only the packing
+ * step moves off the calling thread.
+ */
+#include "swiglu_stack.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "swiglu_memory.h"
+
+struct swiglu_layer_state {
+  struct swiglu_layer_weights weights;
+  xnn_subgraph_t subgraph = NULL;
+  xnn_runtime_t runtime = NULL;
+  // Batch size the runtime is currently reshaped for, 0 before the first run.
+  size_t batch_size = 0;
+  // Set once the layer's weights are in the cache (parallel and lazy modes).
+  bool packed = false;
+  enum xnn_status pack_status = xnn_status_success;
+};
+
+struct swiglu_stack {
+  std::vector<swiglu_layer_state> layers;
+  enum swiglu_pack_mode pack_mode;
+  // Cache the stack packs into, NULL when the caller provides packed weights
+  struct swiglu_weights_cache* owned_weights_cache = NULL;
+  xnn_weights_cache_t weights_cache = NULL;
+  xnn_workspace_t workspace = NULL;
+  pthreadpool_t threadpool = NULL;
+  // Ping-pong activations between layers.
+  std::vector<float> activations[2];
+  // Set once swiglu_warmup_stack has mlocked the activations
+  bool activations_locked = false;
+
+  // Lazy packing state
+  std::thread packer;
+  std::mutex mutex;
+  std::condition_variable packed_cv;
+  bool cancel_packing = false;
+};
+
+// Packs the weights of one layer's subgraph into weights_cache.
+static enum xnn_status pack_subgraph(xnn_subgraph_t subgraph, xnn_weights_cache_t weights_cache, size_t i) {
+  xnn_runtime_t runtime = NULL;
+  enum xnn_status status = xnn_create_runtime_v4(
+    subgraph,
+    /*weights_cache=*/weights_cache,
+    /*workspace=*/NULL,
+    /*threadpool=*/NULL,
+    /*flags=*/0,
+    &runtime);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_runtime_v4 failed while packing layer %zu: %d\n", i, status);
+    return status;
+  }
+  xnn_delete_runtime(runtime);
+  return xnn_status_success;
+}
+
+static enum xnn_status pack_layer(struct swiglu_stack* stack, size_t i) {
+  return pack_subgraph(stack->layers[i].subgraph, stack->weights_cache, i);
+}
+
+static void pack_layer_task(void* context, size_t i) {
+  struct swiglu_stack* stack = static_cast<struct swiglu_stack*>(context);
+  stack->layers[i].pack_status = pack_layer(stack, i);
+  stack->layers[i].packed = true;
+}
+
+static void pack_layers_in_background(struct swiglu_stack* stack) {
+  for (size_t i = 0; i < stack->layers.size(); ++i) {
+    {
+      std::lock_guard<std::mutex> lock(stack->mutex);
+      if (stack->cancel_packing) {
+        return;
+      }
+    }
+    const enum xnn_status status = pack_layer(stack, i);
+    {
+      std::lock_guard<std::mutex> lock(stack->mutex);
+      stack->layers[i].pack_status = status;
+      stack->layers[i].packed = true;
+    }
+    stack->packed_cv.notify_all();
+  }
+}
+
+// Creates the layer's real runtime, waiting for its weights in lazy mode.
+static enum xnn_status create_layer_runtime(struct swiglu_stack* stack, size_t i) {
+  struct swiglu_layer_state& layer = stack->layers[i];
+  if (layer.runtime != NULL) {
+    return xnn_status_success;
+  }
+
+  if (stack->pack_mode == swiglu_pack_lazy) {
+    std::unique_lock<std::mutex> lock(stack->mutex);
+    stack->packed_cv.wait(lock, [&layer] { return layer.packed; });
+  }
+  if (layer.pack_status != xnn_status_success) {
+    return layer.pack_status;
+  }
+
+  enum xnn_status status = xnn_create_runtime_v4(
+    layer.subgraph,
+    /*weights_cache=*/stack->weights_cache,
+    /*workspace=*/stack->workspace,
+    /*threadpool=*/stack->threadpool,
+    /*flags=*/0,
+    &layer.runtime);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_runtime_v4 failed for layer %zu: %d\n", i, status);
+    return status;
+  }
+
+  // The runtime keeps everything it needs from the subgraph.
+  xnn_delete_subgraph(layer.subgraph);
+  layer.subgraph = NULL;
+  return xnn_status_success;
+}
+
+static enum xnn_status validate_layers(size_t num_layers, const struct swiglu_layer_weights* layers) {
+  if (num_layers == 0) {
+    fprintf(stderr, "a SwiGLU stack needs at least one layer\n");
+    return xnn_status_invalid_parameter;
+  }
+  for (size_t i = 0; i + 1 < num_layers; ++i) {
+    if (layers[i].output_dim != layers[i + 1].input_dim) {
+      fprintf(stderr, "layer %zu output dim %zu does not match layer %zu input dim %zu\n",
+              i, layers[i].output_dim, i + 1, layers[i + 1].input_dim);
+      return xnn_status_invalid_parameter;
+    }
+  }
+  return xnn_status_success;
+}
+
+// Allocates a stack with its workspace and layer subgraphs, but no runtimes.
+static enum xnn_status allocate_stack(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  pthreadpool_t threadpool,
+  enum swiglu_pack_mode pack_mode,
+  struct swiglu_stack** stack_out)
+{
+  enum xnn_status status = validate_layers(num_layers, layers);
+  if (status != xnn_status_success) {
+    return status;
+  }
+
+  struct swiglu_stack* stack = new (std::nothrow) swiglu_stack();
+  if (stack == NULL) {
+    fprintf(stderr, "failed to allocate SwiGLU stack\n");
+    return xnn_status_out_of_memory;
+  }
+  stack->pack_mode = pack_mode;
+  stack->threadpool = threadpool;
+  stack->layers.resize(num_layers);
+
+  status = xnn_create_workspace(&stack->workspace);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_create_workspace failed: %d\n", status);
+    swiglu_delete_stack(stack);
+    return status;
+  }
+
+  for (size_t i = 0; i < num_layers; ++i) {
+    stack->layers[i].weights = layers[i];
+    status = swiglu_define_layer(&layers[i], &stack->layers[i].subgraph);
+    if (status != xnn_status_success) {
+      swiglu_delete_stack(stack);
+      return status;
+    }
+  }
+
+  *stack_out = stack;
+  return xnn_status_success;
+}
+
+static enum xnn_status create_layer_runtimes(struct swiglu_stack* stack) {
+  for (size_t i = 0; i < stack->layers.size(); ++i) {
+    enum xnn_status status = create_layer_runtime(stack, i);
+    if (status != xnn_status_success) {
+      return status;
+    }
+  }
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_create_stack(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  pthreadpool_t threadpool,
+  enum swiglu_pack_mode pack_mode,
+  struct swiglu_stack** stack_out)
+{
+  struct swiglu_stack* stack = NULL;
+  enum xnn_status status = allocate_stack(num_layers, layers, threadpool, pack_mode, &stack);
+  if (status != xnn_status_success) {
+    return status;
+  }
+
+  status = swiglu_create_weights_cache(&stack->owned_weights_cache);
+  if (status != xnn_status_success) {
+    swiglu_delete_stack(stack);
+    return status;
+  }
+  stack->weights_cache = swiglu_weights_cache_provider(stack->owned_weights_cache);
+
+  switch (pack_mode) {
+    case swiglu_pack_serial:
+      // Every runtime packs its own weights as it is created.
+      break;
+    case swiglu_pack_parallel:
+      pthreadpool_parallelize_1d(threadpool, pack_layer_task, stack, num_layers, /*flags=*/0);
+      break;
+    case swiglu_pack_lazy:
+      // Runs start before the last layers are packed; their inserts still land in
+      // the soft-finalized cache.
+      swiglu_finalize_weights_cache(stack->owned_weights_cache);
+      stack->packer = std::thread(pack_layers_in_background, stack);
+      *stack_out = stack;
+      return xnn_status_success;
+  }
+
+  status = create_layer_runtimes(stack);
+  if (status != xnn_status_success) {
+    swiglu_delete_stack(stack);
+    return status;
+  }
+  swiglu_finalize_weights_cache(stack->owned_weights_cache);
+
+  *stack_out = stack;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_create_stack_with_weights_cache(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  xnn_weights_cache_t weights_cache,
+  pthreadpool_t threadpool,
+  struct swiglu_stack** stack_out)
+{
+  struct swiglu_stack* stack = NULL;
+  enum xnn_status status = allocate_stack(num_layers, layers, threadpool, swiglu_pack_serial, &stack);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  stack->weights_cache = weights_cache;
+
+  status = create_layer_runtimes(stack);
+  if (status != xnn_status_success) {
+    swiglu_delete_stack(stack);
+    return status;
+  }
+
+  *stack_out = stack;
+  return xnn_status_success;
+}
+
+struct pack_layers_context {
+  const struct swiglu_layer_weights* layers;
+  xnn_weights_cache_t weights_cache;
+  std::vector<enum xnn_status> statuses;
+};
+
+static void pack_layers_task(void* context, size_t i) {
+  struct pack_layers_context* pack_context = static_cast<struct pack_layers_context*>(context);
+  xnn_subgraph_t subgraph = NULL;
+  enum xnn_status status = swiglu_define_layer(&pack_context->layers[i], &subgraph);
+  if (status == xnn_status_success) {
+    status = pack_subgraph(subgraph, pack_context->weights_cache, i);
+    xnn_delete_subgraph(subgraph);
+  }
+  pack_context->statuses[i] = status;
+}
+
+enum xnn_status swiglu_pack_layers(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  pthreadpool_t threadpool,
+  struct swiglu_weights_cache* cache)
+{
+  struct pack_layers_context context;
+  context.layers = layers;
+  context.weights_cache = swiglu_weights_cache_provider(cache);
+  context.statuses.assign(num_layers, xnn_status_success);
+  pthreadpool_parallelize_1d(threadpool, pack_layers_task, &context, num_layers, /*flags=*/0);
+  for (enum xnn_status status : context.statuses) {
+    if (status != xnn_status_success) {
+      return status;
+    }
+  }
+  swiglu_finalize_weights_cache(cache);
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_run_stack_layer(
+  struct swiglu_stack* stack,
+  size_t i,
+  size_t batch_size,
+  const float* input,
+  float* output)
+{
+  struct swiglu_layer_state& layer = stack->layers[i];
+  enum xnn_status status = create_layer_runtime(stack, i);
+  if (status != xnn_status_success) {
+    return status;
+  }
+
+  if (layer.batch_size != batch_size) {
+    std::vector<size_t> input_dims = {batch_size, layer.weights.input_dim};
+    status = xnn_reshape_external_value(layer.runtime, SWIGLU_INPUT_EXTERNAL_ID, input_dims.size(), input_dims.data());
+    if (status != xnn_status_success) {
+      fprintf(stderr, "xnn_reshape_external_value failed: %d\n", status);
+      return status;
+    }
+    std::vector<size_t> output_dims = {batch_size, layer.weights.output_dim};
+    status = xnn_reshape_external_value(layer.runtime, SWIGLU_OUTPUT_EXTERNAL_ID, output_dims.size(), output_dims.data());
+    if (status != xnn_status_success) {
+      fprintf(stderr, "xnn_reshape_external_value failed: %d\n", status);
+      return status;
+    }
+    status = xnn_reshape_runtime(layer.runtime);
+    if (status != xnn_status_success) {
+      fprintf(stderr, "xnn_reshape_runtime failed: %d\n", status);
+      return status;
+    }
+    layer.batch_size = batch_size;
+  }
+
+  struct xnn_external_value external_values[SWIGLU_NUM_EXTERNAL_VALUES] = {
+    {SWIGLU_INPUT_EXTERNAL_ID, const_cast<float*>(input)},
+    {SWIGLU_OUTPUT_EXTERNAL_ID, output},
+  };
+  status = xnn_setup_runtime_v2(layer.runtime, SWIGLU_NUM_EXTERNAL_VALUES, external_values);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_setup_runtime_v2 failed: %d\n", status);
+    return status;
+  }
+  status = xnn_invoke_runtime(layer.runtime);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "xnn_invoke_runtime failed: %d\n", status);
+    return status;
+  }
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_run_stack(
+  struct swiglu_stack* stack,
+  size_t batch_size,
+  const float* input,
+  float* output)
+{
+  size_t max_dim = 0;
+  for (const swiglu_layer_state& layer : stack->layers) {
+    max_dim = std::max(max_dim, layer.weights.output_dim);
+  }
+  for (std::vector<float>& activations : stack->activations) {
+    if (activations.size() < batch_size * max_dim) {
+      if (stack->activations_locked) {
+        // Growing reallocates; the new buffers are not locked.
+        swiglu_unlock({{activations.data(), activations.size() * sizeof(float)}});
+      }
+      activations.resize(batch_size * max_dim);
+    }
+  }
+
+  const float* layer_input = input;
+  for (size_t i = 0; i < stack->layers.size(); ++i) {
+    float* layer_output = i + 1 == stack->layers.size() ? output : stack->activations[i % 2].data();
+    enum xnn_status status = swiglu_run_stack_layer(stack, i, batch_size, layer_input, layer_output);
+    if (status != xnn_status_success) {
+      return status;
+    }
+    layer_input = layer_output;
+  }
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_wait_for_packing(struct swiglu_stack* stack) {
+  if (stack->pack_mode == swiglu_pack_lazy) {
+    std::unique_lock<std::mutex> lock(stack->mutex);
+    stack->packed_cv.wait(lock, [stack] { return stack->layers.back().packed; });
+  }
+  for (const swiglu_layer_state& layer : stack->layers) {
+    if (layer.pack_status != xnn_status_success) {
+      return layer.pack_status;
+    }
+  }
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_warmup_stack(
+  struct swiglu_stack* stack,
+  size_t num_batch_sizes,
+  const size_t* batch_sizes,
+  bool lock)
+{
+  enum xnn_status status = swiglu_wait_for_packing(stack);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  if (stack->owned_weights_cache != NULL) {
+    status = swiglu_prefault_weights_cache(stack->owned_weights_cache, stack->threadpool, lock);
+    if (status != xnn_status_success) {
+      return status;
+    }
+  }
+
+  // Largest first, so the workspace grows once and later sizes fit in it.
+  std::vector<size_t> sizes(batch_sizes, batch_sizes + num_batch_sizes);
+  std::sort(sizes.begin(), sizes.end(), [](size_t a, size_t b) { return a > b; });
+  if (sizes.empty() || sizes.front() == 0) {
+    return xnn_status_success;
+  }
+  std::vector<float> input(sizes.front() * stack->layers.front().weights.input_dim, 0.0f);
+  std::vector<float> output(sizes.front() * stack->layers.back().weights.output_dim);
+  for (size_t batch_size : sizes) {
+    if (batch_size == 0) {
+      continue;
+    }
+    status = swiglu_run_stack(stack, batch_size, input.data(), output.data());
+    if (status != xnn_status_success) {
+      return status;
+    }
+  }
+
+  if (lock && !stack->activations_locked) {
+    std::vector<struct swiglu_memory_range> ranges;
+    for (const std::vector<float>& activations : stack->activations) {
+      ranges.push_back({activations.data(), activations.size() * sizeof(float)});
+    }
+    status = swiglu_prefault(ranges, /*threadpool=*/NULL, /*lock=*/true);
+    if (status != xnn_status_success) {
+      return status;
+    }
+    stack->activations_locked = true;
+  }
+  return xnn_status_success;
+}
+
+size_t swiglu_stack_num_layers(const struct swiglu_stack* stack) {
+  return stack->layers.size();
+}
+
+size_t swiglu_stack_layer_output_dim(const struct swiglu_stack* stack, size_t i) {
+  return stack->layers[i].weights.output_dim;
+}
+
+size_t swiglu_stack_input_dim(const struct swiglu_stack* stack) {
+  return stack->layers.front().weights.input_dim;
+}
+
+size_t swiglu_stack_output_dim(const struct swiglu_stack* stack) {
+  return stack->layers.back().weights.output_dim;
+}
+
+size_t swiglu_stack_packed_size(struct swiglu_stack* stack) {
+  if (stack->owned_weights_cache == NULL) {
+    return 0;
+  }
+  return swiglu_weights_cache_size(stack->owned_weights_cache);
+}
+
+void swiglu_delete_stack(struct swiglu_stack* stack) {
+  if (stack->packer.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(stack->mutex);
+      stack->cancel_packing = true;
+    }
+    stack->packer.join();
+  }
+  for (swiglu_layer_state& layer : stack->layers) {
+    if (layer.runtime != NULL) {
+      xnn_delete_runtime(layer.runtime);
+    }
+    if (layer.subgraph != NULL) {
+      xnn_delete_subgraph(layer.subgraph);
+    }
+  }
+  if (stack->activations_locked) {
+    for (const std::vector<float>& activations : stack->activations) {
+      swiglu_unlock({{activations.data(), activations.size() * sizeof(float)}});
+    }
+  }
+  if (stack->workspace != NULL) {
+    xnn_release_workspace(stack->workspace);
+  }
+  swiglu_delete_weights_cache(stack->owned_weights_cache);
+  delete stack;
+}
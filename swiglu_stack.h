@@ -0,0 +1,132 @@
+/**
+ * @file swiglu_stack.h
+ * @brief A stack of SwiGLU layers, each with its own runtime, sharing one workspace
+ *        and one weights cache
+ *
+ * Creating a runtime packs the layer's weights, which dominates startup for deep
+ * models. The stack can pack layers serially (as xnn_create_runtime_v4 does when
+ * called in a loop), in parallel across the thread pool, or lazily on a background
+ * thread so that the first run starts while later layers are still being packed.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_layer.h"
+#include "swiglu_weights_cache.h"
+
+enum swiglu_pack_mode {
+  // Pack every layer on the calling thread before swiglu_create_stack returns.
+  swiglu_pack_serial,
+  // Pack all layers concurrently on the thread pool before swiglu_create_stack returns.
+  swiglu_pack_parallel,
+  // Return immediately and pack layers in order on a background thread. A run
+  // waits only for the layer it is about to execute.
+  swiglu_pack_lazy,
+};
+
+struct swiglu_stack;
+
+/**
+ * @brief Creates a stack of num_layers SwiGLU layers
+ *
+ * layers[i].output_dim must equal layers[i + 1].input_dim. The weights are not
+ * copied and must outlive the stack. threadpool may be NULL and is used both for
+ * parallel packing and for running the layers.
+ */
+enum xnn_status swiglu_create_stack(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  pthreadpool_t threadpool,
+  enum swiglu_pack_mode pack_mode,
+  struct swiglu_stack** stack_out);
+
+/**
+ * @brief Creates a stack whose weights are already packed in weights_cache
+ *
+ * Use this with read-only caches such as the one of a packed weights file, where
+ * creating the runtimes only looks weights up. The cache must outlive the stack.
+ */
+enum xnn_status swiglu_create_stack_with_weights_cache(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  xnn_weights_cache_t weights_cache,
+  pthreadpool_t threadpool,
+  struct swiglu_stack** stack_out);
+
+/**
+ * @brief Packs the weights of every layer into cache, concurrently on threadpool,
+ *        without creating any runtime that outlives the call
+ *
+ * On success the cache is finalized (see swiglu_finalize_weights_cache).
+ */
+enum xnn_status swiglu_pack_layers(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  pthreadpool_t threadpool,
+  struct swiglu_weights_cache* cache);
+
+/**
+ * @brief Runs batch_size rows through every layer of the stack
+ *
+ * input is [batch_size, layers[0].input_dim] and output is
+ * [batch_size, layers[num_layers - 1].output_dim]. Layers are reshaped only when
+ * the batch size changes.
+ */
+enum xnn_status swiglu_run_stack(
+  struct swiglu_stack* stack,
+  size_t batch_size,
+  const float* input,
+  float* output);
+
+/**
+ * @brief Runs batch_size rows through layer i only
+ *
+ * input is [batch_size, layers[i].input_dim] and output is
+ * [batch_size, layers[i].output_dim]. Running a stack one layer at a time lets a
+ * scheduler switch to more urgent work between layers.
+ */
+enum xnn_status swiglu_run_stack_layer(
+  struct swiglu_stack* stack,
+  size_t i,
+  size_t batch_size,
+  const float* input,
+  float* output);
+
+// Blocks until every layer's weights are packed. Only waits in lazy mode.
+enum xnn_status swiglu_wait_for_packing(struct swiglu_stack* stack);
+
+/**
+ * @brief Takes every page fault and allocation of serving ahead of the first request
+ *
+ * Waits for packing, faults in the stack's packed weights, then runs zeros through
+ * the stack once per batch size, largest first, which sizes the shared workspace
+ * and activation buffers and faults them in. With lock set, the packed weights and
+ * activations are also mlocked. The workspace belongs to XNNPACK and is only
+ * faulted in; weights in a caller's cache, such as a packed file, are prefaulted
+ * by the cache's owner. Runs at other batch sizes still reshape, but no longer
+ * allocate as long as they are no larger than the largest warmed-up size.
+ */
+enum xnn_status swiglu_warmup_stack(
+  struct swiglu_stack* stack,
+  size_t num_batch_sizes,
+  const size_t* batch_sizes,
+  bool lock);
+
+size_t swiglu_stack_num_layers(const struct swiglu_stack* stack);
+
+// layers[i].output_dim
+size_t swiglu_stack_layer_output_dim(const struct swiglu_stack* stack, size_t i);
+
+// Row width of the stack's input, layers[0].input_dim.
+size_t swiglu_stack_input_dim(const struct swiglu_stack* stack);
+
+// Row width of the stack's output, layers[num_layers - 1].output_dim.
+size_t swiglu_stack_output_dim(const struct swiglu_stack* stack);
+
+// Bytes of weights the stack has packed, 0 if it was given a weights cache.
+size_t swiglu_stack_packed_size(struct swiglu_stack* stack);
+
+void swiglu_delete_stack(struct swiglu_stack* stack);
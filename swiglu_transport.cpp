@@ -0,0 +1,505 @@
+/**
+ * @file swiglu_transport.cpp
+ * @brief Shared-memory slots and lock-free queues between front ends and a worker
+ *
+ * Segment layout, every part 64-byte aligned:
+ *
+ *   transport_header (with the submit and free queue positions)
+ *   queue_cell[capacity] of the submit queue
+ *   queue_cell[capacity] of the free queue
+ *   num_slots x (slot_header, input rows, output rows)
+ *
+ * The queues are Vyukov's bounded queue: every cell carries a sequence number that
+ * tells producers and consumers whether it is theirs to fill or drain, so both sides
+ * only need one compare-and-swap on their position.
+ */
+#include "swiglu_transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+#include <string>
+
+#define SWIGLU_TRANSPORT_MAGIC "SWIGLUTR"
+#define SWIGLU_TRANSPORT_VERSION 2
+#define SWIGLU_TRANSPORT_ALIGNMENT 64
+// Iterations to spin before sleeping on a futex
+#define SWIGLU_TRANSPORT_SPIN_COUNT 4096
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "transport queues need address-free atomics to work across processes");
+
+enum slot_state : uint32_t {
+  slot_free = 0,
+  slot_filling = 1,
+  slot_submitted = 2,
+  // Claimed by the worker, or by a shutdown cancelling it
+  slot_running = 3,
+  slot_done = 4,
+};
+
+struct queue_cell {
+  std::atomic<uint64_t> sequence;
+  uint32_t value;
+};
+
+struct queue_positions {
+  alignas(SWIGLU_TRANSPORT_ALIGNMENT) std::atomic<uint64_t> enqueue_pos;
+  alignas(SWIGLU_TRANSPORT_ALIGNMENT) std::atomic<uint64_t> dequeue_pos;
+  // Bumped on every enqueue; consumers sleep on it when the queue is empty.
+  alignas(SWIGLU_TRANSPORT_ALIGNMENT) std::atomic<uint32_t> enqueued;
+  // Consumers sleeping on enqueued, so producers only make the wake syscall when needed
+  std::atomic<uint32_t> waiters;
+};
+
+struct transport_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_slots;
+  // Power of two no smaller than num_slots
+  uint64_t capacity;
+  uint64_t max_rows;
+  uint64_t input_dim;
+  uint64_t output_dim;
+  uint64_t slot_stride;
+  uint64_t input_offset;
+  uint64_t output_offset;
+  uint64_t slots_offset;
+  std::atomic<uint32_t> shutdown;
+  struct queue_positions submit;
+  struct queue_positions free;
+};
+
+struct slot_header {
+  std::atomic<uint32_t> state;
+  // Set by a front end about to sleep on state, cleared by whoever wakes it
+  std::atomic<uint32_t> waiting;
+  int32_t status;
+  uint64_t rows;
+};
+
+struct swiglu_transport {
+  std::string name;
+  void* mapping = MAP_FAILED;
+  size_t size = 0;
+  struct transport_header* header = NULL;
+  struct queue_cell* submit_cells = NULL;
+  struct queue_cell* free_cells = NULL;
+};
+
+static size_t align_up(size_t n, size_t alignment) {
+  return (n + alignment - 1) / alignment * alignment;
+}
+
+static void futex_wait(std::atomic<uint32_t>* word, uint32_t value) {
+  // Not FUTEX_PRIVATE: waiters and wakers live in different processes.
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+static void futex_wake_all(std::atomic<uint32_t>* word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+static bool enqueue(struct queue_positions* queue, struct queue_cell* cells, uint64_t capacity, uint32_t value) {
+  uint64_t pos = queue->enqueue_pos.load(std::memory_order_relaxed);
+  struct queue_cell* cell;
+  for (;;) {
+    cell = &cells[pos & (capacity - 1)];
+    const uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+    const int64_t diff = static_cast<int64_t>(sequence - pos);
+    if (diff == 0) {
+      if (queue->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = queue->enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  cell->value = value;
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  // Sequentially consistent with the waiter count in dequeue: either this sees the
+  // waiter, or the waiter's futex_wait sees the new count and does not sleep.
+  queue->enqueued.fetch_add(1, std::memory_order_seq_cst);
+  if (queue->waiters.load(std::memory_order_seq_cst) != 0) {
+    futex_wake_all(&queue->enqueued);
+  }
+  return true;
+}
+
+static bool try_dequeue(struct queue_positions* queue, struct queue_cell* cells, uint64_t capacity, uint32_t* value) {
+  uint64_t pos = queue->dequeue_pos.load(std::memory_order_relaxed);
+  struct queue_cell* cell;
+  for (;;) {
+    cell = &cells[pos & (capacity - 1)];
+    const uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+    const int64_t diff = static_cast<int64_t>(sequence - (pos + 1));
+    if (diff == 0) {
+      if (queue->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = queue->dequeue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  *value = cell->value;
+  cell->sequence.store(pos + capacity, std::memory_order_release);
+  return true;
+}
+
+// Dequeues, waiting while the queue is empty. Returns false after shutdown.
+static bool dequeue(
+  struct swiglu_transport* transport,
+  struct queue_positions* queue,
+  struct queue_cell* cells,
+  uint32_t* value)
+{
+  struct transport_header* header = transport->header;
+  for (uint32_t spin = 0;; ++spin) {
+    const uint32_t enqueued = queue->enqueued.load(std::memory_order_acquire);
+    if (try_dequeue(queue, cells, header->capacity, value)) {
+      return true;
+    }
+    if (header->shutdown.load(std::memory_order_acquire) != 0) {
+      return false;
+    }
+    if (spin >= SWIGLU_TRANSPORT_SPIN_COUNT) {
+      queue->waiters.fetch_add(1, std::memory_order_seq_cst);
+      futex_wait(&queue->enqueued, enqueued);
+      queue->waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+}
+
+static struct slot_header* slot_at(struct swiglu_transport* transport, uint32_t slot) {
+  uint8_t* base = static_cast<uint8_t*>(transport->mapping);
+  return reinterpret_cast<struct slot_header*>(
+    base + transport->header->slots_offset + slot * transport->header->slot_stride);
+}
+
+static float* slot_input(struct swiglu_transport* transport, uint32_t slot) {
+  return reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(slot_at(transport, slot)) + transport->header->input_offset);
+}
+
+static float* slot_output(struct swiglu_transport* transport, uint32_t slot) {
+  return reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(slot_at(transport, slot)) + transport->header->output_offset);
+}
+
+// Takes a submitted slot for running or cancelling; false if someone else has it.
+static bool claim_slot(struct slot_header* header) {
+  uint32_t expected = slot_submitted;
+  return header->state.compare_exchange_strong(expected, slot_running, std::memory_order_acquire);
+}
+
+// Publishes status of a claimed slot and wakes its front end if it is asleep.
+static void complete_slot(struct slot_header* header, enum xnn_status status) {
+  header->status = status;
+  // Sequentially consistent with the waiting flag, as for the queue waiter counts.
+  header->state.store(slot_done, std::memory_order_seq_cst);
+  if (header->waiting.exchange(0, std::memory_order_seq_cst) != 0) {
+    futex_wake_all(&header->state);
+  }
+}
+
+// True if count items of size bytes fit in limit bytes, without overflowing.
+static bool fits_array(uint64_t count, uint64_t size, uint64_t limit) {
+  return size == 0 || count <= limit / size;
+}
+
+// True if [offset, offset + size) lies within the first limit bytes, without overflowing.
+static bool fits(uint64_t offset, uint64_t size, uint64_t limit) {
+  return offset <= limit && size <= limit - offset;
+}
+
+// Checks that the queue cells and every slot region the header describes lie in a
+// segment of size bytes, in order and without overlapping, before anything binds them.
+static bool valid_layout(const struct transport_header* header, size_t size) {
+  if (header->num_slots == 0 || header->capacity < header->num_slots ||
+      (header->capacity & (header->capacity - 1)) != 0 ||
+      header->max_rows == 0 || header->input_dim == 0 || header->output_dim == 0 ||
+      (header->slots_offset | header->slot_stride | header->input_offset | header->output_offset) %
+        SWIGLU_TRANSPORT_ALIGNMENT != 0) {
+    return false;
+  }
+  // Both queues' cells, between the header and the slots
+  const uint64_t cells_offset = align_up(sizeof(struct transport_header), SWIGLU_TRANSPORT_ALIGNMENT);
+  if (!fits_array(header->capacity, sizeof(struct queue_cell), size)) {
+    return false;
+  }
+  const uint64_t cells_size = align_up(header->capacity * sizeof(struct queue_cell), SWIGLU_TRANSPORT_ALIGNMENT);
+  if (!fits(cells_offset, cells_size, header->slots_offset) ||
+      !fits(cells_offset + cells_size, cells_size, header->slots_offset)) {
+    return false;
+  }
+  // The slots, then within one slot its header, input rows with the XNN_EXTRA_BYTES
+  // XNNPACK may read past them, and output rows
+  const uint64_t stride = header->slot_stride;
+  if (!fits_array(header->num_slots, stride, size) || !fits(header->slots_offset, header->num_slots * stride, size) ||
+      header->input_offset < sizeof(struct slot_header) ||
+      !fits_array(header->input_dim, sizeof(float), stride) ||
+      !fits_array(header->max_rows, header->input_dim * sizeof(float), stride) ||
+      !fits(header->input_offset, header->max_rows * header->input_dim * sizeof(float) + XNN_EXTRA_BYTES,
+            header->output_offset) ||
+      !fits_array(header->output_dim, sizeof(float), stride) ||
+      !fits_array(header->max_rows, header->output_dim * sizeof(float), stride) ||
+      !fits(header->output_offset, header->max_rows * header->output_dim * sizeof(float), stride)) {
+    return false;
+  }
+  return true;
+}
+
+// Points transport at its mapped segment.
+static void bind_segment(struct swiglu_transport* transport) {
+  uint8_t* base = static_cast<uint8_t*>(transport->mapping);
+  transport->header = reinterpret_cast<struct transport_header*>(base);
+  const size_t cells_offset = align_up(sizeof(struct transport_header), SWIGLU_TRANSPORT_ALIGNMENT);
+  const size_t cells_size = align_up(transport->header->capacity * sizeof(struct queue_cell), SWIGLU_TRANSPORT_ALIGNMENT);
+  transport->submit_cells = reinterpret_cast<struct queue_cell*>(base + cells_offset);
+  transport->free_cells = reinterpret_cast<struct queue_cell*>(base + cells_offset + cells_size);
+}
+
+enum xnn_status swiglu_create_transport(
+  const char* name,
+  size_t num_slots,
+  size_t max_rows,
+  size_t input_dim,
+  size_t output_dim,
+  struct swiglu_transport** transport_out)
+{
+  if (num_slots == 0 || num_slots > UINT32_MAX || max_rows == 0 || input_dim == 0 || output_dim == 0) {
+    fprintf(stderr, "a transport needs at least one slot of at least one row\n");
+    return xnn_status_invalid_parameter;
+  }
+  size_t capacity = 1;
+  while (capacity < num_slots) {
+    capacity *= 2;
+  }
+  const size_t cells_offset = align_up(sizeof(struct transport_header), SWIGLU_TRANSPORT_ALIGNMENT);
+  const size_t cells_size = align_up(capacity * sizeof(struct queue_cell), SWIGLU_TRANSPORT_ALIGNMENT);
+  const size_t slots_offset = cells_offset + 2 * cells_size;
+  const size_t input_offset = align_up(sizeof(struct slot_header), SWIGLU_TRANSPORT_ALIGNMENT);
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  const size_t output_offset =
+    input_offset + align_up(max_rows * input_dim * sizeof(float) + XNN_EXTRA_BYTES, SWIGLU_TRANSPORT_ALIGNMENT);
+  const size_t slot_stride = output_offset + align_up(max_rows * output_dim * sizeof(float), SWIGLU_TRANSPORT_ALIGNMENT);
+  const size_t size = slots_offset + num_slots * slot_stride;
+
+  struct swiglu_transport* transport = new (std::nothrow) swiglu_transport();
+  if (transport == NULL) {
+    fprintf(stderr, "failed to allocate transport\n");
+    return xnn_status_out_of_memory;
+  }
+  transport->name = name;
+  const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "failed to create shared memory %s: %s\n", name, strerror(errno));
+    delete transport;
+    return xnn_status_invalid_parameter;
+  }
+  if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+    transport->mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (transport->mapping == MAP_FAILED) {
+    fprintf(stderr, "failed to map %zu bytes of shared memory %s: %s\n", size, name, strerror(errno));
+    swiglu_destroy_transport(transport);
+    return xnn_status_out_of_memory;
+  }
+  transport->size = size;
+
+  // The segment starts zeroed; the header is published last, with the magic.
+  struct transport_header* header = new (transport->mapping) transport_header();
+  header->version = SWIGLU_TRANSPORT_VERSION;
+  header->num_slots = static_cast<uint32_t>(num_slots);
+  header->capacity = capacity;
+  header->max_rows = max_rows;
+  header->input_dim = input_dim;
+  header->output_dim = output_dim;
+  header->slot_stride = slot_stride;
+  header->input_offset = input_offset;
+  header->output_offset = output_offset;
+  header->slots_offset = slots_offset;
+  bind_segment(transport);
+  for (size_t i = 0; i < capacity; ++i) {
+    new (&transport->submit_cells[i]) queue_cell();
+    transport->submit_cells[i].sequence.store(i, std::memory_order_relaxed);
+    new (&transport->free_cells[i]) queue_cell();
+    transport->free_cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  for (uint32_t slot = 0; slot < num_slots; ++slot) {
+    new (slot_at(transport, slot)) slot_header();
+    enqueue(&header->free, transport->free_cells, capacity, slot);
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->magic, SWIGLU_TRANSPORT_MAGIC, sizeof(header->magic));
+
+  *transport_out = transport;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_attach_transport(const char* name, struct swiglu_transport** transport_out) {
+  const int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    fprintf(stderr, "failed to open shared memory %s: %s\n", name, strerror(errno));
+    return xnn_status_invalid_parameter;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(struct transport_header)) {
+    fprintf(stderr, "%s is not a SwiGLU transport\n", name);
+    close(fd);
+    return xnn_status_invalid_parameter;
+  }
+  struct swiglu_transport* transport = new (std::nothrow) swiglu_transport();
+  if (transport == NULL) {
+    fprintf(stderr, "failed to allocate transport\n");
+    close(fd);
+    return xnn_status_out_of_memory;
+  }
+  transport->name = name;
+  transport->size = static_cast<size_t>(st.st_size);
+  transport->mapping = mmap(NULL, transport->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (transport->mapping == MAP_FAILED) {
+    fprintf(stderr, "failed to map shared memory %s: %s\n", name, strerror(errno));
+    delete transport;
+    return xnn_status_invalid_parameter;
+  }
+
+  const struct transport_header* header = static_cast<const struct transport_header*>(transport->mapping);
+  if (memcmp(header->magic, SWIGLU_TRANSPORT_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != SWIGLU_TRANSPORT_VERSION) {
+    fprintf(stderr, "%s is not a version %d SwiGLU transport\n", name, SWIGLU_TRANSPORT_VERSION);
+    swiglu_detach_transport(transport);
+    return xnn_status_invalid_parameter;
+  }
+  // The rest of the header is published before the magic.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (!valid_layout(header, transport->size)) {
+    fprintf(stderr, "%s describes slots or queues outside its %zu bytes\n", name, transport->size);
+    swiglu_detach_transport(transport);
+    return xnn_status_invalid_parameter;
+  }
+  bind_segment(transport);
+  *transport_out = transport;
+  return xnn_status_success;
+}
+
+size_t swiglu_transport_max_rows(const struct swiglu_transport* transport) {
+  return transport->header->max_rows;
+}
+
+size_t swiglu_transport_input_dim(const struct swiglu_transport* transport) {
+  return transport->header->input_dim;
+}
+
+size_t swiglu_transport_output_dim(const struct swiglu_transport* transport) {
+  return transport->header->output_dim;
+}
+
+bool swiglu_transport_acquire(struct swiglu_transport* transport, uint32_t* slot_out) {
+  if (!dequeue(transport, &transport->header->free, transport->free_cells, slot_out)) {
+    return false;
+  }
+  slot_at(transport, *slot_out)->state.store(slot_filling, std::memory_order_relaxed);
+  return true;
+}
+
+float* swiglu_transport_input(struct swiglu_transport* transport, uint32_t slot) {
+  return slot_input(transport, slot);
+}
+
+void swiglu_transport_submit(struct swiglu_transport* transport, uint32_t slot, size_t rows) {
+  struct slot_header* header = slot_at(transport, slot);
+  header->rows = rows;
+  header->state.store(slot_submitted, std::memory_order_release);
+  enqueue(&transport->header->submit, transport->submit_cells, transport->header->capacity, slot);
+}
+
+enum xnn_status swiglu_transport_wait(struct swiglu_transport* transport, uint32_t slot) {
+  struct slot_header* header = slot_at(transport, slot);
+  for (uint32_t spin = 0;; ++spin) {
+    const uint32_t state = header->state.load(std::memory_order_acquire);
+    if (state == slot_done) {
+      return static_cast<enum xnn_status>(header->status);
+    }
+    // A request submitted after shutdown will never be dequeued; one the worker is
+    // running still completes.
+    if (transport->header->shutdown.load(std::memory_order_acquire) != 0 && claim_slot(header)) {
+      complete_slot(header, xnn_status_invalid_state);
+      continue;
+    }
+    if (spin >= SWIGLU_TRANSPORT_SPIN_COUNT) {
+      header->waiting.store(1, std::memory_order_seq_cst);
+      futex_wait(&header->state, state);
+    }
+  }
+}
+
+const float* swiglu_transport_output(struct swiglu_transport* transport, uint32_t slot) {
+  return slot_output(transport, slot);
+}
+
+void swiglu_transport_release(struct swiglu_transport* transport, uint32_t slot) {
+  slot_at(transport, slot)->state.store(slot_free, std::memory_order_relaxed);
+  enqueue(&transport->header->free, transport->free_cells, transport->header->capacity, slot);
+}
+
+void swiglu_serve_transport(struct swiglu_stack* stack, struct swiglu_transport* transport) {
+  uint32_t slot;
+  while (dequeue(transport, &transport->header->submit, transport->submit_cells, &slot)) {
+    struct slot_header* header = slot_at(transport, slot);
+    if (!claim_slot(header)) {
+      // Cancelled by a shutdown racing with this dequeue
+      continue;
+    }
+    enum xnn_status status = xnn_status_invalid_parameter;
+    if (header->rows != 0 && header->rows <= transport->header->max_rows) {
+      status = swiglu_run_stack(stack, header->rows, slot_input(transport, slot), slot_output(transport, slot));
+    } else {
+      fprintf(stderr, "transport request of %zu rows, expected 1 to %zu\n",
+              static_cast<size_t>(header->rows), static_cast<size_t>(transport->header->max_rows));
+    }
+    complete_slot(header, status);
+  }
+}
+
+void swiglu_shutdown_transport(struct swiglu_transport* transport) {
+  struct transport_header* header = transport->header;
+  header->shutdown.store(1, std::memory_order_release);
+  // Bump the counters so sleepers do not miss the flag between checking and waiting.
+  header->submit.enqueued.fetch_add(1, std::memory_order_release);
+  header->free.enqueued.fetch_add(1, std::memory_order_release);
+  futex_wake_all(&header->submit.enqueued);
+  futex_wake_all(&header->free.enqueued);
+  // Fail every request the worker has not started, so front ends waiting on them
+  // return; the one it is running completes normally.
+  for (uint32_t slot = 0; slot < header->num_slots; ++slot) {
+    struct slot_header* request = slot_at(transport, slot);
+    if (claim_slot(request)) {
+      complete_slot(request, xnn_status_invalid_state);
+    }
+  }
+}
+
+void swiglu_detach_transport(struct swiglu_transport* transport) {
+  if (transport->mapping != MAP_FAILED) {
+    munmap(transport->mapping, transport->size);
+  }
+  delete transport;
+}
+
+void swiglu_destroy_transport(struct swiglu_transport* transport) {
+  shm_unlink(transport->name.c_str());
+  swiglu_detach_transport(transport);
+}
@@ -0,0 +1,89 @@
+/**
+ * @file swiglu_transport.h
+ * @brief Zero-copy shared-memory request transport between front ends and a worker
+ *
+ * A transport is a POSIX shared memory segment holding a fixed number of request
+ * slots. Each slot owns an input buffer of [max_rows, input_dim] floats and an output
+ * buffer of [max_rows, output_dim] floats. Front-end processes write input rows
+ * straight into a slot, and the worker binds the slot buffers as the external input
+ * and output of the SwiGLU runtimes, so rows are never serialized or copied.
+ *
+ * Slot indices move through two lock-free bounded queues in the segment: a free
+ * queue that front ends take slots from, and a submit queue that the worker takes
+ * requests from. Both accept any number of producers and consumers, so the same
+ * queue serves one front end (SPSC) or many (MPSC). Waiting spins briefly and then
+ * sleeps on a shared futex, so an idle worker uses no CPU; wakers only make the wake
+ * syscall when someone is asleep.
+ *
+ * Request lifecycle on the front end:
+ *
+ *   swiglu_transport_acquire -> write swiglu_transport_input -> swiglu_transport_submit
+ *   -> swiglu_transport_wait -> read swiglu_transport_output -> swiglu_transport_release
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <xnnpack.h>
+
+#include "swiglu_stack.h"
+
+struct swiglu_transport;
+
+/**
+ * @brief Creates a transport segment named name (as for shm_open)
+ *
+ * Called by the worker, which owns the segment and removes its name in
+ * swiglu_destroy_transport. Fails if name already exists.
+ */
+enum xnn_status swiglu_create_transport(
+  const char* name,
+  size_t num_slots,
+  size_t max_rows,
+  size_t input_dim,
+  size_t output_dim,
+  struct swiglu_transport** transport_out);
+
+// Maps an existing transport segment; called by front ends.
+enum xnn_status swiglu_attach_transport(const char* name, struct swiglu_transport** transport_out);
+
+size_t swiglu_transport_max_rows(const struct swiglu_transport* transport);
+size_t swiglu_transport_input_dim(const struct swiglu_transport* transport);
+size_t swiglu_transport_output_dim(const struct swiglu_transport* transport);
+
+// Takes a free slot, waiting for one if all are in use. Returns false after shutdown.
+bool swiglu_transport_acquire(struct swiglu_transport* transport, uint32_t* slot_out);
+
+// Input rows of slot, [max_rows, input_dim], to be written before submitting.
+float* swiglu_transport_input(struct swiglu_transport* transport, uint32_t slot);
+
+// Hands the first rows rows of slot's input to the worker.
+void swiglu_transport_submit(struct swiglu_transport* transport, uint32_t slot, size_t rows);
+
+// Waits until the worker has completed slot and returns the status of its run, or
+// xnn_status_invalid_state if the transport was shut down before the worker ran it.
+enum xnn_status swiglu_transport_wait(struct swiglu_transport* transport, uint32_t slot);
+
+// Output rows of a completed slot, [rows, output_dim].
+const float* swiglu_transport_output(struct swiglu_transport* transport, uint32_t slot);
+
+// Returns slot to the free queue once its output has been read.
+void swiglu_transport_release(struct swiglu_transport* transport, uint32_t slot);
+
+/**
+ * @brief Runs submitted requests through stack until the transport is shut down
+ *
+ * Each request runs with its slot's buffers bound directly as the stack's input and
+ * output. Failures are reported to the request's front end.
+ */
+void swiglu_serve_transport(struct swiglu_stack* stack, struct swiglu_transport* transport);
+
+// Makes swiglu_serve_transport and every waiting acquire return, and fails every
+// submitted request the worker has not started.
+void swiglu_shutdown_transport(struct swiglu_transport* transport);
+
+// Unmaps the segment in a front end.
+void swiglu_detach_transport(struct swiglu_transport* transport);
+
+// Unmaps the segment in the worker and removes its name.
+void swiglu_destroy_transport(struct swiglu_transport* transport);
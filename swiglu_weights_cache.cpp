@@ -0,0 +1,194 @@
+/**
+ * @file swiglu_weights_cache.cpp
+ * @brief Concurrent weights cache provider for XNNPACK runtimes
+ */
+#include "swiglu_weights_cache.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <new>
+#include <set>
+#include <tuple>
+
+#include "swiglu_memory.h"
+
+// At least XNN_ALLOCATION_ALIGNMENT on every platform XNNPACK supports
+#define SWIGLU_WEIGHTS_ALIGNMENT 128
+
+typedef std::tuple<uint32_t, const void*, const void*> cache_key_t;
+
+struct packed_buffer {
+  void* data;
+  size_t size;
+};
+
+struct swiglu_weights_cache {
+  struct xnn_weights_cache_provider provider;
+  std::mutex mutex;
+  // Packed weights by (seed, kernel, bias).
+  std::map<cache_key_t, packed_buffer> entries;
+  // Every buffer handed out by reserve_space, including ones that lost an insert race.
+  std::set<void*> buffers;
+  size_t packed_size = 0;
+  // Set by swiglu_finalize_weights_cache; read by XNNPACK without the lock.
+  std::atomic<bool> finalized{false};
+  // Buffers mlocked by swiglu_prefault_weights_cache
+  std::vector<struct swiglu_memory_range> locked;
+};
+
+static cache_key_t make_key(const struct xnn_weights_cache_look_up_key* cache_key) {
+  return cache_key_t(cache_key->seed, cache_key->kernel, cache_key->bias);
+}
+
+static void* allocate_buffer(size_t n) {
+  // XNNPACK microkernels may read up to XNN_EXTRA_BYTES past the packed weights.
+  size_t size = n + XNN_EXTRA_BYTES;
+  size = (size + SWIGLU_WEIGHTS_ALIGNMENT - 1) / SWIGLU_WEIGHTS_ALIGNMENT * SWIGLU_WEIGHTS_ALIGNMENT;
+  return aligned_alloc(SWIGLU_WEIGHTS_ALIGNMENT, size);
+}
+
+// Offsets returned to XNNPACK are the packed buffer addresses themselves, which
+// keeps offset_to_addr lock-free while other threads are still inserting.
+static size_t look_up(void* context, const struct xnn_weights_cache_look_up_key* cache_key) {
+  struct swiglu_weights_cache* cache = static_cast<struct swiglu_weights_cache*>(context);
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  auto it = cache->entries.find(make_key(cache_key));
+  if (it == cache->entries.end()) {
+    return XNN_CACHE_NOT_FOUND;
+  }
+  return reinterpret_cast<size_t>(it->second.data);
+}
+
+static void* reserve_space(void* context, size_t n) {
+  struct swiglu_weights_cache* cache = static_cast<struct swiglu_weights_cache*>(context);
+  void* buffer = allocate_buffer(n);
+  if (buffer == NULL) {
+    fprintf(stderr, "failed to allocate %zu bytes for packed weights\n", n);
+    return NULL;
+  }
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  cache->buffers.insert(buffer);
+  return buffer;
+}
+
+static size_t look_up_or_insert(
+  void* context,
+  const struct xnn_weights_cache_look_up_key* cache_key,
+  void* ptr,
+  size_t size)
+{
+  struct swiglu_weights_cache* cache = static_cast<struct swiglu_weights_cache*>(context);
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  auto it = cache->entries.find(make_key(cache_key));
+  if (it != cache->entries.end()) {
+    // Another thread packed the same weights first; ours are freed with the cache.
+    return reinterpret_cast<size_t>(it->second.data);
+  }
+  if (cache->buffers.count(ptr) == 0) {
+    // Not a buffer from reserve_space, so take a copy that the cache owns.
+    void* buffer = allocate_buffer(size);
+    if (buffer == NULL) {
+      fprintf(stderr, "failed to allocate %zu bytes for packed weights\n", size);
+      return XNN_CACHE_NOT_FOUND;
+    }
+    memcpy(buffer, ptr, size);
+    cache->buffers.insert(buffer);
+    ptr = buffer;
+  }
+  cache->entries.emplace(make_key(cache_key), packed_buffer{ptr, size});
+  cache->packed_size += size;
+  return reinterpret_cast<size_t>(ptr);
+}
+
+static bool is_finalized(void* context) {
+  struct swiglu_weights_cache* cache = static_cast<struct swiglu_weights_cache*>(context);
+  return cache->finalized.load(std::memory_order_acquire);
+}
+
+static void* offset_to_addr(void* context, size_t offset) {
+  (void) context;
+  return reinterpret_cast<void*>(offset);
+}
+
+static enum xnn_status delete_cache(void* context) {
+  struct swiglu_weights_cache* cache = static_cast<struct swiglu_weights_cache*>(context);
+  // Heap pages outlive free(), so they have to be unlocked explicitly.
+  swiglu_unlock(cache->locked);
+  for (void* buffer : cache->buffers) {
+    free(buffer);
+  }
+  delete cache;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_create_weights_cache(struct swiglu_weights_cache** cache_out) {
+  struct swiglu_weights_cache* cache = new (std::nothrow) swiglu_weights_cache();
+  if (cache == NULL) {
+    fprintf(stderr, "failed to allocate weights cache\n");
+    return xnn_status_out_of_memory;
+  }
+  cache->provider.context = cache;
+  cache->provider.look_up = look_up;
+  cache->provider.reserve_space = reserve_space;
+  cache->provider.look_up_or_insert = look_up_or_insert;
+  cache->provider.is_finalized = is_finalized;
+  cache->provider.offset_to_addr = offset_to_addr;
+  cache->provider.delete_cache = delete_cache;
+  *cache_out = cache;
+  return xnn_status_success;
+}
+
+xnn_weights_cache_t swiglu_weights_cache_provider(struct swiglu_weights_cache* cache) {
+  return &cache->provider;
+}
+
+void swiglu_finalize_weights_cache(struct swiglu_weights_cache* cache) {
+  cache->finalized.store(true, std::memory_order_release);
+}
+
+size_t swiglu_weights_cache_size(struct swiglu_weights_cache* cache) {
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  return cache->packed_size;
+}
+
+std::vector<struct swiglu_weights_cache_entry> swiglu_weights_cache_entries(struct swiglu_weights_cache* cache) {
+  std::vector<struct swiglu_weights_cache_entry> entries;
+  std::lock_guard<std::mutex> lock(cache->mutex);
+  for (const auto& entry : cache->entries) {
+    entries.push_back({std::get<0>(entry.first), std::get<1>(entry.first), std::get<2>(entry.first),
+                       entry.second.data, entry.second.size});
+  }
+  return entries;
+}
+
+enum xnn_status swiglu_prefault_weights_cache(
+  struct swiglu_weights_cache* cache,
+  pthreadpool_t threadpool,
+  bool lock)
+{
+  std::vector<struct swiglu_memory_range> ranges;
+  {
+    std::lock_guard<std::mutex> guard(cache->mutex);
+    for (const auto& entry : cache->entries) {
+      ranges.push_back({entry.second.data, entry.second.size});
+    }
+  }
+  enum xnn_status status = swiglu_prefault(ranges, threadpool, lock);
+  if (status == xnn_status_success && lock) {
+    std::lock_guard<std::mutex> guard(cache->mutex);
+    swiglu_unlock(cache->locked);
+    cache->locked = ranges;
+  }
+  return status;
+}
+
+void swiglu_delete_weights_cache(struct swiglu_weights_cache* cache) {
+  if (cache != NULL) {
+    delete_cache(cache);
+  }
+}
@@ -0,0 +1,64 @@
+/**
+ * @file swiglu_weights_cache.h
+ * @brief XNNPACK weights cache that allows several threads to pack at the same time
+ *
+ * XNNPACK's built-in weights cache packs into one growing buffer and holds its lock
+ * from reserve_space() until look_up_or_insert(), so runtimes created from several
+ * threads still pack one operator at a time. This cache gives every reservation its
+ * own buffer and only locks around the index, so packing of different layers runs
+ * concurrently. Runtimes created later with the same weights find them packed.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+struct swiglu_weights_cache;
+
+// One packed buffer and the XNNPACK look-up key it was inserted under.
+struct swiglu_weights_cache_entry {
+  uint32_t seed;
+  const void* kernel;
+  const void* bias;
+  const void* data;
+  size_t size;
+};
+
+enum xnn_status swiglu_create_weights_cache(struct swiglu_weights_cache** cache_out);
+
+// Returns the handle to pass as the weights_cache argument of xnn_create_runtime_v4.
+xnn_weights_cache_t swiglu_weights_cache_provider(struct swiglu_weights_cache* cache);
+
+/**
+ * @brief Marks the cache finalized once its owner has packed every layer
+ *
+ * XNNPACK refuses to reshape an operator whose weights cache is not finalized,
+ * because its own cache may move packed weights while inserting. Buffers here
+ * never move, so finalizing is soft, like XNNPACK's own soft finalization: later
+ * reservations and inserts are still accepted, e.g. while a lazy stack is still
+ * packing its last layers.
+ */
+void swiglu_finalize_weights_cache(struct swiglu_weights_cache* cache);
+
+// Total bytes of packed weights held by the cache.
+size_t swiglu_weights_cache_size(struct swiglu_weights_cache* cache);
+
+// Returns every packed buffer in the cache, e.g. to write them to a file.
+std::vector<struct swiglu_weights_cache_entry> swiglu_weights_cache_entries(struct swiglu_weights_cache* cache);
+
+/**
+ * @brief Faults in every packed buffer and optionally mlocks them
+ *
+ * Packing already writes every page, so this matters after the weights may have
+ * been swapped out, or with lock set to keep them resident for good.
+ */
+enum xnn_status swiglu_prefault_weights_cache(
+  struct swiglu_weights_cache* cache,
+  pthreadpool_t threadpool,
+  bool lock);
+
+// Frees all packed weights. Runtimes using the cache must be deleted first.
+void swiglu_delete_weights_cache(struct swiglu_weights_cache* cache);
@@ -0,0 +1,416 @@
+/**
+ * @file swiglu_weights_io.cpp
+ * @brief Loading fp32 SwiGLU layer weights from safetensors or raw fp32 files
+ */
+#include "swiglu_weights_io.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+
+#include "safetensors.h"
+#include "swiglu_quantize.h"
+
+static std::string replace_all(std::string text, const std::string& from, const std::string& to) {
+  for (size_t pos = text.find(from); pos != std::string::npos; pos = text.find(from, pos + to.size())) {
+    text.replace(pos, from.size(), to);
+  }
+  return text;
+}
+
+static std::string tensor_name(const char* key_format, size_t layer, const char* proj) {
+  return replace_all(replace_all(key_format, "{layer}", std::to_string(layer)), "{proj}", proj);
+}
+
+bool swiglu_load_safetensors_layers(
+  const char* path,
+  const char* key_format,
+  const char* w1_name,
+  const char* w3_name,
+  const char* w2_name,
+  size_t num_layers,
+  std::vector<struct swiglu_fp32_layer>* layers)
+{
+  struct safetensors_file file;
+  if (!safetensors_open(path, &file)) {
+    return false;
+  }
+  if (num_layers == 0) {
+    while (file.tensors.count(tensor_name(key_format, num_layers, w1_name)) != 0) {
+      ++num_layers;
+    }
+    if (num_layers == 0) {
+      fprintf(stderr, "%s has no tensor named %s\n", path, tensor_name(key_format, 0, w1_name).c_str());
+      safetensors_close(&file);
+      return false;
+    }
+  }
+
+  layers->resize(num_layers);
+  for (size_t i = 0; i < num_layers; ++i) {
+    struct swiglu_fp32_layer& layer = (*layers)[i];
+    size_t w1_rows, w1_cols, w3_rows, w3_cols, w2_rows, w2_cols;
+    if (!safetensors_read_matrix(&file, tensor_name(key_format, i, w1_name), &layer.w1, &w1_rows, &w1_cols) ||
+        !safetensors_read_matrix(&file, tensor_name(key_format, i, w3_name), &layer.w3, &w3_rows, &w3_cols) ||
+        !safetensors_read_matrix(&file, tensor_name(key_format, i, w2_name), &layer.w2, &w2_rows, &w2_cols)) {
+      safetensors_close(&file);
+      return false;
+    }
+    if (w1_rows != w3_rows || w1_cols != w3_cols || w2_cols != w1_rows) {
+      fprintf(stderr, "layer %zu has inconsistent shapes: w1 [%zu, %zu], w3 [%zu, %zu], w2 [%zu, %zu]\n",
+              i, w1_rows, w1_cols, w3_rows, w3_cols, w2_rows, w2_cols);
+      safetensors_close(&file);
+      return false;
+    }
+    layer.input_dim = w1_cols;
+    layer.inter_dim = w1_rows;
+    layer.output_dim = w2_rows;
+  }
+  safetensors_close(&file);
+  return true;
+}
+
+static bool read_raw(FILE* file, const char* path, std::vector<float>* data, size_t count) {
+  data->resize(count);
+  if (fread(data->data(), sizeof(float), count, file) != count) {
+    fprintf(stderr, "%s is too short\n", path);
+    return false;
+  }
+  return true;
+}
+
+bool swiglu_load_raw_layers(
+  const char* w1_path,
+  const char* w3_path,
+  const char* w2_path,
+  size_t num_layers,
+  size_t input_dim,
+  size_t inter_dim,
+  size_t output_dim,
+  std::vector<struct swiglu_fp32_layer>* layers)
+{
+  FILE* w1_file = fopen(w1_path, "rb");
+  FILE* w3_file = fopen(w3_path, "rb");
+  FILE* w2_file = fopen(w2_path, "rb");
+  bool ok = w1_file != NULL && w3_file != NULL && w2_file != NULL;
+  if (!ok) {
+    fprintf(stderr, "failed to open %s, %s or %s\n", w1_path, w3_path, w2_path);
+  }
+
+  layers->resize(num_layers);
+  for (size_t i = 0; ok && i < num_layers; ++i) {
+    struct swiglu_fp32_layer& layer = (*layers)[i];
+    layer.input_dim = input_dim;
+    layer.inter_dim = inter_dim;
+    layer.output_dim = output_dim;
+    ok = read_raw(w1_file, w1_path, &layer.w1, inter_dim * input_dim) &&
+         read_raw(w3_file, w3_path, &layer.w3, inter_dim * input_dim) &&
+         read_raw(w2_file, w2_path, &layer.w2, output_dim * inter_dim);
+  }
+
+  for (FILE* file : {w1_file, w3_file, w2_file}) {
+    if (file != NULL) {
+      fclose(file);
+    }
+  }
+  return ok;
+}
+
+struct swiglu_fp32_layer swiglu_example_layer(void) {
+  struct swiglu_fp32_layer layer;
+  layer.input_dim = 3;
+  layer.inter_dim = 4;
+  layer.output_dim = 2;
+  layer.w1.resize(layer.inter_dim * layer.input_dim);
+  for (size_t i = 0; i < layer.inter_dim; ++i) {
+    for (size_t j = 0; j < layer.input_dim; ++j) {
+      layer.w1[i * layer.input_dim + j] =
+        static_cast<float>(i * layer.input_dim + j + 1) / (layer.inter_dim * layer.input_dim);
+    }
+  }
+  layer.w3 = layer.w1;
+  layer.w2.resize(layer.output_dim * layer.inter_dim);
+  for (size_t i = 0; i < layer.output_dim; ++i) {
+    for (size_t j = 0; j < layer.inter_dim; ++j) {
+      layer.w2[i * layer.inter_dim + j] =
+        static_cast<float>(i * layer.inter_dim + j + 1) / (layer.output_dim * layer.inter_dim);
+    }
+  }
+  return layer;
+}
+
+void swiglu_fill_random(float* data, size_t size, float scale, uint32_t seed) {
+  uint32_t state = seed * 2654435761u + 1;
+  for (size_t i = 0; i < size; ++i) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    data[i] = scale * (static_cast<float>(state) / 2147483648.0f - 1.0f);
+  }
+}
+
+std::vector<struct swiglu_fp32_layer> swiglu_random_layers(size_t num_layers, size_t dim, size_t inter_dim) {
+  std::vector<struct swiglu_fp32_layer> layers(num_layers);
+  for (size_t i = 0; i < num_layers; ++i) {
+    struct swiglu_fp32_layer& layer = layers[i];
+    layer.input_dim = dim;
+    layer.inter_dim = inter_dim;
+    layer.output_dim = dim;
+    layer.w1.resize(inter_dim * dim);
+    layer.w3.resize(inter_dim * dim);
+    layer.w2.resize(dim * inter_dim);
+    swiglu_fill_random(layer.w1.data(), layer.w1.size(), 1.0f / sqrtf(static_cast<float>(dim)), 3 * i);
+    swiglu_fill_random(layer.w3.data(), layer.w3.size(), 1.0f / sqrtf(static_cast<float>(dim)), 3 * i + 1);
+    swiglu_fill_random(layer.w2.data(), layer.w2.size(), 1.0f / sqrtf(static_cast<float>(inter_dim)), 3 * i + 2);
+  }
+  return layers;
+}
+
+struct swiglu_layer_weights swiglu_fp32_layer_weights(const struct swiglu_fp32_layer& layer) {
+  struct swiglu_layer_weights weights;
+  weights.input_dim = layer.input_dim;
+  weights.inter_dim = layer.inter_dim;
+  weights.output_dim = layer.output_dim;
+  weights.w1 = {swiglu_weight_fp32, layer.w1.data(), NULL, NULL, 0};
+  weights.w3 = {swiglu_weight_fp32, layer.w3.data(), NULL, NULL, 0};
+  weights.w2 = {swiglu_weight_fp32, layer.w2.data(), NULL, NULL, 0};
+  return weights;
+}
+
+std::vector<struct swiglu_fp32_decoder_layer> swiglu_random_decoder_layers(
+  size_t num_layers,
+  size_t dim,
+  size_t inter_dim,
+  size_t num_heads,
+  size_t num_kv_heads)
+{
+  std::vector<struct swiglu_fp32_layer> ffns = swiglu_random_layers(num_layers, dim, inter_dim);
+  std::vector<struct swiglu_fp32_decoder_layer> layers(num_layers);
+  for (size_t i = 0; i < num_layers; ++i) {
+    struct swiglu_fp32_decoder_layer& layer = layers[i];
+    layer.num_heads = num_heads;
+    layer.num_kv_heads = num_kv_heads;
+    layer.head_dim = dim / num_heads;
+    const size_t attention_dim = num_heads * layer.head_dim;
+    layer.wqkv.resize((num_heads + 2 * num_kv_heads) * layer.head_dim * dim);
+    layer.wo.resize(dim * attention_dim);
+    // Seeds after the FFN's 3 * num_layers
+    swiglu_fill_random(layer.wqkv.data(), layer.wqkv.size(), 1.0f / sqrtf(static_cast<float>(dim)),
+                       3 * num_layers + 2 * i);
+    swiglu_fill_random(layer.wo.data(), layer.wo.size(), 1.0f / sqrtf(static_cast<float>(attention_dim)),
+                       3 * num_layers + 2 * i + 1);
+    layer.ffn = std::move(ffns[i]);
+  }
+  return layers;
+}
+
+struct swiglu_decoder_weights swiglu_fp32_decoder_weights(const struct swiglu_fp32_decoder_layer& layer) {
+  struct swiglu_decoder_weights weights;
+  weights.num_heads = layer.num_heads;
+  weights.num_kv_heads = layer.num_kv_heads;
+  weights.head_dim = layer.head_dim;
+  weights.wqkv = {swiglu_weight_fp32, layer.wqkv.data(), NULL, NULL, 0};
+  weights.wo = {swiglu_weight_fp32, layer.wo.data(), NULL, NULL, 0};
+  weights.ffn = swiglu_fp32_layer_weights(layer.ffn);
+  return weights;
+}
+
+struct swiglu_qc8_layer swiglu_quantize_layer_qc8(const struct swiglu_fp32_layer& layer) {
+  struct swiglu_qc8_layer qc8;
+  qc8.input_dim = layer.input_dim;
+  qc8.inter_dim = layer.inter_dim;
+  qc8.output_dim = layer.output_dim;
+  qc8.w1.resize(layer.w1.size());
+  qc8.w3.resize(layer.w3.size());
+  qc8.w2.resize(layer.w2.size());
+  qc8.w1_scale.resize(layer.inter_dim);
+  qc8.w3_scale.resize(layer.inter_dim);
+  qc8.w2_scale.resize(layer.output_dim);
+  swiglu_quantize_qc8(layer.w1.data(), layer.inter_dim, layer.input_dim, qc8.w1.data(), qc8.w1_scale.data());
+  swiglu_quantize_qc8(layer.w3.data(), layer.inter_dim, layer.input_dim, qc8.w3.data(), qc8.w3_scale.data());
+  swiglu_quantize_qc8(layer.w2.data(), layer.output_dim, layer.inter_dim, qc8.w2.data(), qc8.w2_scale.data());
+  return qc8;
+}
+
+struct swiglu_layer_weights swiglu_qc8_layer_weights(const struct swiglu_qc8_layer& layer) {
+  struct swiglu_layer_weights weights;
+  weights.input_dim = layer.input_dim;
+  weights.inter_dim = layer.inter_dim;
+  weights.output_dim = layer.output_dim;
+  weights.w1 = {swiglu_weight_qc8, layer.w1.data(), layer.w1_scale.data(), NULL, 0};
+  weights.w3 = {swiglu_weight_qc8, layer.w3.data(), layer.w3_scale.data(), NULL, 0};
+  weights.w2 = {swiglu_weight_qc8, layer.w2.data(), layer.w2_scale.data(), NULL, 0};
+  return weights;
+}
+
+struct swiglu_qb4_layer swiglu_quantize_layer_qb4(const struct swiglu_fp32_layer& layer, size_t block_size) {
+  struct swiglu_qb4_layer qb4;
+  qb4.input_dim = layer.input_dim;
+  qb4.inter_dim = layer.inter_dim;
+  qb4.output_dim = layer.output_dim;
+  qb4.block_size = block_size;
+  qb4.w1.resize(layer.w1.size() / 2);
+  qb4.w3.resize(layer.w3.size() / 2);
+  qb4.w2.resize(layer.w2.size() / 2);
+  qb4.w1_scale.resize(layer.w1.size() / block_size);
+  qb4.w3_scale.resize(layer.w3.size() / block_size);
+  qb4.w2_scale.resize(layer.w2.size() / block_size);
+  swiglu_quantize_qb4(layer.w1.data(), layer.inter_dim, layer.input_dim, block_size, qb4.w1.data(),
+                      qb4.w1_scale.data());
+  swiglu_quantize_qb4(layer.w3.data(), layer.inter_dim, layer.input_dim, block_size, qb4.w3.data(),
+                      qb4.w3_scale.data());
+  swiglu_quantize_qb4(layer.w2.data(), layer.output_dim, layer.inter_dim, block_size, qb4.w2.data(),
+                      qb4.w2_scale.data());
+  return qb4;
+}
+
+struct swiglu_layer_weights swiglu_qb4_layer_weights(const struct swiglu_qb4_layer& layer) {
+  struct swiglu_layer_weights weights;
+  weights.input_dim = layer.input_dim;
+  weights.inter_dim = layer.inter_dim;
+  weights.output_dim = layer.output_dim;
+  weights.w1 = {swiglu_weight_qb4, layer.w1.data(), NULL, layer.w1_scale.data(), layer.block_size};
+  weights.w3 = {swiglu_weight_qb4, layer.w3.data(), NULL, layer.w3_scale.data(), layer.block_size};
+  weights.w2 = {swiglu_weight_qb4, layer.w2.data(), NULL, layer.w2_scale.data(), layer.block_size};
+  return weights;
+}
+
+static struct swiglu_fp8_matrix quantize_fp8(
+  const std::vector<float>& weights,
+  size_t rows,
+  size_t cols,
+  enum swiglu_fp8_format format,
+  bool per_channel)
+{
+  struct swiglu_fp8_matrix matrix;
+  matrix.format = format;
+  matrix.data.resize(rows * cols);
+  matrix.scale.resize(per_channel ? rows : 1);
+  swiglu_quantize_fp8(weights.data(), rows, cols, format, per_channel, matrix.data.data(), matrix.scale.data());
+  return matrix;
+}
+
+struct swiglu_fp8_layer swiglu_quantize_layer_fp8(
+  const struct swiglu_fp32_layer& layer,
+  enum swiglu_fp8_format format,
+  bool per_channel)
+{
+  struct swiglu_fp8_layer fp8;
+  fp8.input_dim = layer.input_dim;
+  fp8.inter_dim = layer.inter_dim;
+  fp8.output_dim = layer.output_dim;
+  fp8.w1 = quantize_fp8(layer.w1, layer.inter_dim, layer.input_dim, format, per_channel);
+  fp8.w3 = quantize_fp8(layer.w3, layer.inter_dim, layer.input_dim, format, per_channel);
+  fp8.w2 = quantize_fp8(layer.w2, layer.output_dim, layer.inter_dim, format, per_channel);
+  return fp8;
+}
+
+// Reads one fp8 projection and its scale.
+static bool read_fp8(
+  const struct safetensors_file* file,
+  const std::string& name,
+  const char* scale_suffix,
+  struct swiglu_fp8_matrix* matrix,
+  size_t* rows,
+  size_t* cols)
+{
+  std::string dtype;
+  if (!safetensors_read_fp8_matrix(file, name, &dtype, &matrix->data, rows, cols) ||
+      !safetensors_read_values(file, name + scale_suffix, &matrix->scale)) {
+    return false;
+  }
+  matrix->format = dtype == "F8_E4M3" ? swiglu_fp8_e4m3 : swiglu_fp8_e5m2;
+  if (matrix->scale.size() != 1 && matrix->scale.size() != *rows) {
+    fprintf(stderr, "%s%s has %zu values, expected 1 or %zu\n", name.c_str(), scale_suffix, matrix->scale.size(),
+            *rows);
+    return false;
+  }
+  return true;
+}
+
+bool swiglu_load_safetensors_fp8_layers(
+  const char* path,
+  const char* key_format,
+  const char* w1_name,
+  const char* w3_name,
+  const char* w2_name,
+  const char* scale_suffix,
+  size_t num_layers,
+  std::vector<struct swiglu_fp8_layer>* layers)
+{
+  struct safetensors_file file;
+  if (!safetensors_open(path, &file)) {
+    return false;
+  }
+  if (num_layers == 0) {
+    while (file.tensors.count(tensor_name(key_format, num_layers, w1_name)) != 0) {
+      ++num_layers;
+    }
+    if (num_layers == 0) {
+      fprintf(stderr, "%s has no tensor named %s\n", path, tensor_name(key_format, 0, w1_name).c_str());
+      safetensors_close(&file);
+      return false;
+    }
+  }
+
+  layers->resize(num_layers);
+  for (size_t i = 0; i < num_layers; ++i) {
+    struct swiglu_fp8_layer& layer = (*layers)[i];
+    size_t w1_rows, w1_cols, w3_rows, w3_cols, w2_rows, w2_cols;
+    if (!read_fp8(&file, tensor_name(key_format, i, w1_name), scale_suffix, &layer.w1, &w1_rows, &w1_cols) ||
+        !read_fp8(&file, tensor_name(key_format, i, w3_name), scale_suffix, &layer.w3, &w3_rows, &w3_cols) ||
+        !read_fp8(&file, tensor_name(key_format, i, w2_name), scale_suffix, &layer.w2, &w2_rows, &w2_cols)) {
+      safetensors_close(&file);
+      return false;
+    }
+    if (w1_rows != w3_rows || w1_cols != w3_cols || w2_cols != w1_rows) {
+      fprintf(stderr, "layer %zu has inconsistent shapes: w1 [%zu, %zu], w3 [%zu, %zu], w2 [%zu, %zu]\n",
+              i, w1_rows, w1_cols, w3_rows, w3_cols, w2_rows, w2_cols);
+      safetensors_close(&file);
+      return false;
+    }
+    layer.input_dim = w1_cols;
+    layer.inter_dim = w1_rows;
+    layer.output_dim = w2_rows;
+  }
+  safetensors_close(&file);
+  return true;
+}
+
+static std::vector<float> dequantize_fp8(const struct swiglu_fp8_matrix& matrix, size_t rows, size_t cols) {
+  std::vector<float> weights(rows * cols);
+  for (size_t r = 0; r < rows; ++r) {
+    const float scale = matrix.scale[matrix.scale.size() == 1 ? 0 : r];
+    for (size_t j = 0; j < cols; ++j) {
+      weights[r * cols + j] = scale * swiglu_fp8_to_fp32(matrix.data[r * cols + j], matrix.format);
+    }
+  }
+  return weights;
+}
+
+struct swiglu_fp32_layer swiglu_dequantize_layer_fp8(const struct swiglu_fp8_layer& layer) {
+  struct swiglu_fp32_layer fp32;
+  fp32.input_dim = layer.input_dim;
+  fp32.inter_dim = layer.inter_dim;
+  fp32.output_dim = layer.output_dim;
+  fp32.w1 = dequantize_fp8(layer.w1, layer.inter_dim, layer.input_dim);
+  fp32.w3 = dequantize_fp8(layer.w3, layer.inter_dim, layer.input_dim);
+  fp32.w2 = dequantize_fp8(layer.w2, layer.output_dim, layer.inter_dim);
+  return fp32;
+}
+
+static struct swiglu_fp8_projection fp8_projection(const struct swiglu_fp8_matrix& matrix) {
+  return {matrix.format, matrix.data.data(), matrix.scale.data(), matrix.scale.size() != 1};
+}
+
+struct swiglu_fp8_weights swiglu_fp8_layer_weights(const struct swiglu_fp8_layer& layer) {
+  struct swiglu_fp8_weights weights;
+  weights.input_dim = layer.input_dim;
+  weights.inter_dim = layer.inter_dim;
+  weights.output_dim = layer.output_dim;
+  weights.w1 = fp8_projection(layer.w1);
+  weights.w3 = fp8_projection(layer.w3);
+  weights.w2 = fp8_projection(layer.w2);
+  return weights;
+}
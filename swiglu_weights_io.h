@@ -0,0 +1,171 @@
+/**
+ * @file swiglu_weights_io.h
+ * @brief Loading fp32 SwiGLU layer weights from safetensors or raw fp32 files
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "swiglu_fp8.h"
+#include "swiglu_layer.h"
+
+// Owned fp32 weights of one layer, row-major like the arrays in minimal_swiglu.cpp.
+struct swiglu_fp32_layer {
+  size_t input_dim;
+  size_t inter_dim;
+  size_t output_dim;
+  std::vector<float> w1;  // [inter_dim, input_dim]
+  std::vector<float> w3;  // [inter_dim, input_dim]
+  std::vector<float> w2;  // [output_dim, inter_dim]
+};
+
+/**
+ * @brief Loads layers from a safetensors file
+ *
+ * Tensor names are built from key_format by replacing "{layer}" with the layer index
+ * and "{proj}" with w1_name, w3_name or w2_name, e.g.
+ * "model.layers.{layer}.mlp.{proj}.weight" with gate_proj, up_proj and down_proj.
+ * If num_layers is 0, layers are loaded until the first missing index.
+ */
+bool swiglu_load_safetensors_layers(
+  const char* path,
+  const char* key_format,
+  const char* w1_name,
+  const char* w3_name,
+  const char* w2_name,
+  size_t num_layers,
+  std::vector<struct swiglu_fp32_layer>* layers);
+
+/**
+ * @brief Loads layers from raw little-endian fp32 files
+ *
+ * Each file holds num_layers row-major matrices of one projection back to back.
+ */
+bool swiglu_load_raw_layers(
+  const char* w1_path,
+  const char* w3_path,
+  const char* w2_path,
+  size_t num_layers,
+  size_t input_dim,
+  size_t inter_dim,
+  size_t output_dim,
+  std::vector<struct swiglu_fp32_layer>* layers);
+
+// The single layer of minimal_swiglu.cpp, with W3 sharing W1's values.
+struct swiglu_fp32_layer swiglu_example_layer(void);
+
+// Fills data with uniform values in [-scale, scale] from a fixed-seed xorshift generator.
+void swiglu_fill_random(float* data, size_t size, float scale, uint32_t seed);
+
+// Random square layers that chain, scaled to keep activations bounded.
+std::vector<struct swiglu_fp32_layer> swiglu_random_layers(size_t num_layers, size_t dim, size_t inter_dim);
+
+// fp32 layer weights pointing into layer, which must outlive them.
+struct swiglu_layer_weights swiglu_fp32_layer_weights(const struct swiglu_fp32_layer& layer);
+
+// Owned fp32 weights of one decoder block (see swiglu_decoder_weights).
+struct swiglu_fp32_decoder_layer {
+  size_t num_heads;
+  size_t num_kv_heads;
+  size_t head_dim;
+  std::vector<float> wqkv;  // [(num_heads + 2 * num_kv_heads) * head_dim, dim]
+  std::vector<float> wo;    // [dim, num_heads * head_dim]
+  struct swiglu_fp32_layer ffn;
+};
+
+// Random decoder blocks that chain, scaled like swiglu_random_layers.
+std::vector<struct swiglu_fp32_decoder_layer> swiglu_random_decoder_layers(
+  size_t num_layers,
+  size_t dim,
+  size_t inter_dim,
+  size_t num_heads,
+  size_t num_kv_heads);
+
+// fp32 decoder block weights pointing into layer, which must outlive them.
+struct swiglu_decoder_weights swiglu_fp32_decoder_weights(const struct swiglu_fp32_decoder_layer& layer);
+
+// Owned int8 weights of one layer with one scale per row (see swiglu_quantize_qc8).
+struct swiglu_qc8_layer {
+  size_t input_dim;
+  size_t inter_dim;
+  size_t output_dim;
+  std::vector<int8_t> w1;
+  std::vector<int8_t> w3;
+  std::vector<int8_t> w2;
+  std::vector<float> w1_scale;
+  std::vector<float> w3_scale;
+  std::vector<float> w2_scale;
+};
+
+struct swiglu_qc8_layer swiglu_quantize_layer_qc8(const struct swiglu_fp32_layer& layer);
+
+// qc8 layer weights pointing into layer, which must outlive them.
+struct swiglu_layer_weights swiglu_qc8_layer_weights(const struct swiglu_qc8_layer& layer);
+
+// Owned 4-bit weights of one layer with bf16 scales per block (see swiglu_weight_qb4).
+struct swiglu_qb4_layer {
+  size_t input_dim;
+  size_t inter_dim;
+  size_t output_dim;
+  size_t block_size;
+  std::vector<uint8_t> w1;
+  std::vector<uint8_t> w3;
+  std::vector<uint8_t> w2;
+  std::vector<uint16_t> w1_scale;
+  std::vector<uint16_t> w3_scale;
+  std::vector<uint16_t> w2_scale;
+};
+
+// Round-to-nearest qb4 weights (see swiglu_quantize_qb4); block_size must divide input_dim and inter_dim.
+struct swiglu_qb4_layer swiglu_quantize_layer_qb4(const struct swiglu_fp32_layer& layer, size_t block_size);
+
+// qb4 layer weights pointing into layer, which must outlive them.
+struct swiglu_layer_weights swiglu_qb4_layer_weights(const struct swiglu_qb4_layer& layer);
+
+// Owned fp8 weights of one projection, with one scale per row or a single scale.
+struct swiglu_fp8_matrix {
+  enum swiglu_fp8_format format;
+  std::vector<uint8_t> data;
+  std::vector<float> scale;
+};
+
+// Owned fp8 weights of one layer (see swiglu_fp8.h).
+struct swiglu_fp8_layer {
+  size_t input_dim;
+  size_t inter_dim;
+  size_t output_dim;
+  struct swiglu_fp8_matrix w1;
+  struct swiglu_fp8_matrix w3;
+  struct swiglu_fp8_matrix w2;
+};
+
+struct swiglu_fp8_layer swiglu_quantize_layer_fp8(
+  const struct swiglu_fp32_layer& layer,
+  enum swiglu_fp8_format format,
+  bool per_channel);
+
+/**
+ * @brief Loads layers stored as fp8 from a safetensors file, without converting them
+ *
+ * Weights are F8_E4M3 or F8_E5M2 tensors named as for swiglu_load_safetensors_layers.
+ * Each has an F32, F16 or BF16 scale named by appending scale_suffix, e.g.
+ * "model.layers.0.mlp.down_proj.weight_scale" for "_scale", holding one value or one
+ * per row. Block-wise scales are not supported.
+ */
+bool swiglu_load_safetensors_fp8_layers(
+  const char* path,
+  const char* key_format,
+  const char* w1_name,
+  const char* w3_name,
+  const char* w2_name,
+  const char* scale_suffix,
+  size_t num_layers,
+  std::vector<struct swiglu_fp8_layer>* layers);
+
+// fp32 layer holding exactly the values of an fp8 layer, to compare fp8 stacks against.
+struct swiglu_fp32_layer swiglu_dequantize_layer_fp8(const struct swiglu_fp8_layer& layer);
+
+// fp8 layer weights pointing into layer, which must outlive them.
+struct swiglu_fp8_weights swiglu_fp8_layer_weights(const struct swiglu_fp8_layer& layer);
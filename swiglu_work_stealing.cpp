@@ -0,0 +1,312 @@
+/**
+ * @file swiglu_work_stealing.cpp
+ * @brief Per-worker tile queues, stealing and one pool-backed stack per worker
+ */
+#include "swiglu_work_stealing.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "swiglu_runtime_pool.h"
+#include "swiglu_stack.h"
+
+struct stealing_request {
+  std::atomic<size_t> remaining_tiles;
+  std::atomic<int> status;
+  swiglu_request_done_fn done;
+  void* context;
+};
+
+struct tile {
+  struct stealing_request* request;
+  size_t rows;
+  const float* input;
+  float* output;
+};
+
+struct stealing_worker {
+  // Guards tiles and stats
+  std::mutex mutex;
+  std::deque<tile> tiles;
+  struct swiglu_work_stealing_stats stats = {};
+  struct swiglu_stack* stack = NULL;
+  // A request's last tile, padded to tile_rows rows
+  std::vector<float> padded_input;
+  std::vector<float> padded_output;
+  std::thread thread;
+};
+
+struct swiglu_work_stealing {
+  struct swiglu_runtime_pool* pool = NULL;
+  std::vector<stealing_worker> workers;
+  size_t tile_rows;
+  size_t input_dim;
+  size_t output_dim;
+  std::atomic<size_t> next_worker{0};
+  // Workers sleep on work_cv while every queue is empty.
+  std::mutex sleep_mutex;
+  std::condition_variable work_cv;
+  bool stop = false;
+};
+
+static bool any_queued(struct swiglu_work_stealing* executor) {
+  for (stealing_worker& worker : executor->workers) {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tiles.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Takes the newest tile of worker w, or else the oldest tile of another worker.
+static bool take_tile(struct swiglu_work_stealing* executor, size_t w, tile* tile_out, bool* stolen) {
+  {
+    stealing_worker& own = executor->workers[w];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tiles.empty()) {
+      *tile_out = own.tiles.back();
+      own.tiles.pop_back();
+      *stolen = false;
+      return true;
+    }
+  }
+  for (size_t i = 1; i < executor->workers.size(); ++i) {
+    stealing_worker& victim = executor->workers[(w + i) % executor->workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tiles.empty()) {
+      *tile_out = victim.tiles.front();
+      victim.tiles.pop_front();
+      *stolen = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void run_worker(struct swiglu_work_stealing* executor, size_t w) {
+  stealing_worker& worker = executor->workers[w];
+  for (;;) {
+    tile t;
+    bool stolen;
+    if (!take_tile(executor, w, &t, &stolen)) {
+      std::unique_lock<std::mutex> lock(executor->sleep_mutex);
+      executor->work_cv.wait(lock, [executor] { return executor->stop || any_queued(executor); });
+      if (executor->stop && !any_queued(executor)) {
+        return;
+      }
+      continue;
+    }
+
+    // Every tile runs at tile_rows, so the stack is never reshaped. The rows are
+    // independent, so the padding rows can hold whatever an earlier tile left.
+    const bool padded = t.rows < executor->tile_rows;
+    if (padded) {
+      memcpy(worker.padded_input.data(), t.input, t.rows * executor->input_dim * sizeof(float));
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const enum xnn_status status =
+      swiglu_run_stack(worker.stack, executor->tile_rows, padded ? worker.padded_input.data() : t.input,
+                       padded ? worker.padded_output.data() : t.output);
+    if (padded && status == xnn_status_success) {
+      memcpy(t.output, worker.padded_output.data(), t.rows * executor->output_dim * sizeof(float));
+    }
+    const double busy_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    {
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      worker.stats.tiles++;
+      worker.stats.steals += stolen;
+      worker.stats.busy_ms += busy_ms;
+    }
+
+    struct stealing_request* request = t.request;
+    if (status != xnn_status_success) {
+      request->status.store(status);
+    }
+    if (request->remaining_tiles.fetch_sub(1) == 1) {
+      request->done(request->context, static_cast<enum xnn_status>(request->status.load()));
+      delete request;
+    }
+  }
+}
+
+static void pin_workers(struct swiglu_work_stealing* executor) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    fprintf(stderr, "sched_getaffinity failed; workers are not pinned\n");
+    return;
+  }
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      cpus.push_back(cpu);
+    }
+  }
+  for (size_t w = 0; w < executor->workers.size(); ++w) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[w % cpus.size()], &set);
+    if (pthread_setaffinity_np(executor->workers[w].thread.native_handle(), sizeof(set), &set) != 0) {
+      fprintf(stderr, "failed to pin worker %zu to CPU %d\n", w, cpus[w % cpus.size()]);
+    }
+  }
+}
+
+enum xnn_status swiglu_create_work_stealing(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  size_t num_workers,
+  size_t tile_rows,
+  bool pin,
+  struct swiglu_work_stealing** executor_out)
+{
+  if (num_workers == 0 || tile_rows == 0) {
+    fprintf(stderr, "work stealing needs at least one worker and one row per tile\n");
+    return xnn_status_invalid_parameter;
+  }
+  struct swiglu_work_stealing* executor = new (std::nothrow) swiglu_work_stealing();
+  if (executor == NULL) {
+    fprintf(stderr, "failed to allocate work-stealing executor\n");
+    return xnn_status_out_of_memory;
+  }
+  executor->workers = std::vector<stealing_worker>(num_workers);
+  executor->tile_rows = tile_rows;
+  executor->input_dim = layers[0].input_dim;
+  executor->output_dim = layers[num_layers - 1].output_dim;
+
+  // One stack per worker, checked out for the executor's lifetime. Workers are the
+  // parallelism, so the stacks have no thread pools.
+  enum xnn_status status =
+    swiglu_create_runtime_pool(num_layers, layers, num_workers, /*threads_per_runtime=*/1, &executor->pool);
+  if (status != xnn_status_success) {
+    delete executor;
+    return status;
+  }
+  for (stealing_worker& worker : executor->workers) {
+    worker.stack = swiglu_runtime_pool_try_acquire(executor->pool);
+    // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+    worker.padded_input.assign(tile_rows * executor->input_dim + XNN_EXTRA_BYTES / sizeof(float), 0.0f);
+    worker.padded_output.resize(tile_rows * executor->output_dim);
+  }
+  for (size_t w = 0; w < num_workers; ++w) {
+    executor->workers[w].thread = std::thread(run_worker, executor, w);
+  }
+  if (pin) {
+    pin_workers(executor);
+  }
+
+  *executor_out = executor;
+  return xnn_status_success;
+}
+
+enum xnn_status swiglu_work_stealing_submit(
+  struct swiglu_work_stealing* executor,
+  size_t batch_size,
+  const float* input,
+  float* output,
+  swiglu_request_done_fn done,
+  void* context)
+{
+  if (batch_size == 0) {
+    fprintf(stderr, "a request needs at least one row\n");
+    return xnn_status_invalid_parameter;
+  }
+  const size_t num_tiles = (batch_size + executor->tile_rows - 1) / executor->tile_rows;
+  struct stealing_request* request = new (std::nothrow) stealing_request();
+  if (request == NULL) {
+    fprintf(stderr, "failed to allocate request\n");
+    return xnn_status_out_of_memory;
+  }
+  request->remaining_tiles.store(num_tiles);
+  request->status.store(xnn_status_success);
+  request->done = done;
+  request->context = context;
+
+  // Spread the tiles round-robin from a rotating first worker, so concurrent small
+  // requests land on different workers.
+  const size_t first = executor->next_worker.fetch_add(1);
+  for (size_t i = 0; i < num_tiles; ++i) {
+    const size_t row = i * executor->tile_rows;
+    const tile t = {request, std::min(executor->tile_rows, batch_size - row),
+                    input + row * executor->input_dim, output + row * executor->output_dim};
+    stealing_worker& worker = executor->workers[(first + i) % executor->workers.size()];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tiles.push_back(t);
+  }
+  {
+    // Sleeping workers check the queues under sleep_mutex, so this cannot miss one.
+    std::lock_guard<std::mutex> lock(executor->sleep_mutex);
+  }
+  // One worker per tile; waking more would only have them find the queues empty.
+  if (num_tiles >= executor->workers.size()) {
+    executor->work_cv.notify_all();
+  } else {
+    for (size_t i = 0; i < num_tiles; ++i) {
+      executor->work_cv.notify_one();
+    }
+  }
+  return xnn_status_success;
+}
+
+struct request_waiter {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  enum xnn_status status = xnn_status_success;
+};
+
+static void wake_waiter(void* context, enum xnn_status status) {
+  struct request_waiter* waiter = static_cast<struct request_waiter*>(context);
+  std::lock_guard<std::mutex> lock(waiter->mutex);
+  waiter->status = status;
+  waiter->done = true;
+  waiter->cv.notify_one();
+}
+
+enum xnn_status swiglu_work_stealing_run(
+  struct swiglu_work_stealing* executor,
+  size_t batch_size,
+  const float* input,
+  float* output)
+{
+  struct request_waiter waiter;
+  enum xnn_status status = swiglu_work_stealing_submit(executor, batch_size, input, output, wake_waiter, &waiter);
+  if (status != xnn_status_success) {
+    return status;
+  }
+  std::unique_lock<std::mutex> lock(waiter.mutex);
+  waiter.cv.wait(lock, [&waiter] { return waiter.done; });
+  return waiter.status;
+}
+
+struct swiglu_work_stealing_stats swiglu_work_stealing_stats(struct swiglu_work_stealing* executor, size_t worker) {
+  std::lock_guard<std::mutex> lock(executor->workers[worker].mutex);
+  return executor->workers[worker].stats;
+}
+
+void swiglu_delete_work_stealing(struct swiglu_work_stealing* executor) {
+  {
+    std::lock_guard<std::mutex> lock(executor->sleep_mutex);
+    executor->stop = true;
+  }
+  executor->work_cv.notify_all();
+  for (stealing_worker& worker : executor->workers) {
+    worker.thread.join();
+  }
+  for (stealing_worker& worker : executor->workers) {
+    swiglu_runtime_pool_release(executor->pool, worker.stack);
+  }
+  swiglu_delete_runtime_pool(executor->pool);
+  delete executor;
+}
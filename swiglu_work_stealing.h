@@ -0,0 +1,77 @@
+/**
+ * @file swiglu_work_stealing.h
+ * @brief Work-stealing execution of many concurrent requests on one set of threads
+ *
+ * Giving every concurrent request a runtime with its own thread pool oversubscribes
+ * the cores, while sharing one thread pool runs the requests one at a time. Here a
+ * fixed set of worker threads, optionally pinned one per core, runs all requests.
+ * Every worker owns a stack of the layers with no thread pool, and all stacks share
+ * one weights cache.
+ *
+ * A request is split into tiles of tile_rows rows, the last one padded through a
+ * per-worker scratch buffer, so no stack is ever reshaped. The layers work on every
+ * row on its own, so a tile runs through the whole stack on one worker with no
+ * synchronization. Tiles are spread over the workers' queues. A worker runs tiles
+ * from the back of its own queue and, once that is empty, steals from the front of
+ * another's. Small requests then run in parallel with each other, and large ones
+ * spread over every idle core.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <xnnpack.h>
+
+#include "swiglu_layer.h"
+
+struct swiglu_work_stealing_stats {
+  size_t tiles;
+  // Tiles taken from another worker's queue
+  size_t steals;
+  // Time spent running tiles, to compare with wall-clock time for utilization
+  double busy_ms;
+};
+
+// Called on a worker thread once every tile of a request has run.
+typedef void (*swiglu_request_done_fn)(void* context, enum xnn_status status);
+
+struct swiglu_work_stealing;
+
+/**
+ * @brief Packs the layers once and starts num_workers workers
+ *
+ * With pin set, worker i is pinned to the i-th CPU the process may run on. The
+ * weights must outlive the executor.
+ */
+enum xnn_status swiglu_create_work_stealing(
+  size_t num_layers,
+  const struct swiglu_layer_weights* layers,
+  size_t num_workers,
+  size_t tile_rows,
+  bool pin,
+  struct swiglu_work_stealing** executor_out);
+
+/**
+ * @brief Queues batch_size rows, split into tiles
+ *
+ * input must be readable XNN_EXTRA_BYTES past its last row. input and output must
+ * stay valid until done is called.
+ */
+enum xnn_status swiglu_work_stealing_submit(
+  struct swiglu_work_stealing* executor,
+  size_t batch_size,
+  const float* input,
+  float* output,
+  swiglu_request_done_fn done,
+  void* context);
+
+// Submits a request and waits for it.
+enum xnn_status swiglu_work_stealing_run(
+  struct swiglu_work_stealing* executor,
+  size_t batch_size,
+  const float* input,
+  float* output);
+
+struct swiglu_work_stealing_stats swiglu_work_stealing_stats(struct swiglu_work_stealing* executor, size_t worker);
+
+// Runs the tiles still queued, then stops the workers.
+void swiglu_delete_work_stealing(struct swiglu_work_stealing* executor);
@@ -0,0 +1,218 @@
+/**
+ * @file transport_swiglu.cpp
+ * @brief Single-host demo of the zero-copy shared-memory transport
+ *
+ * The worker process creates a SwiGLU stack and a transport, then forks front-end
+ * client processes. Each client attaches to the transport by name, writes its
+ * request rows straight into a slot, and checks the output it reads back from the
+ * slot against a reference computed before the fork:
+ *
+ *   ./transport_swiglu --clients 4 --requests 1000 --rows 4 --slots 8 --threads 4
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_stack.h"
+#include "swiglu_transport.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--clients C] [--requests R] [--rows B] [--slots S] [--layers N] [--dim D]\n"
+          "          [--inter-dim I] [--threads T]\n",
+          program);
+}
+
+// Input rows of request r of client c; a pure function of both so the reference and
+// the client agree without sharing anything.
+static void fill_request(float* input, size_t size, size_t c, size_t r) {
+  swiglu_fill_random(input, size, 1.0f, static_cast<uint32_t>(1000 + 7919 * c + r));
+}
+
+// Front-end process: sends num_requests requests and returns the number of wrong outputs.
+static size_t run_client(
+  const char* name,
+  size_t c,
+  size_t num_requests,
+  size_t rows,
+  const std::vector<std::vector<float>>& expected)
+{
+  struct swiglu_transport* transport = NULL;
+  if (swiglu_attach_transport(name, &transport) != xnn_status_success) {
+    return num_requests;
+  }
+  const size_t input_dim = swiglu_transport_input_dim(transport);
+  const size_t output_dim = swiglu_transport_output_dim(transport);
+
+  size_t errors = 0;
+  std::vector<double> latencies_ms;
+  for (size_t r = 0; r < num_requests; ++r) {
+    const auto start = std::chrono::steady_clock::now();
+    uint32_t slot;
+    if (!swiglu_transport_acquire(transport, &slot)) {
+      errors += num_requests - r;
+      break;
+    }
+    fill_request(swiglu_transport_input(transport, slot), rows * input_dim, c, r);
+    swiglu_transport_submit(transport, slot, rows);
+    if (swiglu_transport_wait(transport, slot) != xnn_status_success) {
+      ++errors;
+    } else {
+      const float* output = swiglu_transport_output(transport, slot);
+      const std::vector<float>& reference = expected[c * num_requests + r];
+      for (size_t i = 0; i < rows * output_dim; ++i) {
+        if (fabsf(output[i] - reference[i]) > 1.0e-5f * (1.0f + fabsf(reference[i]))) {
+          ++errors;
+          break;
+        }
+      }
+    }
+    swiglu_transport_release(transport, slot);
+    latencies_ms.push_back(elapsed_ms(start));
+  }
+  printf("client %zu: %zu requests, p50 %.3f ms, p99 %.3f ms, %zu wrong\n",
+         c, num_requests, percentile(latencies_ms, 50.0), percentile(latencies_ms, 99.0), errors);
+  swiglu_detach_transport(transport);
+  return errors;
+}
+
+int main(int argc, char** argv) {
+  size_t num_clients = 2;
+  size_t num_requests = 100;
+  size_t rows = 1;
+  size_t num_slots = 4;
+  size_t num_layers = 4;
+  size_t dim = 256;
+  size_t inter_dim = 768;
+  size_t num_threads = 1;
+
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 < argc && strcmp(argv[i], "--clients") == 0) {
+      num_clients = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--requests") == 0) {
+      num_requests = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--rows") == 0) {
+      rows = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--slots") == 0) {
+      num_slots = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_clients == 0 || rows == 0 || num_slots == 0 || num_layers == 0 || dim == 0 || inter_dim == 0 ||
+      num_threads == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_fp32_layer> fp32_layers = swiglu_random_layers(num_layers, dim, inter_dim);
+  std::vector<swiglu_layer_weights> layers;
+  for (const swiglu_fp32_layer& layer : fp32_layers) {
+    layers.push_back(swiglu_fp32_layer_weights(layer));
+  }
+  struct swiglu_stack* stack = NULL;
+  enum xnn_status status = swiglu_create_stack(num_layers, layers.data(), threadpool, swiglu_pack_parallel, &stack);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_create_stack failed: %d\n", status);
+    return 1;
+  }
+
+  // References come from the same stack, run in-process on private buffers.
+  std::vector<std::vector<float>> expected(num_clients * num_requests);
+  std::vector<float> input(rows * dim);
+  for (size_t c = 0; c < num_clients; ++c) {
+    for (size_t r = 0; r < num_requests; ++r) {
+      fill_request(input.data(), input.size(), c, r);
+      expected[c * num_requests + r].resize(rows * dim);
+      status = swiglu_run_stack(stack, rows, input.data(), expected[c * num_requests + r].data());
+      if (status != xnn_status_success) {
+        fprintf(stderr, "swiglu_run_stack failed: %d\n", status);
+        return 1;
+      }
+    }
+  }
+
+  const std::string name = "/swiglu-transport-" + std::to_string(getpid());
+  struct swiglu_transport* transport = NULL;
+  status = swiglu_create_transport(name.c_str(), num_slots, rows, dim, dim, &transport);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_create_transport failed: %d\n", status);
+    return 1;
+  }
+
+  // Clients only touch the transport and their own memory after the fork.
+  fflush(stdout);
+  std::vector<pid_t> clients;
+  for (size_t c = 0; c < num_clients; ++c) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+      const size_t errors = run_client(name.c_str(), c, num_requests, rows, expected);
+      fflush(stdout);
+      _exit(errors == 0 ? 0 : 1);
+    }
+    if (pid < 0) {
+      fprintf(stderr, "fork failed\n");
+      swiglu_shutdown_transport(transport);
+      break;
+    }
+    clients.push_back(pid);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::thread worker(swiglu_serve_transport, stack, transport);
+  bool ok = clients.size() == num_clients;
+  for (pid_t pid : clients) {
+    int wstatus = 0;
+    waitpid(pid, &wstatus, 0);
+    ok = ok && WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+  }
+  const double total_ms = elapsed_ms(start);
+  swiglu_shutdown_transport(transport);
+  worker.join();
+
+  printf("%zu clients x %zu requests of %zu rows in %.1f ms (%.0f requests/s): %s\n",
+         num_clients, num_requests, rows, total_ms, num_clients * num_requests / (total_ms / 1000.0),
+         ok ? "all outputs match" : "FAILED");
+
+  swiglu_destroy_transport(transport);
+  swiglu_delete_stack(stack);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file varlen_swiglu.cpp
+ * @brief Ragged prefill batches against batches padded to the longest sequence
+ *
+ * Draws --sequences lengths uniformly from 1 to --max-len and prefills them through
+ * a decoder twice with swiglu_run_decoder_prefill_varlen: padded to max_len rows
+ * each, and packed back to back with cumulative offsets. Attention keeps to each
+ * sequence and is causal, so the padding rows after a sequence never reach its own
+ * rows; both give the same rows, and padding only adds work:
+ *
+ *   ./varlen_swiglu --sequences 32 --max-len 512 --threads 8
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <pthreadpool.h>
+#include <xnnpack.h>
+
+#include "swiglu_bench.h"
+#include "swiglu_decoder.h"
+#include "swiglu_weights_io.h"
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--sequences S] [--max-len L] [--runs R] [--threads T] [--layers N] [--dim D] [--inter-dim I]\n"
+          "          [--heads H] [--kv-heads K]\n",
+          program);
+}
+
+int main(int argc, char** argv) {
+  size_t num_sequences = 32;
+  size_t max_len = 512;
+  size_t num_runs = 5;
+  size_t num_threads = 1;
+  size_t num_layers = 4;
+  size_t dim = 512;
+  size_t inter_dim = 1536;
+  size_t num_heads = 8;
+  size_t num_kv_heads = 2;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (has_value && strcmp(argv[i], "--sequences") == 0) {
+      num_sequences = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--max-len") == 0) {
+      max_len = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--runs") == 0) {
+      num_runs = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--threads") == 0) {
+      num_threads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--layers") == 0) {
+      num_layers = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--dim") == 0) {
+      dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--inter-dim") == 0) {
+      inter_dim = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--heads") == 0) {
+      num_heads = strtoul(argv[++i], NULL, 10);
+    } else if (has_value && strcmp(argv[i], "--kv-heads") == 0) {
+      num_kv_heads = strtoul(argv[++i], NULL, 10);
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_sequences == 0 || max_len == 0 || num_runs == 0 || num_threads == 0 || num_layers == 0 || dim == 0 ||
+      inter_dim == 0 || num_heads == 0 || num_kv_heads == 0 || num_heads % num_kv_heads != 0 || dim % num_heads != 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (xnn_initialize(NULL) != xnn_status_success) {
+    fprintf(stderr, "Failed to initialize XNNPACK\n");
+    return 1;
+  }
+  pthreadpool_t threadpool = NULL;
+  if (num_threads > 1) {
+    threadpool = pthreadpool_create(num_threads);
+    if (threadpool == NULL) {
+      fprintf(stderr, "pthreadpool_create failed\n");
+      return 1;
+    }
+  }
+
+  std::vector<swiglu_fp32_decoder_layer> fp32_layers =
+    swiglu_random_decoder_layers(num_layers, dim, inter_dim, num_heads, num_kv_heads);
+  std::vector<swiglu_decoder_weights> layers;
+  for (const swiglu_fp32_decoder_layer& layer : fp32_layers) {
+    layers.push_back(swiglu_fp32_decoder_weights(layer));
+  }
+  struct swiglu_decoder* decoder = NULL;
+  enum xnn_status status = swiglu_create_decoder(layers.size(), layers.data(), /*rope=*/NULL, threadpool, &decoder);
+  if (status != xnn_status_success) {
+    fprintf(stderr, "swiglu_create_decoder failed: %d\n", status);
+    return 1;
+  }
+
+  std::vector<size_t> offsets = {0};
+  std::vector<size_t> padded_offsets = {0};
+  uint32_t seed = 1;
+  for (size_t s = 0; s < num_sequences; ++s) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    offsets.push_back(offsets.back() + 1 + seed % max_len);
+    padded_offsets.push_back(padded_offsets.back() + max_len);
+  }
+  const size_t num_rows = offsets.back();
+  const size_t padded_rows = num_sequences * max_len;
+
+  // XNNPACK may read up to XNN_EXTRA_BYTES past the end of its input.
+  std::vector<float> ragged(num_rows * dim + XNN_EXTRA_BYTES / sizeof(float));
+  swiglu_fill_random(ragged.data(), num_rows * dim, 1.0f, 2);
+  std::vector<float> padded(padded_rows * dim + XNN_EXTRA_BYTES / sizeof(float), 0.0f);
+  for (size_t s = 0; s < num_sequences; ++s) {
+    std::copy(ragged.begin() + offsets[s] * dim, ragged.begin() + offsets[s + 1] * dim,
+              padded.begin() + s * max_len * dim);
+  }
+  std::vector<float> ragged_output(num_rows * dim);
+  std::vector<float> padded_output(padded_rows * dim);
+
+  std::vector<double> padded_ms;
+  std::vector<double> ragged_ms;
+  for (size_t run = 0; run < num_runs; ++run) {
+    auto start = std::chrono::steady_clock::now();
+    status = swiglu_run_decoder_prefill_varlen(decoder, num_sequences, padded_offsets.data(), padded.data(),
+                                               padded_output.data());
+    padded_ms.push_back(elapsed_ms(start));
+    if (status == xnn_status_success) {
+      start = std::chrono::steady_clock::now();
+      status = swiglu_run_decoder_prefill_varlen(decoder, num_sequences, offsets.data(), ragged.data(),
+                                                 ragged_output.data());
+      ragged_ms.push_back(elapsed_ms(start));
+    }
+    if (status != xnn_status_success) {
+      fprintf(stderr, "run failed: %d\n", status);
+      return 1;
+    }
+  }
+
+  size_t mismatches = 0;
+  for (size_t s = 0; s < num_sequences; ++s) {
+    for (size_t r = offsets[s]; r < offsets[s + 1]; ++r) {
+      const float* expected = &padded_output[(s * max_len + r - offsets[s]) * dim];
+      const float* actual = &ragged_output[r * dim];
+      for (size_t j = 0; j < dim; ++j) {
+        if (fabsf(expected[j] - actual[j]) > 1e-5f * fabsf(expected[j]) + 1e-30f) {
+          mismatches++;
+          break;
+        }
+      }
+    }
+  }
+
+  printf("%zu sequences, %zu rows ragged, %zu rows padded (%.1f%% padding)\n",
+         num_sequences, num_rows, padded_rows, 100.0 * (padded_rows - num_rows) / padded_rows);
+  printf("padded: median %.2f ms\n", percentile(padded_ms, 50.0));
+  printf("ragged: median %.2f ms\n", percentile(ragged_ms, 50.0));
+  printf("rows differing from padded: %zu\n", mismatches);
+
+  swiglu_delete_decoder(decoder);
+  if (threadpool != NULL) {
+    pthreadpool_destroy(threadpool);
+  }
+  xnn_deinitialize();
+  return mismatches == 0 ? 0 : 1;
+}